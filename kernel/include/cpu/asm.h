@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #define IA32_APIC_BASE_MSR      0x1b
+#define IA32_TSC_DEADLINE_MSR   0x6e0
 #define IA32_EFER_MSR           0xc0000080
 #define IA32_STAR_MSR           0xc0000081
 #define IA32_LSTAR_MSR          0xc0000082
@@ -65,6 +66,10 @@ static inline void xsave(void* ctx) {
     __asm__ volatile ("xsave (%0)" :: "r" (ctx), "a" (0xffffffff), "d" (0xffffffff) : "memory");
 }
 
+static inline void xsaveopt(void* ctx) {
+    __asm__ volatile ("xsaveopt (%0)" :: "r" (ctx), "a" (0xffffffff), "d" (0xffffffff) : "memory");
+}
+
 static inline void xrstor(void* ctx) {
     __asm__ volatile ("xrstor (%0)" :: "r"(ctx), "a"(0xffffffff), "d"(0xffffffff) : "memory");
 }
@@ -119,6 +124,10 @@ static inline bool cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_
     return true;
 }
 
+static inline void clts(void) {
+    __asm__ volatile ("clts" ::: "memory");
+}
+
 static inline uint64_t read_cr0(void) {
     uint64_t ret;
     __asm__ volatile ("mov %%cr0, %0" : "=r" (ret) :: "memory");
@@ -178,6 +187,12 @@ static inline uint64_t wrmsr(uint32_t msr, uint64_t val) {
     return ((uint64_t) edx << 32) | eax;
 }
 
+static inline uint64_t rdtsc(void) {
+    uint32_t eax, edx;
+    __asm__ volatile("rdtsc" : "=a" (eax), "=d" (edx));
+    return ((uint64_t) edx << 32) | eax;
+}
+
 static inline uint64_t rdseed(void) {
     uint64_t result;
     __asm__ volatile ("rdseed %0" : "=r" (result));
@@ -0,0 +1,21 @@
+#ifndef _KERNEL_CPU_FPU_H
+#define _KERNEL_CPU_FPU_H
+
+#include <stdbool.h>
+
+struct percpu;
+struct thread;
+
+/*
+ * The FPU state of user threads is switched lazily. A thread only gets its state loaded once it
+ * uses the FPU, and only has it saved when it is switched out after that, so threads that never
+ * touch it in a timeslice cost nothing extra to switch or to make syscalls.
+ */
+void fpu_init(void);
+void fpu_cpu_init(struct percpu* percpu, bool xsave_enabled);
+
+void fpu_thread_init(struct thread* t);
+void fpu_thread_copy(struct thread* dst, struct thread* src);
+void fpu_switch_out(struct percpu* self, struct thread* t);
+
+#endif /* _KERNEL_CPU_FPU_H */
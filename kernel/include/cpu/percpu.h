@@ -3,10 +3,15 @@
 
 #include <cpu/asm.h>
 #include <cpu/gdt.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/process.h>
+#include <sys/sched.h>
+#include <sys/timer.h>
 
 struct percpu {
     struct percpu* self;
@@ -14,16 +19,40 @@ struct percpu {
 
     uintptr_t kernel_stack;
     uintptr_t user_stack;
+    uintptr_t sched_stack;
     struct thread* running_thread;
+    size_t preempt_count;   /* see sys/preempt.h */
+    bool need_resched;
+    struct run_queue run_queue;
+    struct sched_stats sched_stats;
+    struct timer_queue timers;
 	struct tss tss;
 
     size_t fpu_storage_size;
     void (*fpu_save)(void*);
     void (*fpu_restore)(void*);
+    struct thread* fpu_owner;   /* the last thread whose state was loaded into the registers here */
+    bool fpu_loaded;            /* whether the running thread's state is loaded, CR0.TS is set when it is not */
     bool smap_enabled;
 
     uint32_t lapic_id;
+    uint32_t core_id;
+    uint32_t package_id;
+    uint32_t numa_node;
+    struct percpu* smt_next;    /* the next hardware thread of the same core, itself without SMT */
     uint32_t lapic_frequency;
+    uint64_t timer_deadline;    /* what the LAPIC timer is armed for, UINT64_MAX when it is not */
+    bool online;
+
+    /* the last user pagemap loaded here, kept after switching to the kernel pagemap */
+    struct pagemap* active_pagemap;
+    bool tlb_shootdown_pending;
+    size_t pcid_slot;
+    size_t pcid_next_victim;
+    struct pcid_slot pcid_slots[VMM_PCID_SLOTS];
+
+    struct pmm_page_cache page_cache;
+    struct slab_magazine slab_magazines[SLAB_MAX_MAGAZINE_CACHES];
 };
 
 extern struct percpu* percpus;
@@ -5,10 +5,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define PANIC_IPI 0xff
+#define PANIC_IPI           0xff
+#define TLB_SHOOTDOWN_IPI   0xfe
 
 extern size_t smp_cpu_count;
 
+void smp_early_init(void);
 void smp_init(void);
 
 #endif /* _KERNEL_CPU_SMP_H */
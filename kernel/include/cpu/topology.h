@@ -0,0 +1,20 @@
+#ifndef _KERNEL_CPU_TOPOLOGY_H
+#define _KERNEL_CPU_TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct percpu;
+
+/* how far apart two CPUs are in terms of the caches and memory they share */
+#define CPU_DISTANCE_SAME       0
+#define CPU_DISTANCE_SMT        1   /* hardware threads of one core */
+#define CPU_DISTANCE_PACKAGE    2   /* cores sharing the last level cache */
+#define CPU_DISTANCE_NODE       3   /* packages on the same memory */
+#define CPU_DISTANCE_REMOTE     4
+
+void topology_cpu_init(struct percpu* percpu);
+void topology_link(void);
+size_t topology_distance(struct percpu* a, struct percpu* b);
+
+#endif /* _KERNEL_CPU_TOPOLOGY_H */
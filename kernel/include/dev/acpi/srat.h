@@ -0,0 +1,47 @@
+#ifndef _KERNEL_DEV_ACPI_SRAT_H
+#define _KERNEL_DEV_ACPI_SRAT_H
+
+#include <dev/acpi/acpi.h>
+#include <stdint.h>
+
+#define SRAT_LAPIC_ENTRY    0
+#define SRAT_X2APIC_ENTRY   2
+
+#define SRAT_ENABLED        (1 << 0)
+
+struct srat {
+    struct acpi_sdt;
+    uint32_t : 32;
+    uint64_t : 64;
+    char entries[];
+} __attribute__((packed));
+
+struct srat_entry_header {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct srat_lapic {
+    struct srat_entry_header;
+    uint8_t proximity_domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_domain_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct srat_x2apic {
+    struct srat_entry_header;
+    uint16_t : 16;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t : 32;
+} __attribute__((packed));
+
+void srat_init(void);
+uint32_t srat_apic_node(uint32_t apic_id);
+
+#endif /* _KERNEL_DEV_ACPI_SRAT_H */
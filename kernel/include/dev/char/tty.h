@@ -2,8 +2,11 @@
 #define _KERNEL_DEV_CHAR_TTY_H
 
 #include <stddef.h>
+#include <sys/mutex.h>
+#include <sys/wait_queue.h>
 #include <types.h>
 #include <utils/ringbuf.h>
+#include <utils/spinlock.h>
 
 #define TTY_MAJ 2
 
@@ -14,7 +17,10 @@
 struct tty {
     struct termios attr;
     ringbuf_t* input_buf;
+    struct wait_queue input_wait;   /* readers waiting for input_buf to fill up */
     ringbuf_t* canon_buf;
+    struct mutex read_lock;         /* held by readers, who may sleep waiting for input */
+    spinlock_t output_lock;         /* guards the terminal emulator in private */
     void* private;
 };
 
@@ -9,6 +9,7 @@
 extern uint32_t hpet_clock_period;
 
 uint64_t hpet_count(void);
+uint64_t hpet_ns(void);
 void hpet_sleep_ms(uint64_t ms);
 void hpet_sleep_ns(uint64_t ns);
 void hpet_init(void);
@@ -9,7 +9,7 @@
 
 void lapic_eoi(void);
 void lapic_send_ipi(uint32_t lapic_id, uint8_t vector);
-void lapic_timer_oneshot(uint8_t vector, uint64_t us);
+void lapic_timer_deadline(uint8_t vector, uint64_t deadline);
 void lapic_timer_stop(void);
 void lapic_init(uint32_t lapic_id);
 
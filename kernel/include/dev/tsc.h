@@ -0,0 +1,15 @@
+#ifndef _KERNEL_DEV_TSC_H
+#define _KERNEL_DEV_TSC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool tsc_invariant;
+extern bool tsc_deadline_supported;
+extern uint64_t tsc_frequency;
+
+uint64_t tsc_to_ns(uint64_t tsc);
+uint64_t tsc_from_ns(uint64_t ns);
+void tsc_init(void);
+
+#endif /* _KERNEL_DEV_TSC_H */
@@ -20,5 +20,9 @@
 #define ENOTTY          17
 #define EPERM           18
 #define ESPIPE          19
+#define ENODEV          22
+#define EACCES          23
+#define ESRCH           24
+#define ETIMEDOUT       25
 
 #endif /* _KERNEL_ERRNO_H */
@@ -0,0 +1,21 @@
+#ifndef _KERNEL_FS_DCACHE_H
+#define _KERNEL_FS_DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct vfs_node;
+
+/* names are hashed with FNV-1a, one character at a time so that path walks hash while they scan */
+#define DCACHE_HASH_INIT    2166136261u
+
+static inline uint32_t dcache_hash_step(uint32_t hash, char c) {
+    return (hash ^ (uint8_t) c) * 16777619u;
+}
+
+struct vfs_node* dcache_lookup(struct vfs_node* dir, const char* name, size_t len, uint32_t hash);
+void dcache_add(struct vfs_node* dir, const char* name, struct vfs_node* node);
+void dcache_purge(struct vfs_node* node);
+void dcache_init(void);
+
+#endif /* _KERNEL_FS_DCACHE_H */
@@ -0,0 +1,31 @@
+#ifndef _KERNEL_FS_PAGE_CACHE_H
+#define _KERNEL_FS_PAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct vfs_node;
+
+/* the cache only takes new pages while this many are free, below that it recycles its own */
+#define PAGE_CACHE_MIN_FREE 8192
+
+/* dirty pages are written back after this long at most, and may take up 1/PAGE_CACHE_DIRTY_RATIO of memory */
+#define PAGE_CACHE_WRITEBACK_NS     5000000000ul
+#define PAGE_CACHE_DIRTY_RATIO      8
+
+struct page_cache_stats {
+    size_t pages;
+    size_t dirty_pages;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+};
+
+void page_cache_attach(struct vfs_node* node);
+int page_cache_sync_all(void);
+size_t page_cache_reclaim(void);
+void page_cache_get_stats(struct page_cache_stats* stats);
+void page_cache_init(void);
+
+#endif /* _KERNEL_FS_PAGE_CACHE_H */
@@ -0,0 +1,6 @@
+#ifndef _KERNEL_FS_PROCFS_H
+#define _KERNEL_FS_PROCFS_H
+
+void procfs_init(void);
+
+#endif /* _KERNEL_FS_PROCFS_H */
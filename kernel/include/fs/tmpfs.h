@@ -5,6 +5,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct vfs_node;
+
+struct vfs_node* tmpfs_create_anonymous(size_t size);
+void tmpfs_destroy_anonymous(struct vfs_node* node);
 void tmpfs_init(void);
 
 #endif /* _KERNEL_FS_TMPFS_H */
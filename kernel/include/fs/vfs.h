@@ -4,12 +4,15 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/mutex.h>
 #include <types.h>
 #include <utils/hashmap.h>
 #include <utils/spinlock.h>
 
 extern struct vfs_node* vfs_root;
 
+struct page_cache_device;
+
 struct vfs_filesystem {
     void* private;
     struct vfs_node *(*create)(struct vfs_filesystem*, struct vfs_node*, const char*, mode_t);
@@ -27,13 +30,22 @@ struct vfs_node {
     hashmap_t* children;
     struct vfs_filesystem* fs;
     void* private;
+    struct page_cache_device* page_cache;  /* block devices whose pages are cached */
     spinlock_t lock;
+    struct mutex io_lock;   /* serializes reads, writes and the like of anything but devices */
 
     ssize_t (*read)(struct vfs_node*, void*, off_t, size_t, int);
     ssize_t (*write)(struct vfs_node*, const void*, off_t, size_t, int);
     int (*ioctl)(struct vfs_node*, uint64_t, void*);
     int (*truncate)(struct vfs_node*, off_t);
     int (*sync)(struct vfs_node*);
+
+    /*
+     * Looks up the physical page backing the given page aligned offset for a memory mapping, with a
+     * reference taken for the new mapping (except for device memory). With a NULL paddr it only checks
+     * whether the node can be mapped at all.
+     */
+    int (*mmap)(struct vfs_node*, off_t, uintptr_t*);
 };
 
 struct vfs_node* vfs_create_node(struct vfs_filesystem* fs, struct vfs_node* parent, const char* name, bool is_dir);
@@ -44,7 +56,8 @@ size_t vfs_get_pathname(struct vfs_node* node, char* buffer, size_t len);
 struct vfs_node* vfs_get_root(void);
 bool vfs_mount(struct vfs_node* parent, const char* source, const char* target, const char* fs_name);
 struct vfs_node* vfs_create(struct vfs_node* parent, const char* name, mode_t mode);
-ssize_t vfs_getdents(struct vfs_node* node, struct dirent* buffer, off_t offset, size_t count);
+bool vfs_add_child(struct vfs_node* parent, struct vfs_node* child);
+ssize_t vfs_getdents(struct vfs_node* node, struct dirent* buffer, off_t* offset, size_t count);
 bool vfs_register_filesystem(const char* fs_name, vfs_mount_t fs_mount);
 bool vfs_unregister_filesystem(const char* fs_name);
 void vfs_init(void);
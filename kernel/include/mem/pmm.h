@@ -2,14 +2,66 @@
 #define _KERNEL_MEM_PMM_H
 
 #include <limine.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/* largest buddy block is 2^PMM_MAX_ORDER pages (1GiB) */
+#define PMM_MAX_ORDER 18
+
+#define PMM_PAGE_CACHE_SIZE     64
+#define PMM_PAGE_CACHE_BATCH    32
+
+/* pre-zeroed pages kept around for demand-paged anonymous memory, refilled while idle */
+#define PMM_ZERO_POOL_SIZE      256
+#define PMM_ZERO_POOL_MIN_FREE  4096
+
+/* huge pages are only handed out while this many pages are free, so they don't eat the last of memory */
+#define PMM_HUGE_PAGE_MIN_FREE  16384
+
+/* everything below this can be reached by devices that take 32-bit physical addresses */
+#define PMM_DMA32_LIMIT         0x100000000ul
+
+/* per-CPU magazine of free single pages, embedded in struct percpu */
+struct pmm_page_cache {
+    size_t count;
+    uintptr_t pages[PMM_PAGE_CACHE_SIZE];
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+};
+
+struct pmm_page_cache_stats {
+    size_t cached_pages;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+};
+
 extern volatile struct limine_memmap_request memmap_request;
 
 uintptr_t pmm_alloc(size_t pages);
 uintptr_t pmm_allocz(size_t pages);
+uintptr_t pmm_alloc_below(size_t pages, uintptr_t limit);
+uintptr_t pmm_allocz_below(size_t pages, uintptr_t limit);
+uintptr_t pmm_alloc_zeroed_page(void);
+uintptr_t pmm_alloc_huge_page(void);
+bool pmm_zero_pool_refill(void);
 void pmm_free(uintptr_t addr, size_t pages);
+void pmm_page_ref(uintptr_t addr);
+bool pmm_page_unref(uintptr_t addr);
+bool pmm_page_is_shared(uintptr_t addr);
+void pmm_huge_page_ref(uintptr_t addr);
+void pmm_huge_page_unref(uintptr_t addr);
+bool pmm_huge_page_is_shared(uintptr_t addr);
+size_t pmm_get_free_pages(void);
+size_t pmm_get_total_pages(void);
+void pmm_get_page_cache_stats(struct pmm_page_cache_stats* stats);
+void pmm_page_cache_init(void);
+void pmm_selftest(void);
 void pmm_init(void);
 
 #endif /* _KERNEL_MEM_PMM_H */
@@ -6,17 +6,29 @@
 #include <stdint.h>
 #include <utils/spinlock.h>
 
+#define SLAB_MAGAZINE_SIZE          16
+#define SLAB_MAGAZINE_BATCH         8
+#define SLAB_MAX_MAGAZINE_CACHES    32
+#define SLAB_NO_MAGAZINE            ((size_t) -1)
+
 struct slab;
 
+/* per-CPU stack of free objects for one cache, embedded in struct percpu */
+struct slab_magazine {
+    size_t count;
+    void* objects[SLAB_MAGAZINE_SIZE];
+};
+
 struct cache {
     const char* name;
 
     size_t object_size;
-    size_t pages_per_slab;
+    size_t magazine_index;
 
     struct slab* empty_slabs;
     struct slab* partial_slabs;
     struct slab* full_slabs;
+    size_t empty_slab_count;
 
     spinlock_t lock;
 
@@ -26,6 +38,8 @@ struct cache {
 void* cache_alloc_object(struct cache* cache);
 bool cache_free_object(struct cache* cache, void* object);
 struct cache* slab_cache_create(const char* name, size_t object_size);
+size_t slab_reclaim(void);
+void slab_magazines_init(void);
 void slab_init(void);
 
 void* kmalloc(size_t size);
@@ -0,0 +1,60 @@
+#ifndef _KERNEL_MEM_VMA_H
+#define _KERNEL_MEM_VMA_H
+
+#include <fs/vfs.h>
+#include <mem/vmm.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <types.h>
+#include <utils/spinlock.h>
+
+/* vma_flags */
+#define VMA_SHARED      (1 << 0)    /* writes go to the backing node instead of a private copy */
+#define VMA_DEVICE      (1 << 1)    /* backed by device memory that the pmm does not manage */
+#define VMA_ANONYMOUS   (1 << 2)    /* the backing node only exists for this mapping */
+#define VMA_FIXED       (1 << 3)    /* vma_map: replace whatever is mapped at the given address */
+#define VMA_MAYWRITE    (1 << 4)    /* shared mappings: the node was opened for writing */
+
+/*
+ * A reserved, page aligned range [start, end) of user memory that is populated on first touch. Areas
+ * without a node are private anonymous memory, otherwise pages come from node->mmap at the matching
+ * file offset. Private anonymous memory is backed by 2MiB pages wherever a whole aligned 2MiB region
+ * fits inside the area.
+ */
+struct vma {
+    uintptr_t start;
+    uintptr_t end;
+    uint64_t flags;
+    int vma_flags;
+
+    struct vfs_node* node;
+    off_t offset;
+
+    struct vma* left;
+    struct vma* right;
+    size_t height;
+
+    struct vma* prev;
+    struct vma* next;
+};
+
+/* AVL tree keyed by start address, also threaded into a sorted list */
+struct vma_tree {
+    struct vma* root;
+    struct vma* first;
+    spinlock_t lock;
+};
+
+bool vma_reserve(struct vma_tree* tree, uintptr_t start, uintptr_t end, uint64_t flags);
+uintptr_t vma_map(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t addr, size_t length, uint64_t flags,
+        int vma_flags, struct vfs_node* node, off_t offset);
+void vma_release(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t start, uintptr_t end);
+int vma_protect(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t start, uintptr_t end, uint64_t flags);
+bool vma_handle_fault(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t addr);
+bool vma_fork(struct vma_tree* new_tree, struct vma_tree* old_tree);
+void vma_tree_destroy(struct vma_tree* tree);
+
+void vma_init(void);
+
+#endif /* _KERNEL_MEM_VMA_H */
@@ -18,9 +18,17 @@
 #define PTE_CACHE_DISABLE   (1 << 4)
 #define PTE_SIZE            (1 << 7)
 #define PTE_GLOBAL          (1 << 8)
+#define PTE_COW             (1 << 9)
+#define PTE_SHARED          (1 << 10)
+#define PTE_DEVICE          (1 << 11)
 #define PTE_NX              (1ul << 63)
 #define PTE_FLAG_MASK       (0x8000000000000ffful)
 
+#define USER_SPACE_END  0x800000000000
+
+/* address spaces each CPU keeps tagged TLB entries for, PCID 0 belongs to the kernel pagemap */
+#define VMM_PCID_SLOTS  8
+
 #define FAULT_PRESENT   (1 << 0)
 #define FAULT_WRITABLE  (1 << 1)
 #define FAULT_USER      (1 << 2)
@@ -32,19 +40,39 @@
 
 extern volatile struct limine_hhdm_request hhdm_request;
 extern struct pagemap* kernel_pagemap;
+extern bool vmm_pcid_enabled;
 
+/*
+ * tlb_gen is bumped by every change that needs a TLB flush. CPUs remember the generation their tagged
+ * entries for a pagemap are up to date with, and flush them when switching back to an older one.
+ */
 struct pagemap {
     uint64_t* top_level;
     bool has_level5;
     spinlock_t lock;
+
+    uint64_t id;
+    uint64_t tlb_gen;
+};
+
+struct pcid_slot {
+    uint64_t pagemap_id;
+    uint64_t tlb_gen;
 };
 
 struct pagemap* vmm_new_pagemap(void);
 void vmm_destroy_pagemap(struct pagemap* pagemap);
 struct pagemap* vmm_fork_pagemap(struct pagemap* old_pagemap);
+bool vmm_handle_cow_fault(struct pagemap* pagemap, uintptr_t vaddr);
+bool vmm_can_map_huge_page(struct pagemap* pagemap, uintptr_t vaddr);
+void vmm_split_huge_page(struct pagemap* pagemap, uintptr_t vaddr);
 
 void vmm_switch_pagemap(struct pagemap* pagemap);
 
+bool vmm_map_range(struct pagemap* pagemap, uintptr_t vaddr, uintptr_t paddr, size_t size, uint64_t flags);
+size_t vmm_unmap_range(struct pagemap* pagemap, uintptr_t start, uintptr_t end, bool release);
+size_t vmm_protect_range(struct pagemap* pagemap, uintptr_t start, uintptr_t end, uint64_t flags);
+
 bool vmm_map_page(struct pagemap* pagemap, uintptr_t vaddr, uintptr_t paddr, uint64_t flags);
 bool vmm_unmap_page(struct pagemap* pagemap, uintptr_t vaddr);
 bool vmm_update_flags(struct pagemap* pagemap, uintptr_t vaddr, uint64_t flags);
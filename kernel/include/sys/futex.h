@@ -0,0 +1,19 @@
+#ifndef _KERNEL_SYS_FUTEX_H
+#define _KERNEL_SYS_FUTEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUTEX_WAIT      0
+#define FUTEX_WAKE      1
+#define FUTEX_REQUEUE   3
+
+/* shared futexes wait in global buckets, private ones in the buckets of their process */
+#define FUTEX_BUCKETS           64
+#define FUTEX_PRIVATE_BUCKETS   16
+
+int futex_wait(uint32_t* uaddr, uint32_t expected, uint64_t timeout_ns);
+int futex_wake(uint32_t* uaddr, size_t count);
+int futex_requeue(uint32_t* uaddr, size_t wake_count, uint32_t* uaddr2, size_t requeue_count);
+
+#endif /* _KERNEL_SYS_FUTEX_H */
@@ -0,0 +1,29 @@
+#ifndef _KERNEL_SYS_MUTEX_H
+#define _KERNEL_SYS_MUTEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/wait_queue.h>
+
+/*
+ * Sleeping locks for threads, for sections that may block themselves, like waiting on a device.
+ * They cannot be used from interrupt handlers. Zeroed mutexes and condition variables are ready to use.
+ */
+struct mutex {
+    uintptr_t owner;    /* owning thread, with the low bit set once others might be waiting for it */
+    struct wait_queue waiters;
+};
+
+struct condvar {
+    struct wait_queue waiters;
+};
+
+void mutex_acquire(struct mutex* m);
+bool mutex_try_acquire(struct mutex* m);
+void mutex_release(struct mutex* m);
+
+void condvar_wait(struct condvar* cv, struct mutex* m);
+void condvar_signal(struct condvar* cv);
+void condvar_broadcast(struct condvar* cv);
+
+#endif /* _KERNEL_SYS_MUTEX_H */
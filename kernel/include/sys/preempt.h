@@ -0,0 +1,33 @@
+#ifndef _KERNEL_SYS_PREEMPT_H
+#define _KERNEL_SYS_PREEMPT_H
+
+#include <cpu/percpu.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <utils/macros.h>
+
+/*
+ * Sections that must not be preempted nest a per-CPU count, held by every spinlock. A timer or another
+ * CPU that wants to preempt this one while it is nonzero only sets need_resched, and the CPU then
+ * reschedules itself once the count drops back to zero with interrupts enabled. The count is changed
+ * with a single instruction on the current CPU, so it is right even if the thread moves in between.
+ */
+void preempt_resched(void);
+__attribute__((noreturn)) void preempt_underflow(void);
+
+static inline void preempt_disable(void) {
+    __asm__ volatile ("incq %%gs:%c0" :: "i" (offsetof(struct percpu, preempt_count)) : "memory", "cc");
+}
+
+static inline void preempt_enable(void) {
+    bool underflow;
+    __asm__ volatile ("decq %%gs:%c1" : "=@ccs" (underflow) : "i" (offsetof(struct percpu, preempt_count)) : "memory");
+    if (unlikely(underflow)) {
+        preempt_underflow();
+    }
+    if (unlikely(__atomic_load_n(&this_cpu()->need_resched, __ATOMIC_RELAXED))) {
+        preempt_resched();
+    }
+}
+
+#endif /* _KERNEL_SYS_PREEMPT_H */
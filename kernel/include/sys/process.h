@@ -4,14 +4,19 @@
 #include <cpu/isr.h>
 #include <fs/fd.h>
 #include <fs/vfs.h>
+#include <mem/vma.h>
 #include <mem/vmm.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/futex.h>
+#include <sys/timer.h>
+#include <sys/wait_queue.h>
 #include <types.h>
 #include <utils/string.h>
 #include <utils/vector.h>
 
+#define PROCESS_MMAP_BASE           0x10000000000
 #define PROCESS_BRK_BASE            0x60000000000
 #define PROCESS_THREAD_STACK_TOP    0x70000000000
 
@@ -29,6 +34,7 @@ enum thread_state {
 };
 
 struct thread;
+struct run_queue;
 
 struct process {
     pid_t pid;
@@ -40,16 +46,20 @@ struct process {
     uintptr_t code_base;
     uintptr_t thread_stack_top;
     uintptr_t brk;
-    uintptr_t brk_next_unallocated_page_begin;
+    struct vma_tree vmas;
 
     struct vfs_node* cwd;
     spinlock_t fd_lock;
     struct file_descriptor* file_descriptors[MAX_FDS];
-    struct timespec ticks;
+    uint64_t cpu_time;  /* nanoseconds spent running */
 
+    /* children and parent links are guarded by process_list_lock, waiters are woken when a child exits */
     struct process* parent;
     vector_t* children;
+    struct wait_queue child_exited;
     vector_t* threads;
+
+    struct wait_queue futex_buckets[FUTEX_PRIVATE_BUCKETS];    /* private futexes, keyed by their address */
 };
 
 struct thread {
@@ -58,21 +68,49 @@ struct thread {
     struct process* process;
     bool is_user;
     spinlock_t lock;
-    uint64_t timeslice;
     uint64_t sleep_until;
-    struct timespec ticks;
+    struct timer sleep_timer;
+    struct wait_queue* wait_queue;
+    uintptr_t wait_key;
+    struct thread* wait_next;
+    struct thread* wait_prev;
+    uint64_t cpu_time;  /* nanoseconds spent running */
 
     uintptr_t kernel_stack;
     uintptr_t page_fault_stack;
     uintptr_t user_stack;
-    uintptr_t user_stack_paddr;
 
     struct registers ctx;
     void* fpu_storage;
+    size_t fpu_cpu;     /* the CPU it last had its FPU state loaded on */
     uint64_t fs_base;
     uint64_t gs_base;
 
+    /* scheduling, vruntime is relative to the queue's min_vruntime while the thread is off every queue */
+    int policy;
+    int rt_priority;
+    int nice;
+    uint64_t vruntime;
+    uint64_t exec_start;
+    uint64_t queued_weight; /* weight it is in a fair tree with, 0 on a real-time list */
+    cpu_set_t affinity;     /* CPUs it may run on */
+    size_t last_cpu;        /* the CPU it last ran on, whose caches may still hold its data */
+
+    /* statistics for /proc/threads, times are in nanoseconds */
+    uint64_t wait_time;             /* spent on a run queue, ready but not running */
+    uint64_t queued_at;
+    uint64_t woken_at;              /* 0 once it ran after its last wakeup */
+    uint64_t max_wakeup_latency;
+    uint64_t voluntary_switches;    /* gave up the CPU itself, by blocking or yielding */
+    uint64_t involuntary_switches;  /* preempted while still runnable */
+    uint64_t migrations;
+
     struct thread* next;
+    struct thread* prev;
+    struct thread* left;
+    struct thread* right;
+    size_t height;
+    struct run_queue* run_queue;
 };
 
 struct dead_process {
@@ -85,6 +123,8 @@ struct process* process_create(struct process* old, struct pagemap* pagemap);
 bool process_create_init(void);
 void process_destroy(struct process* p);
 void process_exit(struct process* p, int status);
+struct process* process_get(pid_t pid);
+void process_for_each_thread(void (*fn)(struct thread*, void*), void* ctx);
 void* process_sbrk(struct process* p, intptr_t size);
 pid_t process_wait(struct process* p, pid_t pid, int* status, int flags);
 
@@ -5,9 +5,71 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/process.h>
+#include <utils/spinlock.h>
 
-#define SCHED_VECTOR 48
+#define SCHED_VECTOR            48
+#define SCHED_PREEMPT_VECTOR    49
 #define sched_yield() __asm__ volatile("int $48");
+#define sched_preempt() __asm__ volatile("int $49");
+
+/* scheduling policies */
+#define SCHED_OTHER 0   /* fair share by virtual runtime, weighted by the nice value */
+#define SCHED_FIFO  1   /* real-time, runs until it blocks or yields */
+#define SCHED_RR    2   /* real-time, like SCHED_FIFO but round-robin among equal priorities */
+
+#define SCHED_NICE_MIN      -20
+#define SCHED_NICE_MAX      19
+#define SCHED_RT_PRIO_MIN   1
+#define SCHED_RT_PRIO_MAX   99
+
+/* getpriority/setpriority which */
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
+
+struct sched_param {
+    int sched_priority;
+};
+
+static inline bool cpu_set_contains(const cpu_set_t* set, size_t cpu) {
+    return cpu < CPU_SETSIZE && (set->bits[cpu / 64] & (1ul << (cpu % 64)));
+}
+
+static inline void cpu_set_add(cpu_set_t* set, size_t cpu) {
+    if (cpu < CPU_SETSIZE) {
+        set->bits[cpu / 64] |= 1ul << (cpu % 64);
+    }
+}
+
+/*
+ * Threads that are ready to run on one CPU. Real-time threads are kept in a list sorted by priority
+ * and always run first. Fair threads are kept in an AVL tree ordered by virtual runtime, the one that
+ * got the least CPU time for its weight runs next. The thread a CPU is running is not on the queue.
+ */
+struct run_queue {
+    spinlock_t lock;
+    struct thread* rt_head;
+    struct thread* rt_tail;
+    struct thread* fair_root;
+    uint64_t fair_weight;
+    uint64_t min_vruntime;
+    size_t count;
+};
+
+/*
+ * Per-CPU counters, only ever written by their own CPU. Wakeup latencies, from a thread being woken
+ * to it running, are counted in log2 buckets of nanoseconds, bucket i holding [2^i, 2^(i+1)) and the
+ * last one everything above.
+ */
+#define SCHED_LATENCY_BUCKETS   32
+
+struct sched_stats {
+    uint64_t switches;
+    uint64_t idle_time;
+    uint64_t idle_since;    /* 0 while not idle */
+    uint64_t wakeups;
+    uint64_t wakeup_latency[SCHED_LATENCY_BUCKETS];
+};
 
 extern struct process* kernel_process;
 
@@ -15,6 +77,11 @@ __attribute__((noreturn)) void sched_await(void);
 void sched_thread_enqueue(struct thread* t);
 void sched_thread_dequeue(struct thread* t);
 void sched_thread_sleep(struct thread* t, uint64_t ns);
+bool sched_thread_wake(struct thread* t);
+void sched_thread_init(struct thread* t, struct thread* parent);
+int sched_set_nice(struct thread* t, int nice);
+int sched_set_policy(struct thread* t, int policy, int rt_priority);
+int sched_set_affinity(struct thread* t, const cpu_set_t* mask);
 void sched_init(void);
 
 #endif /* _KERNEL_SYS_SCHED_H */
@@ -1,12 +1,20 @@
 #ifndef _KERNEL_SYS_TIME_H
 #define _KERNEL_SYS_TIME_H
 
+#include <stdint.h>
 #include <types.h>
 
-extern struct timespec time_monotonic;
-extern struct timespec time_realtime;
+static inline struct timespec time_ns_to_timespec(uint64_t ns) {
+    return (struct timespec) {
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000
+    };
+}
 
-void time_update_timers(void);
+uint64_t time_ns(void);
+struct timespec time_get_monotonic(void);
+struct timespec time_get_realtime(void);
+void time_set_realtime(struct timespec ts);
 void time_init(void);
 
 #endif /* _KERNEL_SYS_TIME_H */
@@ -0,0 +1,44 @@
+#ifndef _KERNEL_SYS_TIMER_H
+#define _KERNEL_SYS_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utils/spinlock.h>
+
+struct timer;
+
+typedef void (*timer_callback_t)(struct timer* timer, void* ctx);
+
+/*
+ * A callback that runs once, at or after deadline (nanoseconds on the time_ns clock), on the CPU the
+ * timer was armed on. Callbacks run from the scheduler with interrupts disabled, may arm their own
+ * timer again, but must not free it.
+ */
+struct timer {
+    uint64_t deadline;
+    timer_callback_t callback;
+    void* ctx;
+
+    struct timer_queue* queue;
+    bool running;
+
+    struct timer* left;
+    struct timer* right;
+    size_t height;
+};
+
+/* pending timers of one CPU, an AVL tree ordered by deadline with the earliest one cached */
+struct timer_queue {
+    spinlock_t lock;
+    struct timer* root;
+    struct timer* first;
+};
+
+void timer_setup(struct timer* timer, timer_callback_t callback, void* ctx);
+void timer_arm(struct timer* timer, uint64_t deadline);
+bool timer_cancel(struct timer* timer);
+uint64_t timer_next_deadline(void);
+void timer_run_expired(void);
+
+#endif /* _KERNEL_SYS_TIMER_H */
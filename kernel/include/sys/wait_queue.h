@@ -0,0 +1,47 @@
+#ifndef _KERNEL_SYS_WAIT_QUEUE_H
+#define _KERNEL_SYS_WAIT_QUEUE_H
+
+#include <cpu/asm.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utils/spinlock.h>
+
+struct thread;
+
+/*
+ * Threads sleeping until some condition holds, in the order they went to sleep. The condition is
+ * guarded by a lock that both sides hold around checking or changing it, which may be the queue's own
+ * lock, so that a thread is always on the queue before anyone can change the condition and wake it.
+ * A zeroed wait queue is empty.
+ */
+struct wait_queue {
+    spinlock_t lock;
+    struct thread* head;
+    struct thread* tail;
+};
+
+void wait_queue_sleep(struct wait_queue* wq, spinlock_t* lock);
+bool wait_queue_sleep_keyed(struct wait_queue* wq, spinlock_t* lock, uintptr_t key, uint64_t deadline);
+bool wait_queue_wake_one(struct wait_queue* wq);
+size_t wait_queue_wake_all(struct wait_queue* wq);
+size_t wait_queue_wake_key(struct wait_queue* wq, uintptr_t key, size_t max);
+size_t wait_queue_requeue_key(struct wait_queue* from, uintptr_t key, struct wait_queue* to, uintptr_t new_key, size_t max);
+bool wait_queue_remove(struct thread* t);
+
+/* sleeps until the condition, checked under the queue's own lock, holds */
+#define wait_event(wq, condition) \
+    do { \
+        bool __prev_int = interrupt_state(); \
+        cli(); \
+        spinlock_acquire(&(wq)->lock); \
+        while (!(condition)) { \
+            wait_queue_sleep((wq), &(wq)->lock); \
+        } \
+        spinlock_release(&(wq)->lock); \
+        if (__prev_int) { \
+            sti(); \
+        } \
+    } while (0)
+
+#endif /* _KERNEL_SYS_WAIT_QUEUE_H */
@@ -51,6 +51,18 @@
 
 #define WNOHANG     (1 << 0)
 
+#define PROT_NONE   0
+#define PROT_READ   (1 << 0)
+#define PROT_WRITE  (1 << 1)
+#define PROT_EXEC   (1 << 2)
+
+#define MAP_SHARED      (1 << 0)
+#define MAP_PRIVATE     (1 << 1)
+#define MAP_FIXED       (1 << 4)
+#define MAP_ANONYMOUS   (1 << 5)
+
+#define MAP_FAILED ((void*) -1)
+
 #define makedev(maj, min) (dev_t) ((((maj) << 8) & 0xff00u) | ((min) & 0x00ffu))
 #define major(dev) (uint8_t) (((dev) & 0xff00u) >> 8)
 #define minor(dev) (uint8_t) ((dev) & 0x00ffu)
@@ -125,6 +137,12 @@ struct timespec {
 
 typedef int32_t clockid_t;
 
+#define CPU_SETSIZE 1024
+
+typedef struct {
+    uint64_t bits[CPU_SETSIZE / 64];
+} cpu_set_t;
+
 struct stat {
     dev_t st_dev;
     ino_t st_ino;
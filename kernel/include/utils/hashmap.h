@@ -5,15 +5,40 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define HASHMAP_INLINE_KEY  16
+
+/*
+ * Maps byte string keys to pointers. Entries are kept in a dense array in the order they were added,
+ * which is the order iteration goes by, and are found through a power of two sized table of slots
+ * using Robin Hood hashing. Slots hold the full hash, so probing rarely has to look at other keys.
+ * Keys are copied, short ones into the entry itself. Removed entries leave a hole in the array until
+ * it is compacted as the map grows or shrinks. Entries are numbered as they are added, and those
+ * numbers serve as positions that iteration can resume from no matter how the map changed meanwhile.
+ */
 typedef struct hashmap_entry {
-	char* key;
-	void* value;
-	struct hashmap_entry* next;
+    uint32_t hash;
+    uint32_t key_size;  /* HASHMAP_REMOVED for a hole */
+    void* value;
+    uint64_t position;
+    union {
+        char key_inline[HASHMAP_INLINE_KEY];
+        char* key_ptr;
+    };
 } hashmap_entry_t;
 
+typedef struct hashmap_slot {
+    uint32_t hash;
+    uint32_t entry;     /* index of the entry plus one, 0 for an empty slot */
+} hashmap_slot_t;
+
 typedef struct hashmap {
-	size_t size;
-	hashmap_entry_t** entries;
+    size_t count;       /* entries in the map */
+    size_t used;        /* entries in the array, holes included */
+    size_t capacity;
+    size_t mask;        /* slot count minus one */
+    uint64_t next_position;
+    hashmap_slot_t* slots;
+    hashmap_entry_t* entries;
 } hashmap_t;
 
 hashmap_t* hashmap_create(size_t entry_count);
@@ -21,5 +46,9 @@ void hashmap_destroy(hashmap_t* map);
 bool hashmap_set(hashmap_t* map, const void* key, size_t key_size, void* value);
 void* hashmap_get(hashmap_t* map, const void* key, size_t key_size);
 bool hashmap_remove(hashmap_t* map, const void* key, size_t key_size);
+bool hashmap_iterate(hashmap_t* map, size_t* iter, const char** key, size_t* key_size, void** value);
+size_t hashmap_seek(hashmap_t* map, uint64_t position);
+uint64_t hashmap_position(hashmap_t* map, size_t iter);
+void hashmap_selftest(void);
 
 #endif /* _KERNEL_UTILS_HASHMAP_H */
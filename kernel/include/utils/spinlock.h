@@ -6,11 +6,27 @@
 
 typedef uint64_t spinlock_t;
 
-static inline bool spinlock_test_and_acquire(spinlock_t* lock) {
+/*
+ * A CPU holding a spinlock cannot be preempted, so nobody ever spins on a lock whose holder is not
+ * running. The _irqsave variants also disable interrupts, for locks that interrupt handlers take too.
+ * The _raw variants leave preemption alone, they are only for locks that are handed over across a
+ * context switch, like the lock a running thread holds on itself.
+ */
+bool spinlock_test_and_acquire(spinlock_t* lock);
+void spinlock_acquire(spinlock_t* lock);
+void spinlock_release(spinlock_t* lock);
+
+bool spinlock_acquire_irqsave(spinlock_t* lock);
+void spinlock_release_irqrestore(spinlock_t* lock, bool prev_int);
+
+static inline bool spinlock_test_and_acquire_raw(spinlock_t* lock) {
     return __sync_bool_compare_and_swap(lock, 0, 1);
 }
 
-void spinlock_acquire(spinlock_t* lock);
-void spinlock_release(spinlock_t* lock);
+void spinlock_acquire_raw(spinlock_t* lock);
+
+static inline void spinlock_release_raw(spinlock_t* lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_SEQ_CST);
+}
 
 #endif /* _KERNEL_UTILS_SPINLOCK_H */
@@ -5,6 +5,7 @@
 #include <cpu/percpu.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define USER_ACCESS_BEGIN \
     do { \
@@ -20,7 +21,20 @@
         } \
     } while (0)
 
+struct registers;
+
+/*
+ * Copies that may touch user memory, which return false instead of faulting if it is not there or not
+ * accessible. Anything that touches user memory with a lock held has to use them, or the check_user
+ * functions and copies below, as a fault would otherwise kill the thread in the middle of its section.
+ */
+bool user_copy(void* dest, const void* src, size_t size);
+bool user_fill(void* dest, int c, size_t size);
+bool user_load32(uint32_t* dest, const uint32_t* src);
+bool user_access_fixup(struct registers* r);
+
 bool check_user_ptr(const void* ptr);
+bool check_user_range(const void* ptr, size_t size);
 void* copy_from_user(void* kdest, const void* usrc, size_t size);
 void* copy_to_user(void* udest, const void* ksrc, size_t size);
 
@@ -0,0 +1,124 @@
+#include <cpu/asm.h>
+#include <cpu/fpu.h>
+#include <cpu/isr.h>
+#include <cpu/percpu.h>
+#include <sys/process.h>
+#include <utils/panic.h>
+#include <utils/string.h>
+
+#define CR0_TS          (1 << 3)
+#define NM_VECTOR       7
+
+#define DEFAULT_FCW     0x33f
+#define DEFAULT_MXCSR   0x1f80
+
+/* offsets into the legacy region and the header of the save area */
+#define FCW_OFFSET          0
+#define MXCSR_OFFSET        24
+#define XSTATE_BV_OFFSET    512
+
+READONLY_AFTER_INIT static bool xsave_used = false;
+
+/*
+ * CR0.TS is set on a CPU whenever the running thread's state is not loaded, so its first FPU
+ * instruction traps here. The registers may still hold that state if it was the last thread to use
+ * the FPU on this CPU, and did not run it anywhere else since, in which case there is nothing to restore.
+ */
+static void fpu_trap(struct registers* r, void* ctx) {
+    (void) ctx;
+
+    if (!(r->cs & 3)) {
+        kpanic(r, true, "FPU used in kernel mode");
+    }
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct percpu* self = this_cpu();
+    struct thread* current = self->running_thread;
+
+    clts();
+    if (self->fpu_owner != current || current->fpu_cpu != self->cpu_number) {
+        self->fpu_restore(current->fpu_storage);
+        self->fpu_owner = current;
+        current->fpu_cpu = self->cpu_number;
+    }
+    self->fpu_loaded = true;
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+UNMAP_AFTER_INIT void fpu_init(void) {
+    isr_install_handler(NM_VECTOR, fpu_trap, NULL);
+}
+
+/* called with CR0.TS already set, and XSAVE enabled in CR4 and XCR0 if it is used */
+UNMAP_AFTER_INIT void fpu_cpu_init(struct percpu* percpu, bool xsave_enabled) {
+    uint32_t eax = 0, ecx = 0, unused;
+
+    if (xsave_enabled) {
+        cpuid(13, 0, &unused, &unused, &ecx, &unused);
+        percpu->fpu_storage_size = ecx;
+        percpu->fpu_restore = xrstor;
+
+        /* XSAVEOPT skips the components that are unchanged since they were restored */
+        cpuid(13, 1, &eax, &unused, &unused, &unused);
+        percpu->fpu_save = (eax & (1 << 0)) ? xsaveopt : xsave;
+    } else {
+        percpu->fpu_storage_size = 512;
+        percpu->fpu_save = fxsave;
+        percpu->fpu_restore = fxrstor;
+    }
+
+    percpu->fpu_owner = NULL;
+    percpu->fpu_loaded = false;
+    xsave_used = xsave_enabled;
+}
+
+/*
+ * Builds the initial state in memory rather than through the registers, which belong to whatever
+ * thread last used the FPU on this CPU. Everything but the control words starts out zeroed.
+ */
+void fpu_thread_init(struct thread* t) {
+    uint8_t* storage = t->fpu_storage;
+
+    *(uint16_t*) (storage + FCW_OFFSET) = DEFAULT_FCW;
+    *(uint32_t*) (storage + MXCSR_OFFSET) = DEFAULT_MXCSR;
+    if (xsave_used) {
+        /* mark the x87 and SSE state as present, so XRSTOR loads the control words from memory */
+        *(uint64_t*) (storage + XSTATE_BV_OFFSET) = (1 << 0) | (1 << 1);
+    }
+
+    t->fpu_cpu = (size_t) -1;
+}
+
+/* copies the state of a running thread, which may only be in the registers of this CPU so far */
+void fpu_thread_copy(struct thread* dst, struct thread* src) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct percpu* self = this_cpu();
+    if (self->fpu_loaded && self->running_thread == src) {
+        self->fpu_save(src->fpu_storage);
+    }
+    memcpy(dst->fpu_storage, src->fpu_storage, self->fpu_storage_size);
+
+    if (prev_int) {
+        sti();
+    }
+
+    dst->fpu_cpu = (size_t) -1;
+}
+
+/* called with interrupts disabled when a user thread gives up the CPU */
+void fpu_switch_out(struct percpu* self, struct thread* t) {
+    if (!self->fpu_loaded) {
+        return;
+    }
+
+    self->fpu_save(t->fpu_storage);
+    write_cr0(read_cr0() | CR0_TS);
+    self->fpu_loaded = false;
+}
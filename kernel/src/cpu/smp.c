@@ -1,8 +1,10 @@
 #include <cpu/asm.h>
+#include <cpu/fpu.h>
 #include <cpu/gdt.h>
 #include <cpu/idt.h>
 #include <cpu/percpu.h>
 #include <cpu/smp.h>
+#include <cpu/topology.h>
 #include <dev/lapic.h>
 #include <limine.h>
 #include <mem/pmm.h>
@@ -11,6 +13,7 @@
 #include <sys/sched.h>
 #include <utils/cmdline.h>
 #include <utils/log.h>
+#include <utils/string.h>
 
 #define CPU_STACK_SIZE 0x8000
 
@@ -24,6 +27,9 @@ READONLY_AFTER_INIT size_t smp_cpu_count = 0;
 READONLY_AFTER_INIT static uint32_t bsp_lapic_id = 0;
 READONLY_AFTER_INIT static size_t initialized_cpus = 0;
 
+/* spinlocks use this_cpu(), so until smp_init sets up the real one the BSP uses this */
+static struct percpu boot_percpu = { .self = &boot_percpu };
+
 extern void syscall_entry(void);
 
 static void hang(struct limine_smp_info* smp_info) {
@@ -44,9 +50,12 @@ UNMAP_AFTER_INIT static void single_cpu_init(struct limine_smp_info* smp_info) {
     vmm_switch_pagemap(kernel_pagemap);
 
     wrmsr(IA32_GS_BASE_MSR, (uint64_t) percpu);
+    pmm_page_cache_init();
+    slab_magazines_init();
 
     percpu->tss.rsp0 = pmm_alloc(CPU_STACK_SIZE / PAGE_SIZE) + HIGH_VMA;
     percpu->tss.ist1 = pmm_alloc(CPU_STACK_SIZE / PAGE_SIZE) + HIGH_VMA;
+    percpu->sched_stack = pmm_alloc(CPU_STACK_SIZE / PAGE_SIZE) + HIGH_VMA + CPU_STACK_SIZE;
 
     uint64_t cr0 = read_cr0();
     uint64_t cr4 = read_cr4();
@@ -58,6 +67,15 @@ UNMAP_AFTER_INIT static void single_cpu_init(struct limine_smp_info* smp_info) {
         /* enable global pages if supported */
         if (edx & (1 << 13)) {
             cr4 |= (1 << 7);
+
+            /*
+             * tag TLB entries with the address space they belong to, kernel mappings have to be global
+             * for that so they stay visible under every PCID
+             */
+            if (ecx & (1 << 17)) {
+                cr4 |= (1 << 17);
+                vmm_pcid_enabled = true;
+            }
         }
 
         /* enable XSAVE */
@@ -72,9 +90,12 @@ UNMAP_AFTER_INIT static void single_cpu_init(struct limine_smp_info* smp_info) {
         }
     }
 
-    /* enable SSE instruction sets */
+    /* enable SSE instruction sets, trapping the first FPU use of every thread */
     cr0 &= ~(1 << 2);
-    cr0 |= (1 << 1);
+    cr0 |= (1 << 1) | (1 << 3);
+
+    /* make supervisor writes honor read-only pages, so kernel writes to copy-on-write user pages fault too */
+    cr0 |= (1 << 16);
 
     cr4 |= (1 << 9) | (1 << 10);
 
@@ -98,19 +119,11 @@ UNMAP_AFTER_INIT static void single_cpu_init(struct limine_smp_info* smp_info) {
     write_cr0(cr0);
     write_cr4(cr4);
 
-    cpuid(13, 0, &unused, &unused, &ecx, &unused);
-
     if (xcr0 != 0) {
         write_xcr0(xcr0);
-
-        percpu->fpu_storage_size = ecx;
-        percpu->fpu_save = xsave;
-        percpu->fpu_restore = xrstor;
-    } else {
-        percpu->fpu_storage_size = 512;
-        percpu->fpu_save = fxsave;
-        percpu->fpu_restore = fxrstor;
     }
+    fpu_cpu_init(percpu, xcr0 != 0);
+    topology_cpu_init(percpu);
 
     /* enable SYSCALL/SYSRET instructions */
     uint64_t efer = rdmsr(IA32_EFER_MSR);
@@ -133,9 +146,14 @@ UNMAP_AFTER_INIT static void single_cpu_init(struct limine_smp_info* smp_info) {
     }
 }
 
+UNMAP_AFTER_INIT void smp_early_init(void) {
+    wrmsr(IA32_GS_BASE_MSR, (uint64_t) &boot_percpu);
+}
+
 UNMAP_AFTER_INIT void smp_init(void) {
     struct limine_smp_response* smp_response = smp_request.response;
     smp_cpu_count = smp_response->cpu_count;
+    bsp_lapic_id = smp_response->bsp_lapic_id;
 
     klog("[smp] %u processor%c detected\n", smp_cpu_count, (smp_cpu_count == 1 ? '\0' : 's'));
 
@@ -147,6 +165,7 @@ UNMAP_AFTER_INIT void smp_init(void) {
     void (*cpu_goto_fn)(struct limine_smp_info*) = nosmp ? hang : single_cpu_init;
 
     percpus = kmalloc(sizeof(struct percpu) * smp_cpu_count);
+    memset(percpus, 0, sizeof(struct percpu) * smp_cpu_count);
 
     for (size_t i = 0; i < smp_cpu_count; i++) {
         struct limine_smp_info* cpu = smp_response->cpus[i];
@@ -155,7 +174,7 @@ UNMAP_AFTER_INIT void smp_init(void) {
 
         percpus[i].self = &percpus[i];
         percpus[i].cpu_number = i;
-        percpus[i].lapic_id = i;
+        percpus[i].lapic_id = cpu->lapic_id;
 
         if (cpu->lapic_id != smp_response->bsp_lapic_id) {
             __atomic_store_n(&cpu->goto_address, cpu_goto_fn, __ATOMIC_SEQ_CST);
@@ -172,4 +191,5 @@ UNMAP_AFTER_INIT void smp_init(void) {
     }
 
     klog("[smp] initialized %u cpu%c\n", initialized_cpus, (initialized_cpus == 1 ? '\0' : 's'));
+    topology_link();
 }
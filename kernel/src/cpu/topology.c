@@ -0,0 +1,120 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <cpu/smp.h>
+#include <cpu/topology.h>
+#include <dev/acpi/srat.h>
+#include <mem/vmm.h>
+#include <utils/log.h>
+
+#define TOPOLOGY_LEVEL_INVALID  0
+#define TOPOLOGY_LEVEL_SMT      1
+
+/*
+ * Splits this CPU's x2APIC ID into its core and package, using the extended topology leaf 0x1f or
+ * its older version 0xb. The shift of a level gives the bits of the ID that lie below the next level
+ * up, the last level gives the bits below the package. Without either leaf, every CPU is taken to
+ * be its own core in a single package.
+ */
+UNMAP_AFTER_INIT void topology_cpu_init(struct percpu* percpu) {
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    uint32_t leaf = 0x1f;
+    if (!cpuid(leaf, 0, &eax, &ebx, &ecx, &edx) || ebx == 0) {
+        leaf = 0xb;
+        if (!cpuid(leaf, 0, &eax, &ebx, &ecx, &edx)) {
+            ebx = 0;
+        }
+    }
+
+    if (ebx != 0) {
+        uint32_t apic_id = edx;
+        uint32_t smt_shift = 0;
+        uint32_t package_shift = 0;
+
+        for (uint32_t level = 0; ; level++) {
+            cpuid(leaf, level, &eax, &ebx, &ecx, &edx);
+
+            uint32_t type = (ecx >> 8) & 0xff;
+            if (type == TOPOLOGY_LEVEL_INVALID) {
+                break;
+            }
+
+            if (type == TOPOLOGY_LEVEL_SMT) {
+                smt_shift = eax & 0x1f;
+            }
+            package_shift = eax & 0x1f;
+        }
+
+        percpu->core_id = apic_id >> smt_shift;
+        percpu->package_id = apic_id >> package_shift;
+        percpu->numa_node = srat_apic_node(apic_id);
+    } else {
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        percpu->core_id = ebx >> 24;
+        percpu->package_id = 0;
+        percpu->numa_node = srat_apic_node(ebx >> 24);
+    }
+
+    percpu->smt_next = percpu;
+}
+
+/* links the hardware threads of every core into a ring, once all CPUs are up, skipping those left halted */
+UNMAP_AFTER_INIT void topology_link(void) {
+    size_t cores = 0;
+    size_t packages = 0;
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (cpu->smt_next == NULL) {
+            continue;
+        }
+
+        struct percpu* first_sibling = NULL;
+        struct percpu* next_sibling = NULL;
+        bool new_package = true;
+
+        for (size_t j = 0; j < smp_cpu_count; j++) {
+            struct percpu* other = &percpus[j];
+            if (other->smt_next == NULL) {
+                continue;
+            }
+
+            if (other->package_id == cpu->package_id && j < i) {
+                new_package = false;
+            }
+
+            if (other->core_id != cpu->core_id) {
+                continue;
+            }
+
+            if (first_sibling == NULL) {
+                first_sibling = other;
+            }
+            if (next_sibling == NULL && j > i) {
+                next_sibling = other;
+            }
+        }
+
+        cpu->smt_next = next_sibling != NULL ? next_sibling : first_sibling;
+        cores += first_sibling == cpu;
+        packages += new_package;
+    }
+
+    klog("[smp] %u package%s, %u core%s\n", packages, packages == 1 ? "" : "s", cores, cores == 1 ? "" : "s");
+}
+
+size_t topology_distance(struct percpu* a, struct percpu* b) {
+    if (a == b) {
+        return CPU_DISTANCE_SAME;
+    }
+    if (a->core_id == b->core_id) {
+        return CPU_DISTANCE_SMT;
+    }
+    if (a->package_id == b->package_id) {
+        return CPU_DISTANCE_PACKAGE;
+    }
+    if (a->numa_node == b->numa_node) {
+        return CPU_DISTANCE_NODE;
+    }
+    return CPU_DISTANCE_REMOTE;
+}
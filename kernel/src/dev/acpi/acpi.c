@@ -1,5 +1,6 @@
 #include <dev/acpi/acpi.h>
 #include <dev/acpi/madt.h>
+#include <dev/acpi/srat.h>
 #include <limine.h>
 #include <mem/vmm.h>
 #include <utils/log.h>
@@ -95,4 +96,5 @@ UNMAP_AFTER_INIT void acpi_init(void) {
     }
 
     madt_init();
+    srat_init();
 }
@@ -0,0 +1,41 @@
+#include <dev/acpi/srat.h>
+#include <mem/vmm.h>
+#include <utils/log.h>
+
+READONLY_AFTER_INIT static struct srat* srat = NULL;
+
+UNMAP_AFTER_INIT void srat_init(void) {
+    srat = (struct srat*) acpi_find_sdt("SRAT");
+    if (srat == NULL) {
+        klog("[acpi] no SRAT, treating the system as a single NUMA node\n");
+    }
+}
+
+/* the proximity domain of a processor, 0 if the firmware does not tell */
+UNMAP_AFTER_INIT uint32_t srat_apic_node(uint32_t apic_id) {
+    if (srat == NULL) {
+        return 0;
+    }
+
+    for (uint8_t* entry_ptr = (uint8_t*) srat->entries; (uintptr_t) entry_ptr < (uintptr_t) srat + srat->length; entry_ptr += *(entry_ptr + 1)) {
+        struct srat_entry_header* entry = (struct srat_entry_header*) entry_ptr;
+        if (entry->length == 0) {
+            break;
+        }
+
+        if (entry->type == SRAT_LAPIC_ENTRY) {
+            struct srat_lapic* lapic = (struct srat_lapic*) entry;
+            if ((lapic->flags & SRAT_ENABLED) && lapic->apic_id == apic_id) {
+                return lapic->proximity_domain_low | (uint32_t) lapic->proximity_domain_high[0] << 8 |
+                    (uint32_t) lapic->proximity_domain_high[1] << 16 | (uint32_t) lapic->proximity_domain_high[2] << 24;
+            }
+        } else if (entry->type == SRAT_X2APIC_ENTRY) {
+            struct srat_x2apic* x2apic = (struct srat_x2apic*) entry;
+            if ((x2apic->flags & SRAT_ENABLED) && x2apic->x2apic_id == apic_id) {
+                return x2apic->proximity_domain;
+            }
+        }
+    }
+
+    return 0;
+}
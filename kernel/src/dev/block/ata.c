@@ -7,17 +7,19 @@
 #include <dev/lapic.h>
 #include <errno.h>
 #include <fs/devfs.h>
+#include <fs/page_cache.h>
 #include <mem/pmm.h>
 #include <mem/slab.h>
+#include <mem/vmm.h>
 #include <stdbool.h>
 #include <stddef.h>
-#include <sys/sched.h>
+#include <sys/mutex.h>
 #include <sys/time.h>
+#include <sys/wait_queue.h>
 #include <types.h>
 #include <utils/log.h>
 #include <utils/macros.h>
 #include <utils/panic.h>
-#include <utils/spinlock.h>
 #include <utils/string.h>
 
 #define ATA_ISA_IRQ0 14
@@ -86,7 +88,8 @@ struct ata_channel {
     bool awaiting_irq;
     bool dma_in_progress;
     bool error;
-    spinlock_t lock;
+    struct wait_queue dma_wait;
+    struct mutex lock;  /* held across whole transfers, which sleep until the device interrupts */
 };
 
 struct ata_device {
@@ -259,9 +262,9 @@ static void ata_channel_identify_device(struct ata_channel* channel, bool is_sec
         .st_size = sector_count * sector_size,
         .st_blksize = sector_size,
         .st_blocks = sector_count,
-        .st_atim = time_realtime,
-        .st_mtim = time_realtime,
-        .st_ctim = time_realtime,
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime(),
     };
 
     ata_node->private = device;
@@ -270,6 +273,10 @@ static void ata_channel_identify_device(struct ata_channel* channel, bool is_sec
     ata_node->write = ata_write;
     ata_node->sync = ata_sync;
 
+    if (device->type == ATA_DEVICE_TYPE_PATA || device->type == ATA_DEVICE_TYPE_SATA) {
+        page_cache_attach(ata_node);
+    }
+
     klog("[ata] %s device detected of size %uGB with %uB sectors (%s)\n",
             ata_device_type_names[device->type], total_size >> 30, sector_size, dma_supported ? "DMA mode" : "PIO mode");
 
@@ -281,9 +288,7 @@ static bool ata_channel_finish_dma(struct ata_channel* channel) {
         return true;
     }
 
-    while (channel->awaiting_irq) {
-        sched_yield();
-    }
+    wait_event(&channel->dma_wait, !__atomic_load_n(&channel->awaiting_irq, __ATOMIC_SEQ_CST));
 
     outb(channel->busmaster_base + ATA_BUSMASTER_REGISTER_COMMAND, 0);
     channel->dma_in_progress = false;
@@ -340,7 +345,7 @@ static bool ata_device_flush_cache(struct ata_device* device) {
     bool ret = false;
 
     struct ata_channel* channel = device->channel;
-    spinlock_acquire(&channel->lock);
+    mutex_acquire(&channel->lock);
 
     if (device->dma_supported) {
         if (!ata_channel_finish_dma(channel)) {
@@ -365,7 +370,7 @@ static bool ata_device_flush_cache(struct ata_device* device) {
 
     ret = true;
 end:
-    spinlock_release(&channel->lock);
+    mutex_release(&channel->lock);
     return ret;
 }
 
@@ -373,7 +378,7 @@ static bool ata_device_read_dma(struct ata_device* device, uint8_t* buf, size_t
     bool ret = false;
 
     struct ata_channel* channel = device->channel;
-    spinlock_acquire(&channel->lock);
+    mutex_acquire(&channel->lock);
 
     if (!ata_channel_finish_dma(channel)) {
         goto end;
@@ -414,7 +419,7 @@ static bool ata_device_read_dma(struct ata_device* device, uint8_t* buf, size_t
 
     ret = true;
 end:
-    spinlock_release(&channel->lock);
+    mutex_release(&channel->lock);
     return ret;
 }
 
@@ -422,7 +427,7 @@ static bool ata_device_write_dma(struct ata_device* device, const uint8_t* buf,
     bool ret = false;
 
     struct ata_channel* channel = device->channel;
-    spinlock_acquire(&channel->lock);
+    mutex_acquire(&channel->lock);
 
     if (!ata_channel_finish_dma(channel)) {
         goto end;
@@ -451,7 +456,7 @@ static bool ata_device_write_dma(struct ata_device* device, const uint8_t* buf,
 
     ret = true;
 end:
-    spinlock_release(&channel->lock);
+    mutex_release(&channel->lock);
     return ret;
 }
 
@@ -459,7 +464,7 @@ static bool ata_device_read_pio(struct ata_device* device, uint8_t* buf, size_t
     bool ret = false;
 
     struct ata_channel* channel = device->channel;
-    spinlock_acquire(&channel->lock);
+    mutex_acquire(&channel->lock);
 
     bool need_lba48 = ata_channel_set_sectors(channel, sector_count, lba, device->is_secondary);
 
@@ -482,7 +487,7 @@ static bool ata_device_read_pio(struct ata_device* device, uint8_t* buf, size_t
 
     ret = true;
 end:
-    spinlock_release(&channel->lock);
+    mutex_release(&channel->lock);
     return ret;
 }
 
@@ -490,7 +495,7 @@ static bool ata_device_write_pio(struct ata_device* device, const uint8_t* buf,
     bool ret = false;
 
     struct ata_channel* channel = device->channel;
-    spinlock_acquire(&channel->lock);
+    mutex_acquire(&channel->lock);
 
     bool need_lba48 = ata_channel_set_sectors(channel, sector_count, lba, device->is_secondary);
 
@@ -523,7 +528,7 @@ static bool ata_device_write_pio(struct ata_device* device, const uint8_t* buf,
 
     ret = true;
 end:
-    spinlock_release(&channel->lock);
+    mutex_release(&channel->lock);
     return ret;
 }
 
@@ -545,7 +550,8 @@ static void ata_irq_handler(struct registers* r, void* ctx) {
             channel->error = true;
         }
 
-        channel->awaiting_irq = false;
+        __atomic_store_n(&channel->awaiting_irq, false, __ATOMIC_SEQ_CST);
+        wait_queue_wake_all(&channel->dma_wait);
     }
 
     lapic_eoi();
@@ -699,7 +705,8 @@ static void ata_init(struct pci_device* dev) {
 
     pci_write_command_flags(dev, PCI_COMMAND_FLAG_BUSMASTER);
 
-    uintptr_t prdt_paddr = pmm_allocz(1);
+    /* the PRDT and the buffers are given to the controller as 32-bit addresses */
+    uintptr_t prdt_paddr = pmm_allocz_below(1, PMM_DMA32_LIMIT);
 
     struct ata_channel* channel0 = kmalloc(sizeof(struct ata_channel));
     if (unlikely(channel0 == NULL)) {
@@ -710,7 +717,11 @@ static void ata_init(struct pci_device* dev) {
     channel0->busmaster_base = busmaster_base;
     channel0->irq = ATA_ISA_IRQ0;
     channel0->prdt_paddr = prdt_paddr;
-    channel0->dma_area_paddr = pmm_allocz(1);
+    channel0->dma_area_paddr = pmm_allocz_below(1, PMM_DMA32_LIMIT);
+    channel0->awaiting_irq = false;
+    channel0->dma_in_progress = false;
+    channel0->dma_wait = (struct wait_queue) {0};
+    channel0->lock = (struct mutex) {0};
 
     struct ata_channel* channel1 = kmalloc(sizeof(struct ata_channel));
     if (unlikely(channel1 == NULL)) {
@@ -721,7 +732,11 @@ static void ata_init(struct pci_device* dev) {
     channel1->busmaster_base = busmaster_base + 8;
     channel1->irq = ATA_ISA_IRQ1;
     channel1->prdt_paddr = prdt_paddr + 8;
-    channel1->dma_area_paddr = pmm_allocz(1);
+    channel1->dma_area_paddr = pmm_allocz_below(1, PMM_DMA32_LIMIT);
+    channel1->awaiting_irq = false;
+    channel1->dma_in_progress = false;
+    channel1->dma_wait = (struct wait_queue) {0};
+    channel1->lock = (struct mutex) {0};
 
     software_reset_channel(channel0);
     software_reset_channel(channel1);
@@ -133,9 +133,9 @@ static void enum_gpt(struct vfs_node* device_node, struct gpt_header* gpt_header
             .st_size = sector_count * device_node->stat.st_blksize,
             .st_blksize = device_node->stat.st_blksize,
             .st_blocks = sector_count,
-            .st_atim = time_realtime,
-            .st_mtim = time_realtime,
-            .st_ctim = time_realtime,
+            .st_atim = time_get_realtime(),
+            .st_mtim = time_get_realtime(),
+            .st_ctim = time_get_realtime(),
         };
 
         partition_node->private = metadata;
@@ -196,9 +196,9 @@ static void enum_mbr(struct vfs_node* device_node) {
             .st_size = entry->sector_count * device_node->stat.st_blksize,
             .st_blksize = device_node->stat.st_blksize,
             .st_blocks = entry->sector_count,
-            .st_atim = time_realtime,
-            .st_mtim = time_realtime,
-            .st_ctim = time_realtime,
+            .st_atim = time_get_realtime(),
+            .st_mtim = time_get_realtime(),
+            .st_ctim = time_get_realtime(),
         };
 
         partition_node->private = metadata;
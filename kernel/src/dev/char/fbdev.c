@@ -4,6 +4,7 @@
 #include <fs/vfs.h>
 #include <limine.h>
 #include <mem/slab.h>
+#include <mem/vmm.h>
 #include <sys/time.h>
 #include <types.h>
 #include <utils/log.h>
@@ -97,7 +98,9 @@ static ssize_t fbdev_read(struct vfs_node* node, void* buf, off_t offset, size_t
         count = size - offset;
     }
 
-    memcpy(buf, (void*) ((uintptr_t) fb_info->framebuffer->address + offset), count);
+    if (!user_copy(buf, (void*) ((uintptr_t) fb_info->framebuffer->address + offset), count)) {
+        return -EFAULT;
+    }
     return count;
 }
 
@@ -119,10 +122,26 @@ static ssize_t fbdev_write(struct vfs_node* node, const void* buf, off_t offset,
         count = size - offset;
     }
 
-    memcpy((void*) ((uintptr_t) fb_info->framebuffer->address + offset), buf, count);
+    if (!user_copy((void*) ((uintptr_t) fb_info->framebuffer->address + offset), buf, count)) {
+        return -EFAULT;
+    }
     return count;
 }
 
+static int fbdev_mmap(struct vfs_node* node, off_t offset, uintptr_t* paddr) {
+    struct fb_info* fb_info = node->private;
+
+    if ((size_t) offset >= ALIGN_UP(fb_info->fixed.smem_len, PAGE_SIZE)) {
+        return -EINVAL;
+    }
+
+    if (paddr != NULL) {
+        *paddr = (uintptr_t) fb_info->framebuffer->address - HIGH_VMA + offset;
+    }
+
+    return 0;
+}
+
 static int fbdev_ioctl(struct vfs_node* node, uint64_t request, void* argp) {
     struct fb_info* fb_info = node->private;
 
@@ -164,9 +183,9 @@ UNMAP_AFTER_INIT void fbdev_init(void) {
         .st_dev = makedev(0, 1),
         .st_mode = S_IFCHR,
         .st_blksize = 4096,
-        .st_atim = time_realtime,
-        .st_mtim = time_realtime,
-        .st_ctim = time_realtime
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime()
     };
 
     for (size_t i = 0; i < framebuffer_response->framebuffer_count; i++) {
@@ -199,6 +218,7 @@ UNMAP_AFTER_INIT void fbdev_init(void) {
 
         strncpy(fb_info->fixed.id, "LIMINE FB", sizeof(fb_info->fixed.id));
         fb_info->fixed.smem_len = fb_info->fixed.mmio_len = framebuffer->pitch * framebuffer->height;
+        fb_info->fixed.smem_start = (uintptr_t) framebuffer->address - HIGH_VMA;
         fb_info->fixed.type = 0;
         fb_info->fixed.visual = 2;
         fb_info->fixed.line_length = framebuffer->pitch;
@@ -220,5 +240,6 @@ UNMAP_AFTER_INIT void fbdev_init(void) {
         fbdev_node->read = fbdev_read;
         fbdev_node->write = fbdev_write;
         fbdev_node->ioctl = fbdev_ioctl;
+        fbdev_node->mmap = fbdev_mmap;
     }
 }
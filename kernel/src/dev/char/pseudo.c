@@ -9,6 +9,10 @@
 #include <utils/panic.h>
 #include <utils/random.h>
 #include <utils/string.h>
+#include <utils/user_access.h>
+
+/* random bytes go through a buffer on the stack, as the generator holds its lock while filling it */
+#define PSEUDO_RANDOM_CHUNK 256
 
 static ssize_t pseudo_read(struct vfs_node* node, void* buf, off_t offset, size_t count, int flags) {
     (void) offset;
@@ -22,12 +26,21 @@ static ssize_t pseudo_read(struct vfs_node* node, void* buf, off_t offset, size_
             break;
         case PSEUDO_ZERO_MIN:
         case PSEUDO_FULL_MIN:
-            memset(buf, 0, count);
-            read = count;
+            read = user_fill(buf, 0, count) ? (ssize_t) count : -EFAULT;
             break;
         case PSEUDO_RANDOM_MIN:
-            rng_rand_fill((struct rng_state*) node->private, buf, count);
-            read = count;
+            read = 0;
+            while ((size_t) read < count) {
+                uint8_t chunk[PSEUDO_RANDOM_CHUNK];
+                size_t chunk_size = MIN(count - read, sizeof(chunk));
+                rng_rand_fill((struct rng_state*) node->private, chunk, chunk_size);
+
+                if (unlikely(!user_copy((uint8_t*) buf + read, chunk, chunk_size))) {
+                    read = read != 0 ? read : -EFAULT;
+                    break;
+                }
+                read += chunk_size;
+            }
             break;
     }
 
@@ -62,9 +75,9 @@ UNMAP_AFTER_INIT void pseudo_init(void) {
         .st_size = 0,
         .st_blksize = 4096,
         .st_blocks = 0,
-        .st_atim = time_realtime,
-        .st_mtim = time_realtime,
-        .st_ctim = time_realtime
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime()
     };
 
     struct vfs_node* null_node = devfs_create_device("null");
@@ -13,6 +13,8 @@
 #include <utils/user_access.h>
 #include "flanterm/backends/fb.h"
 
+#define TTY_WRITE_CHUNK 256
+
 extern volatile struct limine_framebuffer_request framebuffer_request;
 
 struct tty* active_tty;
@@ -48,6 +50,13 @@ static inline bool pass_to_canon_buf(struct termios* attr, char c) {
 	return true;
 }
 
+/* echoing readers and writers may print at the same time */
+static void tty_output(struct tty* tty, const char* buf, size_t count) {
+    spinlock_acquire(&tty->output_lock);
+    flanterm_write((struct flanterm_context*) tty->private, buf, count);
+    spinlock_release(&tty->output_lock);
+}
+
 static void do_echo(struct tty* tty, char c) {
     if (!(tty->attr.c_lflag & ECHO)) {
         return;
@@ -59,11 +68,11 @@ static void do_echo(struct tty* tty, char c) {
         }
 
         char aux[2] = { '^', c + 64 };
-        flanterm_write((struct flanterm_context*) tty->private, aux, sizeof(aux));
+        tty_output(tty, aux, sizeof(aux));
         return;
     }
 
-    flanterm_write((struct flanterm_context*) tty->private, &c, sizeof(char));
+    tty_output(tty, &c, sizeof(char));
 }
 
 static void* flanterm_alloc(size_t size) {
@@ -82,11 +91,15 @@ static ssize_t tty_handle_canon(struct tty* tty, void* buf, size_t count) {
 
 out:
         if (ringbuf_peek(tty->canon_buf, &line_buf)) {
+            char out;
             for (ret = 0; ret < (ssize_t) count; ret++) {
-                if (!ringbuf_pop(line_buf, c_buf)) {
+                if (!ringbuf_pop(line_buf, &out)) {
+                    break;
+                }
+                if (unlikely(!user_copy(c_buf++, &out, 1))) {
+                    ret = ret != 0 ? ret : -EFAULT;
                     break;
                 }
-                c_buf++;
             }
 
             if (line_buf->size == 0) {
@@ -104,6 +117,8 @@ out:
         ringbuf_push(tty->canon_buf, &line_buf);
 
         while (1) {
+            wait_event(&tty->input_wait, tty->input_buf->size != 0);
+
             while (ringbuf_pop(tty->input_buf, &ch)) {
                 if (ignore_char(&tty->attr, ch)) {
                     continue;
@@ -125,7 +140,7 @@ out:
                     if (items) {
                         items--;
                         char aux2[] = {'\b', ' ', '\b'};
-                        flanterm_write((struct flanterm_context*) tty->private, aux2, sizeof(aux2));
+                        tty_output(tty, aux2, sizeof(aux2));
                         ringbuf_pop_tail(line_buf, &aux);
                     }
                 }
@@ -135,6 +150,28 @@ out:
         goto out;
 }
 
+/* takes up to count characters from the input buffer, without waiting or line editing */
+static ssize_t tty_read_raw(struct tty* tty, char* buf, size_t count) {
+    ssize_t ret = 0;
+    char ch;
+
+    while ((size_t) ret < count && ringbuf_pop(tty->input_buf, &ch)) {
+        if (ignore_char(&tty->attr, ch)) {
+            continue;
+        }
+
+        ch = translate_char(&tty->attr, ch);
+        do_echo(tty, ch);
+
+        if (unlikely(!user_copy(buf + ret, &ch, 1))) {
+            return ret != 0 ? ret : -EFAULT;
+        }
+        ret++;
+    }
+
+    return ret;
+}
+
 static ssize_t tty_read(struct vfs_node* node, void* buf, off_t offset, size_t count, int flags) {
     (void) offset;
     (void) flags;
@@ -142,7 +179,8 @@ static ssize_t tty_read(struct vfs_node* node, void* buf, off_t offset, size_t c
     ssize_t ret = 0;
 
     struct tty* tty = node->private;
-    char* c_buf = buf;
+
+    mutex_acquire(&tty->read_lock);
 
     if (tty->attr.c_lflag & ICANON) {
         ret = tty_handle_canon(tty, buf, count);
@@ -151,44 +189,16 @@ static ssize_t tty_read(struct vfs_node* node, void* buf, off_t offset, size_t c
         cc_t time = tty->attr.c_cc[VTIME];
 
         if (min == 0 && time == 0) {
-            if (tty->input_buf->size != 0) {
-                for (ssize_t i = 0; i < (ssize_t) count; i++) {
-                    if (!ringbuf_pop(tty->input_buf, c_buf)) {
-                        break;
-                    }
-
-                    if (ignore_char(&tty->attr, *c_buf)) {
-                        continue;
-                    }
-
-                    *c_buf = translate_char(&tty->attr, *c_buf);
-                    do_echo(tty, *c_buf++);
-                    ret++;
-                }
-            }
+            ret = tty_read_raw(tty, buf, count);
         } else if (min > 0 && time == 0) {
-            while (tty->input_buf->size < min) {
-                pause();
-            }
-
-            for (ssize_t i = 0; i < (ssize_t) count; i++) {
-                if (!ringbuf_pop(tty->input_buf, c_buf)) {
-                    break;
-                }
-
-                if (ignore_char(&tty->attr, *c_buf)) {
-                    continue;
-                }
-
-                *c_buf = translate_char(&tty->attr, *c_buf);
-                do_echo(tty, *c_buf++);
-                ret++;
-            }
+            wait_event(&tty->input_wait, tty->input_buf->size >= min);
+            ret = tty_read_raw(tty, buf, count);
         } else {
             ret = -1;
         }
     }
 
+    mutex_release(&tty->read_lock);
     return ret;
 }
 
@@ -197,7 +207,19 @@ static ssize_t tty_write(struct vfs_node* node, const void* buf, off_t offset, s
     (void) flags;
 
     struct tty* tty = node->private;
-    flanterm_write((struct flanterm_context*) tty->private, buf, count);
+
+    /* the terminal holds its output lock while printing, so it only ever sees a copy */
+    char chunk[TTY_WRITE_CHUNK];
+    for (size_t done = 0; done < count;) {
+        size_t chunk_size = MIN(count - done, sizeof(chunk));
+        if (unlikely(!user_copy(chunk, (const char*) buf + done, chunk_size))) {
+            return done != 0 ? (ssize_t) done : -EFAULT;
+        }
+
+        tty_output(tty, chunk, chunk_size);
+        done += chunk_size;
+    }
+
     return count;
 }
 
@@ -246,6 +268,10 @@ UNMAP_AFTER_INIT void tty_init(void) {
         kpanic(NULL, false ,"failed to create tty input buffer");
     }
 
+    tty->input_wait = (struct wait_queue) {0};
+    tty->read_lock = (struct mutex) {0};
+    tty->output_lock = (spinlock_t) {0};
+
     tty->canon_buf = ringbuf_create(256, sizeof(ringbuf_t*));
     if (unlikely(tty->canon_buf == NULL)) {
         kpanic(NULL, false, "failed to create tty canonical line buffer");
@@ -298,9 +324,9 @@ UNMAP_AFTER_INIT void tty_init(void) {
         .st_size = 0,
         .st_blksize = 4096,
         .st_blocks = 0,
-        .st_atim = time_realtime,
-        .st_mtim = time_realtime,
-        .st_ctim = time_realtime,
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime(),
     };
 
     tty_node->private = tty;
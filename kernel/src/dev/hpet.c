@@ -43,6 +43,12 @@ uint64_t hpet_count(void) {
     return hpet_read(HPET_COUNT);
 }
 
+/* nanoseconds since the HPET was started, split up so that it does not overflow for centuries */
+uint64_t hpet_ns(void) {
+    uint64_t count = hpet_read(HPET_COUNT);
+    return (count / 1000000) * hpet_clock_period + (count % 1000000) * hpet_clock_period / 1000000;
+}
+
 void hpet_sleep_ms(uint64_t ms) {
     uint64_t target = hpet_read(HPET_COUNT) + (ms * 1000000000000) / hpet_clock_period;
     while (hpet_read(HPET_COUNT) < target) {
@@ -3,7 +3,9 @@
 #include <dev/acpi/madt.h>
 #include <dev/hpet.h>
 #include <dev/lapic.h>
+#include <dev/tsc.h>
 #include <mem/vmm.h>
+#include <sys/time.h>
 #include <utils/macros.h>
 #include <utils/panic.h>
 
@@ -30,6 +32,10 @@
 #define LAPIC_REG_TIMER_DIV     0x3e0
 
 #define LAPIC_IRQ_MASK          0x10000
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+
+/* keeps the one-shot tick count computation from overflowing */
+#define LAPIC_TIMER_MAX_NS      1000000000000ul
 
 static uint32_t lapic_read(uint32_t reg) {
     return *((volatile uint32_t*) (madt_lapic_addr + HIGH_VMA + reg));
@@ -87,16 +93,33 @@ void lapic_send_ipi(uint32_t lapic_id, uint8_t vector) {
     lapic_write(LAPIC_REG_ICR0, vector | (1 << 14));
 }
 
-void lapic_timer_oneshot(uint8_t vector, uint64_t us) {
+/*
+ * Fires vector once, when the time_ns clock reaches deadline, or right away if it already did. With
+ * TSC-deadline mode the deadline is exact, otherwise it is turned into a one-shot countdown, which is
+ * clamped to what the 32-bit counter can hold and fires early for far away deadlines.
+ */
+void lapic_timer_deadline(uint8_t vector, uint64_t deadline) {
     bool prev_int = interrupt_state();
     cli();
 
-    lapic_timer_stop();
+    struct percpu* self = this_cpu();
+    self->timer_deadline = deadline;
+
+    if (tsc_deadline_supported) {
+        lapic_write(LAPIC_REG_LVT_TIMER, vector | LAPIC_TIMER_TSC_DEADLINE);
+
+        /* the LVT write has to land before the MSR write, which is not ordered with MMIO */
+        __asm__ volatile ("mfence; lfence" ::: "memory");
+        wrmsr(IA32_TSC_DEADLINE_MSR, MAX(tsc_from_ns(deadline), 1));
+    } else {
+        uint64_t now = time_ns();
+        uint64_t delta = MIN(deadline > now ? deadline - now : 0, LAPIC_TIMER_MAX_NS);
+        uint64_t ticks = delta * (self->lapic_frequency / 1000) / 1000000;
 
-    uint64_t ticks = us * (this_cpu()->lapic_frequency / 1000000);
-    lapic_write(LAPIC_REG_LVT_TIMER, vector);
-    lapic_write(LAPIC_REG_TIMER_DIV, 0);
-    lapic_write(LAPIC_REG_TIMER_INITCNT, ticks);
+        lapic_write(LAPIC_REG_LVT_TIMER, vector);
+        lapic_write(LAPIC_REG_TIMER_DIV, 0);
+        lapic_write(LAPIC_REG_TIMER_INITCNT, MAX(MIN(ticks, 0xffffffff), 1));
+    }
 
     if (prev_int) {
         sti();
@@ -104,8 +127,13 @@ void lapic_timer_oneshot(uint8_t vector, uint64_t us) {
 }
 
 void lapic_timer_stop(void) {
+    if (tsc_deadline_supported) {
+        wrmsr(IA32_TSC_DEADLINE_MSR, 0);
+    }
+
     lapic_write(LAPIC_REG_TIMER_INITCNT, 0);
-    lapic_write(LAPIC_REG_LVT_TIMER, 0x10000);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_IRQ_MASK);
+    this_cpu()->timer_deadline = UINT64_MAX;
 }
 
 UNMAP_AFTER_INIT void lapic_init(uint32_t lapic_id) {
@@ -9,6 +9,7 @@
 #include <mem/slab.h>
 #include <mem/vmm.h>
 #include <sys/time.h>
+#include <sys/wait_queue.h>
 #include <types.h>
 #include <utils/panic.h>
 #include <utils/ringbuf.h>
@@ -102,6 +103,7 @@ static void keyboard_irq_handler(struct registers* r, void* ctx) {
     char c = translate_keyboard_scancode(scancode);
     if (c != '\0') {
         ringbuf_push(active_tty->input_buf, &c);
+        wait_queue_wake_all(&active_tty->input_wait);
     }
 
     uint8_t new_led_state = led_state;
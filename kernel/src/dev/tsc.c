@@ -0,0 +1,72 @@
+#include <cpu/asm.h>
+#include <dev/hpet.h>
+#include <dev/tsc.h>
+#include <mem/vmm.h>
+#include <utils/log.h>
+
+#define TSC_CALIBRATION_MS  10
+
+/* fixed point factors between TSC cycles and nanoseconds, with TSC_SCALE_SHIFT fractional bits */
+#define TSC_SCALE_SHIFT     24
+#define TSC_SCALE_MASK      ((1ul << TSC_SCALE_SHIFT) - 1)
+
+READONLY_AFTER_INIT bool tsc_invariant = false;
+READONLY_AFTER_INIT bool tsc_deadline_supported = false;
+READONLY_AFTER_INIT uint64_t tsc_frequency = 0;
+
+/* the TSC value at which the time_ns clock read tsc_base_ns, so it carries on from the HPET */
+READONLY_AFTER_INIT static uint64_t tsc_base;
+READONLY_AFTER_INIT static uint64_t tsc_base_ns;
+READONLY_AFTER_INIT static uint64_t ns_per_cycle;
+READONLY_AFTER_INIT static uint64_t cycles_per_ns;
+
+/* split up so that neither product overflows for years of uptime */
+static inline uint64_t scale(uint64_t value, uint64_t factor) {
+    return (value >> TSC_SCALE_SHIFT) * factor + (((value & TSC_SCALE_MASK) * factor) >> TSC_SCALE_SHIFT);
+}
+
+/* nanoseconds since boot for a TSC value */
+uint64_t tsc_to_ns(uint64_t tsc) {
+    return tsc_base_ns + scale(tsc - tsc_base, ns_per_cycle);
+}
+
+uint64_t tsc_from_ns(uint64_t ns) {
+    return ns > tsc_base_ns ? tsc_base + scale(ns - tsc_base_ns, cycles_per_ns) : tsc_base;
+}
+
+/*
+ * The TSC is only used for timekeeping if it is invariant, i.e. ticks at a constant rate regardless of
+ * power states. Firmware starts it in sync on all CPUs, so one calibration against the HPET holds for
+ * every CPU.
+ */
+UNMAP_AFTER_INIT void tsc_init(void) {
+    uint32_t ecx = 0, edx = 0, unused;
+
+    if (cpuid(0x80000007, 0, &unused, &unused, &unused, &edx)) {
+        tsc_invariant = edx & (1 << 8);
+    }
+
+    if (!tsc_invariant) {
+        klog("[tsc] TSC is not invariant, using the HPET for timekeeping\n");
+        return;
+    }
+
+    uint64_t hpet_start = hpet_ns();
+    uint64_t tsc_start = rdtsc();
+    hpet_sleep_ms(TSC_CALIBRATION_MS);
+    uint64_t tsc_end = rdtsc();
+    uint64_t hpet_end = hpet_ns();
+
+    tsc_frequency = (tsc_end - tsc_start) * 1000000000 / (hpet_end - hpet_start);
+    tsc_base = tsc_end;
+    tsc_base_ns = hpet_end;
+    ns_per_cycle = (1000000000ul << TSC_SCALE_SHIFT) / tsc_frequency;
+    cycles_per_ns = (tsc_frequency << TSC_SCALE_SHIFT) / 1000000000;
+
+    if (cpuid(1, 0, &unused, &unused, &ecx, &unused)) {
+        tsc_deadline_supported = ecx & (1 << 24);
+    }
+
+    klog("[tsc] initialized tsc: frequency: %lu kHz, deadline mode: %s\n",
+            tsc_frequency / 1000, tsc_deadline_supported ? "yes" : "no");
+}
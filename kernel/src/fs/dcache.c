@@ -0,0 +1,230 @@
+#include <cpu/asm.h>
+#include <fs/dcache.h>
+#include <fs/vfs.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
+#include <utils/hashmap.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/spinlock.h>
+#include <utils/string.h>
+
+#define DCACHE_BUCKETS  1024
+#define DCACHE_ENTRIES  4096
+#define DCACHE_NAME_MAX 32      /* longer names are always looked up in the directory itself */
+
+/*
+ * Caches the results of looking up names in directories, including names that do not exist. Entries
+ * come from a fixed pool and are only ever recycled, never freed, and chains link them by index, so
+ * a lookup can walk a bucket without any lock while it is being changed. Every bucket has a sequence
+ * count that is odd while it is being changed, lookups that saw it change start over. Changes are
+ * serialized by a single lock, they only happen on misses and when directories gain entries.
+ */
+struct dcache_entry {
+    struct vfs_node* dir;
+    struct vfs_node* node;  /* NULL for a name that does not exist */
+    uint32_t hash;
+    uint32_t next;          /* index of the next entry in the bucket plus one, 0 ends it */
+    uint8_t name_len;
+    bool referenced;        /* set by lookups, cleared as the clock hand passes it */
+    char name[DCACHE_NAME_MAX];
+};
+
+struct dcache_bucket {
+    uint32_t seq;
+    uint32_t head;
+};
+
+READONLY_AFTER_INIT static struct dcache_entry* dcache_entries;
+READONLY_AFTER_INIT static struct dcache_bucket* dcache_buckets;
+static spinlock_t dcache_lock = {0};
+static size_t dcache_clock_hand = 0;
+
+static inline struct dcache_bucket* dcache_bucket(struct vfs_node* dir, uint32_t hash) {
+    uint32_t dir_hash = (uint32_t) ((uintptr_t) dir >> 6) * 0x9e3779b1u;
+    return &dcache_buckets[(hash ^ dir_hash) % DCACHE_BUCKETS];
+}
+
+/* changes to a bucket, called with dcache_lock held */
+static inline void dcache_write_begin(struct dcache_bucket* bucket) {
+    __atomic_store_n(&bucket->seq, bucket->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void dcache_write_end(struct dcache_bucket* bucket) {
+    __atomic_store_n(&bucket->seq, bucket->seq + 1, __ATOMIC_RELEASE);
+}
+
+static struct dcache_entry* dcache_find(struct dcache_bucket* bucket, struct vfs_node* dir, const char* name,
+        size_t len, uint32_t hash) {
+    uint32_t index = __atomic_load_n(&bucket->head, __ATOMIC_RELAXED);
+
+    /* a chain that is changed meanwhile may loop, the walk is cut short and retried then */
+    for (size_t steps = 0; index != 0 && steps < DCACHE_ENTRIES; steps++) {
+        struct dcache_entry* entry = &dcache_entries[index - 1];
+        if (entry->hash == hash && entry->dir == dir && entry->name_len == len && memcmp(entry->name, name, len) == 0) {
+            return entry;
+        }
+        index = __atomic_load_n(&entry->next, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static void dcache_unlink(struct dcache_entry* entry) {
+    struct dcache_bucket* bucket = dcache_bucket(entry->dir, entry->hash);
+    uint32_t index = entry - dcache_entries + 1;
+
+    dcache_write_begin(bucket);
+    if (bucket->head == index) {
+        __atomic_store_n(&bucket->head, entry->next, __ATOMIC_RELAXED);
+    } else {
+        struct dcache_entry* prev = &dcache_entries[bucket->head - 1];
+        while (prev->next != index) {
+            prev = &dcache_entries[prev->next - 1];
+        }
+        __atomic_store_n(&prev->next, entry->next, __ATOMIC_RELAXED);
+    }
+    dcache_write_end(bucket);
+
+    entry->dir = NULL;
+}
+
+/* unused entries first, then whatever was not looked up since the clock hand last came by */
+static struct dcache_entry* dcache_evict(void) {
+    for (;;) {
+        struct dcache_entry* entry = &dcache_entries[dcache_clock_hand];
+        dcache_clock_hand = (dcache_clock_hand + 1) % DCACHE_ENTRIES;
+
+        if (entry->dir == NULL) {
+            return entry;
+        }
+
+        if (entry->referenced) {
+            entry->referenced = false;
+            continue;
+        }
+
+        dcache_unlink(entry);
+        return entry;
+    }
+}
+
+/* called with dcache_lock held, an entry already there is updated in place */
+static void dcache_insert(struct vfs_node* dir, const char* name, size_t len, uint32_t hash, struct vfs_node* node) {
+    if (len > DCACHE_NAME_MAX) {
+        return;
+    }
+
+    struct dcache_bucket* bucket = dcache_bucket(dir, hash);
+
+    struct dcache_entry* entry = dcache_find(bucket, dir, name, len, hash);
+    if (entry != NULL) {
+        dcache_write_begin(bucket);
+        entry->node = node;
+        dcache_write_end(bucket);
+        return;
+    }
+
+    entry = dcache_evict();
+
+    dcache_write_begin(bucket);
+    entry->dir = dir;
+    entry->node = node;
+    entry->hash = hash;
+    entry->name_len = len;
+    entry->referenced = false;
+    memcpy(entry->name, name, len);
+    entry->next = bucket->head;
+    __atomic_store_n(&bucket->head, entry - dcache_entries + 1, __ATOMIC_RELAXED);
+    dcache_write_end(bucket);
+}
+
+/* directories may be resized as entries are added, so they are only looked at with their lock held */
+static struct vfs_node* dcache_lookup_slow(struct vfs_node* dir, const char* name, size_t len) {
+    spinlock_acquire(&dir->lock);
+    struct vfs_node* node = hashmap_get(dir->children, name, len);
+    spinlock_release(&dir->lock);
+    return node;
+}
+
+/*
+ * Looks up a name of the given length and hash in a directory, NULL if there is no such entry. Misses
+ * go to the directory with the lock held, so that the result cannot race with the name being added.
+ */
+struct vfs_node* dcache_lookup(struct vfs_node* dir, const char* name, size_t len, uint32_t hash) {
+    if (len > DCACHE_NAME_MAX) {
+        return dcache_lookup_slow(dir, name, len);
+    }
+
+    struct dcache_bucket* bucket = dcache_bucket(dir, hash);
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            pause();
+            continue;
+        }
+
+        struct dcache_entry* entry = dcache_find(bucket, dir, name, len, hash);
+        struct vfs_node* node = entry != NULL ? entry->node : NULL;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&bucket->seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+
+        if (entry == NULL) {
+            break;
+        }
+
+        if (!entry->referenced) {
+            entry->referenced = true;
+        }
+        return node;
+    }
+
+    spinlock_acquire(&dcache_lock);
+    struct vfs_node* node = dcache_lookup_slow(dir, name, len);
+    dcache_insert(dir, name, len, hash, node);
+    spinlock_release(&dcache_lock);
+
+    return node;
+}
+
+/* called once a node was added to a directory, replacing the entry of a name that did not exist */
+void dcache_add(struct vfs_node* dir, const char* name, struct vfs_node* node) {
+    size_t len = 0;
+    uint32_t hash = DCACHE_HASH_INIT;
+    while (name[len] != '\0') {
+        hash = dcache_hash_step(hash, name[len++]);
+    }
+
+    spinlock_acquire(&dcache_lock);
+    dcache_insert(dir, name, len, hash, node);
+    spinlock_release(&dcache_lock);
+}
+
+/* forgets a node that goes away, both as a directory and as an entry, so its address can be reused */
+void dcache_purge(struct vfs_node* node) {
+    spinlock_acquire(&dcache_lock);
+    for (size_t i = 0; i < DCACHE_ENTRIES; i++) {
+        struct dcache_entry* entry = &dcache_entries[i];
+        if (entry->dir != NULL && (entry->dir == node || entry->node == node)) {
+            dcache_unlink(entry);
+        }
+    }
+    spinlock_release(&dcache_lock);
+}
+
+UNMAP_AFTER_INIT void dcache_init(void) {
+    dcache_entries = kmalloc(DCACHE_ENTRIES * sizeof(struct dcache_entry));
+    dcache_buckets = kmalloc(DCACHE_BUCKETS * sizeof(struct dcache_bucket));
+    if (unlikely(dcache_entries == NULL || dcache_buckets == NULL)) {
+        kpanic(NULL, false, "failed to allocate the dentry cache");
+    }
+
+    memset(dcache_entries, 0, DCACHE_ENTRIES * sizeof(struct dcache_entry));
+    memset(dcache_buckets, 0, DCACHE_BUCKETS * sizeof(struct dcache_bucket));
+}
@@ -2,10 +2,8 @@
 #include <fs/vfs.h>
 #include <mem/vmm.h>
 #include <sys/time.h>
-#include <utils/hashmap.h>
 #include <utils/macros.h>
 #include <utils/panic.h>
-#include <utils/spinlock.h>
 #include <utils/string.h>
 
 READONLY_AFTER_INIT static struct vfs_filesystem devfs = {0};
@@ -28,9 +26,7 @@ struct vfs_node* devfs_create_device(const char* name) {
         kpanic(NULL, false, "failed to create devfs node");
     }
 
-    spinlock_acquire(&devfs_root->lock);
-    hashmap_set(devfs_root->children, dev_node->name, strlen(dev_node->name), dev_node);
-    spinlock_release(&devfs_root->lock);
+    vfs_add_child(devfs_root, dev_node);
     return dev_node;
 }
 
@@ -43,9 +39,9 @@ UNMAP_AFTER_INIT void devfs_init(void) {
         .st_size = 0,
         .st_blksize = 4096,
         .st_blocks = 0,
-        .st_atim = time_realtime,
-        .st_mtim = time_realtime,
-        .st_ctim = time_realtime
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime()
     };
 
     vfs_register_filesystem("devfs", devfs_mount);
@@ -0,0 +1,631 @@
+#include <cpu/asm.h>
+#include <errno.h>
+#include <fs/page_cache.h>
+#include <fs/vfs.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
+#include <sys/mutex.h>
+#include <sys/process.h>
+#include <sys/sched.h>
+#include <sys/time.h>
+#include <sys/wait_queue.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/spinlock.h>
+#include <utils/string.h>
+#include <utils/user_access.h>
+
+#define PAGE_CACHE_MIN_BUCKETS  1024
+
+/*
+ * Pages of block devices, found by device and page index, so that reading what was read before is a
+ * copy rather than a trip to the disk, and writes only reach the disk once the device is synced or
+ * their page is evicted. Partitions go through the cache of their disk, so both see the same data.
+ *
+ * The hash table, the clock list and the state of every page are guarded by a single lock, which is
+ * never held across a copy or the disk. Copies pin their page instead, which keeps it in place, and
+ * reading pages in or writing them back is serialized by a sleeping lock of their device.
+ *
+ * A flusher thread writes dirty pages back periodically, and writers that dirty more than a share of
+ * memory write back their device themselves, so that reclaim always finds clean pages to free.
+ */
+struct cached_page {
+    struct page_cache_device* device;
+    uint64_t index;
+    uintptr_t paddr;
+    struct cached_page* hash_next;
+    struct cached_page* clock_prev;
+    struct cached_page* clock_next;
+    uint32_t pins;
+    bool dirty;
+    bool referenced;    /* set by every use, cleared as the clock hand passes it */
+};
+
+struct page_cache_device {
+    struct vfs_node* node;
+    struct page_cache_device* next;
+    struct mutex lock;
+    size_t dirty_pages;
+
+    /* the callbacks of the device itself, which take whole sectors */
+    ssize_t (*read)(struct vfs_node*, void*, off_t, size_t, int);
+    ssize_t (*write)(struct vfs_node*, const void*, off_t, size_t, int);
+    int (*sync)(struct vfs_node*);
+};
+
+READONLY_AFTER_INIT static struct cached_page** page_cache_buckets;
+READONLY_AFTER_INIT static size_t page_cache_bucket_count;
+static spinlock_t page_cache_lock = {0};
+static struct cached_page* page_cache_hand = NULL;
+static struct cached_page* page_cache_unused = NULL;   /* descriptors of reclaimed pages, for reuse */
+static struct page_cache_stats page_cache_stats = {0};
+static struct page_cache_device* page_cache_devices = NULL;   /* only ever added to */
+READONLY_AFTER_INIT static size_t page_cache_dirty_limit;
+static struct wait_queue page_cache_flusher_wait = {0};
+static bool page_cache_flusher_started = false;
+
+static inline struct cached_page** page_cache_bucket(struct page_cache_device* device, uint64_t index) {
+    uint64_t hash = ((uintptr_t) device >> 6) * 0x9e3779b97f4a7c15ul ^ index * 0xff51afd7ed558ccdul;
+    return &page_cache_buckets[(hash ^ (hash >> 32)) & (page_cache_bucket_count - 1)];
+}
+
+/* everything below up to page_cache_pin is called with page_cache_lock held */
+static struct cached_page* page_cache_find(struct page_cache_device* device, uint64_t index) {
+    for (struct cached_page* page = *page_cache_bucket(device, index); page != NULL; page = page->hash_next) {
+        if (page->device == device && page->index == index) {
+            return page;
+        }
+    }
+    return NULL;
+}
+
+/* new pages go in right behind the clock hand, so they are the last it comes by */
+static void page_cache_insert(struct cached_page* page) {
+    struct cached_page** bucket = page_cache_bucket(page->device, page->index);
+    page->hash_next = *bucket;
+    *bucket = page;
+
+    if (page_cache_hand == NULL) {
+        page->clock_prev = page;
+        page->clock_next = page;
+        page_cache_hand = page;
+    } else {
+        page->clock_next = page_cache_hand;
+        page->clock_prev = page_cache_hand->clock_prev;
+        page->clock_prev->clock_next = page;
+        page_cache_hand->clock_prev = page;
+    }
+
+    page_cache_stats.pages++;
+}
+
+static void page_cache_remove(struct cached_page* page) {
+    struct cached_page** link = page_cache_bucket(page->device, page->index);
+    while (*link != page) {
+        link = &(*link)->hash_next;
+    }
+    *link = page->hash_next;
+
+    if (page->clock_next == page) {
+        page_cache_hand = NULL;
+    } else {
+        if (page_cache_hand == page) {
+            page_cache_hand = page->clock_next;
+        }
+        page->clock_prev->clock_next = page->clock_next;
+        page->clock_next->clock_prev = page->clock_prev;
+    }
+
+    page_cache_stats.pages--;
+}
+
+static void page_cache_set_dirty(struct cached_page* page, bool dirty) {
+    if (page->dirty == dirty) {
+        return;
+    }
+
+    page->dirty = dirty;
+    if (dirty) {
+        page->device->dirty_pages++;
+        page_cache_stats.dirty_pages++;
+    } else {
+        page->device->dirty_pages--;
+        page_cache_stats.dirty_pages--;
+    }
+}
+
+static struct cached_page* page_cache_pin(struct page_cache_device* device, uint64_t index) {
+    struct cached_page* page = page_cache_find(device, index);
+    if (page != NULL) {
+        page->pins++;
+        page->referenced = true;
+    }
+    return page;
+}
+
+/* looks up a page and pins it for a copy, NULL if it has to be read in first */
+static struct cached_page* page_cache_get(struct page_cache_device* device, uint64_t index) {
+    spinlock_acquire(&page_cache_lock);
+
+    struct cached_page* page = page_cache_pin(device, index);
+    if (page != NULL) {
+        page_cache_stats.hits++;
+    } else {
+        page_cache_stats.misses++;
+    }
+
+    spinlock_release(&page_cache_lock);
+    return page;
+}
+
+/* unpins a page once the copy is done, a copy into the page makes it dirty */
+static void page_cache_put(struct cached_page* page, bool dirty) {
+    spinlock_acquire(&page_cache_lock);
+    if (dirty) {
+        page_cache_set_dirty(page, true);
+    }
+    page->pins--;
+    spinlock_release(&page_cache_lock);
+}
+
+/* the part of the page within the device, pages past its end are never cached */
+static size_t page_cache_page_size(struct page_cache_device* device, uint64_t index) {
+    return MIN(PAGE_SIZE, (size_t) device->node->stat.st_size - index * PAGE_SIZE);
+}
+
+/* called with the lock of the page's device held and the page pinned */
+static bool page_cache_writeback(struct cached_page* page) {
+    struct page_cache_device* device = page->device;
+    ssize_t size = page_cache_page_size(device, page->index);
+
+    ssize_t written = device->write(device->node, (void*) (page->paddr + HIGH_VMA), page->index * PAGE_SIZE, size, 0);
+    if (unlikely(written != size)) {
+        klog("[page_cache] failed to write back page %lu of %s\n", page->index, device->node->name);
+        return false;
+    }
+
+    __atomic_add_fetch(&page_cache_stats.writebacks, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+ * Takes the page out of the cache that was not used for the longest time, going by the clock, to
+ * reuse it. Dirty pages of other devices are passed over, writing them back would take their lock.
+ * Called with the lock of the given device held, returns NULL if nothing could be taken.
+ */
+static struct cached_page* page_cache_evict(struct page_cache_device* device) {
+    struct cached_page* victim = NULL;
+
+    spinlock_acquire(&page_cache_lock);
+
+    for (size_t i = 0; i < 2 * page_cache_stats.pages && page_cache_hand != NULL; i++) {
+        struct cached_page* page = page_cache_hand;
+        page_cache_hand = page->clock_next;
+
+        if (page->pins != 0 || (page->dirty && page->device != device)) {
+            continue;
+        }
+
+        if (page->referenced) {
+            page->referenced = false;
+            continue;
+        }
+
+        if (page->dirty) {
+            /* it is clean again before the lock is dropped, so that writes meanwhile make it dirty */
+            page->pins++;
+            page_cache_set_dirty(page, false);
+            spinlock_release(&page_cache_lock);
+
+            bool written = page_cache_writeback(page);
+
+            spinlock_acquire(&page_cache_lock);
+            page->pins--;
+            if (!written) {
+                page_cache_set_dirty(page, true);
+                continue;
+            }
+            if (page->pins != 0 || page->dirty || page->referenced) {
+                continue;
+            }
+        }
+
+        page_cache_remove(page);
+        page_cache_stats.evictions++;
+        victim = page;
+        break;
+    }
+
+    spinlock_release(&page_cache_lock);
+    return victim;
+}
+
+/* a page to read into, recycled from the cache once memory gets low, called with the device lock held */
+static struct cached_page* page_cache_alloc(struct page_cache_device* device) {
+    if (pmm_get_free_pages() < PAGE_CACHE_MIN_FREE) {
+        struct cached_page* page = page_cache_evict(device);
+        if (page != NULL) {
+            return page;
+        }
+    }
+
+    spinlock_acquire(&page_cache_lock);
+    struct cached_page* page = page_cache_unused;
+    if (page != NULL) {
+        page_cache_unused = page->hash_next;
+    }
+    spinlock_release(&page_cache_lock);
+
+    if (page == NULL) {
+        page = kmalloc(sizeof(struct cached_page));
+        if (unlikely(page == NULL)) {
+            return NULL;
+        }
+    }
+
+    page->paddr = pmm_alloc(1);
+    return page;
+}
+
+static void page_cache_release(struct cached_page* page) {
+    pmm_free(page->paddr, 1);
+
+    spinlock_acquire(&page_cache_lock);
+    page->hash_next = page_cache_unused;
+    page_cache_unused = page;
+    spinlock_release(&page_cache_lock);
+}
+
+/*
+ * Reads in a page that was not found in the cache, unless it is about to be overwritten as a whole,
+ * and returns it pinned. It may have been read in by someone else while waiting for the device.
+ */
+static struct cached_page* page_cache_fill(struct page_cache_device* device, uint64_t index, bool overwrite) {
+    mutex_acquire(&device->lock);
+
+    spinlock_acquire(&page_cache_lock);
+    struct cached_page* page = page_cache_pin(device, index);
+    spinlock_release(&page_cache_lock);
+    if (page != NULL) {
+        goto end;
+    }
+
+    page = page_cache_alloc(device);
+    if (unlikely(page == NULL)) {
+        goto end;
+    }
+
+    void* data = (void*) (page->paddr + HIGH_VMA);
+    ssize_t size = page_cache_page_size(device, index);
+
+    if (overwrite) {
+        memset(data, 0, PAGE_SIZE);
+    } else {
+        if (unlikely(device->read(device->node, data, index * PAGE_SIZE, size, 0) != size)) {
+            page_cache_release(page);
+            page = NULL;
+            goto end;
+        }
+        memset((uint8_t*) data + size, 0, PAGE_SIZE - size);
+    }
+
+    page->device = device;
+    page->index = index;
+    page->pins = 1;
+    page->dirty = false;
+    page->referenced = true;
+
+    spinlock_acquire(&page_cache_lock);
+    page_cache_insert(page);
+    spinlock_release(&page_cache_lock);
+
+end:
+    mutex_release(&device->lock);
+    return page;
+}
+
+/* writes back every dirty page of the device, called with its lock held */
+static int page_cache_writeback_device(struct page_cache_device* device) {
+    int ret = 0;
+
+    spinlock_acquire(&page_cache_lock);
+
+    /* pages stay in their bucket while pinned, the bucket is searched again after every write */
+    for (size_t i = 0; i < page_cache_bucket_count && device->dirty_pages != 0; i++) {
+        struct cached_page* page = page_cache_buckets[i];
+        while (page != NULL) {
+            if (page->device != device || !page->dirty) {
+                page = page->hash_next;
+                continue;
+            }
+
+            page->pins++;
+            page_cache_set_dirty(page, false);
+            spinlock_release(&page_cache_lock);
+
+            bool written = page_cache_writeback(page);
+
+            spinlock_acquire(&page_cache_lock);
+            page->pins--;
+            if (!written) {
+                page_cache_set_dirty(page, true);
+                ret = -EIO;
+                goto end;
+            }
+
+            page = page_cache_buckets[i];
+        }
+    }
+
+end:
+    spinlock_release(&page_cache_lock);
+    return ret;
+}
+
+/* writes back every device that has dirty pages */
+static void page_cache_writeback_all(void) {
+    struct page_cache_device* device = __atomic_load_n(&page_cache_devices, __ATOMIC_ACQUIRE);
+    for (; device != NULL; device = device->next) {
+        if (__atomic_load_n(&device->dirty_pages, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+
+        mutex_acquire(&device->lock);
+        page_cache_writeback_device(device);
+        mutex_release(&device->lock);
+    }
+}
+
+/*
+ * Keeps the dirty pages to a share of memory. The flusher is woken once half of that is dirty, and
+ * writers going past all of it write back whatever devices hold the dirty pages before they go on.
+ */
+static void page_cache_balance_dirty(void) {
+    size_t dirty_pages = __atomic_load_n(&page_cache_stats.dirty_pages, __ATOMIC_RELAXED);
+    if (dirty_pages < page_cache_dirty_limit / 2) {
+        return;
+    }
+
+    if (dirty_pages < page_cache_dirty_limit) {
+        wait_queue_wake_all(&page_cache_flusher_wait);
+        return;
+    }
+
+    page_cache_writeback_all();
+}
+
+static ssize_t page_cache_read(struct vfs_node* node, void* buf, off_t offset, size_t count, int flags) {
+    (void) flags;
+
+    struct page_cache_device* device = node->page_cache;
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    if (offset >= node->stat.st_size) {
+        return 0;
+    }
+    count = MIN(count, (size_t) (node->stat.st_size - offset));
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        size_t page_offset = (offset + done) % PAGE_SIZE;
+        size_t chunk = MIN(PAGE_SIZE - page_offset, count - done);
+
+        struct cached_page* page = page_cache_get(device, index);
+        if (page == NULL) {
+            page = page_cache_fill(device, index, false);
+            if (unlikely(page == NULL)) {
+                return done != 0 ? (ssize_t) done : -EIO;
+            }
+        }
+
+        bool copied = user_copy((uint8_t*) buf + done, (void*) (page->paddr + HIGH_VMA + page_offset), chunk);
+        page_cache_put(page, false);
+
+        if (unlikely(!copied)) {
+            return done != 0 ? (ssize_t) done : -EFAULT;
+        }
+
+        done += chunk;
+    }
+
+    return done;
+}
+
+static ssize_t page_cache_write(struct vfs_node* node, const void* buf, off_t offset, size_t count, int flags) {
+    (void) flags;
+
+    struct page_cache_device* device = node->page_cache;
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    if (offset >= node->stat.st_size) {
+        return 0;
+    }
+    count = MIN(count, (size_t) (node->stat.st_size - offset));
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        size_t page_offset = (offset + done) % PAGE_SIZE;
+        size_t chunk = MIN(PAGE_SIZE - page_offset, count - done);
+
+        struct cached_page* page = page_cache_get(device, index);
+        if (page == NULL) {
+            bool overwrite = page_offset == 0 && chunk == page_cache_page_size(device, index);
+            page = page_cache_fill(device, index, overwrite);
+            if (unlikely(page == NULL)) {
+                return done != 0 ? (ssize_t) done : -EIO;
+            }
+        }
+
+        /* a copy that faulted half way may still have changed the page, so it is dirty either way */
+        bool copied = user_copy((void*) (page->paddr + HIGH_VMA + page_offset), (const uint8_t*) buf + done, chunk);
+        page_cache_put(page, true);
+        page_cache_balance_dirty();
+
+        if (unlikely(!copied)) {
+            return done != 0 ? (ssize_t) done : -EFAULT;
+        }
+
+        done += chunk;
+    }
+
+    return done;
+}
+
+/* writes back the dirty pages of the device, then has the device flush its own cache */
+static int page_cache_sync(struct vfs_node* node) {
+    struct page_cache_device* device = node->page_cache;
+
+    mutex_acquire(&device->lock);
+
+    int ret = page_cache_writeback_device(device);
+    if (ret == 0) {
+        ret = device->sync(node);
+    }
+
+    mutex_release(&device->lock);
+    return ret;
+}
+
+/* writes back what every device has dirty at least once every PAGE_CACHE_WRITEBACK_NS */
+__attribute__((noreturn)) static void page_cache_flusher(void) {
+    for (;;) {
+        bool prev_int = interrupt_state();
+        cli();
+
+        spinlock_acquire(&page_cache_flusher_wait.lock);
+        wait_queue_sleep_keyed(&page_cache_flusher_wait, &page_cache_flusher_wait.lock, 0,
+                time_ns() + PAGE_CACHE_WRITEBACK_NS);
+        spinlock_release(&page_cache_flusher_wait.lock);
+
+        if (prev_int) {
+            sti();
+        }
+
+        page_cache_writeback_all();
+    }
+}
+
+/* syncs every device, for when the system is about to go down, returns the first error */
+int page_cache_sync_all(void) {
+    int ret = 0;
+
+    struct page_cache_device* device = __atomic_load_n(&page_cache_devices, __ATOMIC_ACQUIRE);
+    for (; device != NULL; device = device->next) {
+        int err = page_cache_sync(device->node);
+        if (err != 0 && ret == 0) {
+            klog("[page_cache] failed to sync %s\n", device->node->name);
+            ret = err;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Puts the cache in front of a block device, whose read, write and sync callbacks are already set up
+ * and transfer whole sectors. Its size must be a multiple of its sector size.
+ */
+void page_cache_attach(struct vfs_node* node) {
+    struct page_cache_device* device = kmalloc(sizeof(struct page_cache_device));
+    if (unlikely(device == NULL)) {
+        kpanic(NULL, false, "failed to allocate the page cache of %s", node->name);
+    }
+
+    *device = (struct page_cache_device) {
+        .node = node,
+        .read = node->read,
+        .write = node->write,
+        .sync = node->sync,
+    };
+
+    node->page_cache = device;
+    node->read = page_cache_read;
+    node->write = page_cache_write;
+    node->sync = page_cache_sync;
+
+    spinlock_acquire(&page_cache_lock);
+    device->next = page_cache_devices;
+    __atomic_store_n(&page_cache_devices, device, __ATOMIC_RELEASE);
+    bool start_flusher = !page_cache_flusher_started;
+    page_cache_flusher_started = true;
+    spinlock_release(&page_cache_lock);
+
+    /* devices are found once the scheduler runs, so the flusher is started along with the first */
+    if (start_flusher) {
+        struct thread* flusher = thread_create(kernel_process, (uintptr_t) &page_cache_flusher, NULL, NULL, NULL, false);
+        if (unlikely(flusher == NULL)) {
+            kpanic(NULL, false, "failed to create the page cache flusher thread");
+        }
+        sched_thread_enqueue(flusher);
+    }
+}
+
+/*
+ * Hands every clean page nobody is copying back to the PMM, for when it runs out of memory. It may be
+ * called from anywhere, so it never waits, not even for the lock of the cache.
+ */
+size_t page_cache_reclaim(void) {
+    size_t freed_pages = 0;
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    if (spinlock_test_and_acquire(&page_cache_lock)) {
+        size_t count = page_cache_stats.pages;
+        struct cached_page* page = page_cache_hand;
+
+        for (size_t i = 0; i < count; i++) {
+            struct cached_page* next = page->clock_next;
+
+            if (page->pins == 0 && !page->dirty) {
+                page_cache_remove(page);
+                pmm_free(page->paddr, 1);
+
+                page->hash_next = page_cache_unused;
+                page_cache_unused = page;
+                freed_pages++;
+            }
+
+            page = next;
+        }
+
+        page_cache_stats.evictions += freed_pages;
+        spinlock_release(&page_cache_lock);
+    }
+
+    if (prev_int) {
+        sti();
+    }
+
+    return freed_pages;
+}
+
+void page_cache_get_stats(struct page_cache_stats* stats) {
+    spinlock_acquire(&page_cache_lock);
+    *stats = page_cache_stats;
+    stats->writebacks = __atomic_load_n(&page_cache_stats.writebacks, __ATOMIC_RELAXED);
+    spinlock_release(&page_cache_lock);
+}
+
+/* about a bucket for every eight pages of memory, a power of two */
+UNMAP_AFTER_INIT void page_cache_init(void) {
+    page_cache_dirty_limit = pmm_get_total_pages() / PAGE_CACHE_DIRTY_RATIO;
+
+    page_cache_bucket_count = PAGE_CACHE_MIN_BUCKETS;
+    while (page_cache_bucket_count < pmm_get_total_pages() / 8) {
+        page_cache_bucket_count *= 2;
+    }
+
+    page_cache_buckets = kmalloc(page_cache_bucket_count * sizeof(struct cached_page*));
+    if (unlikely(page_cache_buckets == NULL)) {
+        kpanic(NULL, false, "failed to allocate the page cache");
+    }
+
+    memset(page_cache_buckets, 0, page_cache_bucket_count * sizeof(struct cached_page*));
+}
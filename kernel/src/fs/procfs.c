@@ -0,0 +1,213 @@
+#include <cpu/percpu.h>
+#include <cpu/smp.h>
+#include <errno.h>
+#include <fs/page_cache.h>
+#include <fs/procfs.h>
+#include <fs/vfs.h>
+#include <mem/slab.h>
+#include <stdarg.h>
+#include <sys/process.h>
+#include <sys/sched.h>
+#include <sys/time.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/string.h>
+#include <utils/user_access.h>
+
+/*
+ * Read-only files describing the state of the kernel. Their text is generated anew on every read,
+ * so reading one in several chunks may mix up two different snapshots.
+ */
+struct procfs_buffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+};
+
+struct procfs_entry {
+    const char* name;
+    void (*show)(struct procfs_buffer*);
+};
+
+READONLY_AFTER_INIT static struct vfs_filesystem procfs = {0};
+READONLY_AFTER_INIT static struct vfs_node* procfs_root;
+
+static void procfs_printf(struct procfs_buffer* b, const char* fmt, ...) {
+    if (b->failed) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(b->data + b->size, b->capacity - b->size, fmt, args);
+    va_end(args);
+
+    if (b->size + len >= b->capacity) {
+        size_t capacity = MAX(b->capacity * 2, b->size + len + 1);
+        char* data = krealloc(b->data, capacity);
+        if (unlikely(data == NULL)) {
+            b->failed = true;
+            return;
+        }
+        b->data = data;
+        b->capacity = capacity;
+
+        va_start(args, fmt);
+        vsnprintf(b->data + b->size, b->capacity - b->size, fmt, args);
+        va_end(args);
+    }
+
+    b->size += len;
+}
+
+static const char* thread_state_name(enum thread_state state) {
+    switch (state) {
+        case THREAD_RUNNING:
+            return "R";
+        case THREAD_READY_TO_RUN:
+            return "Q";
+        case THREAD_SLEEPING:
+            return "S";
+        case THREAD_ZOMBIE:
+            return "Z";
+    }
+    return "?";
+}
+
+static const char* sched_policy_name(int policy) {
+    switch (policy) {
+        case SCHED_FIFO:
+            return "fifo";
+        case SCHED_RR:
+            return "rr";
+    }
+    return "other";
+}
+
+/* the statistics are read without the thread's lock, a running thread is charged up to now */
+static void show_thread(struct thread* t, void* ctx) {
+    struct procfs_buffer* b = ctx;
+
+    enum thread_state state = __atomic_load_n(&t->state, __ATOMIC_RELAXED);
+    uint64_t run_time = t->cpu_time;
+    uint64_t exec_start = t->exec_start;
+    if (state == THREAD_RUNNING && exec_start != 0) {
+        run_time += time_ns() - exec_start;
+    }
+
+    procfs_printf(b, "%d %d %s %s %d %ld %lu %lu %lu %lu %lu %lu %s\n",
+            t->process->pid, t->tid, thread_state_name(state), sched_policy_name(t->policy),
+            t->policy == SCHED_OTHER ? t->nice : t->rt_priority,
+            t->last_cpu < smp_cpu_count ? (long) t->last_cpu : -1l,
+            run_time, t->wait_time, t->voluntary_switches, t->involuntary_switches, t->migrations,
+            t->max_wakeup_latency, t->process->name);
+}
+
+static void show_threads(struct procfs_buffer* b) {
+    procfs_printf(b, "pid tid state policy prio cpu run_ns wait_ns voluntary involuntary migrations max_latency_ns name\n");
+    process_for_each_thread(show_thread, b);
+}
+
+/* per-CPU counters, then the wakeup latency histogram of all CPUs, by the lower bound of each bucket */
+static void show_schedstat(struct procfs_buffer* b) {
+    uint64_t now = time_ns();
+    uint64_t latency[SCHED_LATENCY_BUCKETS] = {0};
+
+    procfs_printf(b, "cpu switches wakeups idle_ns\n");
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct sched_stats* stats = &percpus[i].sched_stats;
+
+        uint64_t idle_since = stats->idle_since;
+        uint64_t idle_time = stats->idle_time + (idle_since != 0 && idle_since < now ? now - idle_since : 0);
+        procfs_printf(b, "%lu %lu %lu %lu\n", i, stats->switches, stats->wakeups, idle_time);
+
+        for (size_t j = 0; j < SCHED_LATENCY_BUCKETS; j++) {
+            latency[j] += stats->wakeup_latency[j];
+        }
+    }
+
+    procfs_printf(b, "latency_ns wakeups\n");
+    for (size_t i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+        procfs_printf(b, "%lu %lu\n", i == 0 ? 0 : 1ul << i, latency[i]);
+    }
+}
+
+static void show_pagecache(struct procfs_buffer* b) {
+    struct page_cache_stats stats;
+    page_cache_get_stats(&stats);
+
+    procfs_printf(b, "pages dirty hits misses evictions writebacks\n");
+    procfs_printf(b, "%lu %lu %lu %lu %lu %lu\n", stats.pages, stats.dirty_pages, stats.hits, stats.misses,
+            stats.evictions, stats.writebacks);
+}
+
+static const struct procfs_entry procfs_entries[] = {
+    {"threads", show_threads},
+    {"schedstat", show_schedstat},
+    {"pagecache", show_pagecache},
+};
+
+static ssize_t procfs_read(struct vfs_node* node, void* buf, off_t offset, size_t count, int flags) {
+    (void) flags;
+
+    const struct procfs_entry* entry = node->private;
+    struct procfs_buffer b = {0};
+    entry->show(&b);
+
+    ssize_t read = 0;
+    if (unlikely(b.failed)) {
+        read = -ENOMEM;
+    } else if (offset >= 0 && (size_t) offset < b.size) {
+        read = MIN(count, b.size - offset);
+        if (!user_copy(buf, b.data + offset, read)) {
+            read = -EFAULT;
+        }
+    }
+
+    kfree(b.data);
+    return read;
+}
+
+static struct vfs_node* procfs_mount(struct vfs_node* parent, struct vfs_node* source, const char* name) {
+    (void) parent;
+    (void) source;
+    (void) name;
+    return procfs_root;
+}
+
+UNMAP_AFTER_INIT void procfs_init(void) {
+    procfs_root = vfs_create_node(&procfs, NULL, "proc", true);
+    if (unlikely(procfs_root == NULL)) {
+        kpanic(NULL, false, "failed to create procfs root node");
+    }
+
+    struct stat proc_stat = {
+        .st_dev = makedev(0, 2),
+        .st_mode = S_IFDIR,
+        .st_size = 0,
+        .st_blksize = 4096,
+        .st_blocks = 0,
+        .st_atim = time_get_realtime(),
+        .st_mtim = time_get_realtime(),
+        .st_ctim = time_get_realtime()
+    };
+    procfs_root->stat = proc_stat;
+
+    for (size_t i = 0; i < sizeof(procfs_entries) / sizeof(procfs_entries[0]); i++) {
+        struct vfs_node* node = vfs_create_node(&procfs, procfs_root, procfs_entries[i].name, false);
+        if (unlikely(node == NULL)) {
+            kpanic(NULL, false, "failed to create procfs node");
+        }
+
+        node->stat = proc_stat;
+        node->stat.st_mode = S_IFREG;
+        node->private = (void*) &procfs_entries[i];
+        node->read = procfs_read;
+
+        vfs_add_child(procfs_root, node);
+    }
+
+    vfs_register_filesystem("procfs", procfs_mount);
+}
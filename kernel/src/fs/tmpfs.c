@@ -1,7 +1,9 @@
 #include <errno.h>
 #include <fs/tmpfs.h>
 #include <fs/vfs.h>
+#include <mem/pmm.h>
 #include <mem/slab.h>
+#include <mem/vmm.h>
 #include <sys/time.h>
 #include <types.h>
 #include <utils/macros.h>
@@ -14,28 +16,170 @@ struct tmpfs_metadata {
     dev_t dev;
 };
 
+#define RADIX_BITS  9
+#define RADIX_SLOTS (1ul << RADIX_BITS)
+
+/*
+ * Regular files are stored as individually allocated physical pages, so that pages can be mapped
+ * straight into user address spaces and stay put while the file grows. They are indexed by a radix
+ * tree of page sized nodes, which only grows by as many levels and nodes as the pages that exist need,
+ * so writing anywhere costs the same no matter how large or sparse the file is. Missing pages are holes
+ * that read as zeroes. A file of a single page keeps it in the root itself, without any node, so small
+ * files cost no more than their page. The lock only protects the tree and is never held while copying
+ * data, as the caller's buffer may itself be a mapping of the same file that still has to be faulted in.
+ */
 struct tmp_node_metadata {
-    size_t capacity;
-    void* data;
+    spinlock_t lock;
+    size_t height;      /* levels of nodes, 0 while the root is the page at index 0 itself */
+    uintptr_t root;     /* the leaves hold physical page addresses, the other nodes their children */
 };
 
 static uint8_t tmpfs_minor = 0;
 
+static struct tmpfs_metadata anonymous_metadata = { .inode_counter = 1 };
+static struct vfs_filesystem anonymous_tmpfs;
+
 static struct vfs_node* tmpfs_create(struct vfs_filesystem* fs, struct vfs_node* parent, const char* name, mode_t mode);
 
+/* pages covered by a slot with the given number of levels of nodes under it */
+static inline size_t radix_span(size_t height) {
+    return 1ul << (RADIX_BITS * height);
+}
+
+static uintptr_t* radix_alloc_node(void) {
+    uintptr_t node = pmm_allocz(1);
+    return node != 0 ? (uintptr_t*) (node + HIGH_VMA) : NULL;
+}
+
+static void radix_free_node(uintptr_t* node) {
+    pmm_free((uintptr_t) node - HIGH_VMA, 1);
+}
+
+/* the leaf slot for the page at index, NULL if there is none and create is false, or on failure */
+static uintptr_t* radix_lookup(struct tmp_node_metadata* node_metadata, size_t index, bool create) {
+    /* what is there already moves down to slot 0 of new roots, an empty tree only has to be taller */
+    while (index >= radix_span(node_metadata->height)) {
+        if (!create) {
+            return NULL;
+        }
+
+        if (node_metadata->root != 0) {
+            uintptr_t* root = radix_alloc_node();
+            if (unlikely(root == NULL)) {
+                return NULL;
+            }
+
+            root[0] = node_metadata->root;
+            node_metadata->root = (uintptr_t) root;
+        }
+        node_metadata->height++;
+    }
+
+    uintptr_t* slot = &node_metadata->root;
+    for (size_t level = node_metadata->height; level > 0; level--) {
+        if (*slot == 0) {
+            if (!create) {
+                return NULL;
+            }
+
+            uintptr_t* child = radix_alloc_node();
+            if (unlikely(child == NULL)) {
+                return NULL;
+            }
+            *slot = (uintptr_t) child;
+        }
+        slot = &((uintptr_t*) *slot)[(index >> (RADIX_BITS * (level - 1))) % RADIX_SLOTS];
+    }
+
+    return slot;
+}
+
+/* drops the pages from index first on under a slot covering pages from base, clearing it once it is empty */
+static void radix_truncate(uintptr_t* slot, size_t height, size_t base, size_t first) {
+    if (*slot == 0 || base + radix_span(height) <= first) {
+        return;
+    }
+
+    /* pages still mapped somewhere stay alive until the last mapping goes away */
+    if (height == 0) {
+        pmm_page_unref(*slot);
+        *slot = 0;
+        return;
+    }
+
+    uintptr_t* node = (uintptr_t*) *slot;
+    bool empty = true;
+
+    for (size_t i = 0; i < RADIX_SLOTS; i++) {
+        radix_truncate(&node[i], height - 1, base + i * radix_span(height - 1), first);
+        if (node[i] != 0) {
+            empty = false;
+        }
+    }
+
+    if (empty) {
+        radix_free_node(node);
+        *slot = 0;
+    }
+}
+
+/* returns the page at index with a reference held for the caller, or 0 for a hole if create is false */
+static uintptr_t get_page(struct tmp_node_metadata* node_metadata, size_t index, bool create) {
+    spinlock_acquire(&node_metadata->lock);
+
+    uintptr_t page = 0;
+
+    uintptr_t* slot = radix_lookup(node_metadata, index, create);
+    if (slot == NULL) {
+        goto end;
+    }
+
+    page = *slot;
+    if (page == 0 && create) {
+        page = *slot = pmm_allocz(1);
+    }
+
+    if (page != 0) {
+        pmm_page_ref(page);
+    }
+
+end:
+    spinlock_release(&node_metadata->lock);
+    return page;
+}
+
 static ssize_t tmpfs_read(struct vfs_node* node, void* buf, off_t offset, size_t count, int flags) {
     (void) flags;
 
     struct tmp_node_metadata* node_metadata = (struct tmp_node_metadata*) node->private;
 
-    size_t actual_count = count;
-    if ((off_t) (offset + count) >= node->stat.st_size) {
-        actual_count = count - ((offset + count) - node->stat.st_size);
+    if (offset >= node->stat.st_size) {
+        return 0;
     }
 
-    memcpy(buf, (void*) ((uintptr_t) node_metadata->data + offset), actual_count);
+    size_t actual_count = MIN(count, (size_t) (node->stat.st_size - offset));
+
+    for (size_t done = 0; done < actual_count;) {
+        size_t page_offset = (offset + done) % PAGE_SIZE;
+        size_t chunk = MIN(actual_count - done, PAGE_SIZE - page_offset);
+
+        bool copied;
+        uintptr_t page = get_page(node_metadata, (offset + done) / PAGE_SIZE, false);
+        if (page != 0) {
+            copied = user_copy((void*) ((uintptr_t) buf + done), (void*) (page + HIGH_VMA + page_offset), chunk);
+            pmm_page_unref(page);
+        } else {
+            copied = user_fill((void*) ((uintptr_t) buf + done), 0, chunk);
+        }
+
+        if (unlikely(!copied)) {
+            return done != 0 ? (ssize_t) done : -EFAULT;
+        }
+
+        done += chunk;
+    }
 
-    node->stat.st_atim = time_realtime;
+    node->stat.st_atim = time_get_realtime();
 
     return actual_count;
 }
@@ -45,29 +189,36 @@ static ssize_t tmpfs_write(struct vfs_node* node, const void* buf, off_t offset,
 
     struct tmp_node_metadata* node_metadata = (struct tmp_node_metadata*) node->private;
 
-    if (offset + count >= node_metadata->capacity) {
-        size_t new_capacity = node_metadata->capacity;
-        while (offset + count >= new_capacity) {
-            new_capacity *= 2;
-        }
+    for (size_t done = 0; done < count;) {
+        size_t page_offset = (offset + done) % PAGE_SIZE;
+        size_t chunk = MIN(count - done, PAGE_SIZE - page_offset);
 
-        void* new_data = krealloc(node_metadata->data, new_capacity);
-        if (unlikely(new_data == NULL)) {
+        uintptr_t page = get_page(node_metadata, (offset + done) / PAGE_SIZE, true);
+        if (unlikely(page == 0)) {
             return -ENOMEM;
         }
 
-        node_metadata->data = new_data;
-        node_metadata->capacity = new_capacity;
-    }
+        bool copied = user_copy((void*) (page + HIGH_VMA + page_offset), (void*) ((uintptr_t) buf + done), chunk);
+        pmm_page_unref(page);
 
-    memcpy((void*) ((uintptr_t) node_metadata->data + offset), buf, count);
+        /* what made it into the file before the fault counts as written */
+        if (unlikely(!copied)) {
+            if (done == 0) {
+                return -EFAULT;
+            }
+            count = done;
+            break;
+        }
+
+        done += chunk;
+    }
 
     if ((off_t) (offset + count) >= node->stat.st_size) {
         node->stat.st_size = (off_t) (offset + count);
         node->stat.st_blocks = DIV_CEIL(node->stat.st_size, node->stat.st_blksize);
     }
 
-    node->stat.st_atim = node->stat.st_mtim = time_realtime;
+    node->stat.st_atim = node->stat.st_mtim = time_get_realtime();
 
     return count;
 }
@@ -75,30 +226,51 @@ static ssize_t tmpfs_write(struct vfs_node* node, const void* buf, off_t offset,
 static int tmpfs_truncate(struct vfs_node* node, off_t length) {
     struct tmp_node_metadata* node_metadata = (struct tmp_node_metadata*) node->private;
 
-    if ((size_t) length > node_metadata->capacity) {
-        size_t new_capacity = node_metadata->capacity;
-        while (new_capacity < (size_t) length) {
-            new_capacity *= 2;
-        }
+    if (length < node->stat.st_size) {
+        spinlock_acquire(&node_metadata->lock);
 
-        void* new_data = krealloc(node_metadata->data, new_capacity);
-        if (unlikely(new_data == NULL)) {
-            return -ENOMEM;
+        radix_truncate(&node_metadata->root, node_metadata->height, 0, DIV_CEIL(length, PAGE_SIZE));
+        if (node_metadata->root == 0) {
+            node_metadata->height = 0;
         }
 
-        kfree(node_metadata->data);
+        /* clear the tail of the last page so that growing the file again reads zeroes */
+        if (length % PAGE_SIZE != 0) {
+            uintptr_t* slot = radix_lookup(node_metadata, length / PAGE_SIZE, false);
+            if (slot != NULL && *slot != 0) {
+                memset((void*) (*slot + HIGH_VMA + (length % PAGE_SIZE)), 0, PAGE_SIZE - (length % PAGE_SIZE));
+            }
+        }
 
-        node_metadata->capacity = new_capacity;
-        node_metadata->data = new_data;
+        spinlock_release(&node_metadata->lock);
     }
 
     node->stat.st_size = length;
     node->stat.st_blocks = DIV_CEIL(node->stat.st_size, node->stat.st_blksize);
-    node->stat.st_atim = node->stat.st_mtim = time_realtime;
+    node->stat.st_atim = node->stat.st_mtim = time_get_realtime();
 
     return 0;
 }
 
+static int tmpfs_mmap(struct vfs_node* node, off_t offset, uintptr_t* paddr) {
+    if (paddr == NULL) {
+        return 0;
+    }
+
+    /* like a read past the end, touching a mapping past the end of the file is an error */
+    if (offset >= ALIGN_UP(node->stat.st_size, PAGE_SIZE)) {
+        return -EINVAL;
+    }
+
+    uintptr_t page = get_page(node->private, offset / PAGE_SIZE, true);
+    if (unlikely(page == 0)) {
+        return -ENOMEM;
+    }
+
+    *paddr = page;
+    return 0;
+}
+
 static struct vfs_node* tmpfs_mount(struct vfs_node* parent, struct vfs_node* source, const char* name) {
     (void) source;
 
@@ -106,7 +278,7 @@ static struct vfs_node* tmpfs_mount(struct vfs_node* parent, struct vfs_node* so
     metadata->inode_counter = 1;
     metadata->dev = makedev(0, tmpfs_minor++);
 
-    struct vfs_filesystem* tmpfs = kmalloc(sizeof(struct vfs_filesystem*));
+    struct vfs_filesystem* tmpfs = kmalloc(sizeof(struct vfs_filesystem));
     tmpfs->private = metadata;
     tmpfs->create = tmpfs_create;
 
@@ -126,14 +298,9 @@ static struct vfs_node* tmpfs_create(struct vfs_filesystem* fs, struct vfs_node*
             return NULL;
         }
 
-        node_metadata->capacity = 4096;
-
-        node_metadata->data = kmalloc(4096);
-        if (unlikely(node_metadata->data == NULL)) {
-            kfree(node_metadata);
-            vfs_destroy_node(new_node);
-            return NULL;
-        }
+        node_metadata->lock = (spinlock_t) {0};
+        node_metadata->height = 0;
+        node_metadata->root = 0;
 
         new_node->private = node_metadata;
     }
@@ -146,15 +313,40 @@ static struct vfs_node* tmpfs_create(struct vfs_filesystem* fs, struct vfs_node*
     new_node->stat.st_size = 0;
     new_node->stat.st_blksize = 512;
     new_node->stat.st_blocks = 0;
-    new_node->stat.st_atim = new_node->stat.st_mtim = new_node->stat.st_ctim = time_realtime;
+    new_node->stat.st_atim = new_node->stat.st_mtim = new_node->stat.st_ctim = time_get_realtime();
 
     new_node->read = tmpfs_read;
     new_node->write = tmpfs_write;
     new_node->truncate = tmpfs_truncate;
+    new_node->mmap = tmpfs_mmap;
 
     return new_node;
 }
 
+/* unnamed file backing MAP_SHARED | MAP_ANONYMOUS mappings, it lives as long as the mappings do */
+struct vfs_node* tmpfs_create_anonymous(size_t size) {
+    struct vfs_node* node = tmpfs_create(&anonymous_tmpfs, NULL, "", S_IFREG);
+    if (unlikely(node == NULL)) {
+        return NULL;
+    }
+
+    node->stat.st_size = size;
+    node->stat.st_blocks = DIV_CEIL(node->stat.st_size, node->stat.st_blksize);
+    return node;
+}
+
+void tmpfs_destroy_anonymous(struct vfs_node* node) {
+    struct tmp_node_metadata* node_metadata = node->private;
+
+    tmpfs_truncate(node, 0);
+    kfree(node_metadata);
+    vfs_destroy_node(node);
+}
+
 UNMAP_AFTER_INIT void tmpfs_init(void) {
+    anonymous_metadata.dev = makedev(0, tmpfs_minor++);
+    anonymous_tmpfs.private = &anonymous_metadata;
+    anonymous_tmpfs.create = tmpfs_create;
+
     vfs_register_filesystem("tmpfs", tmpfs_mount);
 }
@@ -1,4 +1,6 @@
 #include <errno.h>
+#include <fs/dcache.h>
+#include <fs/page_cache.h>
 #include <fs/vfs.h>
 #include <mem/slab.h>
 #include <mem/vmm.h>
@@ -8,6 +10,7 @@
 #include <utils/macros.h>
 #include <utils/panic.h>
 #include <utils/string.h>
+#include <utils/user_access.h>
 
 struct path2node_res {
     struct vfs_node* parent;
@@ -55,6 +58,13 @@ static int sync_stub(struct vfs_node* node) {
     return 0;
 }
 
+static int mmap_stub(struct vfs_node* node, off_t offset, uintptr_t* paddr) {
+    (void) node;
+    (void) offset;
+    (void) paddr;
+    return -ENODEV;
+}
+
 static void create_dotentries(struct vfs_node* parent, struct vfs_node* node) {
     struct vfs_node* dot = vfs_create_node(node->fs, node, ".", false);
     struct vfs_node* dotdot = vfs_create_node(node->fs, node, "..", false);
@@ -62,8 +72,8 @@ static void create_dotentries(struct vfs_node* parent, struct vfs_node* node) {
     dot->link = node;
     dotdot->link = parent;
 
-    hashmap_set(node->children, ".", 1, dot);
-    hashmap_set(node->children, "..", 2, dotdot);
+    vfs_add_child(node, dot);
+    vfs_add_child(node, dotdot);
 }
 
 static struct path2node_res path2node(struct vfs_node* parent, const char* path) {
@@ -91,8 +101,10 @@ static struct path2node_res path2node(struct vfs_node* parent, const char* path)
     for (;;) {
         const char* elem = &path[index];
         size_t elem_len = 0;
+        uint32_t elem_hash = DCACHE_HASH_INIT;
 
         while (index < path_len && path[index] != '/') {
+            elem_hash = dcache_hash_step(elem_hash, path[index]);
             elem_len++, index++;
         }
 
@@ -102,12 +114,9 @@ static struct path2node_res path2node(struct vfs_node* parent, const char* path)
 
         bool last = index == path_len;
 
-        char* elem_str = kmalloc(elem_len + 1);
-        memcpy(elem_str, elem, elem_len);
-
         current_node = vfs_reduce_node(current_node);
 
-        struct vfs_node* new_node = hashmap_get(current_node->children, elem_str, strlen(elem_str));
+        struct vfs_node* new_node = dcache_lookup(current_node, elem, elem_len, elem_hash);
         if (!new_node) {
             if (last) {
                 return (struct path2node_res) { current_node, NULL };
@@ -145,7 +154,7 @@ struct vfs_node* vfs_create_node(struct vfs_filesystem* fs, struct vfs_node* par
     node->name = strdup(name);
 
     if (is_dir) {
-        node->children = hashmap_create(128);
+        node->children = hashmap_create(0);
     }
 
     node->read = read_stub;
@@ -153,6 +162,7 @@ struct vfs_node* vfs_create_node(struct vfs_filesystem* fs, struct vfs_node* par
     node->ioctl = ioctl_stub;
     node->truncate = truncate_stub;
     node->sync = sync_stub;
+    node->mmap = mmap_stub;
 
     return node;
 }
@@ -170,6 +180,10 @@ struct vfs_node* vfs_reduce_node(struct vfs_node* node) {
 }
 
 void vfs_destroy_node(struct vfs_node* node) {
+    if (node->parent != NULL || S_ISDIR(node->stat.st_mode)) {
+        dcache_purge(node);
+    }
+
     kfree(node->name);
 
     if (S_ISDIR(node->stat.st_mode)) {
@@ -268,13 +282,10 @@ struct vfs_node* vfs_create(struct vfs_node* parent, const char* name, mode_t mo
 
     struct vfs_filesystem* fs = r.parent->fs;
 
-    spinlock_acquire(&parent->lock);
-
     const char* new_node_name = (const char*) basename((char*) name);
     struct vfs_node* new_node = fs->create(fs, r.parent, new_node_name, mode);
 
-    if (unlikely(!hashmap_set(r.parent->children, new_node_name, strlen(new_node_name), new_node))) {
-        spinlock_release(&parent->lock);
+    if (unlikely(!vfs_add_child(r.parent, new_node))) {
         return NULL;
     }
 
@@ -282,94 +293,87 @@ struct vfs_node* vfs_create(struct vfs_node* parent, const char* name, mode_t mo
         create_dotentries(r.parent, new_node);
     }
 
-    spinlock_release(&parent->lock);
     return new_node;
 }
 
-ssize_t vfs_getdents(struct vfs_node* node, struct dirent* buffer, off_t offset, size_t count) {
+/* all entries are added to directories through here, which keeps the dentry cache up to date */
+bool vfs_add_child(struct vfs_node* parent, struct vfs_node* child) {
+    spinlock_acquire(&parent->lock);
+    bool added = hashmap_set(parent->children, child->name, strlen(child->name), child);
+    spinlock_release(&parent->lock);
+
+    if (added) {
+        dcache_add(parent, child->name, child);
+    }
+    return added;
+}
+
+/*
+ * Fills the buffer with as many whole entries as fit, starting at the cursor in *offset, which is
+ * moved past them. Cursors are positions in the directory that stay valid as entries come and go, so
+ * every call picks up where the previous one stopped.
+ */
+ssize_t vfs_getdents(struct vfs_node* node, struct dirent* buffer, off_t* offset, size_t count) {
     if (!S_ISDIR(node->stat.st_mode)) {
         return -ENOTDIR;
     }
 
-    size_t total_length = 0;
-    off_t iter_offset = 0;
-
-    if (node->children->entries != NULL) {
-        for (size_t i = 0; i < node->children->size; i++) {
-            hashmap_entry_t* entry = node->children->entries[i];
-            while (entry != NULL) {
-                struct vfs_node* child = entry->value;
-                size_t ent_len = sizeof(struct dirent) + strlen(child->name) + 1;
+    size_t read_size = 0;
 
-                iter_offset += ent_len;
-                if (iter_offset > offset) {
-                    total_length += ent_len;
-                }
+    size_t iter = hashmap_seek(node->children, *offset);
+    for (;;) {
+        size_t current = iter;
+        struct vfs_node* child;
+        if (!hashmap_iterate(node->children, &iter, NULL, NULL, (void**) &child)) {
+            break;
+        }
 
-                entry = entry->next;
+        size_t name_len = strlen(child->name) + 1;
+        size_t ent_len = sizeof(struct dirent) + name_len;
+        if (read_size + ent_len > count) {
+            iter = current;
+            if (read_size == 0) {
+                return -EINVAL;
             }
+            break;
         }
-    }
 
-    if (total_length == 0) {
-        return 0;
-    }
+        struct vfs_node* reduced_child = vfs_reduce_node(child);
+
+        struct dirent ent = {
+            .d_ino = reduced_child->stat.st_ino,
+            .d_reclen = ent_len,
+        };
+
+        switch (reduced_child->stat.st_mode & S_IFMT) {
+            case S_IFREG:
+                ent.d_type = DT_REG;
+                break;
+            case S_IFDIR:
+                ent.d_type = DT_DIR;
+                break;
+            case S_IFCHR:
+                ent.d_type = DT_CHR;
+                break;
+            case S_IFBLK:
+                ent.d_type = DT_BLK;
+                break;
+            default:
+                ent.d_type = DT_UNKNOWN;
+                break;
+        }
 
-    ssize_t actual_count = (ssize_t) MIN(total_length, count);
-
-    ssize_t read_size = 0;
-    iter_offset = 0;
-
-    if (node->children->entries != NULL) {
-        for (size_t i = 0; i < node->children->size; i++) {
-            hashmap_entry_t* entry = node->children->entries[i];
-            while (entry != NULL) {
-                struct vfs_node* child = entry->value;
-                struct vfs_node* reduced_child = vfs_reduce_node(child);
-
-                size_t name_len = strlen(child->name) + 1;
-                size_t ent_len = sizeof(struct dirent) + name_len;
-
-                iter_offset += ent_len;
-                if (iter_offset <= offset) {
-                    entry = entry->next;
-                    continue;
-                }
-
-                struct dirent* ent = (struct dirent*) ((uintptr_t) buffer + read_size);
-                ent->d_ino = reduced_child->stat.st_ino;
-                ent->d_reclen = ent_len;
-
-                switch (reduced_child->stat.st_mode & S_IFMT) {
-                    case S_IFREG:
-                        ent->d_type = DT_REG;
-                        break;
-                    case S_IFDIR:
-                        ent->d_type = DT_DIR;
-                        break;
-                    case S_IFCHR:
-                        ent->d_type = DT_CHR;
-                        break;
-                    case S_IFBLK:
-                        ent->d_type = DT_BLK;
-                        break;
-                    default:
-                        ent->d_type = DT_UNKNOWN;
-                        break;
-                }
-
-                memcpy(ent->d_name, child->name, name_len);
-
-                if (read_size >= actual_count) {
-                    break;
-                }
-                read_size += ent_len;
-                entry = entry->next;
-            }
+        /* the buffer is user memory and the caller holds the lock of the directory */
+        struct dirent* user_ent = (struct dirent*) ((uintptr_t) buffer + read_size);
+        if (unlikely(!user_copy(user_ent, &ent, sizeof(struct dirent)) ||
+                    !user_copy(user_ent->d_name, child->name, name_len))) {
+            return -EFAULT;
         }
+        read_size += ent_len;
     }
 
-    node->stat.st_atim = time_realtime;
+    *offset = hashmap_position(node->children, iter);
+    node->stat.st_atim = time_get_realtime();
 
     return read_size;
 }
@@ -388,6 +392,9 @@ UNMAP_AFTER_INIT void vfs_init(void) {
         kpanic(NULL, false, "failed to initialize object cache for vfs nodes");
     }
 
+    dcache_init();
+    page_cache_init();
+
     vfs_root = vfs_create_node(NULL, NULL, "", false);
     vfs_filesystems = hashmap_create(20);
 
@@ -1,3 +1,4 @@
+#include <cpu/fpu.h>
 #include <cpu/percpu.h>
 #include <cpu/smp.h>
 #include <dev/acpi/acpi.h>
@@ -8,17 +9,21 @@
 #include <dev/pci.h>
 #include <dev/ps2.h>
 #include <dev/serial.h>
+#include <dev/tsc.h>
 #include <fs/devfs.h>
 #include <fs/initrd.h>
+#include <fs/procfs.h>
 #include <fs/tmpfs.h>
 #include <fs/vfs.h>
 #include <mem/pmm.h>
 #include <mem/slab.h>
+#include <mem/vma.h>
 #include <mem/vmm.h>
 #include <sys/process.h>
 #include <sys/sched.h>
 #include <sys/time.h>
 #include <utils/cmdline.h>
+#include <utils/hashmap.h>
 #include <utils/panic.h>
 #include <utils/random.h>
 
@@ -33,6 +38,7 @@ static void kernel_main(void) {
 
     vfs_init();
     devfs_init();
+    procfs_init();
     tmpfs_init();
 
     vfs_mount(vfs_root, NULL, "/", "tmpfs");
@@ -40,6 +46,9 @@ static void kernel_main(void) {
     vfs_create(vfs_root, "/dev", S_IFDIR);
     vfs_mount(vfs_root, NULL, "/dev", "devfs");
 
+    vfs_create(vfs_root, "/proc", S_IFDIR);
+    vfs_mount(vfs_root, NULL, "/proc", "procfs");
+
     pseudo_init();
     fbdev_init();
     tty_init();
@@ -63,21 +72,28 @@ static void kernel_main(void) {
 }
 
 UNMAP_AFTER_INIT void kernel_entry(void) {
+    smp_early_init();
     pmm_init();
     slab_init();
 
     cmdline_parse();
 
     vmm_init();
+    vma_init();
 
     acpi_init();
     hpet_init();
+    tsc_init();
 
     random_init();
     __stack_chk_guard = fast_rand();
 
+    pmm_selftest();
+    hashmap_selftest();
+
     process_init();
     sched_init();
+    fpu_init();
     smp_init();
 
     struct thread* main_thread = thread_create(kernel_process, (uintptr_t) &kernel_main, NULL, NULL, NULL, false);
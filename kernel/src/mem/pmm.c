@@ -1,23 +1,80 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <cpu/smp.h>
+#include <dev/hpet.h>
+#include <fs/page_cache.h>
 #include <mem/pmm.h>
+#include <mem/slab.h>
 #include <mem/vmm.h>
+#include <utils/cmdline.h>
 #include <utils/log.h>
 #include <utils/macros.h>
 #include <utils/panic.h>
+#include <utils/random.h>
 #include <utils/spinlock.h>
 #include <utils/string.h>
 
+#define PAGE_FLAG_FREE (1 << 0)
+
+/* a shares count that got this high stays there, the page is kept forever rather than freed too early */
+#define PAGE_SHARES_SATURATED UINT32_MAX
+
+#define SELFTEST_STRESS_SLOTS       4096
+#define SELFTEST_STRESS_MAX_PAGES   64
+
+/*
+ * The physical memory manager is a binary buddy allocator. Every physical page has a small
+ * metadata entry in pmm_pages, and the first page of each free block is tagged with PAGE_FLAG_FREE
+ * and the order of the block. The free lists themselves are threaded through the free pages
+ * (accessed through the HHDM), so a block can be unlinked in O(1) once its buddy is known.
+ *
+ * Single page allocations and frees are served from a per-CPU magazine (struct pmm_page_cache) with
+ * interrupts disabled, and only fall through to the buddy allocator and pmm_lock to refill or drain
+ * the magazine in batches of PMM_PAGE_CACHE_BATCH pages.
+ *
+ * Pages mapped into more than one address space (copy-on-write after fork) track how many extra
+ * mappings they have in their shares count; the page is only freed once the last mapping drops it.
+ *
+ * Demand-paged anonymous memory is backed by pages from a small pool of pre-zeroed pages, which idle
+ * CPUs top up so that the page fault path does not have to clear the page itself.
+ *
+ * Huge (2MiB) user pages are plain order 9 blocks. Every page inside keeps its own shares count, so a
+ * huge mapping can be split into 4KiB mappings without touching the counts, and its pages can later be
+ * freed one by one.
+ */
+struct page {
+    uint8_t flags;
+    uint8_t order;
+    uint32_t shares;
+};
+
+struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+};
+
+struct free_area {
+    struct free_block* head;
+    size_t count;
+};
+
 volatile struct limine_memmap_request memmap_request = {
     .id = LIMINE_MEMMAP_REQUEST,
     .revision = 0
 };
 
-READONLY_AFTER_INIT static uint8_t* pmm_bitmap = NULL;
+READONLY_AFTER_INIT static struct page* pmm_pages = NULL;
 READONLY_AFTER_INIT static size_t reserved_pages = 0;
 READONLY_AFTER_INIT static size_t usable_pages = 0;
+READONLY_AFTER_INIT static size_t highest_page_index = 0;
+READONLY_AFTER_INIT static bool page_cache_enabled = false;
+static struct free_area free_areas[PMM_MAX_ORDER + 1] = {0};
 static spinlock_t pmm_lock = {0};
-static size_t used_pages = 0;
-static size_t last_used_index = 0;
-static size_t highest_page_index = 0;
+static size_t free_pages = 0;
+
+static uintptr_t zero_pool[PMM_ZERO_POOL_SIZE];
+static size_t zero_pool_count = 0;
+static spinlock_t zero_pool_lock = {0};
 
 static char* memmap_type_str(uint64_t type) {
     switch (type) {
@@ -33,47 +90,275 @@ static char* memmap_type_str(uint64_t type) {
     }
 }
 
-static uintptr_t alloc_first_fit_from_last(size_t pages, uint64_t last_limit) {
-    size_t p = 0;
+static inline size_t pages_to_order(size_t pages) {
+    if (pages <= 1) {
+        return 0;
+    }
+    return 64 - __builtin_clzl(pages - 1);
+}
+
+static inline struct free_block* index_to_block(size_t index) {
+    return (struct free_block*) (index * PAGE_SIZE + HIGH_VMA);
+}
+
+static inline size_t block_to_index(struct free_block* block) {
+    return ((uintptr_t) block - HIGH_VMA) / PAGE_SIZE;
+}
+
+static void free_area_push(size_t order, size_t index) {
+    struct free_area* area = &free_areas[order];
+    struct free_block* block = index_to_block(index);
+
+    block->prev = NULL;
+    block->next = area->head;
+    if (area->head) {
+        area->head->prev = block;
+    }
+    area->head = block;
+    area->count++;
+
+    pmm_pages[index].flags |= PAGE_FLAG_FREE;
+    pmm_pages[index].order = order;
+}
+
+static void free_area_remove(size_t order, size_t index) {
+    struct free_area* area = &free_areas[order];
+    struct free_block* block = index_to_block(index);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        area->head = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    area->count--;
+
+    pmm_pages[index].flags &= ~PAGE_FLAG_FREE;
+    pmm_pages[index].order = 0;
+}
+
+/* takes a free block off its list and splits it, handing the upper halves back to the lower order free lists */
+static void buddy_split_block(size_t index, size_t block_order, size_t order) {
+    free_area_remove(block_order, index);
+
+    while (block_order > order) {
+        block_order--;
+        free_area_push(block_order, index + (1ul << block_order));
+    }
+}
+
+static size_t buddy_alloc_block(size_t order) {
+    size_t current_order = order;
+    while (current_order <= PMM_MAX_ORDER && free_areas[current_order].head == NULL) {
+        current_order++;
+    }
 
-    while (last_used_index < last_limit) {
-        last_used_index++;
-        if (!BITMAP_TEST(pmm_bitmap, last_used_index)) {
-            if (++p == pages) {
-                size_t page = last_used_index - pages;
+    if (current_order > PMM_MAX_ORDER) {
+        return (size_t) -1;
+    }
 
-                for (size_t i = page; i < last_used_index; i++) {
-                    BITMAP_SET(pmm_bitmap, i);
-                }
+    size_t index = block_to_index(free_areas[current_order].head);
+    buddy_split_block(index, current_order, order);
+    return index;
+}
 
-                return page * PAGE_SIZE;
+/* like buddy_alloc_block, but only takes blocks that end at or below limit_index, searching for one */
+static size_t buddy_alloc_block_below(size_t order, size_t limit_index) {
+    for (size_t current_order = order; current_order <= PMM_MAX_ORDER; current_order++) {
+        for (struct free_block* block = free_areas[current_order].head; block != NULL; block = block->next) {
+            size_t index = block_to_index(block);
+            if (index + (1ul << current_order) <= limit_index) {
+                buddy_split_block(index, current_order, order);
+                return index;
             }
-        } else {
-            p = 0;
         }
     }
 
-    return (uintptr_t) -1;
+    return (size_t) -1;
 }
 
-uintptr_t pmm_alloc(size_t pages) {
+static void buddy_free_block(size_t index, size_t order) {
+    while (order < PMM_MAX_ORDER) {
+        size_t buddy = index ^ (1ul << order);
+        if (buddy >= highest_page_index || !(pmm_pages[buddy].flags & PAGE_FLAG_FREE) || pmm_pages[buddy].order != order) {
+            break;
+        }
+
+        free_area_remove(order, buddy);
+        index &= ~(1ul << order);
+        order++;
+    }
+
+    free_area_push(order, index);
+}
+
+/* break an arbitrary page range into the largest naturally aligned blocks it contains */
+static void buddy_free_range(size_t index, size_t count) {
+    if (index >= highest_page_index) {
+        return;
+    }
+    count = MIN(count, highest_page_index - index);
+
+    while (count > 0) {
+        size_t order = index ? (size_t) __builtin_ctzl(index) : PMM_MAX_ORDER;
+        order = MIN(order, (size_t) (63 - __builtin_clzl(count)));
+        order = MIN(order, PMM_MAX_ORDER);
+
+        if (unlikely(pmm_pages[index].flags & PAGE_FLAG_FREE)) {
+            kpanic(NULL, true, "pmm double free of physical page 0x%p", index * PAGE_SIZE);
+        }
+
+        buddy_free_block(index, order);
+
+        index += 1ul << order;
+        count -= 1ul << order;
+    }
+}
+
+static void page_cache_refill(struct pmm_page_cache* cache) {
     spinlock_acquire(&pmm_lock);
 
-    size_t last = last_used_index;
-    uintptr_t ret = alloc_first_fit_from_last(pages, highest_page_index);
+    /* grab a whole batch as one block if possible, otherwise fall back to single pages */
+    size_t batch_order = pages_to_order(PMM_PAGE_CACHE_BATCH);
+    size_t index = buddy_alloc_block(batch_order);
 
-    if (ret == (uintptr_t) -1) {
-        last_used_index = 0;
-        ret = alloc_first_fit_from_last(pages, last);
+    if (index != (size_t) -1) {
+        for (size_t i = 0; i < PMM_PAGE_CACHE_BATCH; i++) {
+            cache->pages[cache->count++] = (index + i) * PAGE_SIZE;
+        }
+    } else {
+        for (size_t i = 0; i < PMM_PAGE_CACHE_BATCH; i++) {
+            index = buddy_alloc_block(0);
+            if (index == (size_t) -1) {
+                break;
+            }
+            cache->pages[cache->count++] = index * PAGE_SIZE;
+        }
     }
 
-    if (ret == (uintptr_t) -1) {
-        kpanic(NULL, true, "pmm unable to allocate %u physical pages", pages);
+    spinlock_release(&pmm_lock);
+    cache->refills++;
+}
+
+static void page_cache_drain(struct pmm_page_cache* cache) {
+    spinlock_acquire(&pmm_lock);
+
+    /* the oldest (coldest) pages sit at the bottom of the magazine, so those are returned first */
+    for (size_t i = 0; i < PMM_PAGE_CACHE_BATCH; i++) {
+        buddy_free_block(cache->pages[i] / PAGE_SIZE, 0);
+    }
+
+    spinlock_release(&pmm_lock);
+
+    cache->count -= PMM_PAGE_CACHE_BATCH;
+    memmove(cache->pages, cache->pages + PMM_PAGE_CACHE_BATCH, cache->count * sizeof(uintptr_t));
+    cache->drains++;
+}
+
+static uintptr_t page_cache_alloc(void) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct pmm_page_cache* cache = &this_cpu()->page_cache;
+    if (cache->count == 0) {
+        cache->misses++;
+        page_cache_refill(cache);
+    } else {
+        cache->hits++;
+    }
+
+    uintptr_t ret = cache->count ? cache->pages[--cache->count] : (uintptr_t) -1;
+
+    if (prev_int) {
+        sti();
+    }
+    return ret;
+}
+
+static void page_cache_free(uintptr_t addr) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct pmm_page_cache* cache = &this_cpu()->page_cache;
+    if (cache->count == PMM_PAGE_CACHE_SIZE) {
+        page_cache_drain(cache);
+    }
+
+    cache->pages[cache->count++] = addr;
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+static uintptr_t pmm_try_alloc(size_t pages) {
+    if (pages == 1 && page_cache_enabled) {
+        return page_cache_alloc();
+    }
+
+    size_t order = pages_to_order(pages);
+    if (order > PMM_MAX_ORDER) {
+        return (uintptr_t) -1;
+    }
+
+    spinlock_acquire(&pmm_lock);
+
+    size_t index = buddy_alloc_block(order);
+    if (index == (size_t) -1) {
+        spinlock_release(&pmm_lock);
+        return (uintptr_t) -1;
     }
 
-    used_pages += pages;
+    /* give back the tail of the block if the request was not a power of two */
+    size_t block_pages = 1ul << order;
+    if (block_pages > pages) {
+        buddy_free_range(index + pages, block_pages - pages);
+    }
 
     spinlock_release(&pmm_lock);
+    return index * PAGE_SIZE;
+}
+
+static size_t zero_pool_drain(void) {
+    bool prev_int = interrupt_state();
+    cli();
+    spinlock_acquire(&zero_pool_lock);
+
+    size_t count = zero_pool_count;
+    for (size_t i = 0; i < count; i++) {
+        pmm_free(zero_pool[i], 1);
+    }
+    zero_pool_count = 0;
+
+    spinlock_release(&zero_pool_lock);
+    if (prev_int) {
+        sti();
+    }
+
+    return count;
+}
+
+/* lets the slab allocator, the zeroed page pool and the page cache hand their pages back, returns how many */
+static size_t pmm_reclaim(void) {
+    return slab_reclaim() + zero_pool_drain() + page_cache_reclaim();
+}
+
+uintptr_t pmm_alloc(size_t pages) {
+    uintptr_t ret = pmm_try_alloc(pages);
+
+    if (unlikely(ret == (uintptr_t) -1)) {
+        if (pmm_reclaim() > 0) {
+            ret = pmm_try_alloc(pages);
+        }
+
+        if (ret == (uintptr_t) -1) {
+            kpanic(NULL, true, "pmm unable to allocate %u physical pages", pages);
+        }
+    }
+
+    __atomic_sub_fetch(&free_pages, pages, __ATOMIC_RELAXED);
     return ret;
 }
 
@@ -83,16 +368,258 @@ uintptr_t pmm_allocz(size_t pages) {
     return ret;
 }
 
-void pmm_free(uintptr_t addr, size_t pages) {
+uintptr_t pmm_alloc_zeroed_page(void) {
+    uintptr_t ret = 0;
+
+    bool prev_int = interrupt_state();
+    cli();
+    spinlock_acquire(&zero_pool_lock);
+
+    if (zero_pool_count > 0) {
+        ret = zero_pool[--zero_pool_count];
+    }
+
+    spinlock_release(&zero_pool_lock);
+    if (prev_int) {
+        sti();
+    }
+
+    /* page 0 is never handed out by the allocator, so it doubles as the empty pool marker */
+    return ret != 0 ? ret : pmm_allocz(1);
+}
+
+static uintptr_t pmm_try_alloc_below(size_t pages, uintptr_t limit) {
+    size_t order = pages_to_order(pages);
+    if (order > PMM_MAX_ORDER) {
+        return (uintptr_t) -1;
+    }
+
     spinlock_acquire(&pmm_lock);
-    size_t page = (uint64_t) addr / PAGE_SIZE;
 
-    for (size_t i = page; i < page + pages; i++) {
-        BITMAP_CLEAR(pmm_bitmap, i);
+    size_t index = buddy_alloc_block_below(order, MIN(limit / PAGE_SIZE, highest_page_index));
+    if (index == (size_t) -1) {
+        spinlock_release(&pmm_lock);
+        return (uintptr_t) -1;
+    }
+
+    size_t block_pages = 1ul << order;
+    if (block_pages > pages) {
+        buddy_free_range(index + pages, block_pages - pages);
     }
 
-    used_pages -= pages;
     spinlock_release(&pmm_lock);
+    return index * PAGE_SIZE;
+}
+
+/*
+ * Allocates pages that all lie below the given physical address, for devices that cannot reach all of
+ * memory, like DMA engines taking 32-bit addresses. It searches the free lists instead of taking their
+ * heads, so it is meant for the few buffers drivers set up, not for anything frequent.
+ */
+uintptr_t pmm_alloc_below(size_t pages, uintptr_t limit) {
+    uintptr_t ret = pmm_try_alloc_below(pages, limit);
+
+    if (unlikely(ret == (uintptr_t) -1)) {
+        if (pmm_reclaim() > 0) {
+            ret = pmm_try_alloc_below(pages, limit);
+        }
+
+        if (ret == (uintptr_t) -1) {
+            kpanic(NULL, true, "pmm unable to allocate %u physical pages below 0x%p", pages, limit);
+        }
+    }
+
+    __atomic_sub_fetch(&free_pages, pages, __ATOMIC_RELAXED);
+    return ret;
+}
+
+uintptr_t pmm_allocz_below(size_t pages, uintptr_t limit) {
+    uintptr_t ret = pmm_alloc_below(pages, limit);
+    memset((void*) (ret + HIGH_VMA), 0, PAGE_SIZE * pages);
+    return ret;
+}
+
+/* opportunistic allocation of one naturally aligned 2MiB block, returns 0 instead of panicking */
+uintptr_t pmm_alloc_huge_page(void) {
+    size_t pages = BIGPAGE_SIZE / PAGE_SIZE;
+
+    if (pmm_get_free_pages() < PMM_HUGE_PAGE_MIN_FREE) {
+        return 0;
+    }
+
+    uintptr_t ret = pmm_try_alloc(pages);
+    if (ret == (uintptr_t) -1) {
+        return 0;
+    }
+
+    __atomic_sub_fetch(&free_pages, pages, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/*
+ * Zeroes one page into the pool. This runs from the idle loop, which the scheduler abandons instead of
+ * resuming, so interrupts stay off until the page is accounted for to avoid leaking it.
+ */
+bool pmm_zero_pool_refill(void) {
+    if (__atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED) >= PMM_ZERO_POOL_SIZE ||
+            pmm_get_free_pages() < PMM_ZERO_POOL_MIN_FREE) {
+        return false;
+    }
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    bool ret = false;
+
+    uintptr_t page = pmm_try_alloc(1);
+    if (page == (uintptr_t) -1) {
+        goto end;
+    }
+
+    __atomic_sub_fetch(&free_pages, 1, __ATOMIC_RELAXED);
+    memset((void*) (page + HIGH_VMA), 0, PAGE_SIZE);
+
+    spinlock_acquire(&zero_pool_lock);
+    ret = zero_pool_count < PMM_ZERO_POOL_SIZE;
+    if (ret) {
+        zero_pool[zero_pool_count++] = page;
+    }
+    spinlock_release(&zero_pool_lock);
+
+    if (!ret) {
+        pmm_free(page, 1);
+    }
+
+end:
+    if (prev_int) {
+        sti();
+    }
+    return ret;
+}
+
+void pmm_free(uintptr_t addr, size_t pages) {
+    size_t index = addr / PAGE_SIZE;
+    if (index >= highest_page_index) {
+        return;
+    }
+
+    pages = MIN(pages, highest_page_index - index);
+    __atomic_add_fetch(&free_pages, pages, __ATOMIC_RELAXED);
+
+    if (pages == 1 && page_cache_enabled) {
+        page_cache_free(index * PAGE_SIZE);
+        return;
+    }
+
+    spinlock_acquire(&pmm_lock);
+    buddy_free_range(index, pages);
+    spinlock_release(&pmm_lock);
+}
+
+void pmm_page_ref(uintptr_t addr) {
+    size_t index = addr / PAGE_SIZE;
+    if (unlikely(index >= highest_page_index)) {
+        return;
+    }
+
+    uint32_t shares = __atomic_load_n(&pmm_pages[index].shares, __ATOMIC_ACQUIRE);
+    do {
+        if (unlikely(shares == PAGE_SHARES_SATURATED)) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&pmm_pages[index].shares, &shares, shares + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+bool pmm_page_unref(uintptr_t addr) {
+    size_t index = addr / PAGE_SIZE;
+    if (unlikely(index >= highest_page_index)) {
+        return false;
+    }
+
+    uint32_t shares = __atomic_load_n(&pmm_pages[index].shares, __ATOMIC_ACQUIRE);
+    do {
+        if (shares == 0) {
+            pmm_free(addr, 1);
+            return true;
+        }
+        if (unlikely(shares == PAGE_SHARES_SATURATED)) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&pmm_pages[index].shares, &shares, shares - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return false;
+}
+
+bool pmm_page_is_shared(uintptr_t addr) {
+    size_t index = addr / PAGE_SIZE;
+    if (unlikely(index >= highest_page_index)) {
+        return true;
+    }
+    return __atomic_load_n(&pmm_pages[index].shares, __ATOMIC_ACQUIRE) != 0;
+}
+
+void pmm_huge_page_ref(uintptr_t addr) {
+    for (size_t i = 0; i < BIGPAGE_SIZE / PAGE_SIZE; i++) {
+        pmm_page_ref(addr + i * PAGE_SIZE);
+    }
+}
+
+void pmm_huge_page_unref(uintptr_t addr) {
+    size_t index = addr / PAGE_SIZE;
+    size_t pages = BIGPAGE_SIZE / PAGE_SIZE;
+    if (unlikely(index + pages > highest_page_index)) {
+        return;
+    }
+
+    /* the common case is the only mapping going away, which can give back the whole block at once */
+    if (!pmm_huge_page_is_shared(addr)) {
+        pmm_free(addr, pages);
+        return;
+    }
+
+    for (size_t i = 0; i < pages; i++) {
+        pmm_page_unref(addr + i * PAGE_SIZE);
+    }
+}
+
+bool pmm_huge_page_is_shared(uintptr_t addr) {
+    for (size_t i = 0; i < BIGPAGE_SIZE / PAGE_SIZE; i++) {
+        if (pmm_page_is_shared(addr + i * PAGE_SIZE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t pmm_get_free_pages(void) {
+    return __atomic_load_n(&free_pages, __ATOMIC_RELAXED);
+}
+
+size_t pmm_get_total_pages(void) {
+    return usable_pages;
+}
+
+void pmm_get_page_cache_stats(struct pmm_page_cache_stats* stats) {
+    memset(stats, 0, sizeof(struct pmm_page_cache_stats));
+
+    if (!page_cache_enabled) {
+        return;
+    }
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct pmm_page_cache* cache = &percpus[i].page_cache;
+        stats->cached_pages += __atomic_load_n(&cache->count, __ATOMIC_RELAXED);
+        stats->hits += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+        stats->refills += __atomic_load_n(&cache->refills, __ATOMIC_RELAXED);
+        stats->drains += __atomic_load_n(&cache->drains, __ATOMIC_RELAXED);
+    }
+}
+
+/* called by each CPU once its GS base points at its struct percpu */
+UNMAP_AFTER_INIT void pmm_page_cache_init(void) {
+    this_cpu()->page_cache.count = 0;
+    page_cache_enabled = true;
 }
 
 UNMAP_AFTER_INIT void pmm_init(void) {
@@ -118,7 +645,7 @@ UNMAP_AFTER_INIT void pmm_init(void) {
     }
 
     highest_page_index = highest_addr / PAGE_SIZE;
-    uint64_t pmm_bitmap_size = ALIGN_UP(highest_page_index / 8, PAGE_SIZE);
+    uint64_t pmm_pages_size = ALIGN_UP(highest_page_index * sizeof(struct page), PAGE_SIZE);
 
     for (size_t i = 0; i < memmap_response->entry_count; i++) {
         struct limine_memmap_entry* entry = entries[i];
@@ -127,17 +654,21 @@ UNMAP_AFTER_INIT void pmm_init(void) {
             continue;
         }
 
-        if (entry->length >= pmm_bitmap_size) {
-            pmm_bitmap = (uint8_t*) (entry->base + HIGH_VMA);
-            memset(pmm_bitmap, 0xff, pmm_bitmap_size);
+        if (entry->length >= pmm_pages_size) {
+            pmm_pages = (struct page*) (entry->base + HIGH_VMA);
+            memset(pmm_pages, 0, pmm_pages_size);
 
-            entry->length -= pmm_bitmap_size;
-            entry->base += pmm_bitmap_size;
+            entry->length -= pmm_pages_size;
+            entry->base += pmm_pages_size;
 
             break;
         }
     }
 
+    if (unlikely(pmm_pages == NULL)) {
+        kpanic(NULL, false, "no usable memory region is large enough to hold the page metadata");
+    }
+
     for (size_t i = 0; i < memmap_response->entry_count; i++) {
         struct limine_memmap_entry* entry = entries[i];
 
@@ -145,11 +676,157 @@ UNMAP_AFTER_INIT void pmm_init(void) {
             continue;
         }
 
-        for (uint64_t j = 0; j < entry->length; j += PAGE_SIZE) {
-            BITMAP_CLEAR(pmm_bitmap, (entry->base + j) / PAGE_SIZE);
+        size_t start = DIV_CEIL(entry->base, PAGE_SIZE);
+        size_t end = (entry->base + entry->length) / PAGE_SIZE;
+
+        /* physical page 0 is never handed out, since a zero address signals allocation failure */
+        start = MAX(start, 1);
+        if (start >= end) {
+            continue;
         }
+
+        buddy_free_range(start, end - start);
+        free_pages += end - start;
     }
 
     klog("[pmm] usable memory: %uMiB reserved memory: %uMiB\n", (usable_pages * PAGE_SIZE) >> 20, (reserved_pages * PAGE_SIZE) >> 20);
+    for (size_t i = 0; i <= PMM_MAX_ORDER; i++) {
+        if (free_areas[i].count) {
+            klog("- order %u (%uKiB blocks): %u free\n", i, (PAGE_SIZE << i) >> 10, free_areas[i].count);
+        }
+    }
     klog("[pmm] initialized physical memory manager\n");
 }
+
+static inline uint64_t hpet_ticks_to_ns(uint64_t ticks) {
+    return (ticks * hpet_clock_period) / 1000000;
+}
+
+UNMAP_AFTER_INIT static void pmm_selftest_pattern(uintptr_t addr, size_t pages, uint8_t pattern) {
+    uint8_t* ptr = (uint8_t*) (addr + HIGH_VMA);
+    memset(ptr, pattern, pages * PAGE_SIZE);
+
+    for (size_t i = 0; i < pages * PAGE_SIZE; i += PAGE_SIZE / 4) {
+        if (ptr[i] != pattern) {
+            kpanic(NULL, false, "pmm self-test: block at 0x%p was clobbered", addr);
+        }
+    }
+}
+
+UNMAP_AFTER_INIT static void pmm_selftest_stress(void) {
+    struct stress_slot {
+        uintptr_t addr;
+        size_t pages;
+    };
+
+    size_t slot_count = MIN(SELFTEST_STRESS_SLOTS, pmm_get_free_pages() / (SELFTEST_STRESS_MAX_PAGES * 2));
+    size_t slot_pages = DIV_CEIL(slot_count * sizeof(struct stress_slot), PAGE_SIZE);
+    if (slot_count == 0) {
+        klog("[pmm] not enough free memory to run stress test\n");
+        return;
+    }
+
+    uintptr_t slots_paddr = pmm_allocz(slot_pages);
+    struct stress_slot* slots = (struct stress_slot*) (slots_paddr + HIGH_VMA);
+    size_t baseline = pmm_get_free_pages();
+
+    /* pass 1: fill every slot with a randomly sized block */
+    uint64_t start = hpet_count();
+    for (size_t i = 0; i < slot_count; i++) {
+        slots[i].pages = (fast_rand() % SELFTEST_STRESS_MAX_PAGES) + 1;
+        slots[i].addr = pmm_alloc(slots[i].pages);
+    }
+    uint64_t fill_ns = hpet_ticks_to_ns(hpet_count() - start);
+
+    /* pass 2: free every other block to leave the free lists fragmented */
+    for (size_t i = 0; i < slot_count; i += 2) {
+        pmm_free(slots[i].addr, slots[i].pages);
+    }
+
+    /* pass 3: allocate into the holes with a different size distribution */
+    start = hpet_count();
+    for (size_t i = 0; i < slot_count; i += 2) {
+        slots[i].pages = 1ul << (fast_rand() % (pages_to_order(SELFTEST_STRESS_MAX_PAGES) + 1));
+        slots[i].addr = pmm_alloc(slots[i].pages);
+        if (!IS_ALIGNED(slots[i].addr, slots[i].pages * PAGE_SIZE)) {
+            kpanic(NULL, false, "pmm self-test: %u page block at 0x%p is misaligned", slots[i].pages, slots[i].addr);
+        }
+    }
+    uint64_t refill_ns = hpet_ticks_to_ns(hpet_count() - start);
+
+    /* pass 4: release everything in a scattered order so the coalescing path is exercised */
+    start = hpet_count();
+    for (size_t i = 0; i < slot_count; i++) {
+        size_t j = (i * 7919) % slot_count;
+        if (slots[j].addr != 0) {
+            pmm_free(slots[j].addr, slots[j].pages);
+            slots[j].addr = 0;
+        }
+    }
+    for (size_t i = 0; i < slot_count; i++) {
+        if (slots[i].addr != 0) {
+            pmm_free(slots[i].addr, slots[i].pages);
+        }
+    }
+    uint64_t drain_ns = hpet_ticks_to_ns(hpet_count() - start);
+
+    if (pmm_get_free_pages() != baseline) {
+        kpanic(NULL, false, "pmm self-test: stress test leaked %u pages", baseline - pmm_get_free_pages());
+    }
+
+    pmm_free(slots_paddr, slot_pages);
+
+    klog("[pmm] stress: %u allocations in %uus (%uns/op)\n", slot_count, fill_ns / 1000, fill_ns / slot_count);
+    klog("[pmm] stress: %u fragmented allocations in %uus (%uns/op)\n", DIV_CEIL(slot_count, 2), refill_ns / 1000, refill_ns / DIV_CEIL(slot_count, 2));
+    klog("[pmm] stress: %u frees in %uus (%uns/op)\n", slot_count, drain_ns / 1000, drain_ns / slot_count);
+}
+
+UNMAP_AFTER_INIT void pmm_selftest(void) {
+    char* mode = cmdline_get("pmm_selftest");
+    if (mode == NULL) {
+        return;
+    }
+
+    bool stress = !strcmp(mode, "stress");
+    klog("[pmm] running self-test%s...\n", stress ? " with stress mode" : "");
+
+    size_t baseline = pmm_get_free_pages();
+
+    /* every power of two request must come back naturally aligned, up to 2MiB for huge pages */
+    for (size_t order = 0; order <= pages_to_order(BIGPAGE_SIZE / PAGE_SIZE); order++) {
+        size_t pages = 1ul << order;
+        uintptr_t addr = pmm_alloc(pages);
+        if (!IS_ALIGNED(addr, pages * PAGE_SIZE)) {
+            kpanic(NULL, false, "pmm self-test: order %u block at 0x%p is misaligned", order, addr);
+        }
+
+        pmm_selftest_pattern(addr, pages, (uint8_t) order);
+        pmm_free(addr, pages);
+    }
+
+    /* odd sized requests must return the unused tail of their block */
+    uintptr_t a = pmm_alloc(3);
+    uintptr_t b = pmm_alloc(65);
+    pmm_selftest_pattern(a, 3, 0xa5);
+    pmm_selftest_pattern(b, 65, 0x5a);
+    pmm_free(a, 3);
+    pmm_free(b, 65);
+
+    /* limited requests must stay below their limit, whatever order the free lists are in */
+    uintptr_t dma = pmm_alloc_below(3, PMM_DMA32_LIMIT);
+    if (dma + 3 * PAGE_SIZE > PMM_DMA32_LIMIT) {
+        kpanic(NULL, false, "pmm self-test: block at 0x%p is above its limit", dma);
+    }
+    pmm_selftest_pattern(dma, 3, 0x32);
+    pmm_free(dma, 3);
+
+    if (pmm_get_free_pages() != baseline) {
+        kpanic(NULL, false, "pmm self-test: leaked %u pages", baseline - pmm_get_free_pages());
+    }
+
+    if (stress) {
+        pmm_selftest_stress();
+    }
+
+    klog("[pmm] self-test passed\n");
+}
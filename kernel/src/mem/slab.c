@@ -1,3 +1,5 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
 #include <mem/pmm.h>
 #include <mem/vmm.h>
 #include <mem/slab.h>
@@ -6,7 +8,24 @@
 #include <utils/string.h>
 
 #define BIG_ALLOC_HEADER_MAGIC 0xfafeceedabcdeffe
-#define OBJECTS_PER_SLAB 512
+
+/*
+ * Every slab is a naturally aligned block of SLAB_SIZE bytes with its struct slab header at the start,
+ * so the slab owning any object is found by masking the object's address. Free objects are linked
+ * together through their first word, which makes both allocation and free O(1).
+ *
+ * Slab objects are never placed on a page boundary, which keeps page aligned pointers unambiguous:
+ * they always belong to a big allocation whose header lives in the page right before them.
+ *
+ * In front of the slabs, every CPU keeps a small magazine of objects for each cache (struct
+ * slab_magazine in struct percpu). Allocations and frees are served from it with interrupts disabled,
+ * and the cache lock is only taken to refill or drain a magazine in batches.
+ */
+#define SLAB_SIZE           0x8000
+#define SLAB_OBJECT_ALIGN   8
+#define SLAB_MAX_EMPTY      1
+
+#define KMALLOC_MAX_SIZE    2048
 
 struct slab {
     struct cache* cache;
@@ -14,8 +33,7 @@ struct slab {
     size_t available_objects;
     size_t total_objects;
 
-    uint8_t* bitmap;
-    void* buffer;
+    void* freelist;
 
     struct slab* prev;
     struct slab* next;
@@ -29,138 +47,276 @@ struct big_alloc_header {
 
 READONLY_AFTER_INIT static struct cache root_cache = {0};
 READONLY_AFTER_INIT static struct cache* kmalloc_caches[11] = {0};
+READONLY_AFTER_INIT static uint8_t kmalloc_size_classes[KMALLOC_MAX_SIZE / SLAB_OBJECT_ALIGN] = {0};
+READONLY_AFTER_INIT static bool magazines_enabled = false;
 
 static struct cache* cache_list;
+static size_t next_magazine_index = 0;
 
-static struct slab* cache_alloc_slab(struct cache* cache) {
-    struct slab* new_slab = (struct slab*) (pmm_allocz(cache->pages_per_slab) + HIGH_VMA);
-
-    new_slab->bitmap = (uint8_t*) ((uintptr_t) new_slab + sizeof(struct slab));
-    new_slab->buffer = (void*) (ALIGN_UP((uintptr_t) new_slab->bitmap + OBJECTS_PER_SLAB - HIGH_VMA, 16) + HIGH_VMA);
-    new_slab->available_objects = OBJECTS_PER_SLAB;
-    new_slab->total_objects = OBJECTS_PER_SLAB;
-    new_slab->cache = cache;
-
-    if (cache->empty_slabs) {
-        cache->empty_slabs->prev = new_slab;
-    }
-
-    new_slab->next = cache->empty_slabs;
-    cache->empty_slabs = new_slab;
-
-    return new_slab;
+static inline struct slab* object_to_slab(void* object) {
+    return (struct slab*) ALIGN_DOWN((uintptr_t) object, SLAB_SIZE);
 }
 
-static bool cache_move_slab(struct slab** dest_head, struct slab** src_head, struct slab* s) {
-    if (!s || !*src_head) {
-        return false; 
-    }
-
+static void cache_list_remove(struct slab** head, struct slab* s) {
     if (s->next) {
         s->next->prev = s->prev;
     }
     if (s->prev) {
         s->prev->next = s->next;
     }
-    if (*src_head == s) {
-        *src_head = s->next;
-    }
-    if (!*dest_head) {
-        s->prev = NULL;
-        s->next = NULL;
-        *dest_head = s; 
-        return true;
+    if (*head == s) {
+        *head = s->next;
     }
 
-    s->next = *dest_head;
     s->prev = NULL;
+    s->next = NULL;
+}
 
-    if (*dest_head) {
-        (*dest_head)->prev = s;
+static void cache_list_push(struct slab** head, struct slab* s) {
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) {
+        (*head)->prev = s;
     }
-    *dest_head = s;
+    *head = s;
+}
 
-    return true;
+static void cache_move_slab(struct slab** dest_head, struct slab** src_head, struct slab* s) {
+    cache_list_remove(src_head, s);
+    cache_list_push(dest_head, s);
 }
 
-static void* slab_alloc_object(struct slab* slab) {
-    if (slab == NULL) {
+static struct slab* cache_alloc_slab(struct cache* cache) {
+    uintptr_t paddr = pmm_alloc(SLAB_SIZE / PAGE_SIZE);
+    if (paddr == 0) {
         return NULL;
     }
 
-    for (size_t i = 0; i < slab->total_objects; i++) {
-        if (!BITMAP_TEST(slab->bitmap, i)) {
-            BITMAP_SET(slab->bitmap, i);
-            slab->available_objects--;
+    struct slab* new_slab = (struct slab*) (paddr + HIGH_VMA);
+    new_slab->cache = cache;
+    new_slab->total_objects = 0;
+
+    uintptr_t object = ALIGN_UP((uintptr_t) new_slab + sizeof(struct slab), SLAB_OBJECT_ALIGN);
+    uintptr_t end = (uintptr_t) new_slab + SLAB_SIZE;
+    void** tail = &new_slab->freelist;
 
-            void* object = (void*) (((uintptr_t) slab->buffer) + (i * slab->cache->object_size));
-            memset(object, 0, slab->cache->object_size);
-            return object;
+    for (; object + cache->object_size <= end; object += cache->object_size) {
+        if (IS_ALIGNED(object, PAGE_SIZE)) {
+            continue;
         }
+
+        *tail = (void*) object;
+        tail = (void**) object;
+        new_slab->total_objects++;
     }
 
-    return NULL;
+    *tail = NULL;
+    new_slab->available_objects = new_slab->total_objects;
+
+    cache_list_push(&cache->empty_slabs, new_slab);
+    cache->empty_slab_count++;
+
+    return new_slab;
 }
 
-static bool slab_free_object(struct slab* slab, void* object) {
-    if (slab == NULL) {
-        return false;
-    }
+static void cache_release_slab(struct slab* slab) {
+    /* clear the header so stale slab memory can never be mistaken for a live slab */
+    slab->cache = NULL;
+    pmm_free((uintptr_t) slab - HIGH_VMA, SLAB_SIZE / PAGE_SIZE);
+}
 
-    spinlock_acquire(&slab->cache->lock);
-
-    struct slab* root = slab;
-    while (slab) {
-        if ((uintptr_t) slab->buffer <= (uintptr_t) object && ((uintptr_t) slab->buffer + slab->cache->object_size * slab->total_objects) > (uintptr_t) object) {
-            size_t index = ((uintptr_t) object - (uintptr_t) slab->buffer) / slab->cache->object_size;
-            if (BITMAP_TEST(slab->bitmap, index)) {
-                BITMAP_CLEAR(slab->bitmap, index);
-                slab->available_objects++;
-                spinlock_release(&root->cache->lock);
-                return true;
+/* must be called with cache->lock held */
+static void* cache_take_object(struct cache* cache) {
+    struct slab* slab = cache->partial_slabs;
+    if (!slab) {
+        slab = cache->empty_slabs;
+        if (!slab) {
+            slab = cache_alloc_slab(cache);
+            if (unlikely(slab == NULL)) {
+                return NULL;
             }
         }
 
-        slab = slab->next;
+        cache_move_slab(&cache->partial_slabs, &cache->empty_slabs, slab);
+        cache->empty_slab_count--;
+    }
+
+    void* object = slab->freelist;
+    slab->freelist = *(void**) object;
+    slab->available_objects--;
+
+    if (slab->available_objects == 0) {
+        cache_move_slab(&cache->full_slabs, &cache->partial_slabs, slab);
     }
 
-    spinlock_release(&root->cache->lock);
-    return false;
+    return object;
 }
 
-void* cache_alloc_object(struct cache* cache) {
-    spinlock_acquire(&cache->lock);
+/* must be called with cache->lock held */
+static void cache_put_object(struct cache* cache, void* object) {
+    struct slab* slab = object_to_slab(object);
 
-    struct slab* slab = NULL;
-    if (cache->partial_slabs) {
-        slab = cache->partial_slabs;
-    } else if (cache->empty_slabs) {
-        slab = cache->empty_slabs;
+    *(void**) object = slab->freelist;
+    slab->freelist = object;
+    slab->available_objects++;
+
+    if (slab->available_objects == 1) {
+        cache_move_slab(&cache->partial_slabs, &cache->full_slabs, slab);
     }
 
-    if (!slab) {
-        slab = cache_alloc_slab(cache);
+    if (slab->available_objects == slab->total_objects) {
+        if (cache->empty_slab_count >= SLAB_MAX_EMPTY) {
+            cache_list_remove(&cache->partial_slabs, slab);
+            cache_release_slab(slab);
+            return;
+        }
+
+        cache_move_slab(&cache->empty_slabs, &cache->partial_slabs, slab);
+        cache->empty_slab_count++;
     }
+}
 
-    void* addr = slab_alloc_object(slab);
+static void magazine_refill(struct cache* cache, struct slab_magazine* magazine) {
+    spinlock_acquire(&cache->lock);
 
-    if (slab->available_objects == 0) {
-        cache_move_slab(&cache->full_slabs, &cache->partial_slabs, slab);
-    } else if (slab->available_objects == (slab->total_objects - 1)) {
-        cache_move_slab(&cache->partial_slabs, &cache->empty_slabs, slab);
+    while (magazine->count < SLAB_MAGAZINE_BATCH) {
+        void* object = cache_take_object(cache);
+        if (object == NULL) {
+            break;
+        }
+        magazine->objects[magazine->count++] = object;
     }
 
     spinlock_release(&cache->lock);
-    return addr;
+}
+
+static void magazine_drain(struct cache* cache, struct slab_magazine* magazine, size_t count) {
+    spinlock_acquire(&cache->lock);
+
+    /* the oldest (coldest) objects sit at the bottom of the magazine, so those are returned first */
+    for (size_t i = 0; i < count; i++) {
+        cache_put_object(cache, magazine->objects[i]);
+    }
+
+    spinlock_release(&cache->lock);
+
+    magazine->count -= count;
+    memmove(magazine->objects, magazine->objects + count, magazine->count * sizeof(void*));
+}
+
+void* cache_alloc_object(struct cache* cache) {
+    void* object = NULL;
+
+    if (magazines_enabled && cache->magazine_index != SLAB_NO_MAGAZINE) {
+        bool prev_int = interrupt_state();
+        cli();
+
+        struct slab_magazine* magazine = &this_cpu()->slab_magazines[cache->magazine_index];
+        if (magazine->count == 0) {
+            magazine_refill(cache, magazine);
+        }
+
+        if (magazine->count > 0) {
+            object = magazine->objects[--magazine->count];
+        }
+
+        if (prev_int) {
+            sti();
+        }
+    } else {
+        spinlock_acquire(&cache->lock);
+        object = cache_take_object(cache);
+        spinlock_release(&cache->lock);
+    }
+
+    if (likely(object != NULL)) {
+        memset(object, 0, cache->object_size);
+    }
+    return object;
 }
 
 bool cache_free_object(struct cache* cache, void* object) {
-    if (slab_free_object(cache->partial_slabs, object)) {
-        return true;
-    } else if (slab_free_object(cache->full_slabs, object)) {
-        return true;
+    if (unlikely(object_to_slab(object)->cache != cache)) {
+        return false;
+    }
+
+    if (magazines_enabled && cache->magazine_index != SLAB_NO_MAGAZINE) {
+        bool prev_int = interrupt_state();
+        cli();
+
+        struct slab_magazine* magazine = &this_cpu()->slab_magazines[cache->magazine_index];
+        if (magazine->count == SLAB_MAGAZINE_SIZE) {
+            magazine_drain(cache, magazine, SLAB_MAGAZINE_BATCH);
+        }
+
+        magazine->objects[magazine->count++] = object;
+
+        if (prev_int) {
+            sti();
+        }
+    } else {
+        spinlock_acquire(&cache->lock);
+        cache_put_object(cache, object);
+        spinlock_release(&cache->lock);
+    }
+
+    return true;
+}
+
+size_t slab_reclaim(void) {
+    size_t freed_pages = 0;
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    for (struct cache* cache = cache_list; cache != NULL; cache = cache->next) {
+        /* a cache that is busy may be the one asking the PMM for memory right now */
+        if (!spinlock_test_and_acquire(&cache->lock)) {
+            continue;
+        }
+
+        /* objects parked in this CPU's magazine keep their slabs alive, so hand them back first */
+        if (magazines_enabled && cache->magazine_index != SLAB_NO_MAGAZINE) {
+            struct slab_magazine* magazine = &this_cpu()->slab_magazines[cache->magazine_index];
+            for (size_t i = 0; i < magazine->count; i++) {
+                cache_put_object(cache, magazine->objects[i]);
+            }
+            magazine->count = 0;
+        }
+
+        struct slab* empty = cache->empty_slabs;
+        cache->empty_slabs = NULL;
+        cache->empty_slab_count = 0;
+
+        spinlock_release(&cache->lock);
+
+        while (empty != NULL) {
+            struct slab* next = empty->next;
+            cache_release_slab(empty);
+            freed_pages += SLAB_SIZE / PAGE_SIZE;
+            empty = next;
+        }
+    }
+
+    if (prev_int) {
+        sti();
     }
-    return false;
+
+    return freed_pages;
+}
+
+/* called by each CPU once its GS base points at its struct percpu */
+UNMAP_AFTER_INIT void slab_magazines_init(void) {
+    memset(this_cpu()->slab_magazines, 0, sizeof(this_cpu()->slab_magazines));
+    magazines_enabled = true;
+}
+
+static void cache_init(struct cache* cache, const char* name, size_t object_size) {
+    cache->name = name;
+    cache->object_size = ALIGN_UP(MAX(object_size, sizeof(void*)), SLAB_OBJECT_ALIGN);
+
+    size_t index = __atomic_fetch_add(&next_magazine_index, 1, __ATOMIC_RELAXED);
+    cache->magazine_index = index < SLAB_MAX_MAGAZINE_CACHES ? index : SLAB_NO_MAGAZINE;
 }
 
 struct cache* slab_cache_create(const char* name, size_t object_size) {
@@ -169,9 +325,7 @@ struct cache* slab_cache_create(const char* name, size_t object_size) {
         return NULL;
     }
 
-    new_cache->name = name;
-    new_cache->object_size = object_size;
-    new_cache->pages_per_slab = DIV_CEIL(object_size * OBJECTS_PER_SLAB + sizeof(struct slab) + OBJECTS_PER_SLAB, PAGE_SIZE);
+    cache_init(new_cache, name, object_size);
 
     new_cache->next = cache_list;
     cache_list = new_cache;
@@ -180,9 +334,7 @@ struct cache* slab_cache_create(const char* name, size_t object_size) {
 }
 
 UNMAP_AFTER_INIT void slab_init(void) {
-    root_cache.name = "cache cache";
-    root_cache.object_size = sizeof(struct cache);
-    root_cache.pages_per_slab = DIV_CEIL(sizeof(struct cache) * OBJECTS_PER_SLAB + sizeof(struct slab) + OBJECTS_PER_SLAB, PAGE_SIZE);
+    cache_init(&root_cache, "cache cache", sizeof(struct cache));
 
     cache_list = &root_cache;
 
@@ -197,6 +349,15 @@ UNMAP_AFTER_INIT void slab_init(void) {
     kmalloc_caches[8] = slab_cache_create("kmalloc_512 cache", 512);
     kmalloc_caches[9] = slab_cache_create("kmalloc_1024 cache", 1024);
     kmalloc_caches[10] = slab_cache_create("kmalloc_2048 cache", 2048);
+
+    /* map every 8 byte size step to the smallest cache that fits it */
+    size_t cache_index = 0;
+    for (size_t i = 0; i < SIZEOF_ARRAY(kmalloc_size_classes); i++) {
+        while (kmalloc_caches[cache_index]->object_size < (i + 1) * SLAB_OBJECT_ALIGN) {
+            cache_index++;
+        }
+        kmalloc_size_classes[i] = cache_index;
+    }
 }
 
 void* kmalloc(size_t size) {
@@ -204,10 +365,8 @@ void* kmalloc(size_t size) {
         return NULL;
     }
 
-    for (size_t i = 0; i < SIZEOF_ARRAY(kmalloc_caches); i++) {
-        if (kmalloc_caches[i]->object_size >= size) {
-            return cache_alloc_object(kmalloc_caches[i]);
-        }
+    if (size <= KMALLOC_MAX_SIZE) {
+        return cache_alloc_object(kmalloc_caches[kmalloc_size_classes[(size - 1) / SLAB_OBJECT_ALIGN]]);
     }
 
     size_t page_count = DIV_CEIL(size, PAGE_SIZE);
@@ -231,6 +390,8 @@ void* krealloc(void* ptr, size_t size) {
         return kmalloc(size);
     }
 
+    size_t old_size;
+
     if (!((uintptr_t) ptr & 0xfff)) {
         struct big_alloc_header* header = (struct big_alloc_header*) ((uintptr_t) ptr - PAGE_SIZE);
         if (DIV_CEIL(header->size, PAGE_SIZE) == DIV_CEIL(size, PAGE_SIZE)) {
@@ -238,55 +399,23 @@ void* krealloc(void* ptr, size_t size) {
             return ptr;
         }
 
-        void* new_ptr = kmalloc(size);
-        if (new_ptr == NULL) {
-            return NULL;
-        }
-
-        if (header->size > size) {
-            memcpy(new_ptr, ptr, size);
-        } else {
-            memcpy(new_ptr, ptr, header->size);
-        }
-
-        kfree(ptr);
-        return new_ptr;
-    }
-
-    for (size_t i = 0; i < SIZEOF_ARRAY(kmalloc_caches); i++) {
-        struct cache* cache = kmalloc_caches[i];
-        spinlock_acquire(&cache->lock);
-
-        struct slab* slab = cache->partial_slabs;
-        while (slab) {
-            if ((uintptr_t) slab->buffer <= (uintptr_t) ptr && ((uintptr_t) slab->buffer + slab->cache->object_size * slab->total_objects) > (uintptr_t) ptr) {
-                if (cache->object_size >= size) {
-                    spinlock_release(&cache->lock);
-                    return ptr;
-                }
-            }
-            slab = slab->next;
-        }
-
-        slab = cache->full_slabs;
-        while (slab) {
-            if ((uintptr_t) slab->buffer <= (uintptr_t) ptr && ((uintptr_t) slab->buffer + slab->cache->object_size * slab->total_objects) > (uintptr_t) ptr) {
-                if (cache->object_size >= size) {
-                    spinlock_release(&cache->lock);
-                    return ptr;
-                }
-            }
-            slab = slab->next;
+        old_size = header->size;
+    } else {
+        struct cache* cache = object_to_slab(ptr)->cache;
+        if (cache->object_size >= size) {
+            return ptr;
         }
 
-        spinlock_release(&cache->lock);
+        old_size = cache->object_size;
     }
 
     void* new_ptr = kmalloc(size);
-    if (new_ptr) {
-        memcpy(new_ptr, ptr, size);
+    if (new_ptr == NULL) {
+        return NULL;
     }
 
+    memcpy(new_ptr, ptr, MIN(old_size, size));
+
     kfree(ptr);
     return new_ptr;
 }
@@ -298,13 +427,12 @@ void kfree(void* ptr) {
 
     if (!((uintptr_t) ptr & 0xfff)) {
         struct big_alloc_header* header = (struct big_alloc_header*) ((uintptr_t) ptr - PAGE_SIZE);
-        pmm_free((uintptr_t) ptr - HIGH_VMA, header->page_count + 1);
+        pmm_free((uintptr_t) ptr - PAGE_SIZE - HIGH_VMA, header->page_count + 1);
         return;
     }
 
-    for (size_t i = 0; i < SIZEOF_ARRAY(kmalloc_caches); i++) {
-        if (cache_free_object(kmalloc_caches[i], ptr)) {
-            return;
-        }
+    struct slab* slab = object_to_slab(ptr);
+    if (likely(slab->cache != NULL)) {
+        cache_free_object(slab->cache, ptr);
     }
 }
@@ -0,0 +1,557 @@
+#include <errno.h>
+#include <fs/tmpfs.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
+#include <mem/vma.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/string.h>
+
+READONLY_AFTER_INIT static struct cache* vma_cache;
+
+static inline size_t tree_height(struct vma* node) {
+    return node != NULL ? node->height : 0;
+}
+
+static inline void tree_update_height(struct vma* node) {
+    node->height = 1 + MAX(tree_height(node->left), tree_height(node->right));
+}
+
+static struct vma* tree_rotate_right(struct vma* node) {
+    struct vma* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    tree_update_height(node);
+    tree_update_height(left);
+    return left;
+}
+
+static struct vma* tree_rotate_left(struct vma* node) {
+    struct vma* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    tree_update_height(node);
+    tree_update_height(right);
+    return right;
+}
+
+static struct vma* tree_rebalance(struct vma* node) {
+    tree_update_height(node);
+
+    if (tree_height(node->left) > tree_height(node->right) + 1) {
+        if (tree_height(node->left->left) < tree_height(node->left->right)) {
+            node->left = tree_rotate_left(node->left);
+        }
+        return tree_rotate_right(node);
+    }
+
+    if (tree_height(node->right) > tree_height(node->left) + 1) {
+        if (tree_height(node->right->right) < tree_height(node->right->left)) {
+            node->right = tree_rotate_right(node->right);
+        }
+        return tree_rotate_left(node);
+    }
+
+    return node;
+}
+
+static struct vma* tree_insert(struct vma* root, struct vma* vma) {
+    if (root == NULL) {
+        vma->left = vma->right = NULL;
+        vma->height = 1;
+        return vma;
+    }
+
+    if (vma->start < root->start) {
+        root->left = tree_insert(root->left, vma);
+    } else {
+        root->right = tree_insert(root->right, vma);
+    }
+
+    return tree_rebalance(root);
+}
+
+static struct vma* tree_remove_min(struct vma* root, struct vma** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = tree_remove_min(root->left, min);
+    return tree_rebalance(root);
+}
+
+static struct vma* tree_remove(struct vma* root, struct vma* vma) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    if (root == vma) {
+        if (root->left == NULL) {
+            return root->right;
+        }
+        if (root->right == NULL) {
+            return root->left;
+        }
+
+        struct vma* min;
+        struct vma* right = tree_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return tree_rebalance(min);
+    }
+
+    if (vma->start < root->start) {
+        root->left = tree_remove(root->left, vma);
+    } else {
+        root->right = tree_remove(root->right, vma);
+    }
+
+    return tree_rebalance(root);
+}
+
+static struct vma* find_vma(struct vma_tree* tree, uintptr_t addr) {
+    struct vma* iter = tree->root;
+    while (iter != NULL) {
+        if (addr < iter->start) {
+            iter = iter->left;
+        } else if (addr >= iter->end) {
+            iter = iter->right;
+        } else {
+            return iter;
+        }
+    }
+    return NULL;
+}
+
+/* last area starting below addr, NULL if there is none */
+static struct vma* find_prev_vma(struct vma_tree* tree, uintptr_t addr) {
+    struct vma* prev = NULL;
+    struct vma* iter = tree->root;
+    while (iter != NULL) {
+        if (iter->start < addr) {
+            prev = iter;
+            iter = iter->right;
+        } else {
+            iter = iter->left;
+        }
+    }
+    return prev;
+}
+
+static void get_node(struct vma* vma) {
+    if (vma->node != NULL) {
+        __atomic_add_fetch(&vma->node->refcount, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+static void put_node(struct vma* vma) {
+    if (vma->node == NULL) {
+        return;
+    }
+
+    if (__atomic_sub_fetch(&vma->node->refcount, 1, __ATOMIC_ACQ_REL) == 0 && (vma->vma_flags & VMA_ANONYMOUS)) {
+        /* anonymous shared memory has no name that keeps it alive */
+        tmpfs_destroy_anonymous(vma->node);
+    }
+}
+
+static struct vma* vma_create(struct vma_tree* tree, uintptr_t start, uintptr_t end, uint64_t flags,
+        int vma_flags, struct vfs_node* node, off_t offset) {
+    struct vma* vma = cache_alloc_object(vma_cache);
+    if (unlikely(vma == NULL)) {
+        return NULL;
+    }
+
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->vma_flags = vma_flags;
+    vma->node = node;
+    vma->offset = offset;
+    get_node(vma);
+
+    struct vma* prev = find_prev_vma(tree, start);
+    struct vma* next = prev != NULL ? prev->next : tree->first;
+
+    vma->prev = prev;
+    vma->next = next;
+    if (prev != NULL) {
+        prev->next = vma;
+    } else {
+        tree->first = vma;
+    }
+    if (next != NULL) {
+        next->prev = vma;
+    }
+
+    tree->root = tree_insert(tree->root, vma);
+    return vma;
+}
+
+static void vma_destroy(struct vma_tree* tree, struct vma* vma) {
+    tree->root = tree_remove(tree->root, vma);
+
+    if (vma->prev != NULL) {
+        vma->prev->next = vma->next;
+    } else {
+        tree->first = vma->next;
+    }
+    if (vma->next != NULL) {
+        vma->next->prev = vma->prev;
+    }
+
+    put_node(vma);
+    cache_free_object(vma_cache, vma);
+}
+
+/* cuts vma in two at addr, the new area covering [addr, end) is returned */
+static struct vma* vma_split(struct vma_tree* tree, struct vma* vma, uintptr_t addr) {
+    struct vma* tail = vma_create(tree, addr, vma->end, vma->flags, vma->vma_flags, vma->node,
+            vma->offset + (addr - vma->start));
+    if (unlikely(tail == NULL)) {
+        kpanic(NULL, false, "failed to split virtual memory area");
+    }
+
+    vma->end = addr;
+    return tail;
+}
+
+static inline bool can_merge(struct vma* vma, uint64_t flags, int vma_flags, struct vfs_node* node) {
+    return vma->node == NULL && node == NULL && vma->flags == flags && vma->vma_flags == vma_flags;
+}
+
+static bool insert_area(struct vma_tree* tree, uintptr_t start, uintptr_t end, uint64_t flags,
+        int vma_flags, struct vfs_node* node, off_t offset) {
+    struct vma* prev = find_prev_vma(tree, start);
+    struct vma* next = prev != NULL ? prev->next : tree->first;
+
+    if ((prev != NULL && prev->end > start) || (next != NULL && next->start < end)) {
+        return false;
+    }
+
+    bool merge_prev = prev != NULL && prev->end == start && can_merge(prev, flags, vma_flags, node);
+    bool merge_next = next != NULL && next->start == end && can_merge(next, flags, vma_flags, node);
+
+    if (merge_prev) {
+        prev->end = end;
+
+        if (merge_next) {
+            prev->end = next->end;
+            vma_destroy(tree, next);
+        }
+    } else if (merge_next) {
+        next->start = start;
+    } else if (vma_create(tree, start, end, flags, vma_flags, node, offset) == NULL) {
+        return false;
+    }
+
+    return true;
+}
+
+static void release_range(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t start, uintptr_t end) {
+    struct vma* iter = find_prev_vma(tree, start);
+    if (iter == NULL) {
+        iter = tree->first;
+    }
+
+    while (iter != NULL && iter->start < end) {
+        struct vma* next = iter->next;
+
+        if (iter->end <= start) {
+            iter = next;
+            continue;
+        }
+
+        vmm_unmap_range(pagemap, MAX(iter->start, start), MIN(iter->end, end), true);
+
+        if (start <= iter->start && end >= iter->end) {
+            vma_destroy(tree, iter);
+        } else if (start > iter->start && end < iter->end) {
+            vma_split(tree, iter, end);
+            iter->end = start;
+            break;
+        } else if (start <= iter->start) {
+            /* moving the start up to end keeps the tree ordered, nothing else lives in between */
+            iter->offset += end - iter->start;
+            iter->start = end;
+        } else {
+            iter->end = start;
+        }
+
+        iter = next;
+    }
+}
+
+static uintptr_t find_gap(struct vma_tree* tree, uintptr_t base, size_t length, size_t align) {
+    uintptr_t candidate = ALIGN_UP(base, align);
+
+    struct vma* iter = find_prev_vma(tree, base);
+    if (iter == NULL) {
+        iter = tree->first;
+    }
+
+    for (; iter != NULL && iter->start < candidate + length; iter = iter->next) {
+        candidate = MAX(candidate, ALIGN_UP(iter->end, align));
+    }
+
+    if (candidate + length < candidate || candidate + length > USER_SPACE_END) {
+        return (uintptr_t) -1;
+    }
+
+    return candidate;
+}
+
+bool vma_reserve(struct vma_tree* tree, uintptr_t start, uintptr_t end, uint64_t flags) {
+    if (!IS_ALIGNED(start, PAGE_SIZE) || !IS_ALIGNED(end, PAGE_SIZE) || start >= end || end > USER_SPACE_END) {
+        return false;
+    }
+
+    spinlock_acquire(&tree->lock);
+    bool ret = insert_area(tree, start, end, flags, 0, NULL, 0);
+    spinlock_release(&tree->lock);
+    return ret;
+}
+
+/*
+ * Reserves length bytes backed by node (or private anonymous memory if node is NULL). With VMA_FIXED
+ * the area goes exactly at addr and replaces any existing mappings there, otherwise addr is only where
+ * the search for a free range starts. Returns the start of the area, or -1 if no room was found.
+ */
+uintptr_t vma_map(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t addr, size_t length, uint64_t flags,
+        int vma_flags, struct vfs_node* node, off_t offset) {
+    length = ALIGN_UP(length, PAGE_SIZE);
+    if (length == 0 || !IS_ALIGNED(addr, PAGE_SIZE)) {
+        return (uintptr_t) -1;
+    }
+
+    spinlock_acquire(&tree->lock);
+
+    uintptr_t start;
+
+    if (vma_flags & VMA_FIXED) {
+        start = addr;
+        if (start + length < start || start + length > USER_SPACE_END) {
+            start = (uintptr_t) -1;
+            goto end;
+        }
+
+        release_range(tree, pagemap, start, start + length);
+    } else {
+        /* large private anonymous areas start on a 2MiB boundary so they can be backed by huge pages */
+        size_t align = node == NULL && length >= BIGPAGE_SIZE ? BIGPAGE_SIZE : PAGE_SIZE;
+
+        start = find_gap(tree, addr, length, align);
+        if (start == (uintptr_t) -1) {
+            goto end;
+        }
+    }
+
+    if (!insert_area(tree, start, start + length, flags, vma_flags & ~VMA_FIXED, node, offset)) {
+        start = (uintptr_t) -1;
+    }
+
+end:
+    spinlock_release(&tree->lock);
+    return start;
+}
+
+void vma_release(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t start, uintptr_t end) {
+    spinlock_acquire(&tree->lock);
+    release_range(tree, pagemap, ALIGN_DOWN(start, PAGE_SIZE), ALIGN_UP(end, PAGE_SIZE));
+    spinlock_release(&tree->lock);
+}
+
+/*
+ * Changes the page flags of [start, end), which has to be covered by areas without any holes. Pages
+ * that are already present are updated in place; private pages that become writable are turned into
+ * copy-on-write pages, so a page still shared with a file or another process is copied on first write.
+ */
+int vma_protect(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t start, uintptr_t end, uint64_t flags) {
+    start = ALIGN_DOWN(start, PAGE_SIZE);
+    end = ALIGN_UP(end, PAGE_SIZE);
+
+    spinlock_acquire(&tree->lock);
+
+    int ret = -ENOMEM;
+
+    struct vma* first = find_vma(tree, start);
+    if (first == NULL) {
+        goto end;
+    }
+
+    struct vma* iter = first;
+    for (;;) {
+        /* a shared mapping of a node opened read-only can never become writable */
+        if ((flags & PTE_WRITABLE) && (iter->vma_flags & VMA_SHARED) && !(iter->vma_flags & VMA_MAYWRITE)) {
+            ret = -EACCES;
+            goto end;
+        }
+
+        if (iter->end >= end) {
+            break;
+        }
+
+        struct vma* next = iter->next;
+        if (next == NULL || next->start != iter->end) {
+            goto end;
+        }
+        iter = next;
+    }
+
+    if (first->start < start) {
+        first = vma_split(tree, first, start);
+    }
+
+    for (iter = first; iter != NULL && iter->start < end; iter = iter->next) {
+        if (iter->end > end) {
+            vma_split(tree, iter, end);
+        }
+
+        iter->flags = flags;
+    }
+
+    vmm_protect_range(pagemap, start, end, flags);
+
+    ret = 0;
+
+end:
+    spinlock_release(&tree->lock);
+    return ret;
+}
+
+/*
+ * Backs the whole 2MiB region around vaddr with one huge page, if the region lies entirely inside the
+ * area, nothing in it has been mapped yet and the pmm has a free 2MiB block to spare.
+ */
+static bool map_huge_page(struct vma* vma, struct pagemap* pagemap, uintptr_t vaddr) {
+    uintptr_t huge_start = ALIGN_DOWN(vaddr, BIGPAGE_SIZE);
+    if (huge_start < vma->start || huge_start + BIGPAGE_SIZE > vma->end || !vmm_can_map_huge_page(pagemap, huge_start)) {
+        return false;
+    }
+
+    uintptr_t paddr = pmm_alloc_huge_page();
+    if (paddr == 0) {
+        return false;
+    }
+
+    memset((void*) (paddr + HIGH_VMA), 0, BIGPAGE_SIZE);
+
+    if (unlikely(!vmm_map_page(pagemap, huge_start, paddr, vma->flags | PTE_SIZE))) {
+        pmm_free(paddr, BIGPAGE_SIZE / PAGE_SIZE);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Materializes the page containing addr if it lies inside an accessible area. Called from the page
+ * fault handler for non-present faults; a page that is already mapped means another thread of the
+ * same process won the race to fault it in, which also counts as handled.
+ */
+bool vma_handle_fault(struct vma_tree* tree, struct pagemap* pagemap, uintptr_t addr) {
+    spinlock_acquire(&tree->lock);
+
+    bool ret = false;
+    uintptr_t vaddr = ALIGN_DOWN(addr, PAGE_SIZE);
+
+    struct vma* vma = find_vma(tree, vaddr);
+    if (vma == NULL || !(vma->flags & PTE_USER)) {
+        goto end;
+    }
+
+    if (vmm_get_page_mapping(pagemap, vaddr) != (uintptr_t) -1) {
+        ret = true;
+        goto end;
+    }
+
+    uintptr_t paddr;
+    uint64_t flags = vma->flags;
+
+    if (vma->node == NULL && map_huge_page(vma, pagemap, vaddr)) {
+        ret = true;
+        goto end;
+    }
+
+    if (vma->node == NULL) {
+        paddr = pmm_alloc_zeroed_page();
+    } else {
+        if (vma->node->mmap(vma->node, vma->offset + (vaddr - vma->start), &paddr) < 0) {
+            goto end;
+        }
+
+        if (vma->vma_flags & VMA_DEVICE) {
+            flags |= PTE_DEVICE | PTE_SHARED;
+        } else if (vma->vma_flags & VMA_SHARED) {
+            flags |= PTE_SHARED;
+        } else if (flags & PTE_WRITABLE) {
+            /* the page still belongs to the file, so private writable mappings get their copy on first write */
+            flags = (flags & ~PTE_WRITABLE) | PTE_COW;
+        }
+    }
+
+    if (unlikely(!vmm_map_page(pagemap, vaddr, paddr, flags))) {
+        if (!(flags & PTE_DEVICE)) {
+            pmm_page_unref(paddr);
+        }
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    spinlock_release(&tree->lock);
+    return ret;
+}
+
+/* the pages themselves are shared by vmm_fork_pagemap, only the bookkeeping is copied here */
+bool vma_fork(struct vma_tree* new_tree, struct vma_tree* old_tree) {
+    spinlock_acquire(&old_tree->lock);
+
+    bool ret = true;
+
+    *new_tree = (struct vma_tree) {0};
+
+    for (struct vma* iter = old_tree->first; iter != NULL; iter = iter->next) {
+        if (unlikely(vma_create(new_tree, iter->start, iter->end, iter->flags, iter->vma_flags, iter->node, iter->offset) == NULL)) {
+            ret = false;
+            break;
+        }
+    }
+
+    spinlock_release(&old_tree->lock);
+
+    if (!ret) {
+        vma_tree_destroy(new_tree);
+    }
+
+    return ret;
+}
+
+/* only frees the area descriptors, the pages are released together with the pagemap */
+void vma_tree_destroy(struct vma_tree* tree) {
+    spinlock_acquire(&tree->lock);
+
+    struct vma* iter = tree->first;
+    while (iter != NULL) {
+        struct vma* next = iter->next;
+        put_node(iter);
+        cache_free_object(vma_cache, iter);
+        iter = next;
+    }
+
+    tree->root = NULL;
+    tree->first = NULL;
+    spinlock_release(&tree->lock);
+}
+
+UNMAP_AFTER_INIT void vma_init(void) {
+    vma_cache = slab_cache_create("vma cache", sizeof(struct vma));
+    if (unlikely(vma_cache == NULL)) {
+        kpanic(NULL, false, "failed to initialize object cache for virtual memory areas");
+    }
+
+    klog("[vma] initialized virtual memory area cache\n");
+}
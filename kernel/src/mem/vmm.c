@@ -1,15 +1,23 @@
 #include <cpu/asm.h>
+#include <cpu/isr.h>
 #include <cpu/percpu.h>
+#include <cpu/smp.h>
+#include <dev/lapic.h>
 #include <mem/pmm.h>
 #include <mem/slab.h>
+#include <mem/vma.h>
 #include <mem/vmm.h>
 #include <sys/sched.h>
 #include <utils/log.h>
 #include <utils/macros.h>
 #include <utils/panic.h>
 #include <utils/string.h>
+#include <utils/user_access.h>
 
 #define MASKED_FLAGS ~(PTE_SIZE | PTE_GLOBAL | PTE_NX)
+#define CR4_PGE (1 << 7)
+#define CR3_ADDR_MASK   0x000ffffffffff000ul
+#define CR3_NOFLUSH     (1ul << 63)
 #define PAGE_FAULT_VECTOR 14
 
 extern uint8_t text_start_addr[], text_end_addr[];
@@ -19,6 +27,7 @@ extern uint8_t data_start_addr[], data_end_addr[];
 extern uint8_t ro_after_init_start_addr[], ro_after_init_end_addr[];
 
 READONLY_AFTER_INIT struct pagemap* kernel_pagemap = NULL;
+READONLY_AFTER_INIT bool vmm_pcid_enabled = false;
 
 volatile struct limine_hhdm_request hhdm_request = {
     .id = LIMINE_HHDM_REQUEST,
@@ -31,37 +40,432 @@ static volatile struct limine_kernel_address_request kaddr_request = {
 };
 
 static struct cache* pagemap_cache = NULL;
+static uint64_t next_pagemap_id = 0;
 
 static void destroy_levels_recursive(uint64_t* level, size_t start, size_t end, size_t depth) {
-    if (depth < 1) {
-        return;
-    } else if (depth == 1) {
-        pmm_free((uintptr_t) level - HIGH_VMA, 1);
-        return;
+    for (size_t i = start; i < end; i++) {
+        if (!(level[i] & PTE_PRESENT)) {
+            continue;
+        }
+
+        uintptr_t paddr = level[i] & ~PTE_FLAG_MASK;
+
+        if (depth == 1) {
+            if (!(level[i] & PTE_DEVICE)) {
+                pmm_page_unref(paddr);
+            }
+        } else if (depth == 2 && (level[i] & PTE_SIZE)) {
+            pmm_huge_page_unref(paddr);
+        } else {
+            destroy_levels_recursive((uint64_t*) (paddr + HIGH_VMA), 0, 512, depth - 1);
+        }
     }
 
+    pmm_free((uintptr_t) level - HIGH_VMA, 1);
+}
+
+/*
+ * Duplicates the page table structure of a user address space without copying any of the pages it
+ * maps. Every leaf page gains a reference, and writable private pages become read-only PTE_COW mappings
+ * in both the old and the new tables, so the first write from either side takes a page fault and gets
+ * a copy. Shared mappings stay shared, and device memory is not reference counted at all.
+ */
+static void fork_levels_recursive(uint64_t* old_level, uint64_t* new_level, size_t start, size_t end, size_t depth) {
     for (size_t i = start; i < end; i++) {
-        if (!(level[i] & PTE_PRESENT)) {
+        uint64_t entry = old_level[i];
+        if (!(entry & PTE_PRESENT)) {
             continue;
         }
 
-        if ((level[i] & PTE_SIZE) && depth == 2) {
-            pmm_free((uintptr_t) level - HIGH_VMA, BIGPAGE_SIZE / PAGE_SIZE);
+        uintptr_t paddr = entry & ~PTE_FLAG_MASK;
+
+        bool is_huge = depth == 2 && (entry & PTE_SIZE);
+
+        if (depth == 1 || is_huge) {
+            if (!(entry & (PTE_SHARED | PTE_DEVICE)) && (entry & (PTE_WRITABLE | PTE_COW))) {
+                entry = (entry & ~PTE_WRITABLE) | PTE_COW;
+                old_level[i] = entry;
+            }
+
+            if (is_huge) {
+                pmm_huge_page_ref(paddr);
+            } else if (!(entry & PTE_DEVICE)) {
+                pmm_page_ref(paddr);
+            }
+            new_level[i] = entry;
+        } else {
+            uintptr_t new_paddr = pmm_allocz(1);
+            fork_levels_recursive((uint64_t*) (paddr + HIGH_VMA), (uint64_t*) (new_paddr + HIGH_VMA), 0, 512, depth - 1);
+            new_level[i] = new_paddr | (entry & PTE_FLAG_MASK);
         }
+    }
+}
 
-        destroy_levels_recursive((uint64_t*) ((level[i] & ~PTE_FLAG_MASK) + HIGH_VMA), 0, 512, depth - 1);
+#define PML2_COVERAGE   (BIGPAGE_SIZE * 512ul)
+#define CURSOR_INVALID  ((uintptr_t) -1)
+
+/*
+ * TLB invalidations collected while a range operation runs, issued in one go at the end. Pages that
+ * were unmapped are only released after every CPU has dropped its entries for them.
+ */
+#define TLB_BATCH_SIZE 32
+
+/*
+ * Walks go through a cursor that remembers the last page directory and page table it went through, so
+ * stepping through consecutive addresses only descends from the top level again once per 1GiB, and
+ * only looks at the page directory again once per 2MiB.
+ */
+struct walk_cursor {
+    struct pagemap* pagemap;
+    uintptr_t pml2_vaddr;
+    uint64_t* pml2;
+    uintptr_t pml1_vaddr;
+    uint64_t* pml1;
+};
+
+struct tlb_batch {
+    struct pagemap* pagemap;
+    size_t count;
+    bool flush_all;
+    uintptr_t addrs[TLB_BATCH_SIZE];
+
+    size_t release_count;
+    uint64_t released[TLB_BATCH_SIZE];
+};
+
+/*
+ * The shootdown currently in flight. Only one runs at a time, the initiator waits until every CPU it
+ * sent the IPI to has handled it, which also keeps the batch on its stack alive for them.
+ */
+static struct {
+    spinlock_t lock;
+    struct tlb_batch* batch;
+    uint64_t tlb_gen;
+    size_t pending;
+} shootdown = {0};
+
+static inline bool is_loaded(struct pagemap* pagemap) {
+    return (read_cr3() & CR3_ADDR_MASK) == (uintptr_t) pagemap->top_level - HIGH_VMA;
+}
+
+static inline bool is_huge_entry(uint64_t entry) {
+    return (entry & (PTE_PRESENT | PTE_SIZE)) == (PTE_PRESENT | PTE_SIZE);
+}
+
+/* start of the next size aligned block after vaddr, saturating instead of wrapping around at the top */
+static inline uintptr_t next_boundary(uintptr_t vaddr, size_t size) {
+    uintptr_t next = ALIGN_DOWN(vaddr, size) + size;
+    return next > vaddr ? next : (uintptr_t) -1;
+}
+
+static inline void cursor_init(struct walk_cursor* cursor, struct pagemap* pagemap) {
+    cursor->pagemap = pagemap;
+    cursor->pml2_vaddr = CURSOR_INVALID;
+    cursor->pml2 = NULL;
+    cursor->pml1_vaddr = CURSOR_INVALID;
+    cursor->pml1 = NULL;
+}
+
+/* follows an entry to the table below it, allocating the table first if create is set */
+static uint64_t* next_level(uint64_t* entry, bool create, uint64_t flags) {
+    if (!(*entry & PTE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+
+        uintptr_t table = pmm_allocz(1);
+        if (table == 0) {
+            return NULL;
+        }
+
+        *entry = table | (flags & MASKED_FLAGS) | PTE_WRITABLE;
     }
 
-    pmm_free((uintptr_t) level - HIGH_VMA, 1);
+    return (uint64_t*) ((*entry & ~PTE_FLAG_MASK) + HIGH_VMA);
 }
 
-static inline uintptr_t entries_to_vaddr(size_t pml4_index, size_t pml3_index, size_t pml2_index, size_t pml1_index) {
-    uintptr_t vaddr = 0;
-    vaddr |= pml4_index << 39;
-    vaddr |= pml3_index << 30;
-    vaddr |= pml2_index << 21;
-    vaddr |= pml1_index << 12;
-    return vaddr;
+/* the page directory entry covering vaddr, or NULL if one of the levels above it is missing */
+static uint64_t* cursor_get_pml2_entry(struct walk_cursor* cursor, uintptr_t vaddr, bool create, uint64_t flags) {
+    uintptr_t pml2_vaddr = ALIGN_DOWN(vaddr, PML2_COVERAGE);
+
+    if (cursor->pml2_vaddr != pml2_vaddr) {
+        struct pagemap* pagemap = cursor->pagemap;
+        uint64_t* pml4 = pagemap->top_level;
+
+        if (pagemap->has_level5) {
+            pml4 = next_level(&pagemap->top_level[(vaddr >> 48) & 0x1ff], create, flags);
+            if (pml4 == NULL) {
+                return NULL;
+            }
+        }
+
+        uint64_t* pml3 = next_level(&pml4[(vaddr >> 39) & 0x1ff], create, flags);
+        if (pml3 == NULL) {
+            return NULL;
+        }
+
+        uint64_t* pml2 = next_level(&pml3[(vaddr >> 30) & 0x1ff], create, flags);
+        if (pml2 == NULL) {
+            return NULL;
+        }
+
+        cursor->pml2_vaddr = pml2_vaddr;
+        cursor->pml2 = pml2;
+    }
+
+    return &cursor->pml2[(vaddr >> 21) & 0x1ff];
+}
+
+/*
+ * Replaces a 2MiB mapping with a page table of 512 4KiB mappings of the same pages and flags. The
+ * pages keep their individual reference counts, so nothing else has to change. Other CPUs may keep
+ * using the 2MiB entry since it translates exactly the same, until a shootdown for any address inside
+ * it drops the entry there as well.
+ */
+static void split_huge_entry(uint64_t* pml2_entry, uintptr_t vaddr) {
+    uintptr_t paddr = *pml2_entry & ~PTE_FLAG_MASK;
+    uint64_t flags = *pml2_entry & PTE_FLAG_MASK & ~PTE_SIZE;
+
+    uintptr_t table = pmm_alloc(1);
+    uint64_t* pml1 = (uint64_t*) (table + HIGH_VMA);
+    for (size_t i = 0; i < 512; i++) {
+        pml1[i] = (paddr + i * PAGE_SIZE) | flags;
+    }
+
+    *pml2_entry = table | PTE_PRESENT | PTE_WRITABLE | (flags & PTE_USER);
+    invlpg(ALIGN_DOWN(vaddr, BIGPAGE_SIZE));
+}
+
+/*
+ * The page table entry for vaddr. A 2MiB mapping in the way is split when creating, otherwise NULL is
+ * returned for it just like for a missing page table.
+ */
+static uint64_t* cursor_get_pml1_entry(struct walk_cursor* cursor, uintptr_t vaddr, bool create, uint64_t flags) {
+    uintptr_t pml1_vaddr = ALIGN_DOWN(vaddr, BIGPAGE_SIZE);
+
+    if (cursor->pml1_vaddr != pml1_vaddr) {
+        uint64_t* pml2_entry = cursor_get_pml2_entry(cursor, vaddr, create, flags);
+        if (pml2_entry == NULL) {
+            return NULL;
+        }
+
+        if (is_huge_entry(*pml2_entry)) {
+            if (!create) {
+                return NULL;
+            }
+            split_huge_entry(pml2_entry, vaddr);
+        }
+
+        uint64_t* pml1 = next_level(pml2_entry, create, flags);
+        if (pml1 == NULL) {
+            return NULL;
+        }
+
+        cursor->pml1_vaddr = pml1_vaddr;
+        cursor->pml1 = pml1;
+    }
+
+    return &cursor->pml1[(vaddr >> 12) & 0x1ff];
+}
+
+static inline void tlb_batch_init(struct tlb_batch* batch, struct pagemap* pagemap) {
+    batch->pagemap = pagemap;
+    batch->count = 0;
+    batch->flush_all = false;
+    batch->release_count = 0;
+}
+
+/* one address per mapping is enough, invlpg drops a 2MiB entry through any address inside it */
+static inline void tlb_batch_add(struct tlb_batch* batch, uintptr_t vaddr) {
+    if (batch->count < TLB_BATCH_SIZE) {
+        batch->addrs[batch->count++] = vaddr;
+    } else {
+        batch->flush_all = true;
+    }
+}
+
+static void invalidate_local(struct tlb_batch* batch, uint64_t tlb_gen) {
+    bool is_kernel = batch->pagemap == kernel_pagemap;
+
+    if (!batch->flush_all) {
+        for (size_t i = 0; i < batch->count; i++) {
+            invlpg(batch->addrs[i]);
+        }
+    } else {
+        uint64_t cr4 = read_cr4();
+        if (is_kernel && (cr4 & CR4_PGE)) {
+            /* global entries survive a cr3 reload, toggling CR4.PGE drops them as well */
+            write_cr4(cr4 & ~CR4_PGE);
+            write_cr4(cr4);
+        } else {
+            /* without the no-flush bit this only drops the entries tagged with the current PCID */
+            write_cr3(read_cr3());
+        }
+    }
+
+    if (vmm_pcid_enabled && !is_kernel) {
+        struct percpu* self = this_cpu();
+        self->pcid_slots[self->pcid_slot].tlb_gen = tlb_gen;
+    }
+}
+
+/* handles this CPU's part of the shootdown in flight, if it has one */
+static void tlb_shootdown_poll(void) {
+    struct percpu* self = this_cpu();
+    if (!__atomic_load_n(&self->tlb_shootdown_pending, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    /* CPUs that switched away from the pagemap meanwhile catch up through tlb_gen when switching back */
+    struct tlb_batch* batch = shootdown.batch;
+    if (batch->pagemap == kernel_pagemap || is_loaded(batch->pagemap)) {
+        invalidate_local(batch, shootdown.tlb_gen);
+    }
+
+    __atomic_store_n(&self->tlb_shootdown_pending, false, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&shootdown.pending, 1, __ATOMIC_ACQ_REL);
+}
+
+static void tlb_shootdown_handler(struct registers* r, void* ctx) {
+    (void) r;
+    (void) ctx;
+
+    tlb_shootdown_poll();
+    lapic_eoi();
+}
+
+/*
+ * Sends the batch to every other online CPU for the kernel pagemap, and otherwise only to CPUs whose
+ * last loaded user pagemap is this one. Waiting for the lock services requests aimed at this CPU, so
+ * two CPUs shooting down at the same time with interrupts disabled cannot wait on each other.
+ */
+static void tlb_shootdown(struct tlb_batch* batch, uint64_t tlb_gen) {
+    struct percpu* self = this_cpu();
+    bool is_kernel = batch->pagemap == kernel_pagemap;
+
+    while (!spinlock_test_and_acquire(&shootdown.lock)) {
+        tlb_shootdown_poll();
+        pause();
+    }
+
+    shootdown.batch = batch;
+    shootdown.tlb_gen = tlb_gen;
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (cpu == self || !__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        if (!is_kernel && __atomic_load_n(&cpu->active_pagemap, __ATOMIC_SEQ_CST) != batch->pagemap) {
+            continue;
+        }
+
+        __atomic_add_fetch(&shootdown.pending, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&cpu->tlb_shootdown_pending, true, __ATOMIC_SEQ_CST);
+        lapic_send_ipi(cpu->lapic_id, TLB_SHOOTDOWN_IPI);
+    }
+
+    while (__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE) != 0) {
+        pause();
+    }
+
+    spinlock_release(&shootdown.lock);
+}
+
+static void tlb_batch_flush(struct tlb_batch* batch) {
+    struct pagemap* pagemap = batch->pagemap;
+
+    if (batch->count != 0 || batch->flush_all) {
+        bool prev_int = interrupt_state();
+        cli();
+
+        /* bumped before looking for CPUs to notify, see vmm_switch_pagemap */
+        uint64_t tlb_gen = __atomic_add_fetch(&pagemap->tlb_gen, 1, __ATOMIC_SEQ_CST);
+
+        if (pagemap == kernel_pagemap || is_loaded(pagemap)) {
+            invalidate_local(batch, tlb_gen);
+        }
+
+        /* before smp_init only the BSP is running */
+        if (percpus != NULL) {
+            tlb_shootdown(batch, tlb_gen);
+        }
+
+        if (prev_int) {
+            sti();
+        }
+    }
+
+    for (size_t i = 0; i < batch->release_count; i++) {
+        uint64_t entry = batch->released[i];
+        if (entry & PTE_SIZE) {
+            pmm_huge_page_unref(entry & ~PTE_FLAG_MASK);
+        } else {
+            pmm_page_unref(entry & ~PTE_FLAG_MASK);
+        }
+    }
+
+    batch->count = 0;
+    batch->flush_all = false;
+    batch->release_count = 0;
+}
+
+/* entry is the leaf entry that mapped the page, PTE_SIZE tells 2MiB pages apart */
+static void tlb_batch_release(struct tlb_batch* batch, uint64_t entry) {
+    if (batch->release_count == TLB_BATCH_SIZE) {
+        tlb_batch_flush(batch);
+    }
+
+    batch->released[batch->release_count++] = entry;
+}
+
+/*
+ * A write to a copy-on-write 2MiB page copies the whole page if a free huge page is at hand. Otherwise
+ * the mapping is split and only the 4KiB page that was written is copied.
+ */
+static bool handle_huge_cow_fault(uint64_t* pml2_entry, uintptr_t vaddr, struct tlb_batch* batch) {
+    if (!(*pml2_entry & PTE_COW) || !(*pml2_entry & PTE_USER)) {
+        return false;
+    }
+
+    uintptr_t paddr = *pml2_entry & ~PTE_FLAG_MASK;
+    uint64_t flags = (*pml2_entry & PTE_FLAG_MASK & ~PTE_COW) | PTE_WRITABLE;
+
+    if (!pmm_huge_page_is_shared(paddr)) {
+        *pml2_entry = paddr | flags;
+        tlb_batch_add(batch, vaddr);
+        return true;
+    }
+
+    uintptr_t new_paddr = pmm_alloc_huge_page();
+    if (new_paddr == 0) {
+        split_huge_entry(pml2_entry, vaddr);
+        return false;
+    }
+
+    memcpy((void*) (new_paddr + HIGH_VMA), (void*) (paddr + HIGH_VMA), BIGPAGE_SIZE);
+    *pml2_entry = new_paddr | flags;
+    pmm_huge_page_unref(paddr);
+
+    tlb_batch_add(batch, vaddr);
+    return true;
+}
+
+/*
+ * Applies new protection flags to a present entry. Private user pages that become writable go through
+ * copy-on-write instead, unless they were writable already, so pages still shared with a file or
+ * another process get copied on the first write.
+ */
+static uint64_t protect_entry(uint64_t entry, uint64_t flags) {
+    uint64_t new_entry = (entry & ~PTE_FLAG_MASK) | flags | (entry & (PTE_COW | PTE_SHARED | PTE_DEVICE | PTE_SIZE));
+
+    if ((flags & (PTE_WRITABLE | PTE_USER)) == (PTE_WRITABLE | PTE_USER) && !(entry & (PTE_SHARED | PTE_DEVICE)) &&
+            ((entry & PTE_COW) || !(entry & PTE_WRITABLE))) {
+        new_entry = (new_entry & ~PTE_WRITABLE) | PTE_COW;
+    }
+
+    return new_entry;
 }
 
 static void page_fault_handler(struct registers* r, void* ctx) {
@@ -72,17 +476,44 @@ static void page_fault_handler(struct registers* r, void* ctx) {
     bool is_writing = r->error_code & FAULT_WRITABLE;
     bool is_user = r->error_code & FAULT_USER;
 
+    struct thread* current_thread = this_cpu()->running_thread;
+
+    /*
+     * Faults on user addresses can come from user mode or from the kernel accessing user memory. Only
+     * resolve them against the address space that is actually loaded, exec briefly runs on the old one.
+     */
+    if (faulting_addr < USER_SPACE_END && current_thread != NULL && is_loaded(current_thread->process->pagemap)) {
+        struct process* current_process = current_thread->process;
+
+        if (is_present && is_writing && vmm_handle_cow_fault(current_process->pagemap, faulting_addr)) {
+            return;
+        }
+
+        if (!is_present && vma_handle_fault(&current_process->vmas, current_process->pagemap, faulting_addr)) {
+            return;
+        }
+    }
+
+    /* the kernel copying from or to user memory that is not there fails the copy instead */
+    if (!is_user && faulting_addr < USER_SPACE_END && user_access_fixup(r)) {
+        return;
+    }
+
     klog("[vmm] page fault occurred when %s process tried to %s %spresent page entry for address 0x%p\n",
             is_user ? "user-mode" : "supervisor-mode",
             is_writing ? "write to" : "read from",
             is_present ? "\0" : "non-",
             faulting_addr);
 
-    struct thread* current_thread = this_cpu()->running_thread;
     if (current_thread != NULL) {
         struct process* current_process = current_thread->process;
 
         if (current_process->pid != 0) {
+            /* killing it would leave the spinlocks it holds taken forever */
+            if (!is_user && this_cpu()->preempt_count != 0) {
+                kpanic(r, true, "page fault in kernel with preemption disabled");
+            }
+
             klog("[vmm] killing thread (pid: %d, tid: %d) due to page fault\n", current_process->pid, current_thread->tid);
             sched_thread_dequeue(current_thread);
             sched_yield();
@@ -107,6 +538,8 @@ struct pagemap* vmm_new_pagemap(void) {
 
     pagemap->top_level = (uint64_t*) ((uintptr_t) pagemap->top_level + HIGH_VMA);
     pagemap->lock = (spinlock_t) {0};
+    pagemap->id = __atomic_add_fetch(&next_pagemap_id, 1, __ATOMIC_RELAXED);
+    pagemap->tlb_gen = 0;
 
     uint32_t ecx = 0, unused;
     if (cpuid(7, 0, &unused, &unused, &ecx, &unused) && ecx & (1 << 16)) {
@@ -120,12 +553,10 @@ struct pagemap* vmm_new_pagemap(void) {
     return pagemap;
 }
 
+/* nobody can reach the pagemap anymore by now, so it is torn down without taking its lock */
 void vmm_destroy_pagemap(struct pagemap* pagemap) {
-    spinlock_acquire(&pagemap->lock);
-
     destroy_levels_recursive(pagemap->top_level, 0, 256, (pagemap->has_level5 ? 5 : 4));
 
-    pmm_free((uintptr_t) pagemap->top_level - HIGH_VMA, 1);
     cache_free_object(pagemap_cache, pagemap);
 }
 
@@ -135,279 +566,394 @@ struct pagemap* vmm_fork_pagemap(struct pagemap* old_pagemap) {
         return NULL;
     }
 
-    for (size_t i = 0; i < 256; i++) {
-        if (old_pagemap->top_level[i] & PTE_PRESENT) {
-            uint64_t* pml4 = (uint64_t*) ((old_pagemap->top_level[i] & ~PTE_FLAG_MASK) + HIGH_VMA);
-
-            for (size_t j = 0; j < 512; j++) {
-                if (pml4[j] & PTE_PRESENT) {
-                    uint64_t* pml3 = (uint64_t*) ((pml4[j] & ~PTE_FLAG_MASK) + HIGH_VMA);
-
-                    for (size_t k = 0; k < 512; k++) {
-                        if (pml3[k] & PTE_PRESENT) {
-                            uint64_t* pml2 = (uint64_t*) ((pml3[k] & ~PTE_FLAG_MASK) + HIGH_VMA);
-
-                            for (size_t l = 0; l < 512; l++) {
-                                if (pml2[l] & PTE_PRESENT) {
-                                    uintptr_t paddr = pmm_allocz(1);
-                                    memcpy((void*) (paddr + HIGH_VMA),
-                                            (void*) ((pml2[l] & ~PTE_FLAG_MASK) + HIGH_VMA), PAGE_SIZE);
-                                    vmm_map_page(new_pagemap, entries_to_vaddr(i, j, k, l), paddr,
-                                            pml2[l] & PTE_FLAG_MASK);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
+    spinlock_acquire(&old_pagemap->lock);
 
-    return new_pagemap;
-}
+    fork_levels_recursive(old_pagemap->top_level, new_pagemap->top_level, 0, 256, (old_pagemap->has_level5 ? 5 : 4));
 
-void vmm_switch_pagemap(struct pagemap* pagemap) {
-    write_cr3((uintptr_t) pagemap->top_level - HIGH_VMA);
+    /* the old address space just lost write access to all of its pages, so drop any stale TLB entries */
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, old_pagemap);
+    batch.flush_all = true;
+    tlb_batch_flush(&batch);
+
+    spinlock_release(&old_pagemap->lock);
+    return new_pagemap;
 }
 
-bool vmm_map_page(struct pagemap* pagemap, uintptr_t vaddr, uintptr_t paddr, uint64_t flags) {
+bool vmm_handle_cow_fault(struct pagemap* pagemap, uintptr_t vaddr) {
     spinlock_acquire(&pagemap->lock);
 
     bool ret = false;
 
-    size_t pml4_index = (vaddr & (0x1ffull << 39)) >> 39;
-    size_t pml3_index = (vaddr & (0x1ffull << 30)) >> 30;
-    size_t pml2_index = (vaddr & (0x1ffull << 21)) >> 21;
-    size_t pml1_index = (vaddr & (0x1ffull << 12)) >> 12;
-
-    uint64_t* pml4;
-
-    if (pagemap->has_level5) {
-        size_t pml5_index = (vaddr & (0x1ffull << 48)) >> 48;
-
-        if (!(pagemap->top_level[pml5_index] & PTE_PRESENT)) {
-            pagemap->top_level[pml5_index] = pmm_allocz(1);
-            if (pagemap->top_level[pml5_index] == 0) {
-                goto end;
-            }
-
-            pagemap->top_level[pml5_index] |= (flags & MASKED_FLAGS) | PTE_WRITABLE;
-        }
-
-        pml4 = (uint64_t*) ((pagemap->top_level[pml5_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    } else {
-        pml4 = pagemap->top_level;
-    }
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    if (!(pml4[pml4_index] & PTE_PRESENT)) {
-        pml4[pml4_index] = pmm_allocz(1);
-        if (pml4[pml4_index] == 0) {
-            goto end;
-        }
-
-        pml4[pml4_index] |= (flags & MASKED_FLAGS) | PTE_WRITABLE;
-    }
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, pagemap);
 
-    uint64_t* pml3 = (uint64_t*) ((pml4[pml4_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    if (!(pml3[pml3_index] & PTE_PRESENT)) {
-        pml3[pml3_index] = pmm_allocz(1);
-        if (pml3[pml3_index] == 0) {
+    uint64_t* pml2_entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+    if (pml2_entry != NULL && is_huge_entry(*pml2_entry)) {
+        ret = handle_huge_cow_fault(pml2_entry, vaddr, &batch);
+        if (ret || is_huge_entry(*pml2_entry)) {
             goto end;
         }
-
-        pml3[pml3_index] |= (flags & MASKED_FLAGS) | PTE_WRITABLE;
     }
 
-    uint64_t* pml2 = (uint64_t*) ((pml3[pml3_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-
-    if (flags & PTE_SIZE) {
-        pml2[pml2_index] = paddr | flags;
-        ret = true;
+    uint64_t* entry = cursor_get_pml1_entry(&cursor, vaddr, false, 0);
+    if (entry == NULL || !(*entry & PTE_PRESENT) || !(*entry & PTE_COW) || !(*entry & PTE_USER)) {
         goto end;
     }
 
-    if (!(pml2[pml2_index] & PTE_PRESENT)) {
-        pml2[pml2_index] = pmm_allocz(1);
-        if (pml2[pml2_index] == 0) {
-            goto end;
-        }
+    uintptr_t paddr = *entry & ~PTE_FLAG_MASK;
+    uint64_t flags = (*entry & PTE_FLAG_MASK & ~PTE_COW) | PTE_WRITABLE;
 
-        pml2[pml2_index] |= (flags & MASKED_FLAGS) | PTE_WRITABLE;
-    }
+    if (pmm_page_is_shared(paddr)) {
+        uintptr_t new_paddr = pmm_alloc(1);
+        memcpy((void*) (new_paddr + HIGH_VMA), (void*) (paddr + HIGH_VMA), PAGE_SIZE);
 
-    uint64_t* pml1 = (uint64_t*) ((pml2[pml2_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    pml1[pml1_index] = paddr | flags;
+        *entry = new_paddr | flags;
+        pmm_page_unref(paddr);
+    } else {
+        /* every other mapping of the page is already gone, so it can just be made writable again */
+        *entry = paddr | flags;
+    }
 
+    tlb_batch_add(&batch, vaddr);
     ret = true;
 
 end:
+    tlb_batch_flush(&batch);
+
     spinlock_release(&pagemap->lock);
     return ret;
 }
 
-bool vmm_unmap_page(struct pagemap* pagemap, uintptr_t vaddr) {
+/* true if nothing at all is mapped in the 2MiB region around vaddr, not even an empty page table */
+bool vmm_can_map_huge_page(struct pagemap* pagemap, uintptr_t vaddr) {
     spinlock_acquire(&pagemap->lock);
 
-    bool ret = false;
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    size_t pml4_index = (vaddr & (0x1ffull << 39)) >> 39;
-    size_t pml3_index = (vaddr & (0x1ffull << 30)) >> 30;
-    size_t pml2_index = (vaddr & (0x1ffull << 21)) >> 21;
-    size_t pml1_index = (vaddr & (0x1ffull << 12)) >> 12;
+    uint64_t* pml2_entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+    bool ret = pml2_entry == NULL || !(*pml2_entry & PTE_PRESENT);
 
-    uint64_t* pml4;
+    spinlock_release(&pagemap->lock);
+    return ret;
+}
 
-    if (pagemap->has_level5) {
-        size_t pml5_index = (vaddr & (0x1ffull << 48)) >> 48;
+void vmm_split_huge_page(struct pagemap* pagemap, uintptr_t vaddr) {
+    spinlock_acquire(&pagemap->lock);
 
-        if (!(pagemap->top_level[pml5_index] & PTE_PRESENT)) {
-            goto end;
-        }
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-        pml4 = (uint64_t*) ((pagemap->top_level[pml5_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    } else {
-        pml4 = pagemap->top_level;
+    uint64_t* pml2_entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+    if (pml2_entry != NULL && is_huge_entry(*pml2_entry)) {
+        split_huge_entry(pml2_entry, vaddr);
     }
 
-    if (!(pml4[pml4_index] & PTE_PRESENT)) {
-        goto end;
+    spinlock_release(&pagemap->lock);
+}
+
+/*
+ * Loads a pagemap on this CPU. The kernel pagemap always uses PCID 0, and only kernel mappings live
+ * there, so switching to it keeps this CPU marked as running the previous user pagemap. User pagemaps
+ * get one of the per-CPU PCID slots, and keep their tagged TLB entries unless the slot was handed to
+ * another pagemap or a flush happened while they were not loaded here.
+ */
+void vmm_switch_pagemap(struct pagemap* pagemap) {
+    uintptr_t cr3 = (uintptr_t) pagemap->top_level - HIGH_VMA;
+
+    /* a loaded pagemap already got every flush through shootdowns */
+    if (is_loaded(pagemap)) {
+        return;
     }
 
-    uint64_t* pml3 = (uint64_t*) ((pml4[pml4_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    if (!(pml3[pml3_index] & PTE_PRESENT)) {
-        goto end;
+    if (pagemap == kernel_pagemap) {
+        write_cr3(cr3);
+        return;
     }
 
-    uint64_t* pml2 = (uint64_t*) ((pml3[pml3_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
+    bool prev_int = interrupt_state();
+    cli();
+
+    /* published before reading tlb_gen, so a concurrent tlb_batch_flush either sees us or we see it */
+    struct percpu* self = this_cpu();
+    __atomic_store_n(&self->active_pagemap, pagemap, __ATOMIC_SEQ_CST);
 
-    if (pml2[pml2_index] & PTE_SIZE) {
-        pml2[pml2_index] = 0;
-        invlpg(vaddr);
-        ret = true;
+    if (!vmm_pcid_enabled) {
+        write_cr3(cr3);
         goto end;
     }
 
-    if (!(pml2[pml2_index] & PTE_PRESENT)) {
-        goto end;
+    uint64_t tlb_gen = __atomic_load_n(&pagemap->tlb_gen, __ATOMIC_SEQ_CST);
+    bool flush = false;
+
+    size_t slot = 0;
+    while (slot < VMM_PCID_SLOTS && self->pcid_slots[slot].pagemap_id != pagemap->id) {
+        slot++;
+    }
+
+    if (slot == VMM_PCID_SLOTS) {
+        slot = self->pcid_next_victim;
+        self->pcid_next_victim = (slot + 1) % VMM_PCID_SLOTS;
+        self->pcid_slots[slot].pagemap_id = pagemap->id;
+        flush = true;
+    } else if (self->pcid_slots[slot].tlb_gen != tlb_gen) {
+        flush = true;
     }
 
-    uint64_t* pml1 = (uint64_t*) ((pml2[pml2_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    pml1[pml1_index] = 0;
-    invlpg(vaddr);
+    self->pcid_slots[slot].tlb_gen = tlb_gen;
+    self->pcid_slot = slot;
 
-    ret = true;
+    write_cr3(cr3 | (slot + 1) | (flush ? 0 : CR3_NOFLUSH));
 
 end:
-    spinlock_release(&pagemap->lock);
-    return ret;
+    if (prev_int) {
+        sti();
+    }
 }
 
-bool vmm_update_flags(struct pagemap* pagemap, uintptr_t vaddr, uint64_t flags) {
+/*
+ * Maps size bytes of contiguous physical memory at vaddr, in 2MiB steps if flags has PTE_SIZE. The
+ * page tables are walked once for the whole range, and entries that replace an existing mapping are
+ * flushed from the TLB together at the end.
+ */
+bool vmm_map_range(struct pagemap* pagemap, uintptr_t vaddr, uintptr_t paddr, size_t size, uint64_t flags) {
     spinlock_acquire(&pagemap->lock);
 
-    bool ret = false;
+    bool ret = true;
+    bool is_huge = flags & PTE_SIZE;
+    size_t step = is_huge ? BIGPAGE_SIZE : PAGE_SIZE;
 
-    size_t pml4_index = (vaddr & (0x1ffull << 39)) >> 39;
-    size_t pml3_index = (vaddr & (0x1ffull << 30)) >> 30;
-    size_t pml2_index = (vaddr & (0x1ffull << 21)) >> 21;
-    size_t pml1_index = (vaddr & (0x1ffull << 12)) >> 12;
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    uint64_t* pml4;
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, pagemap);
 
-    if (pagemap->has_level5) {
-        size_t pml5_index = (vaddr & (0x1ffull << 48)) >> 48;
+    for (size_t offset = 0; offset < size; offset += step) {
+        uint64_t* entry;
+        if (is_huge) {
+            entry = cursor_get_pml2_entry(&cursor, vaddr + offset, true, flags);
+            cursor.pml1_vaddr = CURSOR_INVALID;
+        } else {
+            entry = cursor_get_pml1_entry(&cursor, vaddr + offset, true, flags);
+        }
 
-        if (!(pagemap->top_level[pml5_index] & PTE_PRESENT)) {
-            goto end;
+        if (entry == NULL) {
+            ret = false;
+            break;
         }
 
-        pml4 = (uint64_t*) ((pagemap->top_level[pml5_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    } else {
-        pml4 = pagemap->top_level;
+        if (*entry & PTE_PRESENT) {
+            tlb_batch_add(&batch, vaddr + offset);
+        }
+        *entry = (paddr + offset) | flags;
     }
 
-    if (!(pml4[pml4_index] & PTE_PRESENT)) {
-        goto end;
-    }
+    tlb_batch_flush(&batch);
 
-    uint64_t* pml3 = (uint64_t*) ((pml4[pml4_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    if (!(pml3[pml3_index] & PTE_PRESENT)) {
-        goto end;
-    }
+    spinlock_release(&pagemap->lock);
+    return ret;
+}
 
-    uint64_t* pml2 = (uint64_t*) ((pml3[pml3_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
+/*
+ * Unmaps everything in [start, end) and returns how many 4KiB pages were mapped there. With release
+ * set the pages are also unreferenced, except for device memory. 2MiB pages the range only partly
+ * covers are split first. Missing page tables are skipped as a whole.
+ */
+size_t vmm_unmap_range(struct pagemap* pagemap, uintptr_t start, uintptr_t end, bool release) {
+    spinlock_acquire(&pagemap->lock);
 
-    if (pml2[pml2_index] & PTE_SIZE) {
-        uintptr_t paddr = pml2[pml2_index] & ~PTE_FLAG_MASK;
-        pml2[pml2_index] = paddr | flags;
-        invlpg(vaddr);
-        ret = true;
-        goto end;
-    }
+    size_t count = 0;
 
-    if (!(pml2[pml2_index] & PTE_PRESENT)) {
-        goto end;
-    }
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    uint64_t* pml1 = (uint64_t*) ((pml2[pml2_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    uintptr_t paddr = pml1[pml1_index] & ~PTE_FLAG_MASK;
-    pml1[pml1_index] = paddr | flags;
-    invlpg(vaddr);
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, pagemap);
 
-    ret = true;
+    uintptr_t vaddr = start;
+    while (vaddr < end) {
+        uint64_t* pml2_entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+        if (pml2_entry == NULL) {
+            vaddr = next_boundary(vaddr, PML2_COVERAGE);
+            continue;
+        }
+        if (!(*pml2_entry & PTE_PRESENT)) {
+            vaddr = next_boundary(vaddr, BIGPAGE_SIZE);
+            continue;
+        }
+
+        if (is_huge_entry(*pml2_entry)) {
+            uintptr_t huge_start = ALIGN_DOWN(vaddr, BIGPAGE_SIZE);
+
+            if (huge_start >= start && end - huge_start >= BIGPAGE_SIZE) {
+                uint64_t entry = *pml2_entry;
+                *pml2_entry = 0;
+                cursor.pml1_vaddr = CURSOR_INVALID;
+
+                tlb_batch_add(&batch, huge_start);
+                if (release) {
+                    tlb_batch_release(&batch, entry);
+                }
+
+                count += BIGPAGE_SIZE / PAGE_SIZE;
+                vaddr = next_boundary(vaddr, BIGPAGE_SIZE);
+                continue;
+            }
+
+            split_huge_entry(pml2_entry, vaddr);
+        }
+
+        uint64_t* entry = cursor_get_pml1_entry(&cursor, vaddr, false, 0);
+        if (entry != NULL && (*entry & PTE_PRESENT)) {
+            uint64_t old_entry = *entry;
+            *entry = 0;
+
+            tlb_batch_add(&batch, vaddr);
+            if (release && !(old_entry & PTE_DEVICE)) {
+                tlb_batch_release(&batch, old_entry);
+            }
+
+            count++;
+        }
+
+        vaddr += PAGE_SIZE;
+    }
+
+    tlb_batch_flush(&batch);
 
-end:
     spinlock_release(&pagemap->lock);
-    return ret;
+    return count;
 }
 
-
-uintptr_t vmm_get_page_mapping(struct pagemap* pagemap, uintptr_t vaddr) {
+/*
+ * Changes the flags of everything mapped in [start, end), see protect_entry, and returns how many
+ * 4KiB pages were mapped there. 2MiB pages the range only partly covers are split first.
+ */
+size_t vmm_protect_range(struct pagemap* pagemap, uintptr_t start, uintptr_t end, uint64_t flags) {
     spinlock_acquire(&pagemap->lock);
 
-    uintptr_t ret = (uintptr_t) -1;
+    size_t count = 0;
+
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    size_t pml4_index = (vaddr & (0x1ffull << 39)) >> 39;
-    size_t pml3_index = (vaddr & (0x1ffull << 30)) >> 30;
-    size_t pml2_index = (vaddr & (0x1ffull << 21)) >> 21;
-    size_t pml1_index = (vaddr & (0x1ffull << 12)) >> 12;
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, pagemap);
 
-    uint64_t* pml4;
+    uintptr_t vaddr = start;
+    while (vaddr < end) {
+        uint64_t* pml2_entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+        if (pml2_entry == NULL) {
+            vaddr = next_boundary(vaddr, PML2_COVERAGE);
+            continue;
+        }
+        if (!(*pml2_entry & PTE_PRESENT)) {
+            vaddr = next_boundary(vaddr, BIGPAGE_SIZE);
+            continue;
+        }
 
-    if (pagemap->has_level5) {
-        size_t pml5_index = (vaddr & (0x1ffull << 48)) >> 48;
+        if (is_huge_entry(*pml2_entry)) {
+            uintptr_t huge_start = ALIGN_DOWN(vaddr, BIGPAGE_SIZE);
 
-        if (!(pagemap->top_level[pml5_index] & PTE_PRESENT)) {
-            goto end;
+            if (huge_start >= start && end - huge_start >= BIGPAGE_SIZE) {
+                *pml2_entry = protect_entry(*pml2_entry, flags);
+
+                tlb_batch_add(&batch, huge_start);
+                count += BIGPAGE_SIZE / PAGE_SIZE;
+                vaddr = next_boundary(vaddr, BIGPAGE_SIZE);
+                continue;
+            }
+
+            split_huge_entry(pml2_entry, vaddr);
         }
 
-        pml4 = (uint64_t*) ((pagemap->top_level[pml5_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    } else {
-        pml4 = pagemap->top_level;
+        uint64_t* entry = cursor_get_pml1_entry(&cursor, vaddr, false, 0);
+        if (entry != NULL && (*entry & PTE_PRESENT)) {
+            *entry = protect_entry(*entry, flags);
+
+            tlb_batch_add(&batch, vaddr);
+            count++;
+        }
+
+        vaddr += PAGE_SIZE;
     }
 
-    if (!(pml4[pml4_index] & PTE_PRESENT)) {
+    tlb_batch_flush(&batch);
+
+    spinlock_release(&pagemap->lock);
+    return count;
+}
+
+bool vmm_map_page(struct pagemap* pagemap, uintptr_t vaddr, uintptr_t paddr, uint64_t flags) {
+    return vmm_map_range(pagemap, vaddr, paddr, (flags & PTE_SIZE) ? BIGPAGE_SIZE : PAGE_SIZE, flags);
+}
+
+bool vmm_unmap_page(struct pagemap* pagemap, uintptr_t vaddr) {
+    return vmm_unmap_range(pagemap, vaddr, vaddr + PAGE_SIZE, false) != 0;
+}
+
+bool vmm_update_flags(struct pagemap* pagemap, uintptr_t vaddr, uint64_t flags) {
+    spinlock_acquire(&pagemap->lock);
+
+    bool ret = false;
+
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
+
+    struct tlb_batch batch;
+    tlb_batch_init(&batch, pagemap);
+
+    uint64_t* entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+    if (entry == NULL || !(*entry & PTE_PRESENT)) {
         goto end;
     }
 
-    uint64_t* pml3 = (uint64_t*) ((pml4[pml4_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    if (!(pml3[pml3_index] & PTE_PRESENT)) {
-        goto end;
+    if (!is_huge_entry(*entry)) {
+        entry = cursor_get_pml1_entry(&cursor, vaddr, false, 0);
+        if (entry == NULL || !(*entry & PTE_PRESENT)) {
+            goto end;
+        }
     }
 
-    uint64_t* pml2 = (uint64_t*) ((pml3[pml3_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
+    uintptr_t paddr = *entry & ~PTE_FLAG_MASK;
+    *entry = paddr | flags;
+    tlb_batch_add(&batch, vaddr);
+
+    ret = true;
+
+end:
+    tlb_batch_flush(&batch);
+
+    spinlock_release(&pagemap->lock);
+    return ret;
+}
+
+uintptr_t vmm_get_page_mapping(struct pagemap* pagemap, uintptr_t vaddr) {
+    spinlock_acquire(&pagemap->lock);
+
+    uintptr_t ret = (uintptr_t) -1;
+
+    struct walk_cursor cursor;
+    cursor_init(&cursor, pagemap);
 
-    if (pml2[pml2_index] & PTE_SIZE) {
-        ret = pml2[pml2_index];
+    uint64_t* entry = cursor_get_pml2_entry(&cursor, vaddr, false, 0);
+    if (entry == NULL || !(*entry & PTE_PRESENT)) {
         goto end;
     }
 
-    if (!(pml2[pml2_index] & PTE_PRESENT)) {
-        goto end;
+    if (!is_huge_entry(*entry)) {
+        entry = cursor_get_pml1_entry(&cursor, vaddr, false, 0);
+        if (entry == NULL || !(*entry & PTE_PRESENT)) {
+            goto end;
+        }
     }
 
-    uint64_t* pml1 = (uint64_t*) ((pml2[pml2_index] & ~PTE_FLAG_MASK) + HIGH_VMA);
-    ret = (pml1[pml1_index] & PTE_PRESENT) ? pml1[pml1_index] : (uintptr_t) -1;
+    ret = *entry;
 
 end:
     spinlock_release(&pagemap->lock);
@@ -418,10 +964,9 @@ UNMAP_AFTER_INIT void vmm_readonly_data_after_init(void) {
     uintptr_t ro_after_init_start = ALIGN_DOWN((uintptr_t) ro_after_init_start_addr, PAGE_SIZE),
               ro_after_init_end = ALIGN_UP((uintptr_t) ro_after_init_end_addr, PAGE_SIZE);
 
-    for (uintptr_t ro_after_init_addr = ro_after_init_start; ro_after_init_addr < ro_after_init_end; ro_after_init_addr += PAGE_SIZE) {
-        if (!vmm_update_flags(kernel_pagemap, ro_after_init_addr, PTE_PRESENT | PTE_NX)) {
-            kpanic(NULL, false, "vmm_readonly_data_after_init: failed to update page mapping");
-        }
+    size_t pages = (ro_after_init_end - ro_after_init_start) / PAGE_SIZE;
+    if (vmm_protect_range(kernel_pagemap, ro_after_init_start, ro_after_init_end, PTE_PRESENT | PTE_NX) != pages) {
+        kpanic(NULL, false, "vmm_readonly_data_after_init: failed to update page mapping");
     }
 }
 
@@ -429,10 +974,9 @@ void vmm_unmap_text_after_init(void) {
     uintptr_t unmap_after_init_start = ALIGN_DOWN((uintptr_t) unmap_after_init_start_addr, PAGE_SIZE),
               unmap_after_init_end = ALIGN_UP((uintptr_t) unmap_after_init_end_addr, PAGE_SIZE);
 
-    for (uintptr_t unmap_after_init_addr = unmap_after_init_start; unmap_after_init_addr < unmap_after_init_end; unmap_after_init_addr += PAGE_SIZE) {
-        if (!vmm_unmap_page(kernel_pagemap, unmap_after_init_addr)) {
-            kpanic(NULL, false, "vmm_unmap_text_after_init: failed to unmap page");
-        }
+    size_t pages = (unmap_after_init_end - unmap_after_init_start) / PAGE_SIZE;
+    if (vmm_unmap_range(kernel_pagemap, unmap_after_init_start, unmap_after_init_end, false) != pages) {
+        kpanic(NULL, false, "vmm_unmap_text_after_init: failed to unmap page");
     }
 
     struct limine_kernel_address_response* kaddr_response = kaddr_request.response;
@@ -456,6 +1000,8 @@ UNMAP_AFTER_INIT void vmm_init(void) {
 
     kernel_pagemap->top_level = (uint64_t*) ((uintptr_t) kernel_pagemap->top_level + HIGH_VMA);
     kernel_pagemap->lock = (spinlock_t) {0};
+    kernel_pagemap->id = 0;
+    kernel_pagemap->tlb_gen = 0;
 
     uint32_t ecx = 0, unused;
     if (cpuid(7, 0, &unused, &unused, &ecx, &unused) && ecx & (1 << 16)) {
@@ -468,12 +1014,8 @@ UNMAP_AFTER_INIT void vmm_init(void) {
 
     klog("[vmm] creating kernel virtual memory mappings...\n");
 
-    uintptr_t paddr = 0;
-    for (size_t i = 1; i < 0x800; i++) {
-        vmm_map_page(kernel_pagemap, paddr + HIGH_VMA, paddr,
-                PTE_PRESENT | PTE_WRITABLE | PTE_SIZE | PTE_GLOBAL | PTE_NX);
-        paddr += BIGPAGE_SIZE;
-    }
+    vmm_map_range(kernel_pagemap, HIGH_VMA, 0, 0x7fful * BIGPAGE_SIZE,
+            PTE_PRESENT | PTE_WRITABLE | PTE_SIZE | PTE_GLOBAL | PTE_NX);
 
     struct limine_memmap_response* memmap_response = memmap_request.response;
     uint64_t entry_count = memmap_response->entry_count;
@@ -485,13 +1027,9 @@ UNMAP_AFTER_INIT void vmm_init(void) {
             continue;
         }
 
-        paddr = ALIGN_DOWN(memmap_entry->base, BIGPAGE_SIZE);
-
-        for (size_t j = 0; j < DIV_CEIL(memmap_entry->length, BIGPAGE_SIZE); j++) {
-            vmm_map_page(kernel_pagemap, paddr + HIGH_VMA, paddr,
-                    PTE_PRESENT | PTE_WRITABLE | PTE_SIZE | PTE_GLOBAL | PTE_NX);
-            paddr += BIGPAGE_SIZE;
-        }
+        uintptr_t paddr = ALIGN_DOWN(memmap_entry->base, BIGPAGE_SIZE);
+        vmm_map_range(kernel_pagemap, paddr + HIGH_VMA, paddr, DIV_CEIL(memmap_entry->length, BIGPAGE_SIZE) * BIGPAGE_SIZE,
+                PTE_PRESENT | PTE_WRITABLE | PTE_SIZE | PTE_GLOBAL | PTE_NX);
     }
 
     struct limine_kernel_address_response* kaddr_response = kaddr_request.response;
@@ -503,25 +1041,20 @@ UNMAP_AFTER_INIT void vmm_init(void) {
     uintptr_t data_start = ALIGN_DOWN((uintptr_t) data_start_addr, PAGE_SIZE),
               data_end = ALIGN_UP((uintptr_t) data_end_addr, PAGE_SIZE);
 
-    for (uintptr_t text_addr = text_start; text_addr < text_end; text_addr += PAGE_SIZE) {
-        paddr = text_addr - kaddr_response->virtual_base + kaddr_response->physical_base;
-        vmm_map_page(kernel_pagemap, text_addr, ALIGN_DOWN(paddr, PAGE_SIZE), PTE_PRESENT | PTE_GLOBAL);
-    }
+    uintptr_t image_offset = kaddr_response->physical_base - kaddr_response->virtual_base;
 
-    for (uintptr_t rodata_addr = rodata_start; rodata_addr < rodata_end; rodata_addr += PAGE_SIZE) {
-        paddr = rodata_addr - kaddr_response->virtual_base + kaddr_response->physical_base;
-        vmm_map_page(kernel_pagemap, rodata_addr, paddr, PTE_PRESENT | PTE_GLOBAL | PTE_NX);
-    }
-
-    for (uintptr_t data_addr = data_start; data_addr < data_end; data_addr += PAGE_SIZE) {
-        paddr = data_addr - kaddr_response->virtual_base + kaddr_response->physical_base;
-        vmm_map_page(kernel_pagemap, data_addr, paddr, PTE_PRESENT | PTE_WRITABLE | PTE_GLOBAL | PTE_NX);
-    }
+    vmm_map_range(kernel_pagemap, text_start, text_start + image_offset, text_end - text_start,
+            PTE_PRESENT | PTE_GLOBAL);
+    vmm_map_range(kernel_pagemap, rodata_start, rodata_start + image_offset, rodata_end - rodata_start,
+            PTE_PRESENT | PTE_GLOBAL | PTE_NX);
+    vmm_map_range(kernel_pagemap, data_start, data_start + image_offset, data_end - data_start,
+            PTE_PRESENT | PTE_WRITABLE | PTE_GLOBAL | PTE_NX);
 
     vmm_switch_pagemap(kernel_pagemap);
     klog("[vmm] switched to new kernel pagemap\n");
 
     isr_install_handler(PAGE_FAULT_VECTOR, page_fault_handler, NULL);
+    isr_install_handler(TLB_SHOOTDOWN_IPI, tlb_shootdown_handler, NULL);
 
     klog("[vmm] initialized virtual memory manager\n");
 }
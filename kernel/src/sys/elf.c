@@ -1,15 +1,62 @@
 #include <errno.h>
 #include <mem/pmm.h>
 #include <sys/elf.h>
+#include <sys/mutex.h>
 #include <utils/log.h>
 #include <utils/macros.h>
-#include <utils/spinlock.h>
 #include <utils/string.h>
 
+/*
+ * Maps and fills the next chunk of a loadable segment at vaddr, with remaining bytes of the segment
+ * left from there. A chunk is either one 2MiB page, where the segment covers a whole aligned 2MiB
+ * region, or a physically contiguous run of 4KiB pages up to the next 2MiB boundary, so that every
+ * chunk takes a single page table walk and a single read. Returns the size of the chunk.
+ */
+static ssize_t load_segment_chunk(struct vfs_node* node, struct elf_program_header* pheader, struct pagemap* pagemap,
+        uintptr_t vaddr, size_t remaining, uint64_t vmm_flags) {
+    size_t size = 0;
+    uintptr_t paddr = 0;
+
+    if (IS_ALIGNED(vaddr, BIGPAGE_SIZE) && remaining >= BIGPAGE_SIZE && vmm_can_map_huge_page(pagemap, vaddr)) {
+        paddr = pmm_alloc_huge_page();
+        if (paddr != 0) {
+            size = BIGPAGE_SIZE;
+            vmm_flags |= PTE_SIZE;
+        }
+    }
+
+    if (paddr == 0) {
+        size = MIN(ALIGN_DOWN(vaddr, BIGPAGE_SIZE) + BIGPAGE_SIZE - vaddr, remaining);
+        paddr = pmm_alloc(size / PAGE_SIZE);
+    }
+
+    memset((void*) (paddr + HIGH_VMA), 0, size);
+
+    if (!vmm_map_range(pagemap, vaddr, paddr, size, vmm_flags)) {
+        pmm_free(paddr, size / PAGE_SIZE);
+        return -EFAULT;
+    }
+
+    /* copy whatever part of the file image falls into this chunk, the rest stays zeroed */
+    uintptr_t file_start = MAX(vaddr, pheader->p_vaddr);
+    uintptr_t file_end = MIN(vaddr + size, pheader->p_vaddr + pheader->p_filesz);
+
+    if (file_start < file_end) {
+        void* buffer = (void*) (paddr + HIGH_VMA + (file_start - vaddr));
+        off_t offset = pheader->p_offset + (file_start - pheader->p_vaddr);
+
+        if (unlikely(node->read(node, buffer, offset, file_end - file_start, 0) < 0)) {
+            return -EIO;
+        }
+    }
+
+    return size;
+}
+
 int elf_load(struct vfs_node* node, struct pagemap* pagemap, uintptr_t* entry) {
     int ret = 0;
 
-    spinlock_acquire(&node->lock);
+    mutex_acquire(&node->io_lock);
 
     struct elf_header header;
     if (unlikely(node->read(node, &header, 0, sizeof(header), 0) < 0)) {
@@ -40,15 +87,6 @@ int elf_load(struct vfs_node* node, struct pagemap* pagemap, uintptr_t* entry) {
             continue;
         }
 
-        size_t misalign = pheader.p_vaddr & (PAGE_SIZE - 1);
-        size_t page_count = (misalign + pheader.p_memsz + (PAGE_SIZE - 1)) / PAGE_SIZE;
-
-        uintptr_t phys_pages = pmm_allocz(page_count);
-        if (!phys_pages) {
-            ret = -ENOMEM;
-            goto end;
-        }
-
         uint64_t vmm_flags = PTE_PRESENT | PTE_USER;
         if (pheader.p_flags & PF_W) {
             vmm_flags |= PTE_WRITABLE;
@@ -58,18 +96,16 @@ int elf_load(struct vfs_node* node, struct pagemap* pagemap, uintptr_t* entry) {
             vmm_flags |= PTE_NX;
         }
 
-        for (size_t j = 0; j < page_count; j++) {
-            uintptr_t vaddr = pheader.p_vaddr + (j * PAGE_SIZE);
-            uintptr_t paddr = phys_pages + (j * PAGE_SIZE);
-            if (!vmm_map_page(pagemap, vaddr, paddr, vmm_flags)) {
-                ret = -EFAULT;
+        uintptr_t segment_start = ALIGN_DOWN(pheader.p_vaddr, PAGE_SIZE);
+        uintptr_t segment_end = ALIGN_UP(pheader.p_vaddr + pheader.p_memsz, PAGE_SIZE);
+        for (uintptr_t vaddr = segment_start; vaddr < segment_end;) {
+            ssize_t size = load_segment_chunk(node, &pheader, pagemap, vaddr, segment_end - vaddr, vmm_flags);
+            if (size < 0) {
+                ret = size;
                 goto end;
             }
-        }
 
-        if (unlikely(node->read(node, (void*) (phys_pages + HIGH_VMA + misalign), pheader.p_offset, pheader.p_filesz, 0) < 0)) {
-            ret = -EIO;
-            goto end;
+            vaddr += size;
         }
     }
 
@@ -78,6 +114,6 @@ int elf_load(struct vfs_node* node, struct pagemap* pagemap, uintptr_t* entry) {
     }
 
 end:
-    spinlock_release(&node->lock);
+    mutex_release(&node->io_lock);
     return ret;
 }
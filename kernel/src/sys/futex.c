@@ -0,0 +1,130 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <errno.h>
+#include <mem/vmm.h>
+#include <sys/futex.h>
+#include <sys/process.h>
+#include <sys/time.h>
+#include <sys/wait_queue.h>
+#include <utils/user_access.h>
+
+static struct wait_queue futex_buckets[FUTEX_BUCKETS];
+
+static inline size_t futex_hash(uintptr_t key) {
+    return ((key >> 2) * 0x9e3779b97f4a7c15ul) >> 32;
+}
+
+/*
+ * Futexes in shared mappings are keyed by the physical address of their word, in the global buckets,
+ * so that processes sharing the page meet on the same one. All others are private to their process
+ * and keyed by their address, in the buckets of the process, as their page may change under the
+ * waiters: copy-on-write moves the word to a new page with the next write after a fork, and an
+ * unmapped page may be reused by anyone.
+ */
+static int futex_key(uint32_t* uaddr, uintptr_t* key, struct wait_queue** bucket) {
+    uintptr_t vaddr = (uintptr_t) uaddr;
+    if (vaddr & (sizeof(uint32_t) - 1)) {
+        return -EINVAL;
+    }
+
+    /* faults the page in, so that its mapping can be looked up */
+    uint32_t value;
+    if (copy_from_user(&value, uaddr, sizeof(uint32_t)) == NULL) {
+        return -EFAULT;
+    }
+
+    struct process* process = this_cpu()->running_thread->process;
+
+    uint64_t entry = vmm_get_page_mapping(process->pagemap, vaddr);
+    if (entry == (uint64_t) -1) {
+        return -EFAULT;
+    }
+
+    if (entry & PTE_SHARED) {
+        size_t page_size = (entry & PTE_SIZE) ? BIGPAGE_SIZE : PAGE_SIZE;
+        *key = (entry & ~PTE_FLAG_MASK) + (vaddr & (page_size - 1));
+        *bucket = &futex_buckets[futex_hash(*key) % FUTEX_BUCKETS];
+    } else {
+        *key = vaddr;
+        *bucket = &process->futex_buckets[futex_hash(*key) % FUTEX_PRIVATE_BUCKETS];
+    }
+
+    return 0;
+}
+
+/*
+ * Sleeps as long as the word still holds the expected value, checked under the bucket lock that wakers
+ * take as well. The word is read where it is mapped now, with a load that fails instead of faulting.
+ */
+int futex_wait(uint32_t* uaddr, uint32_t expected, uint64_t timeout_ns) {
+    uintptr_t key;
+    struct wait_queue* bucket;
+    int ret = futex_key(uaddr, &key, &bucket);
+    if (ret < 0) {
+        return ret;
+    }
+
+    uint64_t deadline = 0;
+    if (timeout_ns != UINT64_MAX) {
+        deadline = time_ns() + timeout_ns;
+    }
+
+    bool prev_int = interrupt_state();
+    cli();
+    spinlock_acquire(&bucket->lock);
+
+    uint32_t value;
+    USER_ACCESS_BEGIN;
+    bool loaded = user_load32(&value, uaddr);
+    USER_ACCESS_END;
+
+    if (!loaded) {
+        ret = -EFAULT;
+    } else if (value != expected) {
+        ret = -EAGAIN;
+    } else if (!wait_queue_sleep_keyed(bucket, &bucket->lock, key, deadline) && deadline != 0) {
+        ret = -ETIMEDOUT;
+    }
+
+    spinlock_release(&bucket->lock);
+    if (prev_int) {
+        sti();
+    }
+
+    return ret;
+}
+
+int futex_wake(uint32_t* uaddr, size_t count) {
+    uintptr_t key;
+    struct wait_queue* bucket;
+    int ret = futex_key(uaddr, &key, &bucket);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return wait_queue_wake_key(bucket, key, count);
+}
+
+/* wakes up to wake_count waiters, and moves up to requeue_count of the others over to the second futex */
+int futex_requeue(uint32_t* uaddr, size_t wake_count, uint32_t* uaddr2, size_t requeue_count) {
+    uintptr_t key, key2;
+    struct wait_queue *bucket, *bucket2;
+    int ret = futex_key(uaddr, &key, &bucket);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = futex_key(uaddr2, &key2, &bucket2);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t woken = wait_queue_wake_key(bucket, key, wake_count);
+
+    size_t moved = 0;
+    if (key2 != key || bucket2 != bucket) {
+        moved = wait_queue_requeue_key(bucket, key, bucket2, key2, requeue_count);
+    }
+
+    return woken + moved;
+}
@@ -0,0 +1,95 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <sys/mutex.h>
+#include <sys/process.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/spinlock.h>
+
+#define MUTEX_WAITERS   1ul
+
+/* uncontended acquires and releases never touch the waiter queue */
+static inline bool mutex_try_take(struct mutex* m, uintptr_t owner) {
+    uintptr_t unowned = 0;
+    return __atomic_compare_exchange_n(&m->owner, &unowned, owner, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+bool mutex_try_acquire(struct mutex* m) {
+    return mutex_try_take(m, (uintptr_t) this_cpu()->running_thread);
+}
+
+/*
+ * Contended acquires mark the mutex before going to sleep, so that the owner wakes someone up when it
+ * lets go. The mark is kept by whoever takes the mutex from there, there may be more threads asleep.
+ */
+void mutex_acquire(struct mutex* m) {
+    uintptr_t current = (uintptr_t) this_cpu()->running_thread;
+    if (likely(mutex_try_take(m, current))) {
+        return;
+    }
+
+    if (unlikely((__atomic_load_n(&m->owner, __ATOMIC_RELAXED) & ~MUTEX_WAITERS) == current)) {
+        kpanic(NULL, true, "thread tried to acquire a mutex it already holds");
+    }
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    spinlock_acquire(&m->waiters.lock);
+    for (;;) {
+        uintptr_t owner = __atomic_load_n(&m->owner, __ATOMIC_SEQ_CST);
+        if (owner == 0) {
+            if (mutex_try_take(m, current | MUTEX_WAITERS)) {
+                break;
+            }
+            continue;
+        }
+
+        if (!(owner & MUTEX_WAITERS) && !__atomic_compare_exchange_n(&m->owner, &owner, owner | MUTEX_WAITERS,
+                    false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            continue;
+        }
+
+        wait_queue_sleep(&m->waiters, &m->waiters.lock);
+    }
+    spinlock_release(&m->waiters.lock);
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+void mutex_release(struct mutex* m) {
+    uintptr_t owner = __atomic_exchange_n(&m->owner, 0, __ATOMIC_SEQ_CST);
+    if (owner & MUTEX_WAITERS) {
+        wait_queue_wake_one(&m->waiters);
+    }
+}
+
+/*
+ * The mutex is released with the queue lock held, so whoever takes it next can only signal once the
+ * thread is asleep on the queue.
+ */
+void condvar_wait(struct condvar* cv, struct mutex* m) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    spinlock_acquire(&cv->waiters.lock);
+    mutex_release(m);
+    wait_queue_sleep(&cv->waiters, &cv->waiters.lock);
+    spinlock_release(&cv->waiters.lock);
+
+    if (prev_int) {
+        sti();
+    }
+
+    mutex_acquire(m);
+}
+
+void condvar_signal(struct condvar* cv) {
+    wait_queue_wake_one(&cv->waiters);
+}
+
+void condvar_broadcast(struct condvar* cv) {
+    wait_queue_wake_all(&cv->waiters);
+}
@@ -1,4 +1,5 @@
 #include <cpu/asm.h>
+#include <cpu/fpu.h>
 #include <cpu/percpu.h>
 #include <errno.h>
 #include <mem/pmm.h>
@@ -13,7 +14,8 @@
 #include <utils/string.h>
 #include <utils/vector.h>
 
-#define STACK_SIZE 0x40000
+#define STACK_SIZE              0x40000
+#define PAGE_FAULT_STACK_SIZE   0x8000
 
 // TODO: use actual tree data structure for processes
 READONLY_AFTER_INIT static struct cache* process_cache;
@@ -67,6 +69,10 @@ struct process* process_create(struct process* old, struct pagemap* pagemap) {
     }
 
     new->state = PROCESS_RUNNING;
+    new->vmas = (struct vma_tree) {0};
+    new->cpu_time = 0;
+    new->parent = NULL;
+    new->child_exited = (struct wait_queue) {0};
 
     new->children = vector_create(sizeof(struct process*));
     if (unlikely(new->children == NULL)) {
@@ -86,6 +92,10 @@ struct process* process_create(struct process* old, struct pagemap* pagemap) {
             goto error;
         }
 
+        if (unlikely(!vma_fork(&new->vmas, &old->vmas))) {
+            goto error;
+        }
+
         new->brk = old->brk;
         new->thread_stack_top = old->thread_stack_top;
         new->cwd = old->cwd;
@@ -100,11 +110,9 @@ struct process* process_create(struct process* old, struct pagemap* pagemap) {
                 goto error;
             }
         }
-
-        vector_push_back(old->children, new);
     } else {
         new->pagemap = pagemap;
-        new->brk = new->brk_next_unallocated_page_begin = PROCESS_BRK_BASE;
+        new->brk = PROCESS_BRK_BASE;
         new->thread_stack_top = PROCESS_THREAD_STACK_TOP;
         new->cwd = vfs_root;
     }
@@ -114,6 +122,9 @@ struct process* process_create(struct process* old, struct pagemap* pagemap) {
 
     spinlock_acquire(&process_list_lock);
     vector_push_back(running_processes, new);
+    if (old != NULL) {
+        vector_push_back(old->children, new);
+    }
     spinlock_release(&process_list_lock);
 
     goto end;
@@ -128,6 +139,7 @@ error:
     if (new->pagemap != NULL) {
         vmm_destroy_pagemap(new->pagemap);
     }
+    vma_tree_destroy(&new->vmas);
 
     cache_free_object(process_cache, new);
     new = NULL;
@@ -183,36 +195,65 @@ UNMAP_AFTER_INIT bool process_create_init(void) {
     return true;
 }
 
+/*
+ * A process its parent did not wait for yet leaves its exit status behind for it. All of the unlinking
+ * happens at once, so that a waiting parent always finds the child in one place or the other.
+ */
 void process_destroy(struct process* p) {
-    if (likely(p->parent != NULL)) {
-        vector_remove_by_value(p->parent->children, p);
-    }
-
     for (int i = 0; i < MAX_FDS; i++) {
         fd_close(p, i);
     }
 
-    /* reparent the now dead process' children to init (pid=1) */
+    vma_tree_destroy(&p->vmas);
+    vmm_destroy_pagemap(p->pagemap);
+
+    struct dead_process* dp = cache_alloc_object(dead_process_cache);
+
+    spinlock_acquire(&process_list_lock);
+
+    /* reparent the now dead process' children to init (pid=1), along with the ones it did not collect */
     struct process* init = vector_get(running_processes, 1);
+    bool reparented = p->children->size != 0;
     for (size_t i = 0; i < p->children->size; i++) {
-        vector_push_back(init->children, vector_get(p->children, i));
+        struct process* child = vector_get(p->children, i);
+        child->parent = init;
+        vector_push_back(init->children, child);
     }
 
-    vector_destroy(p->children);
-    vector_destroy(p->threads);
+    for (size_t i = 0; i < dead_processes->size; i++) {
+        struct dead_process* dead_child = dead_processes->data[i];
+        if (dead_child->ppid == p->pid) {
+            dead_child->ppid = init->pid;
+            reparented = true;
+        }
+    }
 
-    vmm_destroy_pagemap(p->pagemap);
+    if (reparented) {
+        wait_queue_wake_all(&init->child_exited);
+    }
 
-    struct dead_process* dp = cache_alloc_object(dead_process_cache);
-    dp->pid = p->pid;
-    dp->ppid = p->parent != NULL ? p->parent->pid : 0;
-    dp->status = p->status;
+    if (likely(p->parent != NULL)) {
+        vector_remove_by_value(p->parent->children, p);
+
+        if (likely(dp != NULL)) {
+            dp->pid = p->pid;
+            dp->ppid = p->parent->pid;
+            dp->status = p->status;
+            vector_push_back(dead_processes, dp);
+            dp = NULL;
+        }
+    }
 
-    spinlock_acquire(&process_list_lock);
     vector_remove_by_value(running_processes, p);
-    vector_push_back(dead_processes, dp);
     spinlock_release(&process_list_lock);
 
+    if (dp != NULL) {
+        cache_free_object(dead_process_cache, dp);
+    }
+
+    /* only now that it is off the list, which process_for_each_thread walks */
+    vector_destroy(p->threads);
+    vector_destroy(p->children);
     cache_free_object(process_cache, p);
 }
 
@@ -225,114 +266,188 @@ void process_exit(struct process* p, int status) {
      * This is all that *needs* to be done to get a process to just stop running.
      * All of the actual process teardown is done in process_destroy, which is run lazily by the scheduler.
      */
+    bool prev_int = interrupt_state();
+    cli();
+
+    /* the parent checks for exited children with the lock held, so it is either asleep or sees this */
+    spinlock_acquire(&process_list_lock);
     p->state = PROCESS_ZOMBIE;
     p->status = status;
+    spinlock_release(&process_list_lock);
 
     for (size_t i = 0; i < p->threads->size; i++) {
         sched_thread_dequeue(p->threads->data[i]);
     }
+
+    spinlock_acquire(&process_list_lock);
+    if (p->parent != NULL) {
+        wait_queue_wake_all(&p->parent->child_exited);
+    }
+    spinlock_release(&process_list_lock);
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+/* running process with the given pid, NULL if there is none */
+struct process* process_get(pid_t pid) {
+    struct process* found = NULL;
+
+    spinlock_acquire(&process_list_lock);
+    for (size_t i = 0; i < running_processes->size; i++) {
+        struct process* p = running_processes->data[i];
+        if (p->pid == pid && p->state != PROCESS_ZOMBIE) {
+            found = p;
+            break;
+        }
+    }
+    spinlock_release(&process_list_lock);
+
+    return found;
+}
+
+/*
+ * Calls fn on every thread of every process, zombies included. The threads cannot go away meanwhile,
+ * as the process list lock is held, so fn must not block.
+ */
+void process_for_each_thread(void (*fn)(struct thread*, void*), void* ctx) {
+    spinlock_acquire(&process_list_lock);
+    for (size_t i = 0; i < running_processes->size; i++) {
+        struct process* p = running_processes->data[i];
+        for (size_t j = 0; j < p->threads->size; j++) {
+            fn(p->threads->data[j], ctx);
+        }
+    }
+    spinlock_release(&process_list_lock);
+}
+
+/*
+ * Once the heap has outgrown its first 2MiB, the area is reserved in whole 2MiB steps ahead of the
+ * break, so that the rest of it can be backed by huge pages instead of being faulted in piecemeal.
+ */
+static uintptr_t brk_area_end(uintptr_t brk) {
+    if (brk - PROCESS_BRK_BASE <= BIGPAGE_SIZE) {
+        return ALIGN_UP(brk, PAGE_SIZE);
+    }
+    return ALIGN_UP(brk, BIGPAGE_SIZE);
 }
 
+/*
+ * The heap is a single anonymous area starting at PROCESS_BRK_BASE. Growing it only extends the
+ * reservation, the pages are faulted in on first touch; shrinking it gives back whatever was touched.
+ */
 void* process_sbrk(struct process* p, intptr_t size) {
     uintptr_t old_brk = p->brk;
+    uintptr_t new_brk = old_brk + size;
 
-    if (size > 0) {
-        size_t remaining = p->brk_next_unallocated_page_begin - p->brk;
+    if ((size < 0 && new_brk < PROCESS_BRK_BASE) || (size > 0 && new_brk < old_brk)) {
+        return (void*) -1;
+    }
 
-        if ((unsigned) size > remaining) {
-            size_t bytes_needed = size - remaining;
-            size_t page_count = ((bytes_needed - 1) / PAGE_SIZE) + 1;
+    uintptr_t old_end = brk_area_end(old_brk);
+    uintptr_t new_end = brk_area_end(new_brk);
 
-            uintptr_t paddr = pmm_alloc(page_count);
-            if (paddr == 0) {
-                return (void*) -1;
-            }
+    if (new_end > old_end) {
+        if (!vma_reserve(&p->vmas, old_end, new_end, PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX)) {
+            return (void*) -1;
+        }
+    } else if (new_end < old_end) {
+        vma_release(&p->vmas, p->pagemap, new_end, old_end);
+    }
 
-            for (size_t i = 0; i < page_count; i++) {
-                if (!vmm_map_page(p->pagemap, p->brk_next_unallocated_page_begin + (i * PAGE_SIZE),
-                            paddr + (i * PAGE_SIZE), PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX)) {
-                    return (void*) -1;
-                }
-            }
+    p->brk = new_brk;
+    return (void*) old_brk;
+}
 
-            p->brk_next_unallocated_page_begin += page_count * PAGE_SIZE;
-        }
-    } else if (size < 0) {
-        uintptr_t current_page_start = p->brk_next_unallocated_page_begin - PAGE_SIZE;
-        size_t remaining = p->brk - current_page_start;
-
-        if ((unsigned) -size > remaining) {
-            size_t page_count = (((-size - remaining) - 1) / PAGE_SIZE) + 1;
-            for (size_t i = 0; i < page_count; i++) {
-                if (p->brk_next_unallocated_page_begin - PAGE_SIZE >= PROCESS_BRK_BASE) {
-                    p->brk_next_unallocated_page_begin -= PAGE_SIZE;
-                    vmm_unmap_page(p->pagemap, p->brk_next_unallocated_page_begin);
-                }
+/* both called with process_list_lock held */
+static struct process* find_child(struct process* p, pid_t pid, bool* has_children) {
+    for (size_t i = 0; i < p->children->size; i++) {
+        struct process* child = p->children->data[i];
+        if (pid == -1 || child->pid == pid) {
+            *has_children = true;
+            if (child->state == PROCESS_ZOMBIE) {
+                return child;
             }
         }
     }
+    return NULL;
+}
 
-    p->brk += size;
-    return (void*) old_brk;
+static struct dead_process* find_dead_child(struct process* p, pid_t pid) {
+    for (size_t i = 0; i < dead_processes->size; i++) {
+        struct dead_process* dp = dead_processes->data[i];
+        if (dp->ppid == p->pid && (pid == -1 || dp->pid == pid)) {
+            return dp;
+        }
+    }
+    return NULL;
 }
 
+/*
+ * Sleeps until a child matching pid (-1 for any) exited and collects it. Children that exited are
+ * woken for by process_exit, and ones that the scheduler destroyed meanwhile left their status behind.
+ */
 pid_t process_wait(struct process* p, pid_t pid, int* status, int flags) {
-    p->state = PROCESS_WAITING;
+    if (pid != -1 && pid <= 0) {
+        return -EINVAL;
+    }
 
-    struct process* child = NULL;
+    pid_t ret;
+    int child_status = 0;
 
-    if (pid == -1) {
-        while (true) {
-            if (p->children->size == 0) {
-                return -ECHILD;
-            }
-
-            struct process* iter;
-            for (size_t i = 0; i < p->children->size; i++) {
-                iter = p->children->data[i];
-                if (iter->state == PROCESS_ZOMBIE) {
-                    child = iter;
-                    break;
-                }
-            }
+    bool prev_int = interrupt_state();
+    cli();
+    spinlock_acquire(&process_list_lock);
 
-            if (flags & WNOHANG) {
-                return -EAGAIN;
-            }
+    for (;;) {
+        bool has_children = false;
+        struct process* child = find_child(p, pid, &has_children);
+        if (child != NULL) {
+            /* no longer anyone's child, so destroying it later leaves nothing behind */
+            vector_remove_by_value(p->children, child);
+            child->parent = NULL;
+            child_status = child->status;
+            ret = child->pid;
+            break;
+        }
 
-            sched_yield();
+        struct dead_process* dp = find_dead_child(p, pid);
+        if (dp != NULL) {
+            vector_remove_by_value(dead_processes, dp);
+            child_status = dp->status;
+            ret = dp->pid;
+            cache_free_object(dead_process_cache, dp);
+            break;
         }
-    } else if (pid > 0) {
-        struct process* iter;
-        for (size_t i = 0; i < p->children->size; i++) {
-            iter = p->children->data[i];
-            if (iter->pid == pid) {
-                child = iter;
-                break;
-            }
+
+        if (!has_children) {
+            ret = -ECHILD;
+            break;
         }
 
-        if (child == NULL) {
-            return -ECHILD;
+        if (flags & WNOHANG) {
+            ret = -EAGAIN;
+            break;
         }
 
-        while (child->state != PROCESS_ZOMBIE) {
-            if (flags & WNOHANG) {
-                return -EAGAIN;
-            }
-            sched_yield();
+        p->state = PROCESS_WAITING;
+        wait_queue_sleep(&p->child_exited, &process_list_lock);
+        if (p->state == PROCESS_WAITING) {
+            p->state = PROCESS_RUNNING;
         }
-    } else {
-        return -EINVAL;
     }
 
-    p->state = PROCESS_RUNNING;
+    spinlock_release(&process_list_lock);
+    if (prev_int) {
+        sti();
+    }
 
-    if (likely(status)) {
-        *status = child->status;
+    if (ret > 0 && status != NULL) {
+        *status = child_status;
     }
 
-    return child->pid;
+    return ret;
 }
 
 struct thread* thread_create(struct process* p, uintptr_t entry, void* arg, const char** argv, const char** envp, bool is_user) {
@@ -345,8 +460,18 @@ struct thread* thread_create(struct process* p, uintptr_t entry, void* arg, cons
     t->process = p;
     t->is_user = is_user;
     t->lock = (spinlock_t) {0};
+    t->next = NULL;
+    t->prev = NULL;
+    t->run_queue = NULL;
+    t->page_fault_stack = 0;
+
+    /* threads of a process, including the one exec starts, are scheduled like the thread creating them */
+    struct thread* current_thread = this_cpu()->running_thread;
+    sched_thread_init(t, current_thread != NULL && current_thread->process == p ? current_thread : NULL);
 
     uintptr_t user_stack_paddr = 0;
+    size_t user_stack_pages = 0;
+    uintptr_t user_stack_bottom = 0;
 
     t->kernel_stack = pmm_alloc(STACK_SIZE / PAGE_SIZE);
     if (unlikely(t->kernel_stack == 0)) {
@@ -355,52 +480,63 @@ struct thread* thread_create(struct process* p, uintptr_t entry, void* arg, cons
     t->kernel_stack += STACK_SIZE + HIGH_VMA;
 
     if (is_user) {
-        t->timeslice = 20000;
-
         t->ctx.cs = 0x23;
         t->ctx.ss = 0x1b;
 
-        user_stack_paddr = pmm_alloc(STACK_SIZE / PAGE_SIZE);
-        if (unlikely(user_stack_paddr == 0)) {
-            goto error;
-        }
-
-        for (size_t i = 0; i < STACK_SIZE / PAGE_SIZE; i++) {
-            if (unlikely(!vmm_map_page(p->pagemap,
-                        (p->thread_stack_top - STACK_SIZE) + (i * PAGE_SIZE),
-                        user_stack_paddr + (i * PAGE_SIZE),
+        /* the user stack is only reserved here and faulted in as it grows */
+        user_stack_bottom = p->thread_stack_top - STACK_SIZE;
+        if (unlikely(!vma_reserve(&p->vmas, user_stack_bottom, p->thread_stack_top,
                         PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX))) {
-                goto error;
-            }
+            user_stack_bottom = 0;
+            goto error;
         }
 
         t->ctx.rsp = p->thread_stack_top;
-        p->thread_stack_top -= STACK_SIZE - PAGE_SIZE;
 
-        t->page_fault_stack = pmm_alloc(STACK_SIZE / PAGE_SIZE);
+        /* leave an unreserved guard page between thread stacks */
+        p->thread_stack_top -= STACK_SIZE + PAGE_SIZE;
+
+        t->page_fault_stack = pmm_alloc(PAGE_FAULT_STACK_SIZE / PAGE_SIZE);
         if (t->page_fault_stack == 0) {
             goto error;
         }
-        t->page_fault_stack += STACK_SIZE + HIGH_VMA;
+        t->page_fault_stack += PAGE_FAULT_STACK_SIZE + HIGH_VMA;
 
         t->fpu_storage = (void*) pmm_allocz(DIV_CEIL(this_cpu()->fpu_storage_size, PAGE_SIZE));
         if (t->fpu_storage == NULL) {
             goto error;
         }
         t->fpu_storage = (void*) ((uintptr_t) t->fpu_storage + HIGH_VMA);
-
-        this_cpu()->fpu_restore(t->fpu_storage);
-        uint16_t default_fcw = 0x33f;
-        __asm__ volatile ("fldcw %0" :: "m" (default_fcw) : "memory");
-        uint32_t default_mxcsr = 0x1f80;
-        __asm__ volatile ("ldmxcsr %0" :: "m" (default_mxcsr) : "memory");
-        this_cpu()->fpu_save(t->fpu_storage);
+        fpu_thread_init(t);
 
         t->fs_base = 0;
         t->gs_base = 0;
 
         if (p->threads->size == 0 && argv != NULL && envp != NULL) {
-            void* stack_top = (void*) (user_stack_paddr + STACK_SIZE + HIGH_VMA);
+            /*
+             * The initial stack contents are written through the HHDM, so the pages they land on are
+             * populated up front as one contiguous block instead of being faulted in.
+             */
+            size_t initial_size = 64;
+            for (size_t i = 0; envp[i] != NULL; i++) {
+                initial_size += strlen(envp[i]) + 1 + sizeof(uintptr_t);
+            }
+            for (size_t i = 0; argv[i] != NULL; i++) {
+                initial_size += strlen(argv[i]) + 1 + sizeof(uintptr_t);
+            }
+
+            user_stack_pages = DIV_CEIL(initial_size, PAGE_SIZE);
+            if (unlikely(user_stack_pages > STACK_SIZE / PAGE_SIZE)) {
+                goto error;
+            }
+
+            user_stack_paddr = pmm_alloc(user_stack_pages);
+            if (unlikely(!vmm_map_range(p->pagemap, t->ctx.rsp - user_stack_pages * PAGE_SIZE, user_stack_paddr,
+                        user_stack_pages * PAGE_SIZE, PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX))) {
+                goto error;
+            }
+
+            void* stack_top = (void*) (user_stack_paddr + (user_stack_pages * PAGE_SIZE) + HIGH_VMA);
             uintptr_t* stack = stack_top;
 
             int envp_len;
@@ -450,8 +586,6 @@ struct thread* thread_create(struct process* p, uintptr_t entry, void* arg, cons
             t->user_stack = t->ctx.rsp;
         }
     } else {
-        t->timeslice = 5000;
-
         t->ctx.rdi = (uint64_t) arg;
 
         t->ctx.cs = 0x08;
@@ -466,8 +600,10 @@ struct thread* thread_create(struct process* p, uintptr_t entry, void* arg, cons
     t->ctx.rflags = 0x202;
     t->ctx.rip = entry;
 
+    spinlock_acquire(&process_list_lock);
     t->tid = p->threads->size;
     vector_push_back(p->threads, t);
+    spinlock_release(&process_list_lock);
 
     goto end;
 
@@ -477,10 +613,13 @@ error:
     }
     if (is_user) {
         if (t->page_fault_stack != 0) {
-            pmm_free(t->page_fault_stack - STACK_SIZE - HIGH_VMA, STACK_SIZE / PAGE_SIZE);
+            pmm_free(t->page_fault_stack - PAGE_FAULT_STACK_SIZE - HIGH_VMA, PAGE_FAULT_STACK_SIZE / PAGE_SIZE);
         }
-        if (user_stack_paddr != 0) {
-            pmm_free(user_stack_paddr - STACK_SIZE, STACK_SIZE / PAGE_SIZE);
+        if (user_stack_bottom != 0) {
+            /* also unmaps and frees the initial stack pages, if they were mapped */
+            vma_release(&p->vmas, p->pagemap, user_stack_bottom, user_stack_bottom + STACK_SIZE);
+        } else if (user_stack_paddr != 0) {
+            pmm_free(user_stack_paddr, user_stack_pages);
         }
     }
     cache_free_object(thread_cache, t);
@@ -498,7 +637,10 @@ struct thread* thread_fork(struct process* forked, struct thread* old_thread) {
     new_thread->state = THREAD_READY_TO_RUN;
     new_thread->process = forked;
     new_thread->lock = (spinlock_t) {0};
-    new_thread->timeslice = old_thread->timeslice;
+    new_thread->next = NULL;
+    new_thread->prev = NULL;
+    new_thread->run_queue = NULL;
+    sched_thread_init(new_thread, old_thread);
 
     new_thread->kernel_stack = pmm_alloc(STACK_SIZE / PAGE_SIZE);
     if (unlikely(new_thread->kernel_stack == 0)) {
@@ -506,11 +648,11 @@ struct thread* thread_fork(struct process* forked, struct thread* old_thread) {
     }
     new_thread->kernel_stack += STACK_SIZE + HIGH_VMA;
 
-    new_thread->page_fault_stack = pmm_alloc(STACK_SIZE / PAGE_SIZE);
+    new_thread->page_fault_stack = pmm_alloc(PAGE_FAULT_STACK_SIZE / PAGE_SIZE);
     if (unlikely(new_thread->page_fault_stack == 0)) {
         goto error;
     }
-    new_thread->page_fault_stack += STACK_SIZE + HIGH_VMA;
+    new_thread->page_fault_stack += PAGE_FAULT_STACK_SIZE + HIGH_VMA;
 
     new_thread->user_stack = old_thread->user_stack;
 
@@ -522,13 +664,15 @@ struct thread* thread_fork(struct process* forked, struct thread* old_thread) {
         goto error;
     }
     new_thread->fpu_storage = (void*) ((uintptr_t) new_thread->fpu_storage + HIGH_VMA);
-    memcpy(new_thread->fpu_storage, old_thread->fpu_storage, this_cpu()->fpu_storage_size);
+    fpu_thread_copy(new_thread, old_thread);
 
     new_thread->fs_base = old_thread->fs_base;
     new_thread->gs_base = old_thread->gs_base;
 
+    spinlock_acquire(&process_list_lock);
     new_thread->tid = forked->threads->size;
     vector_push_back(forked->threads, new_thread);
+    spinlock_release(&process_list_lock);
 
     goto end;
 
@@ -537,7 +681,7 @@ error:
         pmm_free(new_thread->kernel_stack - STACK_SIZE - HIGH_VMA, STACK_SIZE / PAGE_SIZE);
     }
     if (new_thread->page_fault_stack != 0) {
-        pmm_free(new_thread->page_fault_stack - STACK_SIZE - HIGH_VMA, STACK_SIZE / PAGE_SIZE);
+        pmm_free(new_thread->page_fault_stack - PAGE_FAULT_STACK_SIZE - HIGH_VMA, PAGE_FAULT_STACK_SIZE / PAGE_SIZE);
     }
     cache_free_object(thread_cache, new_thread);
     new_thread = NULL;
@@ -549,11 +693,14 @@ void thread_destroy(struct thread* t) {
     pmm_free(t->kernel_stack - STACK_SIZE - HIGH_VMA, STACK_SIZE / PAGE_SIZE);
 
     if (likely(t->is_user)) {
-        pmm_free(t->page_fault_stack - STACK_SIZE - HIGH_VMA, STACK_SIZE / PAGE_SIZE);
+        pmm_free(t->page_fault_stack - PAGE_FAULT_STACK_SIZE - HIGH_VMA, PAGE_FAULT_STACK_SIZE / PAGE_SIZE);
         pmm_free((uintptr_t) t->fpu_storage - HIGH_VMA, DIV_CEIL(this_cpu()->fpu_storage_size, PAGE_SIZE));
     }
 
+    spinlock_acquire(&process_list_lock);
     vector_remove_by_value(t->process->threads, t);
+    spinlock_release(&process_list_lock);
+
     cache_free_object(thread_cache, t);
 }
 
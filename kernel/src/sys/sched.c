@@ -1,16 +1,24 @@
 #include <cpu/asm.h>
+#include <cpu/fpu.h>
 #include <cpu/isr.h>
 #include <cpu/percpu.h>
-#include <dev/hpet.h>
+#include <cpu/smp.h>
+#include <cpu/topology.h>
 #include <dev/lapic.h>
+#include <errno.h>
+#include <mem/pmm.h>
+#include <sys/preempt.h>
 #include <sys/sched.h>
+#include <sys/time.h>
+#include <sys/timer.h>
+#include <sys/wait_queue.h>
 #include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
 #include <utils/spinlock.h>
 
 READONLY_AFTER_INIT struct process* kernel_process;
 
-static struct thread* runnable_threads = NULL;
-static struct thread* blocking_threads = NULL;
 static struct thread* zombie_threads = NULL;
 static spinlock_t thread_list_lock = {0};
 static spinlock_t thread_management_lock = {0};
@@ -59,113 +67,616 @@ static void remove_thread_from_list(struct thread** list, struct thread* t) {
     spinlock_release(&thread_list_lock);
 }
 
-static struct thread* get_next_thread(struct thread* current) {
-    struct thread* iter = NULL;
-    if (current) {
-        iter = current->next;
+/* targeted latency every runnable fair thread gets to run within, and the shortest slice handed out */
+#define SCHED_LATENCY_NS        6000000
+#define SCHED_MIN_GRANULARITY_NS 750000
+/* how far ahead of the queue a thread that slept or is new may be placed */
+#define SCHED_SLEEPER_CREDIT_NS (SCHED_LATENCY_NS / 2)
+/* SCHED_RR threads rotate this often, SCHED_FIFO threads are only interrupted by timers */
+#define SCHED_RR_TIMESLICE_NS   100000000
+/* how soon a CPU that could not be preempted is asked again */
+#define SCHED_PREEMPT_RETRY_NS  100000
+
+#define NICE_0_WEIGHT 1024
+
+/* every nice level is worth about 10% of CPU time against a thread one level apart */
+static const uint64_t nice_weights[] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+static inline uint64_t nice_weight(int nice) {
+    return nice_weights[nice - SCHED_NICE_MIN];
+}
+
+/* vruntimes are compared by their distance so that placing a thread before 0 works */
+static inline bool vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t) (a - b) < 0;
+}
+
+static inline bool fair_before(struct thread* a, struct thread* b) {
+    if (a->vruntime != b->vruntime) {
+        return vruntime_before(a->vruntime, b->vruntime);
+    }
+    return a < b;
+}
+
+static inline size_t fair_tree_height(struct thread* node) {
+    return node != NULL ? node->height : 0;
+}
+
+static inline void fair_tree_update_height(struct thread* node) {
+    node->height = 1 + MAX(fair_tree_height(node->left), fair_tree_height(node->right));
+}
+
+static struct thread* fair_tree_rotate_right(struct thread* node) {
+    struct thread* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    fair_tree_update_height(node);
+    fair_tree_update_height(left);
+    return left;
+}
+
+static struct thread* fair_tree_rotate_left(struct thread* node) {
+    struct thread* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    fair_tree_update_height(node);
+    fair_tree_update_height(right);
+    return right;
+}
+
+static struct thread* fair_tree_rebalance(struct thread* node) {
+    fair_tree_update_height(node);
+
+    if (fair_tree_height(node->left) > fair_tree_height(node->right) + 1) {
+        if (fair_tree_height(node->left->left) < fair_tree_height(node->left->right)) {
+            node->left = fair_tree_rotate_left(node->left);
+        }
+        return fair_tree_rotate_right(node);
+    }
+
+    if (fair_tree_height(node->right) > fair_tree_height(node->left) + 1) {
+        if (fair_tree_height(node->right->right) < fair_tree_height(node->right->left)) {
+            node->right = fair_tree_rotate_right(node->right);
+        }
+        return fair_tree_rotate_left(node);
+    }
+
+    return node;
+}
+
+static struct thread* fair_tree_insert(struct thread* root, struct thread* t) {
+    if (root == NULL) {
+        t->left = t->right = NULL;
+        t->height = 1;
+        return t;
+    }
+
+    if (fair_before(t, root)) {
+        root->left = fair_tree_insert(root->left, t);
     } else {
-        iter = runnable_threads;
+        root->right = fair_tree_insert(root->right, t);
     }
 
-    while (iter) {
-        if (iter->state != THREAD_READY_TO_RUN) {
-            iter = iter->next;
+    return fair_tree_rebalance(root);
+}
+
+static struct thread* fair_tree_remove_min(struct thread* root, struct thread** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = fair_tree_remove_min(root->left, min);
+    return fair_tree_rebalance(root);
+}
+
+static struct thread* fair_tree_remove(struct thread* root, struct thread* t) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    if (root == t) {
+        if (root->left == NULL) {
+            return root->right;
+        }
+        if (root->right == NULL) {
+            return root->left;
+        }
+
+        struct thread* min;
+        struct thread* right = fair_tree_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return fair_tree_rebalance(min);
+    }
+
+    if (fair_before(t, root)) {
+        root->left = fair_tree_remove(root->left, t);
+    } else {
+        root->right = fair_tree_remove(root->right, t);
+    }
+
+    return fair_tree_rebalance(root);
+}
+
+static struct thread* fair_tree_first(struct thread* root) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    while (root->left != NULL) {
+        root = root->left;
+    }
+    return root;
+}
+
+/* the real-time list is sorted by priority, at_head puts a thread in front of its equals */
+static void rt_list_insert(struct run_queue* rq, struct thread* t, bool at_head) {
+    struct thread* after = rq->rt_tail;
+    while (after != NULL && (at_head ? after->rt_priority <= t->rt_priority : after->rt_priority < t->rt_priority)) {
+        after = after->prev;
+    }
+
+    t->prev = after;
+    t->next = after != NULL ? after->next : rq->rt_head;
+
+    if (t->next) {
+        t->next->prev = t;
+    } else {
+        rq->rt_tail = t;
+    }
+
+    if (after) {
+        after->next = t;
+    } else {
+        rq->rt_head = t;
+    }
+}
+
+static void rt_list_remove(struct run_queue* rq, struct thread* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        rq->rt_head = t->next;
+    }
+
+    if (t->next) {
+        t->next->prev = t->prev;
+    } else {
+        rq->rt_tail = t->prev;
+    }
+}
+
+/* run queues are only touched with their lock held, t->vruntime is on the queue's timeline here */
+static void run_queue_push(struct run_queue* rq, struct thread* t, bool at_head) {
+    t->next = NULL;
+    t->prev = NULL;
+    t->queued_at = time_ns();
+
+    if (t->policy == SCHED_OTHER) {
+        t->queued_weight = nice_weight(t->nice);
+        rq->fair_root = fair_tree_insert(rq->fair_root, t);
+        rq->fair_weight += t->queued_weight;
+    } else {
+        t->queued_weight = 0;
+        rt_list_insert(rq, t, at_head);
+    }
+
+    __atomic_store_n(&t->run_queue, rq, __ATOMIC_RELEASE);
+    __atomic_store_n(&rq->count, rq->count + 1, __ATOMIC_RELAXED);
+}
+
+static void run_queue_remove(struct run_queue* rq, struct thread* t) {
+    if (t->queued_weight != 0) {
+        rq->fair_root = fair_tree_remove(rq->fair_root, t);
+        rq->fair_weight -= t->queued_weight;
+    } else {
+        rt_list_remove(rq, t);
+    }
+
+    t->next = NULL;
+    t->prev = NULL;
+    t->left = NULL;
+    t->right = NULL;
+    t->wait_time += time_ns() - t->queued_at;
+
+    __atomic_store_n(&t->run_queue, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&rq->count, rq->count - 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Places a thread that is coming from outside the queue, with t->vruntime holding its lag, at the
+ * queue's min_vruntime plus that lag. Threads that ran less than their share before they left are only
+ * credited for so much, so that long sleepers do not get to monopolize the CPU once they wake up.
+ */
+static void run_queue_place(struct run_queue* rq, struct thread* t) {
+    int64_t lag = (int64_t) t->vruntime;
+    if (lag < -SCHED_SLEEPER_CREDIT_NS) {
+        lag = -SCHED_SLEEPER_CREDIT_NS;
+    }
+
+    t->vruntime = rq->min_vruntime + lag;
+    run_queue_push(rq, t, false);
+}
+
+/* run queue locks are also taken by schedule, so they are never held with interrupts enabled */
+static void enqueue_on(struct percpu* cpu, struct thread* t) {
+    struct run_queue* rq = &cpu->run_queue;
+
+    bool prev_int = spinlock_acquire_irqsave(&rq->lock);
+    run_queue_place(rq, t);
+    spinlock_release_irqrestore(&rq->lock, prev_int);
+}
+
+/* the leftmost thread of the tree that may run on the CPU, which is almost always the leftmost one */
+static struct thread* fair_tree_first_allowed(struct thread* node, size_t cpu) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    struct thread* t = fair_tree_first_allowed(node->left, cpu);
+    if (t != NULL) {
+        return t;
+    }
+
+    if (cpu_set_contains(&node->affinity, cpu)) {
+        return node;
+    }
+    return fair_tree_first_allowed(node->right, cpu);
+}
+
+/*
+ * Takes the thread that should run next on a CPU off a queue, real-time threads first, skipping those
+ * that may not run there. Its vruntime is turned back into lag, so that it can be put on the timeline
+ * of whichever CPU ends up running it.
+ */
+static struct thread* run_queue_pop(struct run_queue* rq, struct percpu* cpu) {
+    if (__atomic_load_n(&rq->count, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+
+    spinlock_acquire(&rq->lock);
+
+    struct thread* t = rq->rt_head;
+    while (t != NULL && !cpu_set_contains(&t->affinity, cpu->cpu_number)) {
+        t = t->next;
+    }
+    if (t == NULL) {
+        t = fair_tree_first_allowed(rq->fair_root, cpu->cpu_number);
+    }
+
+    if (t != NULL) {
+        bool fair = t->queued_weight != 0;
+        run_queue_remove(rq, t);
+        t->state = THREAD_RUNNING;
+        t->vruntime = fair ? t->vruntime - rq->min_vruntime : 0;
+    }
+
+    spinlock_release(&rq->lock);
+    return t;
+}
+
+/* min_vruntime only moves forward, following the thread furthest behind including the running one */
+static void update_min_vruntime(struct run_queue* rq, struct thread* current) {
+    bool found = false;
+    uint64_t vruntime = 0;
+
+    if (current != NULL && current->policy == SCHED_OTHER) {
+        vruntime = current->vruntime;
+        found = true;
+    }
+
+    struct thread* first = fair_tree_first(rq->fair_root);
+    if (first != NULL && (!found || vruntime_before(first->vruntime, vruntime))) {
+        vruntime = first->vruntime;
+        found = true;
+    }
+
+    if (found && vruntime_before(rq->min_vruntime, vruntime)) {
+        rq->min_vruntime = vruntime;
+    }
+}
+
+/* fair threads are charged for the time they ran, scaled down the more weight they have */
+static void update_runtime(struct thread* t) {
+    uint64_t now = time_ns();
+    uint64_t delta = now - t->exec_start;
+    t->exec_start = now;
+
+    t->cpu_time += delta;
+    __atomic_add_fetch(&t->process->cpu_time, delta, __ATOMIC_RELAXED);
+
+    if (t->policy == SCHED_OTHER) {
+        t->vruntime += delta * NICE_0_WEIGHT / nice_weight(t->nice);
+    }
+}
+
+/* fair threads split SCHED_LATENCY_NS between them by weight, UINT64_MAX means no timeslice */
+static uint64_t timeslice_ns(struct run_queue* rq, struct thread* t) {
+    if (t->policy == SCHED_FIFO) {
+        return UINT64_MAX;
+    }
+    if (t->policy == SCHED_RR) {
+        return SCHED_RR_TIMESLICE_NS;
+    }
+
+    uint64_t weight = nice_weight(t->nice);
+    uint64_t slice = SCHED_LATENCY_NS * weight / (__atomic_load_n(&rq->fair_weight, __ATOMIC_RELAXED) + weight);
+    return MAX(slice, SCHED_MIN_GRANULARITY_NS);
+}
+
+/*
+ * Work stealing for CPUs that ran out of threads. Whatever the longest queue would run next is taken,
+ * leaving that CPU with the threads that still have something in its caches for longer. Of equally
+ * long queues the closest one is stolen from, and when the threads there may not run here, any other
+ * queue with a thread that may will do.
+ */
+static struct thread* steal_thread(struct percpu* self) {
+    struct percpu* busiest = NULL;
+    size_t busiest_count = 0;
+    size_t busiest_distance = 0;
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (cpu == self) {
             continue;
         }
 
-        if (spinlock_test_and_acquire(&iter->lock)) {
-            return iter;
+        size_t count = __atomic_load_n(&cpu->run_queue.count, __ATOMIC_RELAXED);
+        size_t distance = topology_distance(self, cpu);
+        if (count > busiest_count || (count != 0 && count == busiest_count && distance < busiest_distance)) {
+            busiest = cpu;
+            busiest_count = count;
+            busiest_distance = distance;
+        }
+    }
+
+    if (busiest == NULL) {
+        return NULL;
+    }
+
+    struct thread* t = run_queue_pop(&busiest->run_queue, self);
+    for (size_t i = 0; t == NULL && i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (cpu != self && cpu != busiest) {
+            t = run_queue_pop(&cpu->run_queue, self);
         }
-        iter = iter->next;
     }
 
-    return NULL;
+    return t;
 }
 
-__attribute__((noreturn)) static void schedule(struct registers* r, void* ctx) {
-    (void) ctx;
+static inline size_t cpu_load(struct percpu* cpu) {
+    return __atomic_load_n(&cpu->run_queue.count, __ATOMIC_RELAXED) +
+        (__atomic_load_n(&cpu->running_thread, __ATOMIC_RELAXED) != NULL);
+}
 
-    lapic_timer_stop();
+/* whether another hardware thread of the CPU's core is running something */
+static bool smt_sibling_busy(struct percpu* cpu) {
+    for (struct percpu* sibling = cpu->smt_next; sibling != NULL && sibling != cpu; sibling = sibling->smt_next) {
+        if (__atomic_load_n(&sibling->running_thread, __ATOMIC_RELAXED) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (spinlock_test_and_acquire(&thread_management_lock)) {
-        struct thread* iter = blocking_threads;
-        while (iter != NULL) {
-            if (iter->state == THREAD_SLEEPING && iter->sleep_until < hpet_count()) {
-                iter->state = THREAD_READY_TO_RUN;
-                iter->sleep_until = 0;
-
-                remove_thread_from_list(&blocking_threads, iter);
-                add_thread_to_list(&runnable_threads, iter);
-            }
-            iter = iter->next;
+/* every thread more to share a CPU with outweighs the rest, and a busy sibling outweighs the distance */
+#define PLACEMENT_LOAD_COST (PLACEMENT_SMT_COST * 2)
+#define PLACEMENT_SMT_COST  (CPU_DISTANCE_REMOTE + 1)
+
+/*
+ * Threads go to the online CPU they may run on with the fewest threads, idle CPUs first. Of equally
+ * loaded CPUs, those on a core with nothing running on its other hardware threads come first, so
+ * threads spread over the physical cores before they double up on one, and then those closest to the
+ * CPU the thread last ran on, whose caches may still hold its data.
+ */
+static struct percpu* pick_cpu(struct thread* t) {
+    struct percpu* last = t->last_cpu < smp_cpu_count ? &percpus[t->last_cpu] : NULL;
+    struct percpu* best = NULL;
+    size_t best_cost = (size_t) -1;
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (!__atomic_load_n(&cpu->online, __ATOMIC_RELAXED) || !cpu_set_contains(&t->affinity, i)) {
+            continue;
         }
 
-        iter = zombie_threads;
-        while (iter != NULL) {
-            thread_destroy(iter);
+        size_t cost = cpu_load(cpu) * PLACEMENT_LOAD_COST;
+        if (smt_sibling_busy(cpu)) {
+            cost += PLACEMENT_SMT_COST;
+        }
+        if (last != NULL) {
+            cost += topology_distance(last, cpu);
+        }
+
+        if (cost < best_cost) {
+            best = cpu;
+            best_cost = cost;
+        }
+    }
+
+    return best != NULL ? best : this_cpu();
+}
+
+/*
+ * Whether a thread just queued on a CPU should run there right away: idle CPUs only look at their
+ * queue again on the next timer tick, and real-time threads preempt anything of a lower priority.
+ */
+static bool should_preempt(struct percpu* cpu, struct thread* t) {
+    struct thread* running = __atomic_load_n(&cpu->running_thread, __ATOMIC_RELAXED);
+    if (running == NULL) {
+        return true;
+    }
 
+    if (t->policy == SCHED_OTHER) {
+        return false;
+    }
+
+    return running->policy == SCHED_OTHER || running->rt_priority < t->rt_priority;
+}
+
+/*
+ * Idle CPUs do not tick, so a CPU with more threads than it can run kicks one of them to come and
+ * steal some.
+ */
+static void kick_idle_cpu(struct percpu* self) {
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        struct percpu* cpu = &percpus[i];
+        if (cpu != self && __atomic_load_n(&cpu->online, __ATOMIC_RELAXED) &&
+                __atomic_load_n(&cpu->running_thread, __ATOMIC_RELAXED) == NULL) {
+            lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+            return;
+        }
+    }
+}
+
+/*
+ * Queues a sleeping thread again, called with interrupts disabled. A thread that only just went to
+ * sleep may still be on its way off its CPU, so it is only queued once that CPU let go of it. This CPU
+ * is only kicked when it is not about to pick its next thread anyway.
+ */
+static bool wake_thread(struct thread* t, bool kick_self) {
+    enum thread_state sleeping = THREAD_SLEEPING;
+    if (!__atomic_compare_exchange_n(&t->state, &sleeping, THREAD_READY_TO_RUN, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return false;
+    }
+
+    spinlock_acquire_raw(&t->lock);
+    t->sleep_until = 0;
+    t->woken_at = time_ns();
+
+    struct percpu* cpu = pick_cpu(t);
+    enqueue_on(cpu, t);
+
+    if ((kick_self || cpu != this_cpu()) && should_preempt(cpu, t)) {
+        lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+    }
+
+    spinlock_release_raw(&t->lock);
+    return true;
+}
+
+/* timers only run from schedule, which picks the next thread to run here right after */
+static void sleep_timer_expired(struct timer* timer, void* ctx) {
+    (void) timer;
+    wake_thread(ctx, false);
+}
+
+static void reap_zombie_threads(void) {
+    struct thread* iter = zombie_threads;
+    while (iter != NULL) {
+        struct thread* next = iter->next;
+
+        /* zombies that are still running somewhere, or whose stack is still in use, are left alone */
+        if (spinlock_test_and_acquire_raw(&iter->lock)) {
             struct process* p = iter->process;
+
+            remove_thread_from_list(&zombie_threads, iter);
+            timer_cancel(&iter->sleep_timer);
+            thread_destroy(iter);
+
             if (p != kernel_process && p->state == PROCESS_ZOMBIE && p->threads->size == 0) {
                 klog("[sched] destroying process (pid: %d)\n", p->pid);
                 process_destroy(p);
             }
-
-            remove_thread_from_list(&zombie_threads, iter);
-            iter = iter->next;
         }
 
-        spinlock_release(&thread_management_lock);
+        iter = next;
     }
+}
 
-    struct thread* current = this_cpu()->running_thread;
-    struct thread* next = get_next_thread(current);
-
-    if (current != NULL) {
-        current->ctx = *r;
+static void record_wakeup_latency(struct percpu* self, struct thread* t, uint64_t latency) {
+    size_t bucket = latency == 0 ? 0 : 63 - __builtin_clzl(latency);
+    self->sched_stats.wakeup_latency[MIN(bucket, SCHED_LATENCY_BUCKETS - 1)]++;
+    self->sched_stats.wakeups++;
 
-        if (current->is_user) {
-            current->user_stack = this_cpu()->user_stack;
-            this_cpu()->fpu_save(current->fpu_storage);
-            current->gs_base = rdmsr(IA32_KERNEL_GS_BASE_MSR);
-        }
+    if (latency > t->max_wakeup_latency) {
+        t->max_wakeup_latency = latency;
+    }
+}
 
-        current->fs_base = rdmsr(IA32_FS_BASE_MSR);
+/*
+ * Second half of schedule, running on this CPU's own scheduler stack. A thread's lock is held for as
+ * long as a CPU runs it or still uses its kernel stack, so it is only released here, and a CPU that
+ * picked a thread another CPU just put back waits until that CPU got off its stack.
+ */
+__attribute__((noreturn)) static void switch_to_next(struct thread* prev) {
+    struct percpu* self = this_cpu();
 
-        if (current->state == THREAD_RUNNING) {
-            current->state = THREAD_READY_TO_RUN;
-        }
+    if (prev != NULL) {
+        spinlock_release_raw(&prev->lock);
+    }
 
-        spinlock_release(&current->lock);
+    struct thread* next = run_queue_pop(&self->run_queue, self);
+    if (next == NULL) {
+        next = steal_thread(self);
     }
 
     if (next == NULL) {
-        this_cpu()->running_thread = NULL;
+        self->running_thread = NULL;
+        self->sched_stats.idle_since = time_ns();
         vmm_switch_pagemap(kernel_pagemap);
         lapic_eoi();
         sched_await();
     }
 
-    this_cpu()->running_thread = next;
-    next->state = THREAD_RUNNING;
+    spinlock_acquire_raw(&next->lock);
+
+    /* only this CPU moves its min_vruntime, so it can be read without the queue lock */
+    uint64_t now = time_ns();
+    next->vruntime += self->run_queue.min_vruntime;
+    next->exec_start = now;
+
+    /* threads that never ran yet only inherited their last CPU */
+    if (next->last_cpu != self->cpu_number && next->voluntary_switches + next->involuntary_switches != 0) {
+        next->migrations++;
+    }
+    next->last_cpu = self->cpu_number;
+
+    self->sched_stats.switches++;
+    if (next->woken_at != 0) {
+        record_wakeup_latency(self, next, now - next->woken_at);
+        next->woken_at = 0;
+    }
+
+    self->running_thread = next;
 
-    this_cpu()->tss.rsp0 = next->kernel_stack;
-    this_cpu()->tss.ist2 = next->page_fault_stack;
-    this_cpu()->kernel_stack = next->kernel_stack;
+    self->tss.rsp0 = next->kernel_stack;
+    self->tss.ist2 = next->page_fault_stack;
+    self->kernel_stack = next->kernel_stack;
 
     lapic_eoi();
-    lapic_timer_oneshot(SCHED_VECTOR, next->timeslice);
+
+    /* the timer only fires again at the end of the timeslice or for the next timer, whatever comes first */
+    uint64_t timeslice = timeslice_ns(&self->run_queue, next);
+    uint64_t deadline = MIN(timeslice != UINT64_MAX ? now + timeslice : UINT64_MAX, timer_next_deadline());
+    if (deadline != UINT64_MAX) {
+        lapic_timer_deadline(SCHED_PREEMPT_VECTOR, deadline);
+    }
+
+    if (__atomic_load_n(&self->run_queue.count, __ATOMIC_RELAXED) != 0) {
+        kick_idle_cpu(self);
+    }
 
     if (next->is_user) {
-        this_cpu()->user_stack = next->user_stack;
-        this_cpu()->fpu_restore(next->fpu_storage);
+        self->user_stack = next->user_stack;
         wrmsr(IA32_KERNEL_GS_BASE_MSR, next->gs_base);
     }
 
     wrmsr(IA32_FS_BASE_MSR, next->fs_base);
 
-    if (!current || current->process != next->process) {
-        vmm_switch_pagemap(next->process->pagemap);
-    }
+    /* a no-op when the thread belongs to the pagemap that is already loaded */
+    vmm_switch_pagemap(next->process->pagemap);
 
     __asm__ volatile(
             "mov %0, %%rsp\n\t"
@@ -195,37 +706,458 @@ __attribute__((noreturn)) static void schedule(struct registers* r, void* ctx) {
     __builtin_unreachable();
 }
 
+/*
+ * Installed on SCHED_VECTOR for threads giving up the CPU, and reached through preempt with a non-NULL
+ * ctx for the timer and for other CPUs kicking this one.
+ */
+__attribute__((noreturn)) static void schedule(struct registers* r, void* ctx) {
+    bool preempted = ctx != NULL;
+    struct percpu* self = this_cpu();
+
+    /*
+     * Preemption never gets here with the count raised, so this is a thread giving up the CPU with a
+     * spinlock held, which would leave the lock taken and the count raised for whatever runs next.
+     * Faults on user memory fail the access instead of killing the thread inside such a section.
+     */
+    if (unlikely(self->preempt_count != 0)) {
+        size_t count = self->preempt_count;
+        self->preempt_count = 0;
+        kpanic(r, true, "scheduling with preemption disabled (count: %lu)", count);
+    }
+    self->need_resched = false;
+
+    lapic_timer_stop();
+    timer_run_expired();
+
+    if (spinlock_test_and_acquire(&thread_management_lock)) {
+        reap_zombie_threads();
+
+        spinlock_release(&thread_management_lock);
+    }
+
+    struct thread* current = self->running_thread;
+
+    if (current == NULL && self->sched_stats.idle_since != 0) {
+        self->sched_stats.idle_time += time_ns() - self->sched_stats.idle_since;
+        self->sched_stats.idle_since = 0;
+    }
+
+    if (current != NULL) {
+        current->ctx = *r;
+
+        if (current->is_user) {
+            current->user_stack = self->user_stack;
+            fpu_switch_out(self, current);
+            current->gs_base = rdmsr(IA32_KERNEL_GS_BASE_MSR);
+        }
+
+        current->fs_base = rdmsr(IA32_FS_BASE_MSR);
+
+        struct run_queue* rq = &self->run_queue;
+        spinlock_acquire(&rq->lock);
+
+        update_runtime(current);
+        update_min_vruntime(rq, current);
+
+        /*
+         * Threads that went to sleep or were killed meanwhile are not put back, and only keep their lag,
+         * and so do threads that may no longer run here, which are queued wherever they may.
+         * A preempted SCHED_FIFO thread stays in front of the threads of its priority.
+         */
+        enum thread_state running = THREAD_RUNNING;
+        bool requeued = __atomic_compare_exchange_n(&current->state, &running, THREAD_READY_TO_RUN, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        bool migrating = requeued && !cpu_set_contains(&current->affinity, self->cpu_number);
+        if (preempted && requeued) {
+            current->involuntary_switches++;
+        } else {
+            current->voluntary_switches++;
+        }
+        if (requeued && !migrating) {
+            run_queue_push(rq, current, preempted && current->policy == SCHED_FIFO);
+        } else {
+            current->vruntime -= rq->min_vruntime;
+        }
+
+        spinlock_release(&rq->lock);
+
+        /* whichever CPU picks it up waits for switch_to_next to let go of it */
+        if (migrating) {
+            struct percpu* cpu = pick_cpu(current);
+            enqueue_on(cpu, current);
+            if (cpu != self && should_preempt(cpu, current)) {
+                lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+            }
+        }
+
+        /*
+         * The wakeup is only armed now that the thread is about to leave this CPU, its timer can then
+         * only fire once switch_to_next released it. A timer armed for a thread that was killed
+         * meanwhile is cancelled by the reaper.
+         */
+        if (!requeued && running == THREAD_SLEEPING && current->sleep_until != 0) {
+            timer_arm(&current->sleep_timer, current->sleep_until);
+        }
+    }
+
+    /* the context is saved, nothing needs the current thread's kernel stack anymore */
+    __asm__ volatile(
+            "mov %0, %%rsp\n\t"
+            "xor %%rbp, %%rbp\n\t"
+            "call *%1\n\t"
+            :: "r" (self->sched_stack), "r" (switch_to_next), "D" (current)
+            : "memory"
+            );
+    __builtin_unreachable();
+}
+
+/*
+ * Installed on SCHED_PREEMPT_VECTOR. A CPU in a section that must not be preempted only notes that it
+ * should be, and reschedules once it leaves the section. In case it leaves it with interrupts disabled,
+ * which it cannot reschedule from, the timer asks again a little later.
+ */
+static void preempt(struct registers* r, void* ctx) {
+    struct percpu* self = this_cpu();
+
+    if (self->preempt_count != 0) {
+        self->need_resched = true;
+        lapic_timer_deadline(SCHED_PREEMPT_VECTOR, time_ns() + SCHED_PREEMPT_RETRY_NS);
+        lapic_eoi();
+        return;
+    }
+
+    schedule(r, ctx);
+}
+
+/* called by preempt_enable when the count went below zero, which means an unbalanced release */
+__attribute__((noreturn)) void preempt_underflow(void) {
+    this_cpu()->preempt_count = 0;
+    kpanic(NULL, true, "preempt_enable without a matching preempt_disable");
+}
+
+/* the preemption point of preempt_enable, and of returning to user mode */
+void preempt_resched(void) {
+    if (this_cpu()->preempt_count == 0 && interrupt_state()) {
+        sched_preempt();
+    }
+}
+
+/* idle CPUs sleep until their next timer, or until another CPU kicks them because there is work */
 __attribute__((noreturn)) void sched_await(void) {
-    lapic_timer_oneshot(SCHED_VECTOR, 5000);
+    /* from here on this CPU only runs with interrupts disabled briefly, so it can answer TLB shootdowns */
+    __atomic_store_n(&this_cpu()->online, true, __ATOMIC_SEQ_CST);
+
+    uint64_t deadline = timer_next_deadline();
+    if (deadline != UINT64_MAX) {
+        lapic_timer_deadline(SCHED_PREEMPT_VECTOR, deadline);
+    }
     sti();
     for (;;) {
+        /* use idle time to pre-zero pages for demand-paged memory */
+        while (pmm_zero_pool_refill());
         hlt();
     }
     __builtin_unreachable();
 }
 
 void sched_thread_enqueue(struct thread* t) {
-    add_thread_to_list(&runnable_threads, t);
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct percpu* cpu = pick_cpu(t);
+
+    t->state = THREAD_READY_TO_RUN;
+    enqueue_on(cpu, t);
+
+    if (should_preempt(cpu, t)) {
+        lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+    }
+
+    if (prev_int) {
+        sti();
+    }
 }
 
+/*
+ * Turns a thread into a zombie, wherever it is. A thread running on another CPU is kicked off it, and
+ * just not put back on a queue by schedule.
+ */
 void sched_thread_dequeue(struct thread* t) {
-    remove_thread_from_list(&runnable_threads, t);
-    t->state = THREAD_ZOMBIE;
+    bool prev_int = interrupt_state();
+    cli();
+
+    for (;;) {
+        enum thread_state state = __atomic_load_n(&t->state, __ATOMIC_SEQ_CST);
+
+        if (state == THREAD_ZOMBIE) {
+            goto end;
+        }
+
+        if (state == THREAD_RUNNING) {
+            if (__atomic_compare_exchange_n(&t->state, &state, THREAD_ZOMBIE, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                for (size_t i = 0; i < smp_cpu_count; i++) {
+                    struct percpu* cpu = &percpus[i];
+                    if (cpu != this_cpu() && __atomic_load_n(&cpu->running_thread, __ATOMIC_RELAXED) == t) {
+                        lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+                    }
+                }
+                break;
+            }
+        } else if (state == THREAD_READY_TO_RUN) {
+            /* the queue is only unset for the short moment between being woken and being queued */
+            struct run_queue* rq = __atomic_load_n(&t->run_queue, __ATOMIC_SEQ_CST);
+            if (rq != NULL) {
+                spinlock_acquire(&rq->lock);
+                bool queued = t->run_queue == rq;
+                if (queued) {
+                    run_queue_remove(rq, t);
+                    t->state = THREAD_ZOMBIE;
+                }
+                spinlock_release(&rq->lock);
+
+                if (queued) {
+                    break;
+                }
+            }
+        } else if (state == THREAD_SLEEPING) {
+            if (__atomic_compare_exchange_n(&t->state, &state, THREAD_ZOMBIE, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                timer_cancel(&t->sleep_timer);
+                wait_queue_remove(t);
+                break;
+            }
+        }
+
+        pause();
+    }
+
     add_thread_to_list(&zombie_threads, t);
+
+end:
+    if (prev_int) {
+        sti();
+    }
 }
 
 void sched_thread_sleep(struct thread* t, uint64_t ns) {
-    remove_thread_from_list(&runnable_threads, t);
+    bool prev_int = interrupt_state();
+    cli();
 
-    t->state = THREAD_SLEEPING;
-    t->sleep_until = HPET_CALC_SLEEP_NS(ns);
-    add_thread_to_list(&blocking_threads, t);
+    t->sleep_until = time_ns() + ns;
+
+    /* being preempted in between would leave the thread off every queue with the lock held */
+    enum thread_state running = THREAD_RUNNING;
+    __atomic_compare_exchange_n(&t->state, &running, THREAD_SLEEPING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
 
     sched_yield();
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+/* wakes a thread sleeping on a timer or a wait queue, returns false if it was not asleep */
+bool sched_thread_wake(struct thread* t) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    bool woken = wake_thread(t, true);
+
+    if (prev_int) {
+        sti();
+    }
+
+    return woken;
+}
+
+/*
+ * Threads start out with the parameters and affinity of the thread that created them, and close to
+ * it, or as fair nice 0 threads that may run anywhere.
+ */
+void sched_thread_init(struct thread* t, struct thread* parent) {
+    if (parent != NULL) {
+        t->policy = parent->policy;
+        t->rt_priority = parent->rt_priority;
+        t->nice = parent->nice;
+        t->affinity = parent->affinity;
+        t->last_cpu = parent->last_cpu;
+    } else {
+        t->policy = SCHED_OTHER;
+        t->rt_priority = 0;
+        t->nice = 0;
+        memset(&t->affinity, 0xff, sizeof(cpu_set_t));
+        t->last_cpu = (size_t) -1;
+    }
+
+    t->vruntime = 0;
+    t->exec_start = 0;
+    t->cpu_time = 0;
+    t->queued_weight = 0;
+    t->left = NULL;
+    t->right = NULL;
+    t->height = 0;
+
+    t->wait_time = 0;
+    t->queued_at = 0;
+    t->woken_at = 0;
+    t->max_wakeup_latency = 0;
+    t->voluntary_switches = 0;
+    t->involuntary_switches = 0;
+    t->migrations = 0;
+
+    t->sleep_until = 0;
+    timer_setup(&t->sleep_timer, sleep_timer_expired, t);
+
+    t->wait_queue = NULL;
+    t->wait_key = 0;
+    t->wait_next = NULL;
+    t->wait_prev = NULL;
+}
+
+/*
+ * A queued thread is taken off its queue and placed again with the new parameters, keeping its lag.
+ * Any other thread picks them up the next time it is queued.
+ */
+static void set_params(struct thread* t, int policy, int rt_priority, int nice) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    for (;;) {
+        struct run_queue* rq = __atomic_load_n(&t->run_queue, __ATOMIC_SEQ_CST);
+        if (rq == NULL) {
+            t->rt_priority = rt_priority;
+            t->nice = nice;
+            __atomic_store_n(&t->policy, policy, __ATOMIC_SEQ_CST);
+            break;
+        }
+
+        spinlock_acquire(&rq->lock);
+        bool queued = t->run_queue == rq;
+        if (queued) {
+            bool fair = t->queued_weight != 0;
+            run_queue_remove(rq, t);
+            t->vruntime = fair ? t->vruntime - rq->min_vruntime : 0;
+
+            t->rt_priority = rt_priority;
+            t->nice = nice;
+            t->policy = policy;
+            run_queue_place(rq, t);
+        }
+        spinlock_release(&rq->lock);
+
+        if (queued) {
+            break;
+        }
+
+        pause();
+    }
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+int sched_set_nice(struct thread* t, int nice) {
+    if (nice < SCHED_NICE_MIN) {
+        nice = SCHED_NICE_MIN;
+    } else if (nice > SCHED_NICE_MAX) {
+        nice = SCHED_NICE_MAX;
+    }
+
+    set_params(t, t->policy, t->rt_priority, nice);
+    return 0;
+}
+
+int sched_set_policy(struct thread* t, int policy, int rt_priority) {
+    if (policy == SCHED_OTHER) {
+        if (rt_priority != 0) {
+            return -EINVAL;
+        }
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (rt_priority < SCHED_RT_PRIO_MIN || rt_priority > SCHED_RT_PRIO_MAX) {
+            return -EINVAL;
+        }
+    } else {
+        return -EINVAL;
+    }
+
+    set_params(t, policy, rt_priority, t->nice);
+    return 0;
+}
+
+/*
+ * Restricts a thread to the online CPUs in the mask. A queued thread is moved over to one of them right
+ * away, a running one is kicked off its CPU to be moved when it leaves it. Wakers may read the mask
+ * while it changes, a thread that ends up on a CPU it may no longer run on still moves on from there
+ * the next time it leaves it.
+ */
+int sched_set_affinity(struct thread* t, const cpu_set_t* mask) {
+    cpu_set_t allowed = {0};
+    bool any = false;
+
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        if (cpu_set_contains(mask, i) && __atomic_load_n(&percpus[i].online, __ATOMIC_RELAXED)) {
+            cpu_set_add(&allowed, i);
+            any = true;
+        }
+    }
+
+    if (!any) {
+        return -EINVAL;
+    }
+
+    bool prev_int = interrupt_state();
+    cli();
+
+    for (;;) {
+        struct run_queue* rq = __atomic_load_n(&t->run_queue, __ATOMIC_SEQ_CST);
+        if (rq == NULL) {
+            t->affinity = allowed;
+            break;
+        }
+
+        spinlock_acquire(&rq->lock);
+        bool queued = t->run_queue == rq;
+        if (queued) {
+            bool fair = t->queued_weight != 0;
+            run_queue_remove(rq, t);
+            t->vruntime = fair ? t->vruntime - rq->min_vruntime : 0;
+            t->affinity = allowed;
+        }
+        spinlock_release(&rq->lock);
+
+        if (queued) {
+            struct percpu* cpu = pick_cpu(t);
+            enqueue_on(cpu, t);
+            if (should_preempt(cpu, t)) {
+                lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+            }
+            break;
+        }
+
+        pause();
+    }
+
+    size_t last_cpu = t->last_cpu;
+    if (__atomic_load_n(&t->state, __ATOMIC_SEQ_CST) == THREAD_RUNNING && last_cpu < smp_cpu_count &&
+            !cpu_set_contains(&allowed, last_cpu)) {
+        struct percpu* cpu = &percpus[last_cpu];
+        if (cpu != this_cpu()) {
+            lapic_send_ipi(cpu->lapic_id, SCHED_PREEMPT_VECTOR);
+        } else if (cpu->running_thread == t) {
+            sched_yield();
+        }
+    }
+
+    if (prev_int) {
+        sti();
+    }
+
+    return 0;
 }
 
 UNMAP_AFTER_INIT void sched_init(void) {
     isr_install_handler(SCHED_VECTOR, schedule, NULL);
+    isr_install_handler(SCHED_PREEMPT_VECTOR, preempt, (void*) 1);
     kernel_process = process_create(NULL, kernel_pagemap);
 
     klog("[sched] intialized scheduler and created kernel process\n");
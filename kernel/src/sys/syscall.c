@@ -3,6 +3,7 @@
 #include <cpu/percpu.h>
 #include <errno.h>
 #include <mem/vmm.h>
+#include <sys/preempt.h>
 #include <utils/log.h>
 #include <utils/macros.h>
 
@@ -36,6 +37,17 @@
 #define SYS_SLEEP           27
 #define SYS_CLOCK_GETTIME   28
 #define SYS_CLOCK_SETTIME   29
+#define SYS_MMAP            30
+#define SYS_MUNMAP          31
+#define SYS_MPROTECT        32
+#define SYS_GETPRIORITY     33
+#define SYS_SETPRIORITY     34
+#define SYS_SCHED_SETSCHEDULER  35
+#define SYS_SCHED_GETSCHEDULER  36
+#define SYS_SCHED_GETPARAM  37
+#define SYS_FUTEX           38
+#define SYS_SCHED_SETAFFINITY   39
+#define SYS_SCHED_GETAFFINITY   40
 
 typedef void (*syscall_handler_t)(struct registers*);
 
@@ -69,6 +81,17 @@ extern void syscall_sysact(struct registers* r);
 extern void syscall_sleep(struct registers* r);
 extern void syscall_clock_gettime(struct registers* r);
 extern void syscall_clock_settime(struct registers* r);
+extern void syscall_mmap(struct registers* r);
+extern void syscall_munmap(struct registers* r);
+extern void syscall_mprotect(struct registers* r);
+extern void syscall_getpriority(struct registers* r);
+extern void syscall_setpriority(struct registers* r);
+extern void syscall_sched_setscheduler(struct registers* r);
+extern void syscall_sched_getscheduler(struct registers* r);
+extern void syscall_sched_getparam(struct registers* r);
+extern void syscall_futex(struct registers* r);
+extern void syscall_sched_setaffinity(struct registers* r);
+extern void syscall_sched_getaffinity(struct registers* r);
 
 READONLY_AFTER_INIT static syscall_handler_t syscall_table[] = {
     [SYS_EXIT]          = syscall_exit,
@@ -101,6 +124,17 @@ READONLY_AFTER_INIT static syscall_handler_t syscall_table[] = {
     [SYS_SLEEP]         = syscall_sleep,
     [SYS_CLOCK_GETTIME] = syscall_clock_gettime,
     [SYS_CLOCK_SETTIME] = syscall_clock_settime,
+    [SYS_MMAP]          = syscall_mmap,
+    [SYS_MUNMAP]        = syscall_munmap,
+    [SYS_MPROTECT]      = syscall_mprotect,
+    [SYS_GETPRIORITY]   = syscall_getpriority,
+    [SYS_SETPRIORITY]   = syscall_setpriority,
+    [SYS_SCHED_SETSCHEDULER] = syscall_sched_setscheduler,
+    [SYS_SCHED_GETSCHEDULER] = syscall_sched_getscheduler,
+    [SYS_SCHED_GETPARAM] = syscall_sched_getparam,
+    [SYS_FUTEX]         = syscall_futex,
+    [SYS_SCHED_SETAFFINITY] = syscall_sched_setaffinity,
+    [SYS_SCHED_GETAFFINITY] = syscall_sched_getaffinity,
 };
 
 void syscall_handler(struct registers* r) {
@@ -116,7 +150,11 @@ void syscall_handler(struct registers* r) {
 
     this_cpu()->running_thread->ctx = *r;
     this_cpu()->running_thread->user_stack = this_cpu()->user_stack;
-    this_cpu()->fpu_save(this_cpu()->running_thread->fpu_storage);
 
     syscall_table[r->rax](r);
+
+    /* returning to user mode is a preemption point for preemptions put off during the syscall */
+    if (unlikely(this_cpu()->need_resched)) {
+        preempt_resched();
+    }
 }
@@ -4,11 +4,20 @@
 #include <fs/fd.h>
 #include <fs/vfs.h>
 #include <mem/slab.h>
+#include <sys/mutex.h>
 #include <types.h>
 #include <utils/log.h>
 #include <utils/spinlock.h>
 #include <utils/user_access.h>
 
+/*
+ * Devices do their own locking. Everything else is called with the io_lock of the node held, which
+ * sleeps rather than spins, so that copying a large file stays preemptible.
+ */
+static inline bool node_needs_lock(struct vfs_node* node) {
+    return !S_ISCHR(node->stat.st_mode) && !S_ISBLK(node->stat.st_mode);
+}
+
 void syscall_open(struct registers* r) {
     const char* path = (char*) r->rdi;
     int flags = r->rsi;
@@ -163,7 +172,7 @@ void syscall_read(struct registers* r) {
     klog("[syscall] running syscall_read (fdnum: %d, buf: 0x%p, count: %zu) on (pid: %u, tid: %u)\n",
             fdnum, (uintptr_t) buf, count, current_process->pid, current_thread->tid);
 
-    if (!check_user_ptr(buf)) {
+    if (!check_user_range(buf, count)) {
         r->rax = -EFAULT;
         return;
     }
@@ -196,13 +205,18 @@ void syscall_read(struct registers* r) {
         return;
     }
 
-    spinlock_acquire(&node->lock);
+    bool lock = node_needs_lock(node);
+    if (lock) {
+        mutex_acquire(&node->io_lock);
+    }
 
     USER_ACCESS_BEGIN;
     ssize_t read = node->read(node, buf, fd->offset, count, fd->flags);
     USER_ACCESS_END;
 
-    spinlock_release(&node->lock);
+    if (lock) {
+        mutex_release(&node->io_lock);
+    }
 
     if (read > 0) {
         fd->offset += read;
@@ -221,7 +235,7 @@ void syscall_write(struct registers* r) {
     klog("[syscall] running syscall_write (fdnum: %d, buf: 0x%p, count: %zu) on (pid: %u, tid: %u)\n",
             fdnum, (uintptr_t) buf, count, current_process->pid, current_thread->tid);
 
-    if (!check_user_ptr(buf)) {
+    if (!check_user_range(buf, count)) {
         r->rax = -EFAULT;
         return;
     }
@@ -254,13 +268,18 @@ void syscall_write(struct registers* r) {
         return;
     }
 
-    spinlock_acquire(&node->lock);
+    bool lock = node_needs_lock(node);
+    if (lock) {
+        mutex_acquire(&node->io_lock);
+    }
 
     USER_ACCESS_BEGIN;
     ssize_t written = node->write(node, buf, fd->offset, count, fd->flags);
     USER_ACCESS_END;
 
-    spinlock_release(&node->lock);
+    if (lock) {
+        mutex_release(&node->io_lock);
+    }
 
     if (written > 0) {
         fd->offset += written;
@@ -293,9 +312,14 @@ void syscall_ioctl(struct registers* r) {
 
     struct vfs_node* node = fd->node;
 
-    spinlock_acquire(&node->lock);
+    if (!node_needs_lock(node)) {
+        r->rax = node->ioctl(node, request, argp);
+        return;
+    }
+
+    mutex_acquire(&node->io_lock);
     r->rax = node->ioctl(node, request, argp);
-    spinlock_release(&node->lock);
+    mutex_release(&node->io_lock);
 }
 
 void syscall_seek(struct registers* r) {
@@ -393,9 +417,14 @@ void syscall_truncate(struct registers* r) {
         return;
     }
 
-    spinlock_acquire(&node->lock);
+    if (!node_needs_lock(node)) {
+        r->rax = node->truncate(node, length);
+        return;
+    }
+
+    mutex_acquire(&node->io_lock);
     r->rax = node->truncate(node, length);
-    spinlock_release(&node->lock);
+    mutex_release(&node->io_lock);
 }
 
 void syscall_fcntl(struct registers* r) {
@@ -471,9 +500,14 @@ void syscall_fsync(struct registers* r) {
 
     struct vfs_node* node = fd->node;
 
-    spinlock_acquire(&node->lock);
+    if (!node_needs_lock(node)) {
+        r->rax = node->sync(node);
+        return;
+    }
+
+    mutex_acquire(&node->io_lock);
     r->rax = node->sync(node);
-    spinlock_release(&node->lock);
+    mutex_release(&node->io_lock);
 }
 
 void syscall_stat(struct registers* r) {
@@ -569,7 +603,7 @@ void syscall_getdents(struct registers* r) {
     klog("[syscall] running syscall_getdents (fdnum: %d, buf: 0x%p, count: %zu) on (pid: %u, tid: %u)\n",
             fdnum, (uintptr_t) buf, count, current_process->pid, current_thread->tid);
 
-    if (!check_user_ptr(buf)) {
+    if (!check_user_range(buf, count)) {
         r->rax = -EFAULT;
         return;
     }
@@ -601,13 +635,10 @@ void syscall_getdents(struct registers* r) {
     }
 
     USER_ACCESS_BEGIN;
-    ssize_t read = vfs_getdents(node, buf, fd->offset, count);
+    ssize_t read = vfs_getdents(node, buf, &fd->offset, count);
     USER_ACCESS_END;
 
     spinlock_release(&node->lock);
 
-    if (read > 0) {
-        fd->offset += read;
-    }
     r->rax = read;
 }
@@ -0,0 +1,55 @@
+#include <cpu/isr.h>
+#include <cpu/percpu.h>
+#include <errno.h>
+#include <sys/futex.h>
+#include <sys/process.h>
+#include <types.h>
+#include <utils/log.h>
+#include <utils/user_access.h>
+
+/* like on linux, FUTEX_REQUEUE takes the number of threads to requeue in place of the timeout */
+void syscall_futex(struct registers* r) {
+    uint32_t* uaddr = (uint32_t*) r->rdi;
+    int op = r->rsi;
+    uint32_t val = r->rdx;
+    const struct timespec* timeout = (const struct timespec*) r->r10;
+    uint32_t* uaddr2 = (uint32_t*) r->r8;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_futex (uaddr: 0x%p, op: %d, val: %u) on (pid: %u, tid: %u)\n",
+            (uintptr_t) uaddr, op, val, current_process->pid, current_thread->tid);
+
+    switch (op) {
+        case FUTEX_WAIT: {
+            uint64_t timeout_ns = UINT64_MAX;
+            if (timeout != NULL) {
+                struct timespec timeout_copy;
+                if (copy_from_user(&timeout_copy, timeout, sizeof(struct timespec)) == NULL) {
+                    r->rax = -EFAULT;
+                    return;
+                }
+
+                if (timeout_copy.tv_nsec < 0 || timeout_copy.tv_nsec > 999999999 || timeout_copy.tv_sec < 0) {
+                    r->rax = -EINVAL;
+                    return;
+                }
+
+                timeout_ns = timeout_copy.tv_sec * 1000000000ul + timeout_copy.tv_nsec;
+            }
+
+            r->rax = futex_wait(uaddr, val, timeout_ns);
+            break;
+        }
+        case FUTEX_WAKE:
+            r->rax = futex_wake(uaddr, val);
+            break;
+        case FUTEX_REQUEUE:
+            r->rax = futex_requeue(uaddr, val, uaddr2, (uintptr_t) timeout);
+            break;
+        default:
+            r->rax = -ENOSYS;
+            break;
+    }
+}
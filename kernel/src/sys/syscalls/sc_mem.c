@@ -0,0 +1,202 @@
+#include <cpu/isr.h>
+#include <cpu/percpu.h>
+#include <errno.h>
+#include <fs/fd.h>
+#include <fs/tmpfs.h>
+#include <fs/vfs.h>
+#include <mem/vma.h>
+#include <mem/vmm.h>
+#include <sys/process.h>
+#include <types.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+
+#define PROT_MASK (PROT_READ | PROT_WRITE | PROT_EXEC)
+
+/* PROT_NONE pages stay present for the kernel's bookkeeping but are not accessible from user mode */
+static uint64_t prot_to_flags(int prot) {
+    uint64_t flags = PTE_PRESENT | PTE_NX;
+
+    if (prot != PROT_NONE) {
+        flags |= PTE_USER;
+    }
+    if (prot & PROT_WRITE) {
+        flags |= PTE_WRITABLE;
+    }
+    if (prot & PROT_EXEC) {
+        flags &= ~PTE_NX;
+    }
+
+    return flags;
+}
+
+/*
+ * The ELF image is not tracked by any area, so fixed mappings are only allowed where the process
+ * keeps its heap, stacks and other mappings.
+ */
+static inline bool is_mmap_range(uintptr_t start, size_t length) {
+    return start >= PROCESS_MMAP_BASE && length <= PROCESS_THREAD_STACK_TOP - start;
+}
+
+void syscall_mmap(struct registers* r) {
+    uintptr_t addr = r->rdi;
+    size_t length = r->rsi;
+    int prot = r->rdx;
+    int flags = r->r10;
+    int fdnum = r->r8;
+    off_t offset = r->r9;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_mmap (addr: 0x%p, length: %zu, prot: %d, flags: %d, fdnum: %d, offset: %ld) "
+            "on (pid: %u, tid: %u)\n", addr, length, prot, flags, fdnum, offset, current_process->pid,
+            current_thread->tid);
+
+    bool shared = flags & MAP_SHARED;
+    if (shared == !!(flags & MAP_PRIVATE) || (prot & ~PROT_MASK) || length == 0 ||
+            length > PROCESS_THREAD_STACK_TOP || offset < 0 || !IS_ALIGNED(offset, PAGE_SIZE) ||
+            !IS_ALIGNED(addr, PAGE_SIZE)) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    length = ALIGN_UP(length, PAGE_SIZE);
+    if ((flags & MAP_FIXED) && !is_mmap_range(addr, length)) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    uint64_t page_flags = prot_to_flags(prot);
+    int vma_flags = 0;
+    struct vfs_node* node = NULL;
+
+    if (flags & MAP_ANONYMOUS) {
+        offset = 0;
+
+        if (shared) {
+            node = tmpfs_create_anonymous(length);
+            if (node == NULL) {
+                r->rax = -ENOMEM;
+                return;
+            }
+
+            vma_flags |= VMA_SHARED | VMA_MAYWRITE | VMA_ANONYMOUS;
+        }
+    } else {
+        struct file_descriptor* fd = fd_from_fdnum(current_process, fdnum);
+        if (fd == NULL) {
+            r->rax = -EBADF;
+            return;
+        }
+
+        int acc_mode = fd->flags & O_ACCMODE;
+        if ((acc_mode & O_PATH) || acc_mode == O_WRONLY) {
+            r->rax = -EACCES;
+            return;
+        }
+
+        node = fd->node;
+        if (!S_ISREG(node->stat.st_mode) && !S_ISCHR(node->stat.st_mode)) {
+            r->rax = -ENODEV;
+            return;
+        }
+
+        if (node->mmap(node, offset, NULL) < 0) {
+            r->rax = -ENODEV;
+            return;
+        }
+
+        /* device memory can't be copied on write, so it is always shared */
+        if (S_ISCHR(node->stat.st_mode)) {
+            shared = true;
+            vma_flags |= VMA_DEVICE;
+        }
+
+        if (shared) {
+            vma_flags |= VMA_SHARED;
+
+            if (acc_mode == O_RDWR) {
+                vma_flags |= VMA_MAYWRITE;
+            } else if (prot & PROT_WRITE) {
+                r->rax = -EACCES;
+                return;
+            }
+        }
+    }
+
+    uintptr_t start;
+    if (flags & MAP_FIXED) {
+        start = vma_map(&current_process->vmas, current_process->pagemap, addr, length, page_flags,
+                vma_flags | VMA_FIXED, node, offset);
+    } else {
+        uintptr_t base = addr >= PROCESS_MMAP_BASE && addr < PROCESS_BRK_BASE ? addr : PROCESS_MMAP_BASE;
+
+        start = vma_map(&current_process->vmas, current_process->pagemap, base, length, page_flags, vma_flags,
+                node, offset);
+
+        /* the search may run into the heap or the stacks, which are reserved for growing */
+        if (start != (uintptr_t) -1 && start + length > PROCESS_BRK_BASE) {
+            vma_release(&current_process->vmas, current_process->pagemap, start, start + length);
+            start = (uintptr_t) -1;
+        }
+    }
+
+    if (start == (uintptr_t) -1) {
+        if ((vma_flags & VMA_ANONYMOUS) && node->refcount == 0) {
+            tmpfs_destroy_anonymous(node);
+        }
+
+        r->rax = -ENOMEM;
+        return;
+    }
+
+    r->rax = start;
+}
+
+void syscall_munmap(struct registers* r) {
+    uintptr_t addr = r->rdi;
+    size_t length = r->rsi;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_munmap (addr: 0x%p, length: %zu) on (pid: %u, tid: %u)\n",
+            addr, length, current_process->pid, current_thread->tid);
+
+    if (length == 0 || !IS_ALIGNED(addr, PAGE_SIZE) || !is_mmap_range(addr, ALIGN_UP(length, PAGE_SIZE))) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    vma_release(&current_process->vmas, current_process->pagemap, addr, addr + length);
+    r->rax = 0;
+}
+
+void syscall_mprotect(struct registers* r) {
+    uintptr_t addr = r->rdi;
+    size_t length = r->rsi;
+    int prot = r->rdx;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_mprotect (addr: 0x%p, length: %zu, prot: %d) on (pid: %u, tid: %u)\n",
+            addr, length, prot, current_process->pid, current_thread->tid);
+
+    if (!IS_ALIGNED(addr, PAGE_SIZE) || (prot & ~PROT_MASK)) {
+        r->rax = -EINVAL;
+        return;
+    }
+    if (length == 0) {
+        r->rax = 0;
+        return;
+    }
+    if (!is_mmap_range(addr, ALIGN_UP(length, PAGE_SIZE))) {
+        r->rax = -ENOMEM;
+        return;
+    }
+
+    r->rax = vma_protect(&current_process->vmas, current_process->pagemap, addr, addr + length,
+            prot_to_flags(prot));
+}
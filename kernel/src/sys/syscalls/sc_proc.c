@@ -22,7 +22,6 @@ __attribute__((noreturn)) void syscall_exit(struct registers* r) {
 
     process_exit(current_process, status);
 
-    this_cpu()->running_thread = NULL;
     sched_yield();
     __builtin_unreachable();
 }
@@ -115,9 +114,12 @@ void syscall_exec(struct registers* r) {
 
     current_process->pagemap = new_pagemap;
     current_process->code_base = entry;
-    current_process->brk = current_process->brk_next_unallocated_page_begin = PROCESS_BRK_BASE;
+    current_process->brk = PROCESS_BRK_BASE;
     current_process->thread_stack_top = PROCESS_THREAD_STACK_TOP;
 
+    /* the old areas' pages go away together with the old pagemap */
+    vma_tree_destroy(&current_process->vmas);
+
     for (size_t i = 0; i < MAX_FDS; i++) {
         struct file_descriptor* fd = current_process->file_descriptors[i];
 
@@ -156,7 +158,6 @@ void syscall_exec(struct registers* r) {
     vmm_switch_pagemap(kernel_pagemap);
     vmm_destroy_pagemap(old_pagemap);
 
-    this_cpu()->running_thread = NULL;
     r->rax = 0;
 
     sched_yield();
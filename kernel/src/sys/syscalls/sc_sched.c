@@ -0,0 +1,235 @@
+#include <cpu/isr.h>
+#include <cpu/percpu.h>
+#include <cpu/smp.h>
+#include <errno.h>
+#include <sys/process.h>
+#include <sys/sched.h>
+#include <types.h>
+#include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/user_access.h>
+
+/* there are no users, so any process may change the scheduling of any other */
+static struct process* get_target_process(pid_t pid) {
+    if (pid == 0) {
+        return this_cpu()->running_thread->process;
+    }
+    return process_get(pid);
+}
+
+/* the parameters of a process are those of its first thread, the calling thread for the caller itself */
+static struct thread* get_target_thread(pid_t pid) {
+    if (pid == 0) {
+        return this_cpu()->running_thread;
+    }
+
+    struct process* p = process_get(pid);
+    if (p == NULL || p->threads->size == 0) {
+        return NULL;
+    }
+    return p->threads->data[0];
+}
+
+/* like on linux, the nice value is returned as 20 - nice so that it is never negative */
+void syscall_getpriority(struct registers* r) {
+    int which = r->rdi;
+    pid_t who = r->rsi;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_getpriority (which: %d, who: %d) on (pid: %u, tid: %u)\n",
+            which, who, current_process->pid, current_thread->tid);
+
+    if (which != PRIO_PROCESS) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    struct thread* t = get_target_thread(who);
+    if (t == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    r->rax = 20 - t->nice;
+}
+
+void syscall_setpriority(struct registers* r) {
+    int which = r->rdi;
+    pid_t who = r->rsi;
+    int prio = r->rdx;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_setpriority (which: %d, who: %d, prio: %d) on (pid: %u, tid: %u)\n",
+            which, who, prio, current_process->pid, current_thread->tid);
+
+    if (which != PRIO_PROCESS) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    struct process* p = get_target_process(who);
+    if (p == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    for (size_t i = 0; i < p->threads->size; i++) {
+        sched_set_nice(p->threads->data[i], prio);
+    }
+
+    r->rax = 0;
+}
+
+void syscall_sched_setscheduler(struct registers* r) {
+    pid_t pid = r->rdi;
+    int policy = r->rsi;
+    const struct sched_param* param = (const struct sched_param*) r->rdx;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_sched_setscheduler (pid: %d, policy: %d, param: 0x%p) on (pid: %u, tid: %u)\n",
+            pid, policy, (uintptr_t) param, current_process->pid, current_thread->tid);
+
+    struct sched_param param_copy;
+    if (copy_from_user(&param_copy, param, sizeof(struct sched_param)) == NULL) {
+        r->rax = -EFAULT;
+        return;
+    }
+
+    struct process* p = get_target_process(pid);
+    if (p == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < p->threads->size; i++) {
+        if ((ret = sched_set_policy(p->threads->data[i], policy, param_copy.sched_priority)) < 0) {
+            break;
+        }
+    }
+
+    r->rax = ret;
+}
+
+void syscall_sched_getscheduler(struct registers* r) {
+    pid_t pid = r->rdi;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_sched_getscheduler (pid: %d) on (pid: %u, tid: %u)\n",
+            pid, current_process->pid, current_thread->tid);
+
+    struct thread* t = get_target_thread(pid);
+    if (t == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    r->rax = t->policy;
+}
+
+void syscall_sched_getparam(struct registers* r) {
+    pid_t pid = r->rdi;
+    struct sched_param* param = (struct sched_param*) r->rsi;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_sched_getparam (pid: %d, param: 0x%p) on (pid: %u, tid: %u)\n",
+            pid, (uintptr_t) param, current_process->pid, current_thread->tid);
+
+    struct thread* t = get_target_thread(pid);
+    if (t == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    struct sched_param param_copy = { .sched_priority = t->rt_priority };
+    if (copy_to_user(param, &param_copy, sizeof(struct sched_param)) == NULL) {
+        r->rax = -EFAULT;
+        return;
+    }
+
+    r->rax = 0;
+}
+
+/* masks shorter than a cpu_set_t leave the CPUs past their end out, longer ones are cut short */
+void syscall_sched_setaffinity(struct registers* r) {
+    pid_t pid = r->rdi;
+    size_t size = r->rsi;
+    const cpu_set_t* mask = (const cpu_set_t*) r->rdx;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_sched_setaffinity (pid: %d, size: %u, mask: 0x%p) on (pid: %u, tid: %u)\n",
+            pid, size, (uintptr_t) mask, current_process->pid, current_thread->tid);
+
+    cpu_set_t mask_copy = {0};
+    if (copy_from_user(&mask_copy, mask, MIN(size, sizeof(cpu_set_t))) == NULL) {
+        r->rax = -EFAULT;
+        return;
+    }
+
+    struct process* p = get_target_process(pid);
+    if (p == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < p->threads->size; i++) {
+        if ((ret = sched_set_affinity(p->threads->data[i], &mask_copy)) < 0) {
+            break;
+        }
+    }
+
+    r->rax = ret;
+}
+
+/* like on linux, the mask has to have room for every CPU, and the number of bytes written is returned */
+void syscall_sched_getaffinity(struct registers* r) {
+    pid_t pid = r->rdi;
+    size_t size = r->rsi;
+    cpu_set_t* mask = (cpu_set_t*) r->rdx;
+
+    struct thread* current_thread = this_cpu()->running_thread;
+    struct process* current_process = current_thread->process;
+
+    klog("[syscall] running syscall_sched_getaffinity (pid: %d, size: %u, mask: 0x%p) on (pid: %u, tid: %u)\n",
+            pid, size, (uintptr_t) mask, current_process->pid, current_thread->tid);
+
+    if (size < DIV_CEIL(smp_cpu_count, 64) * sizeof(uint64_t)) {
+        r->rax = -EINVAL;
+        return;
+    }
+
+    struct thread* t = get_target_thread(pid);
+    if (t == NULL) {
+        r->rax = -ESRCH;
+        return;
+    }
+
+    /* threads that may run anywhere have every bit set, only the CPUs there are get reported */
+    cpu_set_t mask_copy = {0};
+    for (size_t i = 0; i < smp_cpu_count; i++) {
+        if (cpu_set_contains(&t->affinity, i)) {
+            cpu_set_add(&mask_copy, i);
+        }
+    }
+
+    size = MIN(size, sizeof(cpu_set_t));
+    if (copy_to_user(mask, &mask_copy, size) == NULL) {
+        r->rax = -EFAULT;
+        return;
+    }
+
+    r->rax = size;
+}
@@ -3,6 +3,7 @@
 #include <cpu/isr.h>
 #include <dev/acpi/acpi.h>
 #include <errno.h>
+#include <fs/page_cache.h>
 #include <sys/process.h>
 #include <types.h>
 #include <utils/log.h>
@@ -49,17 +50,21 @@ void syscall_sysact(struct registers* r) {
         return;
     }
 
+    /* writes to disks may still sit in the page cache, which does not survive this */
     switch (action) {
         case SYSACT_HALT:
+            page_cache_sync_all();
             cli();
             for (;;) {
                 hlt();
             }
             break;
         case SYSACT_REBOOT:
+            page_cache_sync_all();
             acpi_reboot();
             break;
         case SYSACT_SHUTDOWN:
+            page_cache_sync_all();
             acpi_shutdown();
             break;
         default:
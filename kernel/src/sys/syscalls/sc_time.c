@@ -47,20 +47,22 @@ void syscall_clock_gettime(struct registers* r) {
 
     int ret = 0;
 
-    struct timespec* source = NULL;
+    struct timespec value;
 
+    /* the CPU time of the calling thread includes the part of its timeslice it used so far */
     switch (clk_id) {
         case CLOCK_REALTIME:
-            source = &time_realtime;
+            value = time_get_realtime();
             break;
         case CLOCK_MONOTONIC:
-            source = &time_monotonic;
+            value = time_get_monotonic();
             break;
         case CLOCK_PROCESS_CPUTIME_ID:
-            source = &current_process->ticks;
+            value = time_ns_to_timespec(__atomic_load_n(&current_process->cpu_time, __ATOMIC_RELAXED) +
+                    time_ns() - current_thread->exec_start);
             break;
         case CLOCK_THREAD_CPUTIME_ID:
-            source = &current_thread->ticks;
+            value = time_ns_to_timespec(current_thread->cpu_time + time_ns() - current_thread->exec_start);
             break;
         default:
             ret = -EINVAL;
@@ -68,7 +70,7 @@ void syscall_clock_gettime(struct registers* r) {
     }
 
     if (ret == 0) {
-        if (copy_to_user((void*) ts, (void*) source, sizeof(struct timespec)) == NULL) {
+        if (copy_to_user((void*) ts, (void*) &value, sizeof(struct timespec)) == NULL) {
             ret = -EFAULT;
         }
     }
@@ -89,11 +91,21 @@ void syscall_clock_settime(struct registers* r) {
     int ret = 0;
 
     switch (clk_id) {
-        case CLOCK_REALTIME:
-            if (copy_from_user((void*) &time_realtime, (void*) ts, sizeof(struct timespec)) == NULL) {
+        case CLOCK_REALTIME: {
+            struct timespec ts_copy;
+            if (copy_from_user((void*) &ts_copy, (void*) ts, sizeof(struct timespec)) == NULL) {
                 ret = -EFAULT;
+                break;
+            }
+
+            if (ts_copy.tv_nsec < 0 || ts_copy.tv_nsec > 999999999 || ts_copy.tv_sec < 0) {
+                ret = -EINVAL;
+                break;
             }
+
+            time_set_realtime(ts_copy);
             break;
+        }
         case CLOCK_MONOTONIC:
         case CLOCK_PROCESS_CPUTIME_ID:
         case CLOCK_THREAD_CPUTIME_ID:
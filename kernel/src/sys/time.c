@@ -1,69 +1,46 @@
-#include <cpu/percpu.h>
+#include <cpu/asm.h>
 #include <dev/cmos.h>
-#include <dev/pit.h>
+#include <dev/hpet.h>
+#include <dev/tsc.h>
 #include <mem/vmm.h>
 #include <sys/time.h>
 #include <types.h> 
 #include <utils/log.h>
 #include <utils/macros.h>
 
-#define TIMER_FREQUENCY 1000
+/* CLOCK_REALTIME is kept as an offset from the monotonic clock, only moved by settime */
+static int64_t realtime_offset = 0;
 
-struct timespec time_realtime = {0};
-struct timespec time_monotonic = {0};
-
-static inline struct timespec timespec_add(struct timespec a, struct timespec b) {
-    if (a.tv_nsec + b.tv_nsec > 999999999) {
-        a.tv_nsec = (a.tv_nsec + b.tv_nsec) - 1000000000;
-        a.tv_sec++;
-    } else {
-        a.tv_nsec += b.tv_nsec;
+/*
+ * Nanoseconds since boot, read from a free-running counter instead of counting timer interrupts: the
+ * TSC if it is invariant, the HPET otherwise.
+ */
+uint64_t time_ns(void) {
+    if (likely(tsc_invariant)) {
+        return tsc_to_ns(rdtsc());
     }
-    a.tv_sec += b.tv_sec;
-    return a;
+    return hpet_ns();
 }
 
-static inline struct timespec timespec_sub(struct timespec a, struct timespec b) {
-    if (b.tv_nsec > a.tv_nsec) {
-        a.tv_nsec = 999999999 - (b.tv_nsec - a.tv_nsec);
-        if (a.tv_sec == 0) {
-            a.tv_sec = a.tv_nsec = 0;
-            return a;
-        }
-        a.tv_sec--;
-    } else {
-        a.tv_nsec -= b.tv_nsec;
-    }
-
-    if (b.tv_sec > a.tv_sec) {
-        a.tv_sec = a.tv_nsec = 0;
-        return a;
-    }
-
-    a.tv_sec -= b.tv_sec;
-    return a;
+struct timespec time_get_monotonic(void) {
+    return time_ns_to_timespec(time_ns());
 }
 
-void time_update_timers(void) {
-    struct timespec interval = {
-        .tv_sec = 0,
-        .tv_nsec = 1000000000 / TIMER_FREQUENCY
-    };
-
-    time_monotonic = timespec_add(time_monotonic, interval);
-    time_realtime = timespec_add(time_realtime, interval);
+struct timespec time_get_realtime(void) {
+    int64_t ns = (int64_t) time_ns() + __atomic_load_n(&realtime_offset, __ATOMIC_RELAXED);
+    return time_ns_to_timespec(ns > 0 ? (uint64_t) ns : 0);
+}
 
-    struct thread* current_thread = this_cpu()->running_thread;
-    if (likely(current_thread != NULL)) {
-        current_thread->ticks = timespec_add(current_thread->ticks, interval);
-        current_thread->process->ticks = timespec_add(current_thread->process->ticks, interval);
-    }
+void time_set_realtime(struct timespec ts) {
+    int64_t ns = ts.tv_sec * 1000000000 + ts.tv_nsec;
+    __atomic_store_n(&realtime_offset, ns - (int64_t) time_ns(), __ATOMIC_RELAXED);
 }
 
 UNMAP_AFTER_INIT void time_init(void) {
+    struct timespec rtc_time;
     cmos_init();
-    cmos_get_rtc_time(&time_realtime);
+    cmos_get_rtc_time(&rtc_time);
+    time_set_realtime(rtc_time);
 
-    pit_init(TIMER_FREQUENCY);
     klog("[time] initialized timing subsytem\n");
 }
@@ -0,0 +1,252 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <dev/lapic.h>
+#include <sys/sched.h>
+#include <sys/time.h>
+#include <sys/timer.h>
+#include <utils/macros.h>
+#include <utils/spinlock.h>
+
+/* ties are broken by address so that every timer has a distinct key */
+static inline bool timer_before(struct timer* a, struct timer* b) {
+    if (a->deadline != b->deadline) {
+        return a->deadline < b->deadline;
+    }
+    return a < b;
+}
+
+static inline size_t tree_height(struct timer* node) {
+    return node != NULL ? node->height : 0;
+}
+
+static inline void tree_update_height(struct timer* node) {
+    node->height = 1 + MAX(tree_height(node->left), tree_height(node->right));
+}
+
+static struct timer* tree_rotate_right(struct timer* node) {
+    struct timer* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    tree_update_height(node);
+    tree_update_height(left);
+    return left;
+}
+
+static struct timer* tree_rotate_left(struct timer* node) {
+    struct timer* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    tree_update_height(node);
+    tree_update_height(right);
+    return right;
+}
+
+static struct timer* tree_rebalance(struct timer* node) {
+    tree_update_height(node);
+
+    if (tree_height(node->left) > tree_height(node->right) + 1) {
+        if (tree_height(node->left->left) < tree_height(node->left->right)) {
+            node->left = tree_rotate_left(node->left);
+        }
+        return tree_rotate_right(node);
+    }
+
+    if (tree_height(node->right) > tree_height(node->left) + 1) {
+        if (tree_height(node->right->right) < tree_height(node->right->left)) {
+            node->right = tree_rotate_right(node->right);
+        }
+        return tree_rotate_left(node);
+    }
+
+    return node;
+}
+
+static struct timer* tree_insert(struct timer* root, struct timer* timer) {
+    if (root == NULL) {
+        timer->left = timer->right = NULL;
+        timer->height = 1;
+        return timer;
+    }
+
+    if (timer_before(timer, root)) {
+        root->left = tree_insert(root->left, timer);
+    } else {
+        root->right = tree_insert(root->right, timer);
+    }
+
+    return tree_rebalance(root);
+}
+
+static struct timer* tree_remove_min(struct timer* root, struct timer** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = tree_remove_min(root->left, min);
+    return tree_rebalance(root);
+}
+
+static struct timer* tree_remove(struct timer* root, struct timer* timer) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    if (root == timer) {
+        if (root->left == NULL) {
+            return root->right;
+        }
+        if (root->right == NULL) {
+            return root->left;
+        }
+
+        struct timer* min;
+        struct timer* right = tree_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return tree_rebalance(min);
+    }
+
+    if (timer_before(timer, root)) {
+        root->left = tree_remove(root->left, timer);
+    } else {
+        root->right = tree_remove(root->right, timer);
+    }
+
+    return tree_rebalance(root);
+}
+
+static struct timer* tree_first(struct timer* root) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    while (root->left != NULL) {
+        root = root->left;
+    }
+    return root;
+}
+
+/* timer queues are only touched with their lock held */
+static void queue_remove(struct timer_queue* queue, struct timer* timer) {
+    queue->root = tree_remove(queue->root, timer);
+    if (queue->first == timer) {
+        queue->first = tree_first(queue->root);
+    }
+
+    timer->left = NULL;
+    timer->right = NULL;
+    __atomic_store_n(&timer->queue, NULL, __ATOMIC_SEQ_CST);
+}
+
+/* takes a timer off whatever queue it is on, returns false if it was not pending */
+static bool dequeue_timer(struct timer* timer) {
+    struct timer_queue* queue = __atomic_load_n(&timer->queue, __ATOMIC_SEQ_CST);
+    if (queue == NULL) {
+        return false;
+    }
+
+    spinlock_acquire(&queue->lock);
+    bool pending = timer->queue == queue;
+    if (pending) {
+        queue_remove(queue, timer);
+    }
+    spinlock_release(&queue->lock);
+
+    return pending;
+}
+
+void timer_setup(struct timer* timer, timer_callback_t callback, void* ctx) {
+    *timer = (struct timer) {
+        .callback = callback,
+        .ctx = ctx,
+    };
+}
+
+/*
+ * (Re)arms a timer on this CPU, a timer must only be armed by one CPU at a time. The LAPIC timer is
+ * moved up if it would otherwise fire too late, schedule then runs the timer and reprograms it.
+ */
+void timer_arm(struct timer* timer, uint64_t deadline) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    dequeue_timer(timer);
+
+    struct timer_queue* queue = &this_cpu()->timers;
+    spinlock_acquire(&queue->lock);
+
+    timer->deadline = deadline;
+    queue->root = tree_insert(queue->root, timer);
+    if (queue->first == NULL || timer_before(timer, queue->first)) {
+        queue->first = timer;
+    }
+    __atomic_store_n(&timer->queue, queue, __ATOMIC_SEQ_CST);
+
+    spinlock_release(&queue->lock);
+
+    if (deadline < this_cpu()->timer_deadline) {
+        lapic_timer_deadline(SCHED_PREEMPT_VECTOR, deadline);
+    }
+
+    if (prev_int) {
+        sti();
+    }
+}
+
+/*
+ * Returns whether the timer was still pending. If its callback is running on another CPU, this waits
+ * for it to finish, so the timer can be freed afterwards unless the callback armed it again.
+ */
+bool timer_cancel(struct timer* timer) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    bool pending = dequeue_timer(timer);
+    while (!pending && __atomic_load_n(&timer->running, __ATOMIC_SEQ_CST)) {
+        pause();
+    }
+
+    if (prev_int) {
+        sti();
+    }
+    return pending;
+}
+
+/* deadline of the next timer on this CPU, UINT64_MAX if there is none */
+uint64_t timer_next_deadline(void) {
+    struct timer_queue* queue = &this_cpu()->timers;
+
+    bool prev_int = spinlock_acquire_irqsave(&queue->lock);
+    uint64_t deadline = queue->first != NULL ? queue->first->deadline : UINT64_MAX;
+    spinlock_release_irqrestore(&queue->lock, prev_int);
+
+    return deadline;
+}
+
+/* runs the callbacks of all timers on this CPU whose deadline passed, interrupts must be disabled */
+void timer_run_expired(void) {
+    struct timer_queue* queue = &this_cpu()->timers;
+    if (__atomic_load_n(&queue->first, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    uint64_t now = time_ns();
+    for (;;) {
+        spinlock_acquire(&queue->lock);
+
+        struct timer* timer = queue->first;
+        if (timer == NULL || timer->deadline > now) {
+            spinlock_release(&queue->lock);
+            break;
+        }
+
+        /* running is set before the timer leaves the queue, so timer_cancel never misses it */
+        __atomic_store_n(&timer->running, true, __ATOMIC_SEQ_CST);
+        queue_remove(queue, timer);
+        spinlock_release(&queue->lock);
+
+        timer->callback(timer, timer->ctx);
+        __atomic_store_n(&timer->running, false, __ATOMIC_SEQ_CST);
+    }
+}
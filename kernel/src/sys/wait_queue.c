@@ -0,0 +1,190 @@
+#include <cpu/asm.h>
+#include <cpu/percpu.h>
+#include <sys/process.h>
+#include <sys/sched.h>
+#include <sys/timer.h>
+#include <sys/wait_queue.h>
+#include <utils/spinlock.h>
+
+/* both called with the queue lock held */
+static void wait_queue_append(struct wait_queue* wq, struct thread* t) {
+    t->wait_queue = wq;
+    t->wait_next = NULL;
+    t->wait_prev = wq->tail;
+
+    if (wq->tail != NULL) {
+        wq->tail->wait_next = t;
+    } else {
+        wq->head = t;
+    }
+    wq->tail = t;
+}
+
+static void wait_queue_unlink(struct wait_queue* wq, struct thread* t) {
+    if (t->wait_prev != NULL) {
+        t->wait_prev->wait_next = t->wait_next;
+    } else {
+        wq->head = t->wait_next;
+    }
+
+    if (t->wait_next != NULL) {
+        t->wait_next->wait_prev = t->wait_prev;
+    } else {
+        wq->tail = t->wait_prev;
+    }
+
+    __atomic_store_n(&t->wait_queue, NULL, __ATOMIC_SEQ_CST);
+    t->wait_next = NULL;
+    t->wait_prev = NULL;
+}
+
+/*
+ * Puts the running thread to sleep on the queue, tagged with key so that it can be woken selectively.
+ * Called with interrupts disabled and with the lock guarding the condition held, which is released
+ * while asleep and held again on return. A deadline (on the time_ns clock) other than 0 wakes the
+ * thread up by itself. Returns whether it was woken through the queue rather than by the deadline.
+ * Threads may be woken without the condition holding, so callers check it again in a loop.
+ */
+bool wait_queue_sleep_keyed(struct wait_queue* wq, spinlock_t* lock, uintptr_t key, uint64_t deadline) {
+    struct thread* current = this_cpu()->running_thread;
+
+    if (lock != &wq->lock) {
+        spinlock_acquire(&wq->lock);
+    }
+
+    /* a thread that was killed meanwhile only has to get off the CPU, it never comes back */
+    current->sleep_until = deadline;
+    enum thread_state running = THREAD_RUNNING;
+    if (__atomic_compare_exchange_n(&current->state, &running, THREAD_SLEEPING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        current->wait_key = key;
+        wait_queue_append(wq, current);
+    }
+
+    spinlock_release(&wq->lock);
+    if (lock != &wq->lock) {
+        spinlock_release(lock);
+    }
+
+    sched_yield();
+
+    if (deadline != 0) {
+        timer_cancel(&current->sleep_timer);
+        current->sleep_until = 0;
+    }
+
+    /*
+     * Wakers only unlink a thread after waking it, so it may still be queued, either because the
+     * deadline passed first or because its waker is not done with it yet. Either way it has to be off
+     * the queue before it can go to sleep anywhere else.
+     */
+    bool woken = !wait_queue_remove(current);
+
+    spinlock_acquire(lock);
+    return woken;
+}
+
+void wait_queue_sleep(struct wait_queue* wq, spinlock_t* lock) {
+    wait_queue_sleep_keyed(wq, lock, 0, 0);
+}
+
+/* wakes up to max threads sleeping under key, or under any key if it is 0, oldest first */
+size_t wait_queue_wake_key(struct wait_queue* wq, uintptr_t key, size_t max) {
+    bool prev_int = spinlock_acquire_irqsave(&wq->lock);
+
+    size_t woken = 0;
+    struct thread* t = wq->head;
+    while (t != NULL && woken < max) {
+        struct thread* next = t->wait_next;
+        if (key == 0 || t->wait_key == key) {
+            woken += sched_thread_wake(t);
+            wait_queue_unlink(wq, t);
+        }
+        t = next;
+    }
+
+    spinlock_release_irqrestore(&wq->lock, prev_int);
+    return woken;
+}
+
+/* wakes the thread that has been sleeping the longest, returns whether there was one */
+bool wait_queue_wake_one(struct wait_queue* wq) {
+    return wait_queue_wake_key(wq, 0, 1) != 0;
+}
+
+size_t wait_queue_wake_all(struct wait_queue* wq) {
+    return wait_queue_wake_key(wq, 0, (size_t) -1);
+}
+
+/*
+ * Moves up to max threads sleeping under key over to another queue without waking them, where they
+ * sleep under new_key. Both queue locks are taken in address order.
+ */
+size_t wait_queue_requeue_key(struct wait_queue* from, uintptr_t key, struct wait_queue* to, uintptr_t new_key, size_t max) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    struct wait_queue* first = from < to ? from : to;
+    struct wait_queue* second = from < to ? to : from;
+    spinlock_acquire(&first->lock);
+    if (second != first) {
+        spinlock_acquire(&second->lock);
+    }
+
+    size_t moved = 0;
+    struct thread* t = from->head;
+    while (t != NULL && moved < max) {
+        struct thread* next = t->wait_next;
+        if (t->wait_key == key) {
+            wait_queue_unlink(from, t);
+            t->wait_key = new_key;
+            wait_queue_append(to, t);
+            moved++;
+        }
+        t = next;
+    }
+
+    if (second != first) {
+        spinlock_release(&second->lock);
+    }
+    spinlock_release(&first->lock);
+
+    if (prev_int) {
+        sti();
+    }
+
+    return moved;
+}
+
+/*
+ * Takes a thread off whatever queue it is on, following it if it gets requeued meanwhile. Returns
+ * whether it was still queued, rather than taken off by whoever woke it.
+ */
+bool wait_queue_remove(struct thread* t) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    bool queued = false;
+    for (;;) {
+        struct wait_queue* wq = __atomic_load_n(&t->wait_queue, __ATOMIC_SEQ_CST);
+        if (wq == NULL) {
+            break;
+        }
+
+        spinlock_acquire(&wq->lock);
+        queued = t->wait_queue == wq;
+        if (queued) {
+            wait_queue_unlink(wq, t);
+        }
+        spinlock_release(&wq->lock);
+
+        if (queued) {
+            break;
+        }
+    }
+
+    if (prev_int) {
+        sti();
+    }
+
+    return queued;
+}
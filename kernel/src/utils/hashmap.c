@@ -1,34 +1,150 @@
 #include <mem/slab.h>
+#include <mem/vmm.h>
+#include <sys/time.h>
+#include <utils/cmdline.h>
 #include <utils/hashmap.h>
-#include <utils/string.h>
 #include <utils/log.h>
+#include <utils/macros.h>
+#include <utils/panic.h>
+#include <utils/string.h>
+
+#define HASHMAP_REMOVED     UINT32_MAX
+#define HASHMAP_MIN_SLOTS   8
+
+#define SELFTEST_DEFAULT_KEYS   100000
+
+/* FNV-1a */
+static inline uint32_t hash_function(const void* _key, size_t key_size) {
+    const uint8_t* key = (const uint8_t*) _key;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_size; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash;
+}
 
-static inline uint32_t hash_function(const void * _key) {
-	uint32_t hash = 0;
-	const uint8_t* key = (const uint8_t*) _key;
-	int c;
-	while ((c = *key++)) {
-		hash = c + (hash << 6) + (hash << 16) - hash;
-	}
-	return hash;
+static inline const char* entry_key(const hashmap_entry_t* entry) {
+    return entry->key_size < HASHMAP_INLINE_KEY ? entry->key_inline : entry->key_ptr;
 }
 
-hashmap_t* hashmap_create(size_t size) {
-	hashmap_t* map = kmalloc(sizeof(hashmap_t));
-    if (map == NULL) {
+/* how far a slot is from where its hash would have put it */
+static inline size_t probe_distance(hashmap_t* map, size_t pos, uint32_t hash) {
+    return (pos - hash) & map->mask;
+}
+
+/* entries are at most three quarters of the slots, which keeps probe sequences short */
+static inline size_t slots_capacity(size_t slot_count) {
+    return slot_count - slot_count / 4;
+}
+
+static void place_slot(hashmap_t* map, uint32_t hash, uint32_t entry) {
+    hashmap_slot_t slot = { .hash = hash, .entry = entry };
+    size_t pos = hash & map->mask;
+
+    /* whoever is further from home keeps the slot, the other moves on */
+    for (size_t dist = 0;; dist++) {
+        hashmap_slot_t* current = &map->slots[pos];
+        if (current->entry == 0) {
+            *current = slot;
+            return;
+        }
+
+        size_t current_dist = probe_distance(map, pos, current->hash);
+        if (current_dist < dist) {
+            hashmap_slot_t tmp = *current;
+            *current = slot;
+            slot = tmp;
+            dist = current_dist;
+        }
+
+        pos = (pos + 1) & map->mask;
+    }
+}
+
+static hashmap_slot_t* find_slot(hashmap_t* map, const void* key, size_t key_size, uint32_t hash) {
+    if (map->slots == NULL) {
         return NULL;
     }
 
-	void* data = kmalloc(sizeof(hashmap_entry_t*) * size);
-    if (data == NULL) {
-        kfree(map);
+    size_t pos = hash & map->mask;
+
+    /* a key can never be further from home than the slot being looked at */
+    for (size_t dist = 0;; dist++) {
+        hashmap_slot_t* slot = &map->slots[pos];
+        if (slot->entry == 0 || probe_distance(map, pos, slot->hash) < dist) {
+            return NULL;
+        }
+
+        if (slot->hash == hash) {
+            hashmap_entry_t* entry = &map->entries[slot->entry - 1];
+            if (entry->key_size == key_size && memcmp(entry_key(entry), key, key_size) == 0) {
+                return slot;
+            }
+        }
+
+        pos = (pos + 1) & map->mask;
+    }
+}
+
+/* moves the entries over to new arrays, closing the holes and keeping their order */
+static bool resize(hashmap_t* map, size_t slot_count) {
+    size_t capacity = slots_capacity(slot_count);
+
+    hashmap_slot_t* slots = kmalloc(slot_count * sizeof(hashmap_slot_t));
+    hashmap_entry_t* entries = kmalloc(capacity * sizeof(hashmap_entry_t));
+    if (slots == NULL || entries == NULL) {
+        kfree(slots);
+        kfree(entries);
+        return false;
+    }
+    memset(slots, 0, slot_count * sizeof(hashmap_slot_t));
+
+    hashmap_slot_t* old_slots = map->slots;
+    hashmap_entry_t* old_entries = map->entries;
+    size_t old_used = map->used;
+
+    map->slots = slots;
+    map->entries = entries;
+    map->capacity = capacity;
+    map->mask = slot_count - 1;
+    map->used = 0;
+
+    for (size_t i = 0; i < old_used; i++) {
+        if (old_entries[i].key_size == HASHMAP_REMOVED) {
+            continue;
+        }
+
+        entries[map->used] = old_entries[i];
+        place_slot(map, old_entries[i].hash, ++map->used);
+    }
+
+    kfree(old_slots);
+    kfree(old_entries);
+    return true;
+}
+
+/* entry_count is how many entries to make room for right away, with 0 nothing is allocated yet */
+hashmap_t* hashmap_create(size_t entry_count) {
+    hashmap_t* map = kmalloc(sizeof(hashmap_t));
+    if (map == NULL) {
         return NULL;
     }
 
-    map->size = size;
-    map->entries = data;
- 
-	return map; 
+    memset(map, 0, sizeof(hashmap_t));
+
+    if (entry_count != 0) {
+        size_t slot_count = HASHMAP_MIN_SLOTS;
+        while (slots_capacity(slot_count) < entry_count) {
+            slot_count *= 2;
+        }
+
+        if (!resize(map, slot_count)) {
+            kfree(map);
+            return NULL;
+        }
+    }
+
+    return map;
 }
 
 void hashmap_destroy(hashmap_t* map) {
@@ -36,54 +152,63 @@ void hashmap_destroy(hashmap_t* map) {
         return;
     }
 
-    for (size_t i = 0; i < map->size; i++) {
-        hashmap_entry_t * x = map->entries[i], *p;
-        while (x) {
-            p = x;
-            x = x->next;
-            kfree(p->key);
-            kfree(p);
+    for (size_t i = 0; i < map->used; i++) {
+        hashmap_entry_t* entry = &map->entries[i];
+        if (entry->key_size != HASHMAP_REMOVED && entry->key_size >= HASHMAP_INLINE_KEY) {
+            kfree(entry->key_ptr);
         }
     }
 
+    kfree(map->slots);
     kfree(map->entries);
+    kfree(map);
 }
 
 bool hashmap_set(hashmap_t* map, const void* key, size_t key_size, void* value) {
-    if (!map) {
+    if (!map || key_size >= HASHMAP_REMOVED) {
         return false;
     }
 
-    uint32_t hash = hash_function(key) % map->size;
+    uint32_t hash = hash_function(key, key_size);
 
-	hashmap_entry_t* x = map->entries[hash];
-	if (!x) {
-		hashmap_entry_t* new_entry = kmalloc(sizeof(hashmap_entry_t));
-		new_entry->key = strdup(key);
-		new_entry->value = value;
-		new_entry->next = NULL;
-		map->entries[hash] = new_entry;
-        return true;
-	} else {
-		hashmap_entry_t* p = NULL;
-		do {
-            if (!strncmp(x->key, key, key_size)) {
-				x->value = value;
-				return true;
-			} else {
-				p = x;
-				x = x->next;
-			}
-		} while (x);
-
-		hashmap_entry_t* new_entry = kmalloc(sizeof(hashmap_entry_t));
-		new_entry->key = strdup(key);
-		new_entry->value = value;
-		new_entry->next = NULL;
-
-		p->next = new_entry;
+    hashmap_slot_t* slot = find_slot(map, key, key_size, hash);
+    if (slot != NULL) {
+        map->entries[slot->entry - 1].value = value;
         return true;
-	}
+    }
+
+    /* a full array is compacted if that frees up enough room, and doubled otherwise */
+    if (map->used == map->capacity) {
+        size_t slot_count = map->slots == NULL ? HASHMAP_MIN_SLOTS : map->mask + 1;
+        if (map->slots != NULL && map->count >= map->capacity / 2) {
+            slot_count *= 2;
+        }
+
+        if (!resize(map, slot_count)) {
+            return false;
+        }
+    }
+
+    hashmap_entry_t* entry = &map->entries[map->used];
+    if (key_size >= HASHMAP_INLINE_KEY) {
+        entry->key_ptr = kmalloc(key_size + 1);
+        if (entry->key_ptr == NULL) {
+            return false;
+        }
+    }
+
+    char* entry_key_data = key_size < HASHMAP_INLINE_KEY ? entry->key_inline : entry->key_ptr;
+    memcpy(entry_key_data, key, key_size);
+    entry_key_data[key_size] = '\0';
+
+    entry->hash = hash;
+    entry->key_size = key_size;
+    entry->value = value;
+    entry->position = map->next_position++;
+
+    place_slot(map, hash, ++map->used);
+    map->count++;
+    return true;
 }
 
 void* hashmap_get(hashmap_t* map, const void* key, size_t key_size) {
@@ -91,26 +216,226 @@ void* hashmap_get(hashmap_t* map, const void* key, size_t key_size) {
         return NULL;
     }
 
-    uint32_t hash = hash_function(key) % map->size;
-
-    hashmap_entry_t* x = map->entries[hash];
-    if (!x) {
+    hashmap_slot_t* slot = find_slot(map, key, key_size, hash_function(key, key_size));
+    if (slot == NULL) {
         return NULL;
     }
 
-    do {
-        if (!strncmp(x->key, key, key_size)) {
-            return x->value;
+    return map->entries[slot->entry - 1].value;
+}
+
+/* slots after the removed one shift back, so that lookups never need to skip over removed keys */
+bool hashmap_remove(hashmap_t* map, const void* key, size_t key_size) {
+    if (!map) {
+        return false;
+    }
+
+    hashmap_slot_t* slot = find_slot(map, key, key_size, hash_function(key, key_size));
+    if (slot == NULL) {
+        return false;
+    }
+
+    hashmap_entry_t* entry = &map->entries[slot->entry - 1];
+    if (entry->key_size >= HASHMAP_INLINE_KEY) {
+        kfree(entry->key_ptr);
+    }
+    entry->key_size = HASHMAP_REMOVED;
+    entry->value = NULL;
+
+    size_t pos = slot - map->slots;
+    for (;;) {
+        size_t next = (pos + 1) & map->mask;
+        hashmap_slot_t* next_slot = &map->slots[next];
+        if (next_slot->entry == 0 || probe_distance(map, next, next_slot->hash) == 0) {
+            map->slots[pos].entry = 0;
+            break;
         }
-        x = x->next;
-    } while (x);
 
-    return NULL;
-}
+        map->slots[pos] = *next_slot;
+        pos = next;
+    }
+
+    map->count--;
+    while (map->used != 0 && map->entries[map->used - 1].key_size == HASHMAP_REMOVED) {
+        map->used--;
+    }
+
+    /* shrinking is only an optimization, the map stays usable if it fails */
+    size_t slot_count = map->mask + 1;
+    if (slot_count > HASHMAP_MIN_SLOTS && map->count < map->capacity / 4) {
+        resize(map, slot_count / 2);
+    }
 
-bool hashmap_remove(hashmap_t* hashmap, const void* key, size_t key_size) {
-    (void) hashmap;
-    (void) key;
-    (void) key_size;
     return true;
 }
+
+/*
+ * Walks the entries in the order they were added, with *iter starting out at 0, returns false once
+ * there are no more. Any of key, key_size and value may be NULL. Changing the map while iterating over
+ * it may make the iteration skip or repeat entries.
+ */
+bool hashmap_iterate(hashmap_t* map, size_t* iter, const char** key, size_t* key_size, void** value) {
+    if (!map) {
+        return false;
+    }
+
+    while (*iter < map->used) {
+        hashmap_entry_t* entry = &map->entries[(*iter)++];
+        if (entry->key_size == HASHMAP_REMOVED) {
+            continue;
+        }
+
+        if (key != NULL) {
+            *key = entry_key(entry);
+        }
+        if (key_size != NULL) {
+            *key_size = entry->key_size;
+        }
+        if (value != NULL) {
+            *value = entry->value;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/* the iterator of the first entry at or after a position, which is where iteration resumes from */
+size_t hashmap_seek(hashmap_t* map, uint64_t position) {
+    if (!map) {
+        return 0;
+    }
+
+    /* entries stay sorted by position, compacting the array keeps their order */
+    size_t low = 0;
+    size_t high = map->used;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (map->entries[mid].position < position) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/* the position of the entry an iterator is at, or the position the next entry added will get */
+uint64_t hashmap_position(hashmap_t* map, size_t iter) {
+    if (!map) {
+        return 0;
+    }
+
+    return iter < map->used ? map->entries[iter].position : map->next_position;
+}
+
+static inline uint64_t selftest_key(size_t i) {
+    return i * 0x9e3779b97f4a7c15ul;
+}
+
+/* enabled with hashmap_selftest on the command line, optionally set to the number of keys to use */
+UNMAP_AFTER_INIT void hashmap_selftest(void) {
+    char* arg = cmdline_get("hashmap_selftest");
+    if (arg == NULL) {
+        return;
+    }
+
+    size_t key_count = SELFTEST_DEFAULT_KEYS;
+    if (*arg >= '0' && *arg <= '9') {
+        key_count = 0;
+        while (*arg >= '0' && *arg <= '9') {
+            key_count = key_count * 10 + (*arg++ - '0');
+        }
+    }
+
+    klog("[hashmap] running self-test with %lu keys...\n", key_count);
+
+    hashmap_t* map = hashmap_create(0);
+    if (map == NULL) {
+        kpanic(NULL, false, "hashmap self-test: failed to create map");
+    }
+
+    uint64_t start = time_ns();
+    for (size_t i = 0; i < key_count; i++) {
+        uint64_t key = selftest_key(i);
+        if (!hashmap_set(map, &key, sizeof(key), (void*) (i + 1))) {
+            kpanic(NULL, false, "hashmap self-test: insert %lu failed", i);
+        }
+    }
+    uint64_t insert_ns = time_ns() - start;
+
+    start = time_ns();
+    for (size_t i = 0; i < key_count; i++) {
+        uint64_t key = selftest_key(i);
+        if (hashmap_get(map, &key, sizeof(key)) != (void*) (i + 1)) {
+            kpanic(NULL, false, "hashmap self-test: key %lu has the wrong value", i);
+        }
+    }
+    uint64_t lookup_ns = time_ns() - start;
+
+    start = time_ns();
+    for (size_t i = key_count; i < key_count * 2; i++) {
+        uint64_t key = selftest_key(i);
+        if (hashmap_get(map, &key, sizeof(key)) != NULL) {
+            kpanic(NULL, false, "hashmap self-test: found key %lu that was never added", i);
+        }
+    }
+    uint64_t miss_ns = time_ns() - start;
+
+    /* every other key goes, the rest have to stay in order */
+    size_t resume_key = (key_count / 2) & ~1ul;
+    uint64_t resume = hashmap_position(map, resume_key);
+
+    start = time_ns();
+    for (size_t i = 0; i < key_count; i += 2) {
+        uint64_t key = selftest_key(i);
+        if (!hashmap_remove(map, &key, sizeof(key))) {
+            kpanic(NULL, false, "hashmap self-test: failed to remove key %lu", i);
+        }
+    }
+    uint64_t remove_ns = time_ns() - start;
+
+    size_t iter = 0;
+    size_t expected = 1;
+    void* value;
+    while (hashmap_iterate(map, &iter, NULL, NULL, &value)) {
+        if (value != (void*) (expected + 1)) {
+            kpanic(NULL, false, "hashmap self-test: iteration out of order at key %lu", expected);
+        }
+        expected += 2;
+    }
+    if (map->count != key_count / 2 || expected < key_count) {
+        kpanic(NULL, false, "hashmap self-test: %lu keys left instead of %lu", map->count, key_count / 2);
+    }
+
+    /* a position taken before the removals resumes right after the key that went */
+    iter = hashmap_seek(map, resume);
+    if (resume_key + 1 < key_count && (!hashmap_iterate(map, &iter, NULL, NULL, &value) || value != (void*) (resume_key + 2))) {
+        kpanic(NULL, false, "hashmap self-test: iteration did not resume after key %lu", resume_key);
+    }
+
+    for (size_t i = 1; i < key_count; i += 2) {
+        uint64_t key = selftest_key(i);
+        hashmap_remove(map, &key, sizeof(key));
+    }
+    if (map->count != 0 || map->capacity > slots_capacity(HASHMAP_MIN_SLOTS)) {
+        kpanic(NULL, false, "hashmap self-test: map did not shrink back once empty");
+    }
+
+    /* keys too long to be stored inline */
+    const char* long_key = "a key that does not fit into the entry";
+    hashmap_set(map, long_key, strlen(long_key), map);
+    if (hashmap_get(map, long_key, strlen(long_key)) != map || hashmap_get(map, long_key, 1) != NULL) {
+        kpanic(NULL, false, "hashmap self-test: long key lookup failed");
+    }
+
+    hashmap_destroy(map);
+
+    size_t ops = MAX(key_count, 1);
+    klog("[hashmap] %lu inserts in %luus (%luns/op)\n", key_count, insert_ns / 1000, insert_ns / ops);
+    klog("[hashmap] %lu lookups in %luus (%luns/op)\n", key_count, lookup_ns / 1000, lookup_ns / ops);
+    klog("[hashmap] %lu failed lookups in %luus (%luns/op)\n", key_count, miss_ns / 1000, miss_ns / ops);
+    klog("[hashmap] %lu removals in %luus (%luns/op)\n", DIV_CEIL(key_count, 2), remove_ns / 1000, remove_ns / MAX(DIV_CEIL(key_count, 2), 1));
+    klog("[hashmap] self-test passed\n");
+}
@@ -1,8 +1,9 @@
 #include <cpu/asm.h>
+#include <sys/preempt.h>
 #include <utils/panic.h>
 #include <utils/spinlock.h>
 
-void spinlock_acquire(spinlock_t* lock) {
+void spinlock_acquire_raw(spinlock_t* lock) {
     if (!lock) {
         return;
     }
@@ -10,7 +11,7 @@ void spinlock_acquire(spinlock_t* lock) {
     volatile size_t counter = 0;
 
     for (;;) {
-        if (spinlock_test_and_acquire(lock)) {
+        if (spinlock_test_and_acquire_raw(lock)) {
             break;
         }
 
@@ -22,9 +23,49 @@ void spinlock_acquire(spinlock_t* lock) {
     }
 }
 
+bool spinlock_test_and_acquire(spinlock_t* lock) {
+    preempt_disable();
+    if (spinlock_test_and_acquire_raw(lock)) {
+        return true;
+    }
+    preempt_enable();
+    return false;
+}
+
+void spinlock_acquire(spinlock_t* lock) {
+    if (!lock) {
+        return;
+    }
+
+    preempt_disable();
+    spinlock_acquire_raw(lock);
+}
+
 void spinlock_release(spinlock_t* lock) {
     if (!lock) {
         return;
     }
-    __atomic_store_n(lock, 0, __ATOMIC_SEQ_CST);
+
+    spinlock_release_raw(lock);
+    preempt_enable();
+}
+
+/* returns whether interrupts were enabled, to be passed back on release */
+bool spinlock_acquire_irqsave(spinlock_t* lock) {
+    bool prev_int = interrupt_state();
+    cli();
+
+    spinlock_acquire(lock);
+    return prev_int;
+}
+
+/* interrupts are enabled again first, so that a preemption put off meanwhile can happen right away */
+void spinlock_release_irqrestore(spinlock_t* lock, bool prev_int) {
+    spinlock_release_raw(lock);
+
+    if (prev_int) {
+        sti();
+    }
+
+    preempt_enable();
 }
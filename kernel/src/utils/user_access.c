@@ -1,30 +1,52 @@
 #include <cpu/asm.h>
+#include <cpu/isr.h>
 #include <cpu/percpu.h>
 #include <utils/user_access.h>
 
+/* in user_copy.S */
+extern char user_copy_access[];
+extern char user_fill_access[];
+extern char user_load32_access[];
+extern char user_access_failed[];
+
+/* called for kernel faults that could not be resolved, makes the user access that faulted return false */
+bool user_access_fixup(struct registers* r) {
+    if (r->rip != (uintptr_t) user_copy_access && r->rip != (uintptr_t) user_fill_access &&
+            r->rip != (uintptr_t) user_load32_access) {
+        return false;
+    }
+
+    r->rip = (uintptr_t) user_access_failed;
+    return true;
+}
+
 bool check_user_ptr(const void* ptr) {
     return ((uintptr_t) ptr >= this_cpu()->running_thread->process->code_base &&
             (uintptr_t) ptr < PROCESS_THREAD_STACK_TOP);
 }
 
+bool check_user_range(const void* ptr, size_t size) {
+    return check_user_ptr(ptr) && size <= PROCESS_THREAD_STACK_TOP - (uintptr_t) ptr;
+}
+
 void* copy_from_user(void* kdest, const void* usrc, size_t size) {
-    if (!check_user_ptr(usrc)) {
+    if (!check_user_range(usrc, size)) {
         return NULL;
     }
 
     USER_ACCESS_BEGIN;
-    void* ret = memcpy(kdest, usrc, size);
+    bool copied = user_copy(kdest, usrc, size);
     USER_ACCESS_END;
-    return ret;
+    return copied ? kdest : NULL;
 }
 
 void* copy_to_user(void* udest, const void* ksrc, size_t size) {
-    if (!check_user_ptr(udest)) {
+    if (!check_user_range(udest, size)) {
         return NULL;
     }
 
     USER_ACCESS_BEGIN;
-    void* ret = memcpy(udest, ksrc, size);
+    bool copied = user_copy(udest, ksrc, size);
     USER_ACCESS_END;
-    return ret;
+    return copied ? udest : NULL;
 }
@@ -23,6 +23,11 @@
 
 #define EOVERFLOW       20
 #define ERANGE          21
+#define ENODEV          22
+#define EACCES          23
+#define ESRCH           24
+#define ETIMEDOUT       25
+#define EBUSY           26
 
 extern int errno;
 
@@ -0,0 +1,44 @@
+#ifndef _PTHREAD_H
+#define _PTHREAD_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Futexes in shared mappings are keyed by the physical address of their word, so mutexes and condition
+ * variables in shared memory also work between processes. There are no attributes to set yet.
+ */
+typedef struct {
+    uint32_t state;
+} pthread_mutex_t;
+
+typedef struct {
+    uint32_t seq;
+    pthread_mutex_t* mutex;
+} pthread_cond_t;
+
+typedef struct {
+    int __unused;
+} pthread_mutexattr_t;
+
+typedef struct {
+    int __unused;
+} pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER   { 0 }
+#define PTHREAD_COND_INITIALIZER    { 0, 0 }
+
+int pthread_mutex_destroy(pthread_mutex_t*);
+int pthread_mutex_init(pthread_mutex_t* __restrict, const pthread_mutexattr_t* __restrict);
+int pthread_mutex_lock(pthread_mutex_t*);
+int pthread_mutex_trylock(pthread_mutex_t*);
+int pthread_mutex_unlock(pthread_mutex_t*);
+
+int pthread_cond_broadcast(pthread_cond_t*);
+int pthread_cond_destroy(pthread_cond_t*);
+int pthread_cond_init(pthread_cond_t* __restrict, const pthread_condattr_t* __restrict);
+int pthread_cond_signal(pthread_cond_t*);
+int pthread_cond_timedwait(pthread_cond_t* __restrict, pthread_mutex_t* __restrict, const struct timespec* __restrict);
+int pthread_cond_wait(pthread_cond_t* __restrict, pthread_mutex_t* __restrict);
+
+#endif /* _PTHREAD_H */
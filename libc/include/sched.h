@@ -0,0 +1,48 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO  1
+#define SCHED_RR    2
+
+struct sched_param {
+    int sched_priority;
+};
+
+#define CPU_SETSIZE 1024
+#define __CPU_BITS  (8 * sizeof(unsigned long))
+
+typedef struct {
+    unsigned long __bits[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+} cpu_set_t;
+
+#define CPU_ZERO(set) \
+    do { \
+        for (size_t __i = 0; __i < CPU_SETSIZE / __CPU_BITS; __i++) { \
+            (set)->__bits[__i] = 0; \
+        } \
+    } while (0)
+
+#define CPU_SET(cpu, set) \
+    ((size_t) (cpu) < CPU_SETSIZE ? ((set)->__bits[(cpu) / __CPU_BITS] |= 1ul << ((cpu) % __CPU_BITS)) : 0)
+#define CPU_CLR(cpu, set) \
+    ((size_t) (cpu) < CPU_SETSIZE ? ((set)->__bits[(cpu) / __CPU_BITS] &= ~(1ul << ((cpu) % __CPU_BITS))) : 0)
+#define CPU_ISSET(cpu, set) \
+    ((size_t) (cpu) < CPU_SETSIZE && ((set)->__bits[(cpu) / __CPU_BITS] & (1ul << ((cpu) % __CPU_BITS))) != 0)
+#define CPU_COUNT(set) __sched_cpucount(sizeof(cpu_set_t), (set))
+
+int __sched_cpucount(size_t, const cpu_set_t*);
+
+int sched_get_priority_max(int);
+int sched_get_priority_min(int);
+int sched_getparam(pid_t, struct sched_param*);
+int sched_getaffinity(pid_t, size_t, cpu_set_t*);
+int sched_getscheduler(pid_t);
+int sched_setaffinity(pid_t, size_t, const cpu_set_t*);
+int sched_setscheduler(pid_t, int, const struct sched_param*);
+int sched_yield(void);
+
+#endif /* _SCHED_H */
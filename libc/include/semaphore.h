@@ -0,0 +1,20 @@
+#ifndef _SEMAPHORE_H
+#define _SEMAPHORE_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    uint32_t value;
+    uint32_t waiters;
+} sem_t;
+
+int sem_destroy(sem_t*);
+int sem_getvalue(sem_t* __restrict, int* __restrict);
+int sem_init(sem_t*, int, unsigned int);
+int sem_post(sem_t*);
+int sem_timedwait(sem_t* __restrict, const struct timespec* __restrict);
+int sem_trywait(sem_t*);
+int sem_wait(sem_t*);
+
+#endif /* _SEMAPHORE_H */
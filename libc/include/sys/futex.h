@@ -0,0 +1,13 @@
+#ifndef _SYS_FUTEX_H
+#define _SYS_FUTEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FUTEX_WAIT      0
+#define FUTEX_WAKE      1
+#define FUTEX_REQUEUE   3
+
+int futex(uint32_t*, int, uint32_t, const struct timespec*, uint32_t*);
+
+#endif /* _SYS_FUTEX_H */
@@ -0,0 +1,15 @@
+#ifndef _SYS_RESOURCE_H
+#define _SYS_RESOURCE_H
+
+#include <sys/types.h>
+
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
+
+typedef int id_t;
+
+int getpriority(int, id_t);
+int setpriority(int, id_t, int);
+
+#endif /* _SYS_RESOURCE_H */
@@ -33,11 +33,24 @@
 #define SYS_SLEEP           27
 #define SYS_CLOCK_GETTIME   28
 #define SYS_CLOCK_SETTIME   29
+#define SYS_MMAP            30
+#define SYS_MUNMAP          31
+#define SYS_MPROTECT        32
+#define SYS_GETPRIORITY     33
+#define SYS_SETPRIORITY     34
+#define SYS_SCHED_SETSCHEDULER  35
+#define SYS_SCHED_GETSCHEDULER  36
+#define SYS_SCHED_GETPARAM  37
+#define SYS_FUTEX           38
+#define SYS_SCHED_SETAFFINITY   39
+#define SYS_SCHED_GETAFFINITY   40
 
 extern uint64_t syscall0(uint64_t);
 extern uint64_t syscall1(uint64_t, uint64_t);
 extern uint64_t syscall2(uint64_t, uint64_t, uint64_t);
 extern uint64_t syscall3(uint64_t, uint64_t, uint64_t, uint64_t);
 extern uint64_t syscall4(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+extern uint64_t syscall5(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+extern uint64_t syscall6(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 
 #endif /* _SYS_SYSCALLS_H */
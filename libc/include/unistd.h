@@ -38,6 +38,7 @@ int getopt(int, char* const[], const char*);
 pid_t getpid(void);
 pid_t getppid(void);
 off_t lseek(int, off_t, int);
+int nice(int);
 ssize_t read(int, void*, size_t);
 void* sbrk(intptr_t);
 int sleep(unsigned int);
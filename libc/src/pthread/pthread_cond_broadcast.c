@@ -0,0 +1,19 @@
+#include <stdint.h>
+#include "pthread_internal.h"
+
+/*
+ * Only one waiter is woken, the others are moved over to the mutex and woken one at a time as it gets
+ * unlocked, instead of all of them waking up just to fight over it.
+ */
+int pthread_cond_broadcast(pthread_cond_t* cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_t* mutex = __atomic_load_n(&cond->mutex, __ATOMIC_RELAXED);
+    if (mutex == NULL) {
+        futex(&cond->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL);
+        return 0;
+    }
+
+    futex(&cond->seq, FUTEX_REQUEUE, 1, (const struct timespec*) (uintptr_t) INT32_MAX, &mutex->state);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#include <pthread.h>
+#include <stddef.h>
+
+int pthread_cond_init(pthread_cond_t* __restrict cond, const pthread_condattr_t* __restrict attr) {
+    (void) attr;
+    cond->seq = 0;
+    cond->mutex = NULL;
+    return 0;
+}
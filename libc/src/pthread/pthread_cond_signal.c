@@ -0,0 +1,7 @@
+#include "pthread_internal.h"
+
+int pthread_cond_signal(pthread_cond_t* cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    futex(&cond->seq, FUTEX_WAKE, 1, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <errno.h>
+#include "pthread_internal.h"
+
+/*
+ * Waiters sleep on the sequence number they saw before unlocking the mutex, so a signal sent in
+ * between changes it and they do not go to sleep at all. Spurious wakeups are allowed.
+ */
+int pthread_cond_timedwait(pthread_cond_t* __restrict cond, pthread_mutex_t* __restrict mutex, const struct timespec* __restrict abstime) {
+    struct timespec timeout;
+    if (abstime != NULL) {
+        if (abstime->tv_nsec < 0 || abstime->tv_nsec > 999999999) {
+            return EINVAL;
+        }
+    }
+
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&cond->mutex, mutex, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(mutex);
+
+    int ret = 0;
+    if (abstime != NULL && !__abstime_to_timeout(abstime, &timeout)) {
+        ret = ETIMEDOUT;
+    } else if (futex(&cond->seq, FUTEX_WAIT, seq, abstime != NULL ? &timeout : NULL, NULL) < 0 && errno == ETIMEDOUT) {
+        ret = ETIMEDOUT;
+    }
+
+    __mutex_lock_contended(mutex);
+    return ret;
+}
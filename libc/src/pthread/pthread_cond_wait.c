@@ -0,0 +1,6 @@
+#include <pthread.h>
+#include <stddef.h>
+
+int pthread_cond_wait(pthread_cond_t* __restrict cond, pthread_mutex_t* __restrict mutex) {
+    return pthread_cond_timedwait(cond, mutex, NULL);
+}
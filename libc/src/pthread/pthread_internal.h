@@ -0,0 +1,39 @@
+#ifndef PTHREAD_INTERNAL_H
+#define PTHREAD_INTERNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/futex.h>
+#include <time.h>
+
+/* mutex states, a contended mutex has to wake a waiter when it is unlocked */
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+
+/*
+ * Takes the mutex the slow way, marking it contended. Threads that might have been requeued onto the
+ * mutex take it this way too, since there may be more of them asleep that the unlock has to wake.
+ */
+static inline void __mutex_lock_contended(pthread_mutex_t* mutex) {
+    while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED) {
+        futex(&mutex->state, FUTEX_WAIT, MUTEX_CONTENDED, NULL, NULL);
+    }
+}
+
+/* futexes take a relative timeout, false if the absolute CLOCK_REALTIME time already passed */
+static inline bool __abstime_to_timeout(const struct timespec* abstime, struct timespec* timeout) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    timeout->tv_sec = abstime->tv_sec - now.tv_sec;
+    timeout->tv_nsec = abstime->tv_nsec - now.tv_nsec;
+    if (timeout->tv_nsec < 0) {
+        timeout->tv_sec--;
+        timeout->tv_nsec += 1000000000;
+    }
+
+    return timeout->tv_sec >= 0;
+}
+
+#endif /* PTHREAD_INTERNAL_H */
@@ -0,0 +1,6 @@
+#include <errno.h>
+#include "pthread_internal.h"
+
+int pthread_mutex_destroy(pthread_mutex_t* mutex) {
+    return __atomic_load_n(&mutex->state, __ATOMIC_RELAXED) != MUTEX_UNLOCKED ? EBUSY : 0;
+}
@@ -0,0 +1,7 @@
+#include <pthread.h>
+
+int pthread_mutex_init(pthread_mutex_t* __restrict mutex, const pthread_mutexattr_t* __restrict attr) {
+    (void) attr;
+    mutex->state = 0;
+    return 0;
+}
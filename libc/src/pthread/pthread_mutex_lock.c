@@ -0,0 +1,12 @@
+#include "pthread_internal.h"
+
+/* uncontended locks never enter the kernel */
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    uint32_t unlocked = MUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&mutex->state, &unlocked, MUTEX_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    __mutex_lock_contended(mutex);
+    return 0;
+}
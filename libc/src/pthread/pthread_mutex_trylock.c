@@ -0,0 +1,10 @@
+#include <errno.h>
+#include "pthread_internal.h"
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex) {
+    uint32_t unlocked = MUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&mutex->state, &unlocked, MUTEX_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return EBUSY;
+}
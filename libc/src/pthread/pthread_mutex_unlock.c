@@ -0,0 +1,9 @@
+#include "pthread_internal.h"
+
+/* only a mutex someone went to sleep on needs a wakeup */
+int pthread_mutex_unlock(pthread_mutex_t* mutex) {
+    if (__atomic_exchange_n(&mutex->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE) == MUTEX_CONTENDED) {
+        futex(&mutex->state, FUTEX_WAKE, 1, NULL, NULL);
+    }
+    return 0;
+}
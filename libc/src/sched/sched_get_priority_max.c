@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <sched.h>
+
+int sched_get_priority_max(int policy) {
+    switch (policy) {
+        case SCHED_OTHER:
+            return 0;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            return 99;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
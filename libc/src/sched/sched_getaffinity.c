@@ -0,0 +1,16 @@
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+/* the kernel returns how much of the mask it wrote, the rest is cleared here */
+int sched_getaffinity(pid_t pid, size_t size, cpu_set_t* mask) {
+    long ret = syscall3(SYS_SCHED_GETAFFINITY, pid, size, (uint64_t) mask);
+    if (ret < 0) {
+        return -1;
+    }
+
+    if ((size_t) ret < size) {
+        memset((char*) mask + ret, 0, size - ret);
+    }
+    return 0;
+}
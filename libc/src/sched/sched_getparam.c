@@ -0,0 +1,6 @@
+#include <sched.h>
+#include <sys/syscall.h>
+
+int sched_getparam(pid_t pid, struct sched_param* param) {
+    return syscall2(SYS_SCHED_GETPARAM, pid, (uint64_t) param);
+}
@@ -0,0 +1,6 @@
+#include <sched.h>
+#include <sys/syscall.h>
+
+int sched_getscheduler(pid_t pid) {
+    return syscall1(SYS_SCHED_GETSCHEDULER, pid);
+}
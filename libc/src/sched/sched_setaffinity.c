@@ -0,0 +1,6 @@
+#include <sched.h>
+#include <sys/syscall.h>
+
+int sched_setaffinity(pid_t pid, size_t size, const cpu_set_t* mask) {
+    return syscall3(SYS_SCHED_SETAFFINITY, pid, size, (uint64_t) mask);
+}
@@ -0,0 +1,6 @@
+#include <sched.h>
+#include <sys/syscall.h>
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param* param) {
+    return syscall3(SYS_SCHED_SETSCHEDULER, pid, policy, (uint64_t) param);
+}
@@ -0,0 +1,6 @@
+#include <sched.h>
+#include <sys/syscall.h>
+
+int sched_yield(void) {
+    return syscall0(SYS_YIELD);
+}
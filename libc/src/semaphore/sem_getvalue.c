@@ -0,0 +1,6 @@
+#include <semaphore.h>
+
+int sem_getvalue(sem_t* __restrict sem, int* __restrict value) {
+    *value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#include <semaphore.h>
+#include <stddef.h>
+#include <sys/futex.h>
+
+/* posting to a semaphore nobody waits on never enters the kernel */
+int sem_post(sem_t* sem) {
+    __atomic_add_fetch(&sem->value, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) != 0) {
+        futex(&sem->value, FUTEX_WAKE, 1, NULL, NULL);
+    }
+    return 0;
+}
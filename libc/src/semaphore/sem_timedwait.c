@@ -0,0 +1,40 @@
+#include <errno.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <sys/futex.h>
+#include "../pthread/pthread_internal.h"
+
+/*
+ * Sleepers count themselves in waiters before checking the value one last time in the kernel, so a
+ * post either sees them or changes the value they are about to sleep on.
+ */
+int sem_timedwait(sem_t* __restrict sem, const struct timespec* __restrict abstime) {
+    if (sem_trywait(sem) == 0) {
+        return 0;
+    }
+
+    if (abstime != NULL && (abstime->tv_nsec < 0 || abstime->tv_nsec > 999999999)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int ret = 0;
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+    while (sem_trywait(sem) < 0) {
+        struct timespec timeout;
+        if (abstime != NULL && !__abstime_to_timeout(abstime, &timeout)) {
+            errno = ETIMEDOUT;
+            ret = -1;
+            break;
+        }
+
+        if (futex(&sem->value, FUTEX_WAIT, 0, abstime != NULL ? &timeout : NULL, NULL) < 0 && errno == ETIMEDOUT) {
+            ret = -1;
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
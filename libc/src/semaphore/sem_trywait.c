@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <semaphore.h>
+#include <stdbool.h>
+
+int sem_trywait(sem_t* sem) {
+    uint32_t value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    while (value > 0) {
+        if (__atomic_compare_exchange_n(&sem->value, &value, value - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
@@ -0,0 +1,6 @@
+#include <semaphore.h>
+#include <stddef.h>
+
+int sem_wait(sem_t* sem) {
+    return sem_timedwait(sem, NULL);
+}
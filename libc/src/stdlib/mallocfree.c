@@ -1,13 +1,19 @@
 #include <assert.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include "stdlib_internal.h"
 
 #define HEAP_CHUNK_MAGIC 0xffba67ed89ab32be
 
+/* allocations at least this big get their own mapping, so free can hand them straight back */
+#define MMAP_THRESHOLD (128 * 1024)
+#define PAGE_SIZE 0x1000
+
 struct heap_chunk {
-    size_t size: 63;
+    size_t size: 62;
     size_t free: 1;
+    size_t mapped: 1;
     unsigned long magic;
     struct heap_chunk* next;
 };
@@ -32,6 +38,22 @@ __attribute__((malloc)) void* malloc(size_t size) {
         return NULL;
     }
 
+    if (size >= MMAP_THRESHOLD) {
+        size_t total_size = (sizeof(struct heap_chunk) + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+        struct heap_chunk* chunk = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
+        }
+
+        chunk->size = total_size - sizeof(struct heap_chunk);
+        chunk->free = 0;
+        chunk->mapped = 1;
+        chunk->magic = HEAP_CHUNK_MAGIC;
+        chunk->next = NULL;
+        return (void*) (chunk + 1);
+    }
+
     struct heap_chunk* chunk = get_free_chunk(size);
     if (chunk) {
         chunk->free = 0;
@@ -47,6 +69,7 @@ __attribute__((malloc)) void* malloc(size_t size) {
 
 	chunk->size = size;
 	chunk->free = 0;
+    chunk->mapped = 0;
     chunk->magic = HEAP_CHUNK_MAGIC;
 	chunk->next = NULL;
 
@@ -69,6 +92,11 @@ void free(void* ptr) {
 	struct heap_chunk* chunk = (struct heap_chunk*) ptr - 1;
     assert(chunk->magic == HEAP_CHUNK_MAGIC && "invalid heap pointer");
 
+    if (chunk->mapped) {
+        munmap(chunk, sizeof(struct heap_chunk) + chunk->size);
+        return;
+    }
+
     if ((uintptr_t) ptr + chunk->size == (uintptr_t) sbrk(0)) {
         if (first == last) {
             first = NULL;
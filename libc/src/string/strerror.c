@@ -45,6 +45,16 @@ char* strerror(int errnum) {
             return "Value too large for supplied data type";
         case ERANGE:
             return "Result too large";
+        case ENODEV:
+            return "No such device";
+        case EACCES:
+            return "Permission denied";
+        case ESRCH:
+            return "No such process";
+        case ETIMEDOUT:
+            return "Operation timed out";
+        case EBUSY:
+            return "Device or resource busy";
     }
 
     errno = EINVAL;
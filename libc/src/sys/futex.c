@@ -0,0 +1,6 @@
+#include <sys/futex.h>
+#include <sys/syscall.h>
+
+int futex(uint32_t* uaddr, int op, uint32_t val, const struct timespec* timeout, uint32_t* uaddr2) {
+    return syscall5(SYS_FUTEX, (uint64_t) uaddr, op, val, (uint64_t) timeout, (uint64_t) uaddr2);
+}
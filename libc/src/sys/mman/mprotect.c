@@ -0,0 +1,6 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int mprotect(void* addr, size_t length, int prot) {
+    return syscall3(SYS_MPROTECT, (uint64_t) addr, length, prot);
+}
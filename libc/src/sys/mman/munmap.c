@@ -0,0 +1,6 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int munmap(void* addr, size_t length) {
+    return syscall2(SYS_MUNMAP, (uint64_t) addr, length);
+}
@@ -0,0 +1,6 @@
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+int setpriority(int which, id_t who, int prio) {
+    return syscall3(SYS_SETPRIORITY, which, who, prio);
+}
@@ -0,0 +1,10 @@
+#include <sys/resource.h>
+#include <unistd.h>
+
+int nice(int incr) {
+    int prio = getpriority(PRIO_PROCESS, 0);
+    if (setpriority(PRIO_PROCESS, 0, prio + incr) < 0) {
+        return -1;
+    }
+    return getpriority(PRIO_PROCESS, 0);
+}
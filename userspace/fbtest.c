@@ -1,11 +1,12 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 int main(void) {
-    int fb = open("/dev/fb0", O_WRONLY);
+    int fb = open("/dev/fb0", O_RDWR);
     if (fb < 0) {
         perror("open");
         return EXIT_FAILURE;
@@ -23,21 +24,19 @@ int main(void) {
         return EXIT_FAILURE;
     }
 
-    char* buf = malloc(fb_stat.st_size);
-    if (buf == NULL) {
-        fputs("unable to allocate buffer for framebuffer image\n", stderr);
+    char* buf = mmap(NULL, fb_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
         return EXIT_FAILURE;
     }
 
     for (;;) {
         read(rand, buf, fb_stat.st_size);
-        write(fb, buf, fb_stat.st_size);
-        lseek(fb, 0, SEEK_SET);
 
         usleep(1000 * 100);
     }
 
-    free(buf);
+    munmap(buf, fb_stat.st_size);
     close(fb);
 
     return EXIT_SUCCESS;
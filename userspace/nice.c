@@ -0,0 +1,58 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "nice"
+
+static void error(void) {
+    fputs("try '" PROGRAM_NAME " -h' for more information\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void help(void) {
+    puts("usage: " PROGRAM_NAME " [OPTION] [COMMAND [ARG]...]\n\nRun COMMAND with an adjusted niceness, which affects its share of CPU time.\nWith no COMMAND, print the current niceness. Niceness ranges from -20 (most favorable) to 19 (least favorable).\n\n-n N\tadd integer N to the niceness (default: 10)\n-h\tdisplay this help and exit\n");
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char** argv) {
+    long adjustment = 10;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:h")) != -1) {
+        switch (c) {
+            case 'n': {
+                char* end_ptr;
+                errno = 0;
+                adjustment = strtol(optarg, &end_ptr, 10);
+                if (errno != 0 || *end_ptr != '\0') {
+                    fprintf(stderr, PROGRAM_NAME ": invalid adjustment '%s'\n", optarg);
+                    error();
+                }
+                break;
+            }
+            case 'h':
+                help();
+                break;
+            default:
+                error();
+                break;
+        }
+    }
+
+    if (optind == argc) {
+        printf("%d\n", getpriority(PRIO_PROCESS, 0));
+        return EXIT_SUCCESS;
+    }
+
+    errno = 0;
+    if (nice(adjustment) == -1 && errno != 0) {
+        perror(PROGRAM_NAME ": cannot set niceness");
+    }
+
+    execvp(argv[optind], argv + optind);
+    fprintf(stderr, PROGRAM_NAME ": '%s': %s\n", argv[optind], strerror(errno));
+    return EXIT_FAILURE;
+}
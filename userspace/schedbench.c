@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "schedbench"
+
+static void error(void) {
+    fputs("try '" PROGRAM_NAME " -h' for more information\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void help(void) {
+    puts("usage: " PROGRAM_NAME " [OPTION]...\n\nMeasure context switch throughput with a growing number of threads that do nothing but yield.\n\n-i COUNT\tyield COUNT times in every thread (default: 10000)\n-n COUNT\tgo up to COUNT threads, doubling every round (default: 64)\n-h\t\tdisplay this help and exit\n");
+    exit(EXIT_SUCCESS);
+}
+
+static long parse_count(const char* arg) {
+    char* end_ptr;
+    errno = 0;
+    long count = strtol(arg, &end_ptr, 10);
+    if (errno != 0 || *end_ptr != '\0' || count <= 0) {
+        fprintf(stderr, PROGRAM_NAME ": invalid count '%s'\n", arg);
+        error();
+    }
+    return count;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static int run_round(long threads, long iterations) {
+    for (long i = 0; i < threads; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror(PROGRAM_NAME ": fork");
+            return -1;
+        }
+
+        if (pid == 0) {
+            for (long j = 0; j < iterations; j++) {
+                sched_yield();
+            }
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    for (long i = 0; i < threads; i++) {
+        wait(NULL);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    long iterations = 10000;
+    long max_threads = 64;
+
+    int c;
+    while ((c = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (c) {
+            case 'i':
+                iterations = parse_count(optarg);
+                break;
+            case 'n':
+                max_threads = parse_count(optarg);
+                break;
+            case 'h':
+                help();
+                break;
+            default:
+                error();
+                break;
+        }
+    }
+
+    printf("%8s %14s %12s\n", "threads", "switches/s", "ns/switch");
+
+    for (long threads = 1; threads <= max_threads; threads *= 2) {
+        uint64_t start = now_ns();
+        if (run_round(threads, iterations) < 0) {
+            return EXIT_FAILURE;
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+
+        uint64_t switches = (uint64_t) threads * iterations;
+        printf("%8ld %14lu %12lu\n", threads, switches * 1000000000ul / elapsed, elapsed / switches);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "switchbench"
+
+static void error(void) {
+    fputs("try '" PROGRAM_NAME " -h' for more information\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void help(void) {
+    puts("usage: " PROGRAM_NAME " [OPTION]...\n\nMeasure the latency of a trivial syscall and of switching between two processes that yield to each other\non the same CPU, once without touching the FPU and once with floating-point work between calls.\n\n-i COUNT\trepeat every measurement COUNT times (default: 100000)\n-h\t\tdisplay this help and exit\n");
+    exit(EXIT_SUCCESS);
+}
+
+static long parse_count(const char* arg) {
+    char* end_ptr;
+    errno = 0;
+    long count = strtol(arg, &end_ptr, 10);
+    if (errno != 0 || *end_ptr != '\0' || count <= 0) {
+        fprintf(stderr, PROGRAM_NAME ": invalid count '%s'\n", arg);
+        error();
+    }
+    return count;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static volatile double fpu_sink = 1.0;
+
+/* keeps the SSE registers live, so their state has to be saved and restored around every switch */
+static inline void use_fpu(bool enabled) {
+    if (enabled) {
+        fpu_sink = fpu_sink * 1.000001 + 0.5;
+    }
+}
+
+static uint64_t bench_syscall(long iterations, bool fpu) {
+    uint64_t start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        use_fpu(fpu);
+        getpid();
+    }
+    return now_ns() - start;
+}
+
+/*
+ * Both processes yield back and forth, so every yield is a switch to the other one. They are kept on
+ * one CPU, the child inherits the affinity, as otherwise each would yield to its own empty run queue.
+ */
+static uint64_t bench_switch(long iterations, bool fpu) {
+    cpu_set_t old_set;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &old_set) < 0) {
+        perror(PROGRAM_NAME ": sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0) {
+        perror(PROGRAM_NAME ": sched_setaffinity");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = now_ns();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror(PROGRAM_NAME ": fork");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < iterations; i++) {
+        use_fpu(fpu);
+        sched_yield();
+    }
+
+    if (pid == 0) {
+        _exit(EXIT_SUCCESS);
+    }
+    waitpid(pid, NULL, 0);
+
+    uint64_t elapsed = now_ns() - start;
+    sched_setaffinity(0, sizeof(cpu_set_t), &old_set);
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    long iterations = 100000;
+
+    int c;
+    while ((c = getopt(argc, argv, "i:h")) != -1) {
+        switch (c) {
+            case 'i':
+                iterations = parse_count(optarg);
+                break;
+            case 'h':
+                help();
+                break;
+            default:
+                error();
+                break;
+        }
+    }
+
+    printf("%-10s %4s %12s\n", "test", "fpu", "ns/op");
+
+    for (int fpu = 0; fpu <= 1; fpu++) {
+        uint64_t elapsed = bench_syscall(iterations, fpu);
+        printf("%-10s %4s %12lu\n", "syscall", fpu ? "yes" : "no", elapsed / iterations);
+    }
+
+    for (int fpu = 0; fpu <= 1; fpu++) {
+        uint64_t elapsed = bench_switch(iterations, fpu);
+        printf("%-10s %4s %12lu\n", "switch", fpu ? "yes" : "no", elapsed / (iterations * 2));
+    }
+
+    return EXIT_SUCCESS;
+}
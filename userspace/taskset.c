@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "taskset"
+
+static void error(void) {
+    fputs("try '" PROGRAM_NAME " -h' for more information\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void help(void) {
+    puts("usage: " PROGRAM_NAME " [OPTION]... [COMMAND [ARG]...]\n\nRun COMMAND restricted to a list of CPUs, or show or change the CPUs a running process may use.\nWith -p and without -c, print the CPUs the process may run on.\n\n-c LIST\trestrict to the CPUs in LIST, like 0,2-3\n-p PID\toperate on the process PID instead of running COMMAND\n-h\tdisplay this help and exit\n");
+    exit(EXIT_SUCCESS);
+}
+
+static long parse_number(const char* str, char** end_ptr) {
+    errno = 0;
+    long number = strtol(str, end_ptr, 10);
+    if (errno != 0 || *end_ptr == str || number < 0) {
+        return -1;
+    }
+    return number;
+}
+
+static bool parse_cpu_list(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+
+    const char* iter = list;
+    for (;;) {
+        char* end_ptr;
+        long first = parse_number(iter, &end_ptr);
+        long last = first;
+        if (first < 0) {
+            return false;
+        }
+
+        if (*end_ptr == '-') {
+            last = parse_number(end_ptr + 1, &end_ptr);
+            if (last < first) {
+                return false;
+            }
+        }
+
+        if (last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+
+        if (*end_ptr == '\0') {
+            return true;
+        }
+        if (*end_ptr != ',') {
+            return false;
+        }
+        iter = end_ptr + 1;
+    }
+}
+
+static void print_cpu_list(const cpu_set_t* set) {
+    bool first = true;
+    for (long cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set)) {
+            continue;
+        }
+
+        long last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+            last++;
+        }
+
+        printf(first ? "%ld" : ",%ld", cpu);
+        if (last != cpu) {
+            printf("-%ld", last);
+        }
+
+        first = false;
+        cpu = last;
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv) {
+    cpu_set_t set;
+    bool set_cpus = false;
+    pid_t pid = 0;
+    bool pid_given = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:p:h")) != -1) {
+        switch (c) {
+            case 'c':
+                if (!parse_cpu_list(optarg, &set)) {
+                    fprintf(stderr, PROGRAM_NAME ": invalid CPU list '%s'\n", optarg);
+                    error();
+                }
+                set_cpus = true;
+                break;
+            case 'p': {
+                char* end_ptr;
+                long number = parse_number(optarg, &end_ptr);
+                if (number < 0 || *end_ptr != '\0') {
+                    fprintf(stderr, PROGRAM_NAME ": invalid PID '%s'\n", optarg);
+                    error();
+                }
+                pid = number;
+                pid_given = true;
+                break;
+            }
+            case 'h':
+                help();
+                break;
+            default:
+                error();
+                break;
+        }
+    }
+
+    if (pid_given == (optind != argc)) {
+        error();
+    }
+
+    if (!set_cpus) {
+        if (!pid_given) {
+            error();
+        }
+
+        if (sched_getaffinity(pid, sizeof(cpu_set_t), &set) < 0) {
+            perror(PROGRAM_NAME ": cannot get affinity");
+            return EXIT_FAILURE;
+        }
+        print_cpu_list(&set);
+        return EXIT_SUCCESS;
+    }
+
+    if (sched_setaffinity(pid, sizeof(cpu_set_t), &set) < 0) {
+        perror(PROGRAM_NAME ": cannot set affinity");
+        return EXIT_FAILURE;
+    }
+
+    if (pid_given) {
+        return EXIT_SUCCESS;
+    }
+
+    execvp(argv[optind], argv + optind);
+    fprintf(stderr, PROGRAM_NAME ": '%s': %s\n", argv[optind], strerror(errno));
+    return EXIT_FAILURE;
+}
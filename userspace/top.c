@@ -0,0 +1,361 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "top"
+
+#define THREADS_PATH    "/proc/threads"
+#define SCHEDSTAT_PATH  "/proc/schedstat"
+
+#define LATENCY_BUCKETS 32
+
+struct thread_stats {
+    long pid;
+    long tid;
+    char state[4];
+    char policy[8];
+    long prio;
+    long cpu;
+    unsigned long run_ns;
+    unsigned long wait_ns;
+    unsigned long voluntary;
+    unsigned long involuntary;
+    unsigned long migrations;
+    unsigned long max_latency_ns;
+    char name[64];
+
+    /* over the last interval */
+    unsigned long run_delta;
+    unsigned long wait_delta;
+};
+
+struct snapshot {
+    struct thread_stats* threads;
+    size_t thread_count;
+    unsigned long idle_ns;
+    unsigned long switches;
+    unsigned long wakeups;
+    size_t cpu_count;
+    unsigned long latency[LATENCY_BUCKETS];
+};
+
+static void error(void) {
+    fputs("try '" PROGRAM_NAME " -h' for more information\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void help(void) {
+    puts("usage: " PROGRAM_NAME " [OPTION]...\n\nShow the threads using the most CPU time, how long they waited to run, and the wakeup latency of the scheduler.\n\n-d SECONDS\tmeasure over intervals of SECONDS (default: 1)\n-n COUNT\tstop after COUNT intervals (default: never)\n-t COUNT\tshow the top COUNT threads (default: 20)\n-h\t\tdisplay this help and exit\n");
+    exit(EXIT_SUCCESS);
+}
+
+static long parse_count(const char* arg) {
+    char* end_ptr;
+    errno = 0;
+    long count = strtol(arg, &end_ptr, 10);
+    if (errno != 0 || *end_ptr != '\0' || count <= 0) {
+        fprintf(stderr, PROGRAM_NAME ": invalid count '%s'\n", arg);
+        error();
+    }
+    return count;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* proc files have no size, so they are read until the end */
+static char* read_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, PROGRAM_NAME ": cannot open '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t size = 0;
+    size_t capacity = 4096;
+    char* data = malloc(capacity);
+    while (data != NULL) {
+        ssize_t count = read(fd, data + size, capacity - size - 1);
+        if (count <= 0) {
+            break;
+        }
+
+        size += count;
+        if (size + 1 == capacity) {
+            capacity *= 2;
+            char* bigger = realloc(data, capacity);
+            if (bigger == NULL) {
+                free(data);
+            }
+            data = bigger;
+        }
+    }
+
+    close(fd);
+    if (data != NULL) {
+        data[size] = '\0';
+    }
+    return data;
+}
+
+/* splits off the next space separated field of a line */
+static char* next_field(char** iter) {
+    char* field = *iter;
+    while (**iter != '\0' && **iter != ' ') {
+        (*iter)++;
+    }
+    if (**iter == ' ') {
+        *(*iter)++ = '\0';
+    }
+    return field;
+}
+
+static unsigned long next_number(char** iter) {
+    return strtoul(next_field(iter), NULL, 10);
+}
+
+static bool parse_thread(char* line, struct thread_stats* t) {
+    char* iter = line;
+    t->pid = strtol(next_field(&iter), NULL, 10);
+    t->tid = strtol(next_field(&iter), NULL, 10);
+    snprintf(t->state, sizeof(t->state), "%s", next_field(&iter));
+    snprintf(t->policy, sizeof(t->policy), "%s", next_field(&iter));
+    t->prio = strtol(next_field(&iter), NULL, 10);
+    t->cpu = strtol(next_field(&iter), NULL, 10);
+    t->run_ns = next_number(&iter);
+    t->wait_ns = next_number(&iter);
+    t->voluntary = next_number(&iter);
+    t->involuntary = next_number(&iter);
+    t->migrations = next_number(&iter);
+    t->max_latency_ns = next_number(&iter);
+    snprintf(t->name, sizeof(t->name), "%s", iter);
+    t->run_delta = 0;
+    t->wait_delta = 0;
+    return *line != '\0';
+}
+
+static bool take_snapshot(struct snapshot* s) {
+    memset(s, 0, sizeof(struct snapshot));
+
+    char* threads = read_file(THREADS_PATH);
+    if (threads == NULL) {
+        return false;
+    }
+
+    char* line = strchr(threads, '\n');
+    while (line != NULL && *++line != '\0') {
+        char* end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+
+        struct thread_stats* grown = realloc(s->threads, (s->thread_count + 1) * sizeof(struct thread_stats));
+        if (grown == NULL) {
+            break;
+        }
+        s->threads = grown;
+        if (parse_thread(line, &s->threads[s->thread_count])) {
+            s->thread_count++;
+        }
+
+        line = end;
+    }
+    free(threads);
+
+    char* schedstat = read_file(SCHEDSTAT_PATH);
+    if (schedstat == NULL) {
+        return false;
+    }
+
+    /* per-CPU lines come first, then the latency histogram, each section after its header */
+    bool histogram = false;
+    size_t bucket = 0;
+    line = strchr(schedstat, '\n');
+    while (line != NULL && *++line != '\0') {
+        char* end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+
+        char* iter = line;
+        if (strncmp(line, "latency_ns", 10) == 0) {
+            histogram = true;
+        } else if (histogram) {
+            next_field(&iter);
+            if (bucket < LATENCY_BUCKETS) {
+                s->latency[bucket++] = next_number(&iter);
+            }
+        } else {
+            next_field(&iter);
+            s->switches += next_number(&iter);
+            s->wakeups += next_number(&iter);
+            s->idle_ns += next_number(&iter);
+            s->cpu_count++;
+        }
+
+        line = end;
+    }
+    free(schedstat);
+
+    return true;
+}
+
+static struct thread_stats* find_thread(struct snapshot* s, long pid, long tid) {
+    for (size_t i = 0; i < s->thread_count; i++) {
+        if (s->threads[i].pid == pid && s->threads[i].tid == tid) {
+            return &s->threads[i];
+        }
+    }
+    return NULL;
+}
+
+static int compare_run_delta(const void* a, const void* b) {
+    const struct thread_stats* ta = a;
+    const struct thread_stats* tb = b;
+    if (ta->run_delta != tb->run_delta) {
+        return ta->run_delta < tb->run_delta ? 1 : -1;
+    }
+    return ta->wait_delta < tb->wait_delta ? 1 : ta->wait_delta > tb->wait_delta ? -1 : 0;
+}
+
+/* there is no floating point printf, so percentages are printed with one decimal by hand */
+static void print_percent(unsigned long part, unsigned long whole) {
+    unsigned long permille = whole != 0 ? part * 1000 / whole : 0;
+    printf("%4lu.%lu", permille / 10, permille % 10);
+}
+
+static void format_ns(char* buf, size_t size, unsigned long ns) {
+    if (ns >= 10000000ul) {
+        snprintf(buf, size, "%lums", ns / 1000000);
+    } else if (ns >= 10000ul) {
+        snprintf(buf, size, "%luus", ns / 1000);
+    } else {
+        snprintf(buf, size, "%luns", ns);
+    }
+}
+
+/* the upper bound of the bucket the given fraction (in per mille) of all wakeups falls into */
+static unsigned long latency_percentile(const unsigned long* latency, unsigned long total, unsigned long permille) {
+    unsigned long target = (total * permille + 999) / 1000;
+    unsigned long seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= target) {
+            return 2ul << i;
+        }
+    }
+    return 2ul << (LATENCY_BUCKETS - 1);
+}
+
+static void report(struct snapshot* before, struct snapshot* after, uint64_t interval, long top) {
+    for (size_t i = 0; i < after->thread_count; i++) {
+        struct thread_stats* t = &after->threads[i];
+        struct thread_stats* old = find_thread(before, t->pid, t->tid);
+        unsigned long run_ns = old != NULL ? old->run_ns : 0;
+        unsigned long wait_ns = old != NULL ? old->wait_ns : 0;
+
+        /* the time of a running thread is an estimate, and may seem to go back a little */
+        t->run_delta = t->run_ns > run_ns ? t->run_ns - run_ns : 0;
+        t->wait_delta = t->wait_ns > wait_ns ? t->wait_ns - wait_ns : 0;
+    }
+    qsort(after->threads, after->thread_count, sizeof(struct thread_stats), compare_run_delta);
+
+    unsigned long latency[LATENCY_BUCKETS];
+    unsigned long wakeups = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        latency[i] = after->latency[i] - before->latency[i];
+        wakeups += latency[i];
+    }
+
+    unsigned long busy = 0;
+    unsigned long idle = after->idle_ns - before->idle_ns;
+    if (interval * after->cpu_count > idle) {
+        busy = interval * after->cpu_count - idle;
+    }
+
+    printf("threads: %lu, cpus: %lu, busy:", (unsigned long) after->thread_count, (unsigned long) after->cpu_count);
+    print_percent(busy, interval * after->cpu_count);
+    printf("%%, switches: %lu, wakeups: %lu\n", after->switches - before->switches, wakeups);
+
+    if (wakeups != 0) {
+        char p50[16], p99[16], p999[16];
+        format_ns(p50, sizeof(p50), latency_percentile(latency, wakeups, 500));
+        format_ns(p99, sizeof(p99), latency_percentile(latency, wakeups, 990));
+        format_ns(p999, sizeof(p999), latency_percentile(latency, wakeups, 999));
+        printf("wakeup latency: p50 < %s, p99 < %s, p99.9 < %s\n", p50, p99, p999);
+    }
+
+    puts("\n  PID   TID S POLICY PRIO CPU  %CPU %WAIT   VCSW   ICSW   MIGR MAXLAT NAME");
+    for (size_t i = 0; i < after->thread_count && (long) i < top; i++) {
+        struct thread_stats* t = &after->threads[i];
+        char max_latency[16];
+        format_ns(max_latency, sizeof(max_latency), t->max_latency_ns);
+
+        printf("%5ld %5ld %s %-6s %4ld %3ld ", t->pid, t->tid, t->state, t->policy, t->prio, t->cpu);
+        print_percent(t->run_delta, interval);
+        print_percent(t->wait_delta, interval);
+        printf(" %6lu %6lu %6lu %6s %s\n", t->voluntary, t->involuntary, t->migrations, max_latency, t->name);
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv) {
+    long delay = 1;
+    long iterations = -1;
+    long top = 20;
+
+    int c;
+    while ((c = getopt(argc, argv, "d:n:t:h")) != -1) {
+        switch (c) {
+            case 'd':
+                delay = parse_count(optarg);
+                break;
+            case 'n':
+                iterations = parse_count(optarg);
+                break;
+            case 't':
+                top = parse_count(optarg);
+                break;
+            case 'h':
+                help();
+                break;
+            default:
+                error();
+                break;
+        }
+    }
+
+    struct snapshot before;
+    struct snapshot after;
+    if (!take_snapshot(&before)) {
+        return EXIT_FAILURE;
+    }
+    uint64_t start = now_ns();
+
+    for (long i = 0; iterations < 0 || i < iterations; i++) {
+        sleep(delay);
+
+        if (!take_snapshot(&after)) {
+            return EXIT_FAILURE;
+        }
+        uint64_t end = now_ns();
+
+        report(&before, &after, end - start, top);
+
+        free(before.threads);
+        before = after;
+        start = end;
+    }
+
+    free(before.threads);
+    return EXIT_SUCCESS;
+}